@@ -18,10 +18,209 @@
 /************************************************************************/
 
 #include "aabbtree.h"
+#include "testfixtures.h"
 #include "unittest.h"
+#include "microbench.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+/// boxes scattered along a loop of 300 m radius, like track objects
+static void CreateTestBoxes(int count, std::vector<Aabb<float> > & boxes)
+{
+	TestRandom random(4321);
+
+	boxes.resize(count);
+	for (int i = 0; i < count; ++i)
+	{
+		const float a = 2 * M_PI * random();
+		const float r = 300 + 40 * (random() - 0.5f);
+		const Vec3 center(r * std::cos(a), 10 * random(), r * std::sin(a));
+		const Vec3 half(0.5f + 8 * random(), 0.5f + 4 * random(), 0.5f + 8 * random());
+		boxes[i] = Aabb<float>(center - half, center + half);
+	}
+}
+
+template <typename Tree, typename Shape>
+static std::vector<int> QuerySorted(const Tree & tree, const Shape & shape)
+{
+	std::vector<int> result;
+	tree.Query(shape, result);
+	std::sort(result.begin(), result.end());
+	return result;
+}
+
+template <typename Shape>
+static std::vector<int> QueryBruteForce(const std::vector<Aabb<float> > & boxes, const Shape & shape)
+{
+	std::vector<int> result;
+	for (int i = 0; i < (int)boxes.size(); ++i)
+	{
+		if (boxes[i].Intersect(shape) != Aabb<float>::OUT)
+			result.push_back(i);
+	}
+	return result;
+}
 
 QT_TEST(aabb_space_partitioning_test)
 {
 	AabbTreeNode <int> testnode;
 	QT_CHECK_EQUAL(testnode.size(), 0);
+	QT_CHECK(testnode.Empty());
+
+	std::vector<Aabb<float> > boxes;
+	CreateTestBoxes(1000, boxes);
+
+	AabbTreeNode <int> tree1;
+	AabbTreeNode <int, 8> tree8;
+	AabbRecursiveTree <int> recursive;
+	for (int i = 0; i < (int)boxes.size(); ++i)
+	{
+		tree1.Add(i, boxes[i]);
+		tree8.Add(i, boxes[i]);
+		recursive.Add(i, boxes[i]);
+	}
+	QT_CHECK_EQUAL(tree1.size(), 1000);
+
+	// linear search before optimize
+	const Aabb<float> box(Vec3(250, 0, -50), Vec3(350, 10, 50));
+	QT_CHECK(QuerySorted(tree1, box) == QueryBruteForce(boxes, box));
+
+	tree1.Optimize();
+	tree8.Optimize();
+	recursive.Optimize();
+	QT_CHECK_EQUAL(tree1.size(), 1000);
+
+	int mismatches = 0;
+	int found = 0;
+	for (int i = 0; i < 100; ++i)
+	{
+		const float a = 2 * M_PI * i / 100;
+		const Vec3 p(300 * std::cos(a), 0, 300 * std::sin(a));
+		const Aabb<float> query(p - Vec3(20, 1, 20), p + Vec3(20, 3, 20));
+		const Aabb<float>::Ray ray(p + Vec3(0, 20, 0), Vec3(0, -1, 0), 30);
+		const std::vector<int> box_ref = QueryBruteForce(boxes, query);
+		const std::vector<int> ray_ref = QueryBruteForce(boxes, ray);
+		mismatches += QuerySorted(tree1, query) != box_ref;
+		mismatches += QuerySorted(tree8, query) != box_ref;
+		mismatches += QuerySorted(tree1, ray) != ray_ref;
+		mismatches += QuerySorted(tree8, ray) != ray_ref;
+		mismatches += QuerySorted(recursive, query) != box_ref;
+		mismatches += QuerySorted(recursive, ray) != ray_ref;
+		found += box_ref.size() + ray_ref.size();
+	}
+	QT_CHECK_EQUAL(mismatches, 0);
+	QT_CHECK(found > 100);
+
+	// fully inside queries return everything
+	QT_CHECK_EQUAL(QuerySorted(tree8, Aabb<float>::IntersectAlways()).size(), 1000u);
+
+	// added after optimize
+	int extra = 1000;
+	tree8.Add(extra, box);
+	QT_CHECK_EQUAL(QuerySorted(tree8, box).back(), 1000);
+	tree8.Optimize();
+	QT_CHECK_EQUAL(QuerySorted(tree8, box).back(), 1000);
+
+	tree8.Delete(extra);
+	QT_CHECK_EQUAL(tree8.size(), 1000);
+	QT_CHECK(QuerySorted(tree8, box) == QueryBruteForce(boxes, box));
+
+	std::vector<int*> contained;
+	tree8.GetContainedObjects(contained);
+	QT_CHECK_EQUAL(contained.size(), 1000u);
+
+	int objectcount = 0;
+	std::ostringstream debug;
+	tree8.DebugPrint(0, objectcount, true, debug);
+	QT_CHECK_EQUAL(objectcount, 1000);
+
+	tree8.Clear();
+	QT_CHECK(tree8.Empty());
+
+	// optimizing again keeps the objects of the recursive tree
+	recursive.Add(extra, box);
+	recursive.Optimize();
+	QT_CHECK_EQUAL(QuerySorted(recursive, box).back(), 1000);
+	QT_CHECK_EQUAL(QuerySorted(recursive, Aabb<float>::IntersectAlways()).size(), 1001u);
+	recursive.Clear();
+	QT_CHECK(recursive.Empty());
+}
+
+MICROBENCH(aabbtree)
+{
+	std::vector<Aabb<float> > boxes;
+	CreateTestBoxes(4096, boxes);
+
+	// static drawables use the flat tree with 64 objects per leaf,
+	// road strips the recursive tree with 1
+	AabbTreeNode <int, 64> drawables;
+	AabbTreeNode <int> patches;
+	AabbRecursiveTree <int, 64> recursive_drawables;
+	AabbRecursiveTree <int> recursive_patches;
+	for (int i = 0; i < (int)boxes.size(); ++i)
+	{
+		drawables.Add(i, boxes[i]);
+		patches.Add(i, boxes[i]);
+		recursive_drawables.Add(i, boxes[i]);
+		recursive_patches.Add(i, boxes[i]);
+	}
+	drawables.Optimize();
+	patches.Optimize();
+	recursive_drawables.Optimize();
+	recursive_patches.Optimize();
+
+	const int count = 256;
+	std::vector<Aabb<float> > queries(count);
+	std::vector<Aabb<float>::Ray> rays;
+	for (int i = 0; i < count; ++i)
+	{
+		const float a = 2 * M_PI * i / count;
+		const Vec3 p(300 * std::cos(a), 0, 300 * std::sin(a));
+		queries[i] = Aabb<float>(p - Vec3(100, 10, 100), p + Vec3(100, 20, 100));
+		rays.push_back(Aabb<float>::Ray(p + Vec3(0, 20, 0), Vec3(0, -1, 0), 30));
+	}
+
+	std::vector<int> result;
+	result.reserve(boxes.size());
+	bench.measure("recursive, 64 per leaf, box queries", count, [&]()
+	{
+		for (const auto & query : queries)
+		{
+			result.clear();
+			recursive_drawables.Query(query, result);
+		}
+		microbench::consume(result.size());
+	});
+
+	bench.measure("recursive, 1 per leaf, ray queries", count, [&]()
+	{
+		for (const auto & ray : rays)
+		{
+			result.clear();
+			recursive_patches.Query(ray, result);
+		}
+		microbench::consume(result.size());
+	});
+
+	bench.measure("flat, 64 per leaf, box queries", count, [&]()
+	{
+		for (const auto & query : queries)
+		{
+			result.clear();
+			drawables.Query(query, result);
+		}
+		microbench::consume(result.size());
+	});
+
+	bench.measure("flat, 1 per leaf, ray queries", count, [&]()
+	{
+		for (const auto & ray : rays)
+		{
+			result.clear();
+			patches.Query(ray, result);
+		}
+		microbench::consume(result.size());
+	});
 }
@@ -23,9 +23,16 @@
 #include "aabb.h"
 #include "mathvector.h"
 
+#include <algorithm>
 #include <vector>
-#include <iostream> // std::cout
 
+/// Bounding volume tree, stored as one array of nodes in depth first order.
+/// Each node references the contiguous range of objects of its subtree and
+/// the index of the node following its subtree (skip), so queries walk the
+/// array without recursion or stack. Optimize builds the tree by binned SAH,
+/// nodes with ideal_objects_per_node or fewer objects become leaves.
+/// Objects added after Optimize are found by linear search until the next
+/// Optimize.
 template <typename DataType, unsigned int ideal_objects_per_node = 1>
 class AabbTreeNode
 {
@@ -33,21 +40,26 @@ public:
 	template <class Stream>
 	void DebugPrint(int level, int & objectcount, bool verbose, Stream & output) const
 	{
-		if (verbose)
+		std::vector<unsigned> parents;
+		for (unsigned i = 0; i < nodes.size(); ++i)
 		{
-			for (int i = 0; i < level; ++i) output << "-";
+			while (!parents.empty() && nodes[parents.back()].skip <= i)
+				parents.pop_back();
 
-			output << "objects: " << objects.size() << ", child nodes: " << children.size() << ", aabb: ";
-			bbox.DebugPrint(output);
+			const Node & node = nodes[i];
+			const bool leaf = IsLeaf(i);
+			if (verbose)
+			{
+				for (int l = 0; l < level + int(parents.size()); ++l) output << "-";
+
+				output << "objects: " << (leaf ? node.count : 0) << ", child nodes: " << (leaf ? 0 : 2) << ", aabb: ";
+				node.bbox.DebugPrint(output);
+			}
+			parents.push_back(i);
 		}
 
 		objectcount += objects.size();
 
-		for (const auto & child : children)
-		{
-			child.DebugPrint(level+1, objectcount, verbose, output);
-		}
-
 		if (level == 0)
 		{
 			if (verbose)
@@ -60,283 +72,355 @@ public:
 
 	unsigned int size(unsigned int objectcount = 0) const
 	{
-		unsigned int childcount = 0;
-
-		for (const auto & child : children)
-		{
-			childcount += child.size(objectcount);
-		}
-
-		objectcount += objects.size() + childcount;
-
-		return objectcount;
+		return objectcount + objects.size();
 	}
 
 	void Optimize()
 	{
-		CollapseTo(*this);
+		nodes.clear();
+		if (objects.empty())
+			return;
 
-		RemoveDuplicateObjects();
-
-		DistributeObjectsToChildren(0);
+		nodes.reserve(2 * objects.size() / ideal_objects_per_node + 1);
+		BuildNode(0, objects.size());
 	}
 
 	void Add(DataType & object, const Aabb <float> & newaabb)
 	{
 		objects.push_back(std::make_pair(object, newaabb));
-		if (objects.size() == 1) //don't combine if this is the first object, otherwise the AABB would be forced to include (0,0,0)
-			bbox = newaabb;
-		else
-			bbox.CombineWith(newaabb);
+		nodes.clear();
 	}
 
 	///a slow delete that only requires the object
 	void Delete(DataType & object)
 	{
-		//delete using swap and pop
-		auto i = objects.rbegin();
-		while (i != objects.rend())
-		{
-			auto k = i++;
-			if (k->first == object)
-			{
-				if (k != objects.rbegin())
-					*k = objects.back();
-				objects.pop_back();
-			}
-		}
-
-		//if we have children, pass it on
-		for (auto & child : children)
-		{
-			child.Delete(object);
-		}
+		const bool optimized = !nodes.empty();
+		objects.erase(
+			std::remove_if(objects.begin(), objects.end(),
+				[&object](const std::pair <DataType, Aabb <float> > & o) { return o.first == object; }),
+			objects.end());
+		if (optimized)
+			Optimize();
 	}
 
-	///a faster delete that uses the supplied AABB to find the object
-	void Delete(DataType & object, const Aabb <float> & objaabb)
+	///delete using the supplied AABB
+	void Delete(DataType & object, const Aabb <float> & /*objaabb*/)
 	{
-		//if we've got objects, test them
-		auto i = objects.rbegin();
-		while (i != objects.rend())
-		{
-			auto k = i++;
-			if (k->first == object)
-			{
-				if (k != objects.rbegin())
-					*k = objects.back();
-				objects.pop_back();
-			}
-		}
-
-		//if we have children, pass it on
-		for (auto child : children)
-		{
-			if (child.GetBBOX().Intersect(objaabb))
-			{
-				child.Delete(object, objaabb);
-			}
-		}
+		Delete(object);
 	}
 
 	///run a query for objects that collide with the given shape
 	template <typename T, typename U>
-	void Query(const T & shape, U &outputlist, bool testChildren=true) const
+	void Query(const T & shape, U & outputlist, bool testChildren=true) const
 	{
-		//if we've got objects, test them
-		if (objects.size() > 1 && testChildren)
+		if (nodes.empty())
 		{
 			for (const auto & object : objects)
 			{
-				if (object.second.Intersect(shape) != Aabb<float>::OUT)
+				if (!testChildren || object.second.Intersect(shape) != Aabb<float>::OUT)
 				{
 					outputlist.push_back(object.first);
 				}
 			}
-		}
-		else
-		{
-			for (const auto & object : objects)
-			{
-				outputlist.push_back(object.first);
-			}
+			return;
 		}
 
-		//if we have children, test them
-		for (const auto & child : children)
+		unsigned i = 0;
+		const unsigned end = nodes.size();
+		while (i < end)
 		{
-			Aabb<float>::IntersectionEnum intersection = child.GetAabb().Intersect(shape);
+			const Node & node = nodes[i];
+			const Aabb<float>::IntersectionEnum intersection =
+				testChildren ? node.bbox.Intersect(shape) : Aabb<float>::IN;
 
-			if (intersection != Aabb<float>::OUT)
+			if (intersection == Aabb<float>::OUT)
 			{
-				//our child intersects with the segment, dispatch a query
-				//only bother to test children if we were partially intersecting (if fully in, then we know all children are fully in too)
-				child.Query(shape, outputlist, intersection == Aabb<float>::INTERSECT);
+				i = node.skip;
+			}
+			else if (intersection == Aabb<float>::IN || (IsLeaf(i) && node.count == 1))
+			{
+				//fully inside, so is the subtree
+				for (unsigned k = node.first; k < node.first + node.count; ++k)
+				{
+					outputlist.push_back(objects[k].first);
+				}
+				i = node.skip;
+			}
+			else if (IsLeaf(i))
+			{
+				for (unsigned k = node.first; k < node.first + node.count; ++k)
+				{
+					if (objects[k].second.Intersect(shape) != Aabb<float>::OUT)
+					{
+						outputlist.push_back(objects[k].first);
+					}
+				}
+				i = node.skip;
+			}
+			else
+			{
+				++i;
 			}
 		}
 	}
 
-	bool Empty() const {return (objects.empty() && children.empty());}
+	bool Empty() const {return objects.empty();}
 
-	void Clear() {objects.clear(); children.clear();}
+	void Clear() {objects.clear(); nodes.clear();}
 
 	///traverse the entire tree putting pointers to all DataType objects into the given outputlist
 	template <class List>
 	void GetContainedObjects(List & outputlist)
 	{
-		//if we've got objects, add them
 		for (auto & object : objects)
 		{
 			outputlist.push_back(&object.first);
 		}
-
-		//if we have children, add them
-		for (auto & child : children)
-		{
-			child.GetContainedObjects(outputlist);
-		}
 	}
 
 private:
+	struct Node
+	{
+		Aabb <float> bbox;
+		unsigned skip; ///< index of the node after this subtree
+		unsigned first; ///< first object of this subtree
+		unsigned count; ///< number of objects of this subtree
+	};
+
 	typedef std::vector <std::pair <DataType, Aabb <float> > > objectlist_type;
-	typedef std::vector <AabbTreeNode> childrenlist_type;
-	objectlist_type objects;
-	childrenlist_type children;
-	Aabb <float> bbox;
+	objectlist_type objects; ///< sorted by leaf after Optimize
+	std::vector <Node> nodes;
+
+	bool IsLeaf(unsigned i) const
+	{
+		return nodes[i].skip == i + 1;
+	}
 
-	const Aabb <float> & GetAabb() const {return bbox;}
+	static float HalfArea(const Vec3 & min, const Vec3 & max)
+	{
+		const Vec3 d = max - min;
+		return d[0] * d[1] + d[1] * d[2] + d[2] * d[0];
+	}
 
-	///recursively send all objects and all childrens' objects to the target node, clearing out everything else
-	void CollapseTo(AabbTreeNode & collapse_target)
+	///append the subtree of objects [begin, end) to nodes
+	void BuildNode(const unsigned begin, const unsigned end)
 	{
-		if (this != &collapse_target)
+		const unsigned bin_count = 16;
+		const unsigned index = nodes.size();
+		nodes.push_back(Node());
+
+		Vec3 bmin(1E38), bmax(-1E38), cmin(1E38), cmax(-1E38);
+		for (unsigned i = begin; i < end; ++i)
 		{
-			for (auto & object : objects)
+			const Aabb<float> & box = objects[i].second;
+			for (int k = 0; k < 3; ++k)
 			{
-				collapse_target.Add(object.first, object.second);
+				bmin[k] = std::min(bmin[k], box.GetCenter()[k] - box.GetExtent()[k]);
+				bmax[k] = std::max(bmax[k], box.GetCenter()[k] + box.GetExtent()[k]);
+				cmin[k] = std::min(cmin[k], box.GetCenter()[k]);
+				cmax[k] = std::max(cmax[k], box.GetCenter()[k]);
 			}
-			objects.clear();
 		}
-
-		for (auto & child : children)
+		nodes[index].bbox = Aabb<float>(bmin, bmax);
+		nodes[index].first = begin;
+		nodes[index].count = end - begin;
+		nodes[index].skip = index + 1;
+
+		const unsigned count = end - begin;
+		if (count <= ideal_objects_per_node)
+			return;
+
+		//find the binned split with the lowest surface area heuristic cost
+		float best_cost = -1;
+		int best_axis = -1;
+		unsigned best_bin = 0;
+		for (int axis = 0; axis < 3; ++axis)
 		{
-			child.CollapseTo(collapse_target);
+			const float extent = cmax[axis] - cmin[axis];
+			if (extent <= 0)
+				continue;
+
+			Vec3 bin_min[bin_count], bin_max[bin_count];
+			unsigned bin_objects[bin_count] = {0};
+			for (unsigned b = 0; b < bin_count; ++b)
+			{
+				bin_min[b] = Vec3(1E38);
+				bin_max[b] = Vec3(-1E38);
+			}
+			const float scale = bin_count / extent;
+			for (unsigned i = begin; i < end; ++i)
+			{
+				const Aabb<float> & box = objects[i].second;
+				const unsigned b = std::min(unsigned((box.GetCenter()[axis] - cmin[axis]) * scale), bin_count - 1);
+				for (int k = 0; k < 3; ++k)
+				{
+					bin_min[b][k] = std::min(bin_min[b][k], box.GetCenter()[k] - box.GetExtent()[k]);
+					bin_max[b][k] = std::max(bin_max[b][k], box.GetCenter()[k] + box.GetExtent()[k]);
+				}
+				bin_objects[b]++;
+			}
+
+			//sweep from the right, then evaluate splits from the left
+			float right_cost[bin_count];
+			Vec3 rmin(1E38), rmax(-1E38);
+			unsigned right_objects = 0;
+			for (unsigned b = bin_count - 1; b > 0; --b)
+			{
+				for (int k = 0; k < 3; ++k)
+				{
+					rmin[k] = std::min(rmin[k], bin_min[b][k]);
+					rmax[k] = std::max(rmax[k], bin_max[b][k]);
+				}
+				right_objects += bin_objects[b];
+				right_cost[b] = right_objects ? HalfArea(rmin, rmax) * right_objects : 0;
+			}
+
+			Vec3 lmin(1E38), lmax(-1E38);
+			unsigned left_objects = 0;
+			for (unsigned b = 1; b < bin_count; ++b)
+			{
+				for (int k = 0; k < 3; ++k)
+				{
+					lmin[k] = std::min(lmin[k], bin_min[b - 1][k]);
+					lmax[k] = std::max(lmax[k], bin_max[b - 1][k]);
+				}
+				left_objects += bin_objects[b - 1];
+				if (left_objects == 0 || left_objects == count)
+					continue;
+
+				const float cost = HalfArea(lmin, lmax) * left_objects + right_cost[b];
+				if (best_axis < 0 || cost < best_cost)
+				{
+					best_cost = cost;
+					best_axis = axis;
+					best_bin = b;
+				}
+			}
 		}
-		children.clear();
+
+		//all centers coincide, keep them in one leaf
+		if (best_axis < 0)
+			return;
+
+		const float split_min = cmin[best_axis];
+		const float split_scale = bin_count / (cmax[best_axis] - split_min);
+		const unsigned mid = std::partition(
+			objects.begin() + begin, objects.begin() + end,
+			[best_axis, best_bin, split_min, split_scale, bin_count](const std::pair <DataType, Aabb <float> > & object)
+			{
+				return std::min(unsigned((object.second.GetCenter()[best_axis] - split_min) * split_scale), bin_count - 1) < best_bin;
+			}) - objects.begin();
+
+		BuildNode(begin, mid);
+		BuildNode(mid, end);
+		nodes[index].skip = nodes.size();
 	}
+};
 
-	///requires the DataType class implements operator< and operator==
-	void RemoveDuplicateObjects()
+/// Bounding volume tree of nodes that own their children. Optimize splits
+/// the objects at their mean center on the longest axis until a node has
+/// ideal_objects_per_node or fewer. Road strips keep it for their ray
+/// queries, the flat AabbTreeNode was not consistently faster there.
+template <typename DataType, unsigned int ideal_objects_per_node = 1>
+class AabbRecursiveTree
+{
+public:
+	void Add(const DataType & object, const Aabb <float> & newaabb)
 	{
-		//TODO:  re-enable this code and make it compile
-		//objects.sort();
-		//objects.unique();
+		objects.push_back(std::make_pair(object, newaabb));
+		if (objects.size() == 1 && children.empty())
+			bbox = newaabb;
+		else
+			bbox.CombineWith(newaabb);
 	}
 
-	///intelligently add new child nodes and parse objects to them, recursively
-	void DistributeObjectsToChildren(const int level)
+	void Optimize()
 	{
-		const unsigned int ideal_children_per_node(2);
-		const bool verbose(false);
-
-		//enforce the rules:  i don't want to start with any children,
-		// so tell all children to send me their objects, then delete them
-		for (auto & child : children)
-		{
-			child.CollapseTo(*this);
-		}
-		children.clear();
-
-		//only continue if we have more objects than we need
-		if (objects.size() <= ideal_objects_per_node) return;
+		Collapse(objects);
+		if (objects.size() <= ideal_objects_per_node)
+			return;
 
-		children.resize(ideal_children_per_node);
-
-		//determine the average center position of all objects
 		Vec3 avgcenter;
-		int numobj = objects.size();
-		float incamount = 1.0 / numobj;
+		const float incamount = 1.0 / objects.size();
 		for (const auto & object : objects)
 		{
 			avgcenter = avgcenter + object.second.GetCenter() * incamount;
 		}
 
-		//find axis of maximum change, so we know where to split
-		Vec3 axismask(1,0,0);
-		Vec3 extent = bbox.GetExtent();
-		if (extent[0] > extent[1] && extent[0] > extent[2])
+		//split along the axis of maximum extent
+		Vec3 axismask(1, 0, 0);
+		const Vec3 extent = bbox.GetExtent();
+		if (extent[1] > extent[0] && extent[1] > extent[2])
+			axismask.Set(0, 1, 0);
+		else if (extent[2] > extent[1] && extent[2] > extent[0])
+			axismask.Set(0, 0, 1);
+
+		//objects right on the average center are distributed evenly
+		children.resize(2);
+		const float avgcentercoord = avgcenter.dot(axismask);
+		int distributor = 0;
+		for (const auto & object : objects)
 		{
-			axismask.Set(1,0,0);
+			const float objcentercoord = object.second.GetCenter().dot(axismask);
+			const bool front = (objcentercoord == avgcentercoord) ? (distributor++ % 2 == 0) : (objcentercoord > avgcentercoord);
+			(front ? children.front() : children.back()).Add(object.first, object.second);
 		}
-		else if (extent[1] > extent[0] && extent[1] > extent[2])
+
+		if (children.front().objects.empty() || children.back().objects.empty())
 		{
-			axismask.Set(0,1,0);
+			children.clear();
+			return;
 		}
-		else if (extent[2] > extent[1] && extent[2] > extent[0])
+
+		objects.clear();
+		for (auto & child : children)
 		{
-			axismask.Set(0,0,1);
+			child.Optimize();
 		}
+	}
 
-		//cout << level << endl;
-
-		//distribute objects to each child
-		float avgcentercoord = avgcenter.dot(axismask);
-		int distributor(0);
-		for (auto & object : objects)
+	///run a query for objects that collide with the given shape
+	template <typename T, typename U>
+	void Query(const T & shape, U & outputlist, bool testChildren=true) const
+	{
+		//a single object has the bounding box of its node
+		for (const auto & object : objects)
 		{
-			float objcentercoord = object.second.GetCenter().dot(axismask);
-
-			if (objcentercoord > avgcentercoord)
-			{
-				children.front().Add(object.first, object.second);
-			}
-			else if (objcentercoord < avgcentercoord)
+			if (objects.size() <= 1 || !testChildren || object.second.Intersect(shape) != Aabb<float>::OUT)
 			{
-				children.back().Add(object.first, object.second);
-			}
-			else
-			{
-				//cout << "unusual case #" << distributor << endl;
-				//distribute children that sit right on our average center in an even way
-				if (distributor % 2 == 0)
-				{
-					children.front().Add(object.first, object.second);
-				}
-				else
-				{
-					children.back().Add(object.first, object.second);
-				}
-				distributor++;
+				outputlist.push_back(object.first);
 			}
 		}
 
-		//we've given away all of our objects; clear them out
-		objects.clear();
-
-		//count objects that belong to our children
-		int child1obj = children.front().objects.size();
-		int child2obj = children.back().objects.size();
-
-		if (verbose) std::cout << "Objects: " << objects.size() << ", Child nodes: " << children.size() << " L obj: " << child1obj << " R obj: " << child2obj << std::endl;
-
-		//if one child doesn't have any objects, then delete both children and take back their objects
-		if (child1obj == 0 || child2obj == 0)
+		for (const auto & child : children)
 		{
-			for (auto & child : children)
+			const Aabb<float>::IntersectionEnum intersection = child.bbox.Intersect(shape);
+			if (intersection != Aabb<float>::OUT)
 			{
-				for (auto & object : child.objects)
-				{
-					Add(object.first, object.second);
-				}
+				child.Query(shape, outputlist, intersection == Aabb<float>::INTERSECT);
 			}
-
-			children.clear();
 		}
+	}
 
+	bool Empty() const {return objects.empty() && children.empty();}
+
+	void Clear() {objects.clear(); children.clear();}
+
+private:
+	typedef std::vector <std::pair <DataType, Aabb <float> > > objectlist_type;
+	objectlist_type objects;
+	std::vector <AabbRecursiveTree> children;
+	Aabb <float> bbox;
+
+	///move the objects of all children to the given list
+	void Collapse(objectlist_type & list)
+	{
 		for (auto & child : children)
 		{
-			child.DistributeObjectsToChildren(level + 1);
+			list.insert(list.end(), child.objects.begin(), child.objects.end());
+			child.Collapse(list);
 		}
+		children.clear();
 	}
 };
 
@@ -18,6 +18,8 @@
 /************************************************************************/
 
 #include "ai.h"
+#include "jobsystem.h"
+#include "physics/cardynamics.h"
 #include <cassert>
 // AI implementations:
 #include "ai_car_standard.h"
@@ -65,10 +67,34 @@ void Ai::ClearCars()
 
 void Ai::Update(float dt, const CarDynamics cars[], const int cars_num)
 {
+	car_positions.resize(cars_num);
+	for (int i = 0; i < cars_num; ++i)
+		car_positions[i] = cars[i].GetCenterOfMass();
+	car_grid.Build(car_positions.data(), cars_num);
+
+	// ai cars only read the shared car state and write their own inputs,
+	// so the result does not depend on the order they are updated in
+	parallel_cars.clear();
 	for (auto ai_car : ai_cars)
 	{
-		ai_car->Update(dt, cars, cars_num);
+		if (ai_car->UpdateInParallel())
+			parallel_cars.push_back(ai_car);
 	}
+	JobSystem::get().parallelFor(0, parallel_cars.size(), [this, dt, cars, cars_num](int i)
+	{
+		parallel_cars[i]->Update(dt, cars, cars_num, car_grid);
+	});
+
+	for (auto ai_car : ai_cars)
+	{
+		if (!ai_car->UpdateInParallel())
+			ai_car->Update(dt, cars, cars_num, car_grid);
+	}
+}
+
+void Ai::SetCarGridRadius(float radius)
+{
+	car_grid = AiCarGrid(radius);
 }
 
 const std::vector<float> & Ai::GetInputs(unsigned id) const
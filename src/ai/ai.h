@@ -21,6 +21,7 @@
 #define _AI_H
 
 #include "ai_car.h"
+#include "ai_car_grid.h"
 #include <string>
 #include <vector>
 #include <map>
@@ -41,6 +42,9 @@ public:
 
 	void Update(float dt, const CarDynamics cars[], const int cars_num);
 
+	/// distance in meters within which ai cars notice other cars
+	void SetCarGridRadius(float radius);
+
 	const std::vector<float> & GetInputs(unsigned id) const;
 
 	void AddFactory(const std::string & type_name, AiFactory * factory);
@@ -53,6 +57,9 @@ public:
 
 private:
 	std::vector <AiCar*> ai_cars;
+	std::vector <AiCar*> parallel_cars;
+	std::vector <btVector3> car_positions;
+	AiCarGrid car_grid;
 	std::map <std::string, AiFactory*> ai_factories;
 };
 
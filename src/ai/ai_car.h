@@ -23,6 +23,7 @@
 #include "physics/carinput.h"
 #include <vector>
 
+class AiCarGrid;
 class CarDynamics;
 
 /// AI Car controller interface.
@@ -37,7 +38,14 @@ public:
 
 	const std::vector<float> & GetInputs() const;
 
-	virtual void Update(float dt, const CarDynamics cars[], const unsigned cars_num) = 0;
+	/// Ai cars are updated in parallel unless UpdateInParallel is false.
+	/// Update must only read cars and shared track data, and only write
+	/// the state of this ai car.
+	/// grid indexes the car positions of this tick, to find nearby cars.
+	virtual void Update(float dt, const CarDynamics cars[], const unsigned cars_num, const AiCarGrid & grid) = 0;
+
+	/// False if Update uses state that is not thread safe, like world ray casts.
+	virtual bool UpdateInParallel() const;
 
 	/// This is optional for drawing debug stuff.
 	/// It will only be called, when VISUALIZE_AI_DEBUG macro is defined.
@@ -76,6 +84,11 @@ inline const std::vector<float> & AiCar::GetInputs() const
 	return inputs;
 }
 
+inline bool AiCar::UpdateInParallel() const
+{
+	return true;
+}
+
 inline void AiCar::Visualize()
 {
 	// optional
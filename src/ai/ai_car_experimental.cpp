@@ -18,6 +18,7 @@
 /************************************************************************/
 
 #include "ai_car_experimental.h"
+#include "ai_car_grid.h"
 #include "physics/cardynamics.h"
 #include "physics/dynamicsworld.h"
 #include "minmax.h"
@@ -84,6 +85,11 @@ AiCarExperimental::~AiCarExperimental()
 #endif
 }
 
+bool AiCarExperimental::UpdateInParallel() const
+{
+	return false;
+}
+
 //note that rate_limit_neg should be positive, it gets inverted inside the function
 float AiCarExperimental::RateLimit(float old_value, float new_value, float rate_limit_pos, float rate_limit_neg)
 {
@@ -95,13 +101,13 @@ float AiCarExperimental::RateLimit(float old_value, float new_value, float rate_
 		return new_value;
 }
 
-void AiCarExperimental::Update(float dt, const CarDynamics cars[], const unsigned cars_num)
+void AiCarExperimental::Update(float dt, const CarDynamics cars[], const unsigned cars_num, const AiCarGrid & grid)
 {
 	float lastThrottle = inputs[CarInput::THROTTLE];
 	float lastBreak = inputs[CarInput::BRAKE];
 	fill(inputs.begin(), inputs.end(), 0);
 
-	AnalyzeOthers(dt, cars, cars_num);
+	AnalyzeOthers(dt, cars, cars_num, grid);
 	UpdateGasBrake(cars[carid]);
 	UpdateSteer(cars[carid], dt);
 	float rateLimit = THROTTLE_RATE_LIMIT * dt;
@@ -650,8 +656,9 @@ float AiCarExperimental::BrakeFromOthers(float speed_diff)
 	float mineta = 1000;
 	float mindistance = 1000;
 
-	for (const auto & car : othercars)
+	for (unsigned i : nearby)
 	{
+		const OtherCarInfo & car = othercars[i];
 		if (car.active && std::abs(car.horizontal_distance) < horizontal_care)
 		{
 			if (car.fore_distance < mindistance)
@@ -690,7 +697,7 @@ float AiCarExperimental::BrakeFromOthers(float speed_diff)
 	return bias;
 }
 
-void AiCarExperimental::AnalyzeOthers(float dt, const CarDynamics cars[], const unsigned cars_num)
+void AiCarExperimental::AnalyzeOthers(float dt, const CarDynamics cars[], const unsigned cars_num, const AiCarGrid & grid)
 {
 	const float half_carlength = 1.25;
 	const btVector3 throttle_axis = Direction::forward;
@@ -699,11 +706,18 @@ void AiCarExperimental::AnalyzeOthers(float dt, const CarDynamics cars[], const
 	if (othercars.size() < cars_num)
 		othercars.resize(cars_num);
 
-	for (unsigned i = 0; i < cars_num; ++i)
+	// only cars within the grid radius are considered,
+	// forget the cars that left it since the last update
+	nearby_prev.swap(nearby);
+	grid.Query(carid, nearby);
+	for (unsigned i : nearby_prev)
 	{
-		if (i == carid)
-			continue;
+		if (!std::binary_search(nearby.begin(), nearby.end(), i))
+			othercars[i].active = false;
+	}
 
+	for (unsigned i : nearby)
+	{
 		const CarDynamics & icar = cars[i];
 		OtherCarInfo & info = othercars[i];
 
@@ -768,8 +782,9 @@ float AiCarExperimental::SteerAwayFromOthers(float carspeed)
 	float eta = 1000;
 	float min_horizontal_distance = 1000;
 
-	for (const auto & car : othercars)
+	for (unsigned i : nearby)
 	{
+		const OtherCarInfo & car = othercars[i];
 		if (car.active && std::abs(car.horizontal_distance) < std::abs(min_horizontal_distance))
 		{
 			min_horizontal_distance = car.horizontal_distance;
@@ -42,7 +42,10 @@ public:
 
 	~AiCarExperimental();
 
-	void Update(float dt, const CarDynamics cars[], const unsigned cars_num);
+	void Update(float dt, const CarDynamics cars[], const unsigned cars_num, const AiCarGrid & grid);
+
+	/// casts rays into the dynamics world, its broadphase is not thread safe
+	bool UpdateInParallel() const;
 
 #ifdef VISUALIZE_AI_DEBUG
 	void Visualize();
@@ -62,7 +65,9 @@ private:
 		float eta;
 		bool active;
 	};
-	std::vector <OtherCarInfo> othercars;
+	std::vector <OtherCarInfo> othercars; ///< indexed by car id
+	std::vector <unsigned> nearby; ///< ids of the cars within the grid radius, ascending
+	std::vector <unsigned> nearby_prev;
 
 	void UpdateGasBrake(const CarDynamics & car);
 
@@ -76,7 +81,7 @@ private:
 
 	void UpdateSteer(const CarDynamics & car, float dt);
 
-	void AnalyzeOthers(float dt, const CarDynamics cars[], const unsigned cars_num);
+	void AnalyzeOthers(float dt, const CarDynamics cars[], const unsigned cars_num, const AiCarGrid & grid);
 
 	///< returns a float that should be added into the steering wheel command
 	float SteerAwayFromOthers(float carspeed);
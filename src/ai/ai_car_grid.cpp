@@ -0,0 +1,220 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+
+#include "ai_car_grid.h"
+#include "testfixtures.h"
+#include "unittest.h"
+#include "microbench.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+AiCarGrid::AiCarGrid(float radius) :
+	radius(radius),
+	mask(0)
+{
+	// ctor
+}
+
+void AiCarGrid::Build(const btVector3 new_positions[], unsigned count)
+{
+	positions.assign(new_positions, new_positions + count);
+
+	unsigned size = 1;
+	while (size < count)
+		size *= 2;
+	mask = size - 1;
+
+	// counting sort of the cars by bucket, starts[b] is the end of bucket b
+	// after the prefix sum and its begin after the cars have been placed
+	starts.assign(size + 1, 0);
+	for (unsigned i = 0; i < count; ++i)
+		++starts[GetBucket(GetCell(positions[i][0]), GetCell(positions[i][1]))];
+	for (unsigned b = 1; b < size; ++b)
+		starts[b] += starts[b - 1];
+	starts[size] = count;
+
+	cells.resize(count);
+	for (unsigned i = count; i-- > 0; )
+		cells[--starts[GetBucket(GetCell(positions[i][0]), GetCell(positions[i][1]))]] = i;
+}
+
+void AiCarGrid::Query(unsigned id, std::vector<unsigned> & cars) const
+{
+	cars.clear();
+	if (id >= positions.size())
+		return;
+
+	const btVector3 & p = positions[id];
+	const int cx = GetCell(p[0]);
+	const int cy = GetCell(p[1]);
+	const btScalar radius2 = radius * radius;
+	for (int y = cy - 1; y <= cy + 1; ++y)
+	{
+		for (int x = cx - 1; x <= cx + 1; ++x)
+		{
+			const unsigned b = GetBucket(x, y);
+			for (unsigned k = starts[b]; k < starts[b + 1]; ++k)
+			{
+				const unsigned i = cells[k];
+				const btScalar dx = positions[i][0] - p[0];
+				const btScalar dy = positions[i][1] - p[1];
+				if (i != id && dx * dx + dy * dy <= radius2)
+					cars.push_back(i);
+			}
+		}
+	}
+
+	// several cells can share a bucket
+	std::sort(cars.begin(), cars.end());
+	cars.erase(std::unique(cars.begin(), cars.end()), cars.end());
+}
+
+float AiCarGrid::GetRadius() const
+{
+	return radius;
+}
+
+int AiCarGrid::GetCell(btScalar x) const
+{
+	return int(std::floor(x / radius));
+}
+
+unsigned AiCarGrid::GetBucket(int cx, int cy) const
+{
+	return ((unsigned(cx) * 73856093u) ^ (unsigned(cy) * 19349663u)) & mask;
+}
+
+static void QueryAll(const std::vector<btVector3> & positions, unsigned id, float radius, std::vector<unsigned> & cars)
+{
+	cars.clear();
+	for (unsigned i = 0; i < positions.size(); ++i)
+	{
+		const btScalar dx = positions[i][0] - positions[id][0];
+		const btScalar dy = positions[i][1] - positions[id][1];
+		if (i != id && dx * dx + dy * dy <= radius * radius)
+			cars.push_back(i);
+	}
+}
+
+/// count cars spread around a lap of lap_length meters, a few meters apart sideways
+static void CreateTestField(unsigned count, float lap_length, std::vector<btVector3> & positions)
+{
+	const float lap_radius = lap_length / (2 * float(M_PI));
+	positions.resize(count);
+	TestRandom random(1);
+	for (unsigned i = 0; i < count; ++i)
+	{
+		const float side = random() * 12 - 6;
+		const float angle = 2 * float(M_PI) * i / count;
+		const float r = lap_radius + side;
+		positions[i] = btVector3(r * std::cos(angle), r * std::sin(angle), side * 0.1f);
+	}
+}
+
+QT_TEST(aicargrid_test)
+{
+	const float radius = 100;
+	AiCarGrid grid(radius);
+	std::vector<unsigned> cars, expected;
+
+	// no cars
+	grid.Build(0, 0);
+	grid.Query(0, cars);
+	QT_CHECK(cars.empty());
+
+	// cars along a lap, packed and spread out, with negative coordinates
+	const unsigned counts[] = {1, 2, 7, 32, 128};
+	const float laps[] = {100, 800, 5000};
+	for (unsigned count : counts)
+	{
+		for (float lap : laps)
+		{
+			std::vector<btVector3> positions;
+			CreateTestField(count, lap, positions);
+			grid.Build(&positions[0], count);
+			bool same = true;
+			for (unsigned id = 0; id < count; ++id)
+			{
+				grid.Query(id, cars);
+				QueryAll(positions, id, radius, expected);
+				same = same && cars == expected;
+			}
+			QT_CHECK(same);
+		}
+	}
+
+	// cars on the same spot and on cell borders
+	std::vector<btVector3> positions(4, btVector3(-100, 0, 0));
+	positions[2] = btVector3(0, 0, 0);
+	positions[3] = btVector3(100.5f, 0, 0);
+	grid.Build(&positions[0], positions.size());
+	grid.Query(0, cars);
+	QT_CHECK_EQUAL(cars.size(), 2u);
+	QT_CHECK_EQUAL(cars[0], 1u);
+	QT_CHECK_EQUAL(cars[1], 2u);
+	grid.Query(3, cars);
+	QT_CHECK(cars.empty());
+}
+
+// Cost of finding the opponents of each car, the per opponent work of
+// AiCarStandard::Update is timed by the "ai" block of -stress N, compare
+// -airadius 100 with a radius larger than the track.
+MICROBENCH(aicargrid)
+{
+	const unsigned counts[] = {8, 16, 32, 64, 128};
+	for (unsigned count : counts)
+	{
+		// a field spread over a 5 km lap, opponents within 100 m matter
+		std::vector<btVector3> positions;
+		CreateTestField(count, 5000, positions);
+
+		std::ostringstream label;
+		label << ", " << count << " cars";
+
+		// every car checks the distance to every other car
+		std::vector<unsigned> cars;
+		bench.measure("all pairs" + label.str(), count, [&]()
+		{
+			unsigned found = 0;
+			for (unsigned i = 0; i < count; ++i)
+			{
+				QueryAll(positions, i, 100, cars);
+				found += cars.size();
+			}
+			microbench::consume(found);
+		});
+
+		// shared grid, every car looks up its neighbours
+		AiCarGrid grid;
+		bench.measure("grid" + label.str(), count, [&]()
+		{
+			unsigned found = 0;
+			grid.Build(&positions[0], count);
+			for (unsigned i = 0; i < count; ++i)
+			{
+				grid.Query(i, cars);
+				found += cars.size();
+			}
+			microbench::consume(found);
+		});
+	}
+}
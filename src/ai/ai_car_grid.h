@@ -0,0 +1,58 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+
+#ifndef _AI_CAR_GRID_H
+#define _AI_CAR_GRID_H
+
+#include "LinearMath/btVector3.h"
+
+#include <vector>
+
+/// Uniform grid over the car positions in the ground plane, rebuilt once per
+/// ai tick and shared by all ai cars. Cells are as large as the awareness
+/// radius, a query visits the 3x3 cells around a car. Cells are hashed into
+/// a table sized to the car count, so the grid is unbounded.
+class AiCarGrid
+{
+public:
+	/// radius: distance in meters within which an ai car notices other cars
+	AiCarGrid(float radius = 100);
+
+	/// index the car positions, car ids are position indices
+	void Build(const btVector3 positions[], unsigned count);
+
+	/// ids of the cars within radius of car id in ascending order, excluding id
+	void Query(unsigned id, std::vector<unsigned> & cars) const;
+
+	float GetRadius() const;
+
+private:
+	float radius;
+	std::vector<btVector3> positions;
+	std::vector<unsigned> cells; ///< cars sorted by cell hash
+	std::vector<unsigned> starts; ///< start of each hash bucket in cells, size + 1 entries
+	unsigned mask;
+
+	int GetCell(btScalar x) const;
+
+	unsigned GetBucket(int cx, int cy) const;
+};
+
+#endif // _AI_CAR_GRID_H
@@ -18,6 +18,7 @@
 /************************************************************************/
 
 #include "ai_car_standard.h"
+#include "ai_car_grid.h"
 #include "physics/cardynamics.h"
 #include "physics/dynamicsworld.h"
 #include "minmax.h"
@@ -29,6 +30,7 @@
 #include <cmath>
 #include <algorithm>
 #include <iostream>
+#include <limits>
 
 //used to calculate brake value
 #define MAX_SPEED_DIFF 6.0f
@@ -89,9 +91,9 @@ float AiCarStandard::RateLimit(float old_value, float new_value, float rate_limi
 		return new_value;
 }
 
-void AiCarStandard::Update(float dt, const CarDynamics cars[], const unsigned cars_num)
+void AiCarStandard::Update(float dt, const CarDynamics cars[], const unsigned cars_num, const AiCarGrid & grid)
 {
-	AnalyzeOthers(dt, cars, cars_num);
+	AnalyzeOthers(dt, cars, cars_num, grid);
 	UpdateGasBrake(cars[carid]);
 	UpdateSteer(cars[carid]);
 }
@@ -287,25 +289,17 @@ void AiCarStandard::UpdateGasBrake(const CarDynamics & car)
 		return;
 	}
 
-	RoadPatch curr_patch = RevisePatch(curr_patch_ptr);
+	const PatchSpeed & curr_speed = GetPatchSpeed(car, curr_patch_ptr);
+
+#ifdef VISUALIZE_AI_DEBUG
+	brakelook.push_back(RevisePatch(curr_patch_ptr));
+#endif
 
-	const Vec3 patch_direction = GetPatchDirection(curr_patch).Normalize();
 	const Vec3 car_velocity = ToMathVector<float>(car.GetVelocity());
-	float currentspeed = car_velocity.dot(patch_direction);
+	float currentspeed = car_velocity.dot(curr_speed.direction);
 
 	// check speed against speed limit of current patch
-	float speed_limit = 0;
-	if (!curr_patch.GetNextPatch())
-	{
-		speed_limit = CalcSpeedLimit(car, &curr_patch, 0, 0);
-	}
-	else
-	{
-		RoadPatch next_patch = RevisePatch(curr_patch.GetNextPatch());
-		float width = GetPatchWidthVector(*curr_patch_ptr).Magnitude();
-		speed_limit = CalcSpeedLimit(car, &curr_patch, &next_patch, width);
-	}
-	speed_limit *= difficulty;
+	float speed_limit = curr_speed.speed_limit * difficulty;
 
 	float speed_diff = speed_limit - currentspeed;
 	if (speed_diff < 0)
@@ -332,62 +326,81 @@ void AiCarStandard::UpdateGasBrake(const CarDynamics & car)
 		brake_value = 0.;
 	}
 
-	// check upto maxlookahead distance
-	float maxlookahead = car.GetBrakeDistance(currentspeed, 0, FRICTION_FACTOR_LONG) + 10;
-	float dist_checked = 0;
-	float brake_dist = 0;
-	RoadPatch patch_to_check = curr_patch;
+	// brake if there is not enough distance left to slow down for a patch ahead
+	if (currentspeed > curr_speed.brake_speed)
+	{
+		brake_value = 1;
+		gas_value = 0;
+	}
 
-#ifdef VISUALIZE_AI_DEBUG
-	brakelook.push_back(patch_to_check);
-#endif
+	gas_value = RateLimit(inputs[CarInput::THROTTLE], gas_value, THROTTLE_RATE_LIMIT, THROTTLE_RATE_LIMIT);
+	brake_value = RateLimit(inputs[CarInput::BRAKE], brake_value, BRAKE_RATE_LIMIT, BRAKE_RATE_LIMIT);
 
-	while (dist_checked < maxlookahead)
-	{
-		RoadPatch * unmodified_patch_to_check = patch_to_check.GetNextPatch();
+	inputs[CarInput::THROTTLE] = gas_value;
+	inputs[CarInput::BRAKE] = brake_value;
+}
 
-		if (!patch_to_check.GetNextPatch())
-		{
-			// if there is no next patch(probably a non-closed track, just let it roll
-			brake_value = 0;
-			dist_checked = maxlookahead;
-			break;
-		}
-		else
-		{
-			patch_to_check = RevisePatch(patch_to_check.GetNextPatch());
-		}
+const AiCarStandard::PatchSpeed & AiCarStandard::GetPatchSpeed(const CarDynamics & car, const RoadPatch * patch)
+{
+	auto it = speed_profile.find(patch);
+	if (it == speed_profile.end())
+	{
+		CalcSpeedProfile(car, patch);
+		it = speed_profile.find(patch);
+	}
+	return it->second;
+}
 
-#ifdef VISUALIZE_AI_DEBUG
-		brakelook.push_back(patch_to_check);
-#endif
+void AiCarStandard::CalcSpeedProfile(const CarDynamics & car, const RoadPatch * start)
+{
+	std::vector<const RoadPatch *> patches;
+	const RoadPatch * patch = start;
+	do
+	{
+		patches.push_back(patch);
+		patch = patch->GetNextPatch();
+	}
+	while (patch && patch != start && !speed_profile.count(patch));
 
-		if (!patch_to_check.GetNextPatch())
-		{
-			speed_limit = CalcSpeedLimit(car, &patch_to_check, 0, 0);
-		}
-		else
-		{
-			RoadPatch next_patch = RevisePatch(patch_to_check.GetNextPatch());
-			float width = GetPatchWidthVector(*unmodified_patch_to_check).Magnitude();
-			speed_limit = CalcSpeedLimit(car, &patch_to_check, &next_patch, width);
-		}
+	std::vector<PatchSpeed> speeds(patches.size());
+	for (size_t i = 0; i < patches.size(); ++i)
+	{
+		const RoadPatch * p = patches[i];
+		const Vec3 direction = GetPatchDirection(RevisePatch(p));
+		const float width = GetPatchWidthVector(*p).Magnitude();
+		speeds[i].direction = direction.Normalize();
+		speeds[i].length = direction.Magnitude();
+		speeds[i].speed_limit = CalcSpeedLimit(car, p, p->GetNextPatch(), p->GetNextPatch() ? width : 0);
+	}
 
-		dist_checked += GetPatchDirection(patch_to_check).Magnitude();
-		brake_dist = car.GetBrakeDistance(currentspeed, speed_limit, FRICTION_FACTOR_LONG);
-		if (brake_dist > dist_checked)
+	// Backward pass, the brake speed of a patch is the highest speed from
+	// which the car can slow down to the target speed of the next patch
+	// over the next patch's length. A closed road takes a second lap for
+	// the patches before the start to constrain the ones at the end.
+	const float no_limit = std::numeric_limits<float>::infinity();
+	float next_speed = no_limit;
+	float next_length = 0;
+	if (patch && patch != start)
+	{
+		const PatchSpeed & next = speed_profile[patch];
+		next_speed = Min(next.speed_limit, next.brake_speed);
+		next_length = next.length;
+	}
+	const int passes = (patch == start) ? 2 : 1;
+	for (int pass = 0; pass < passes; ++pass)
+	{
+		for (size_t i = patches.size(); i-- > 0; )
 		{
-			brake_value = 1;
-			gas_value = 0;
-			break;
+			PatchSpeed & speed = speeds[i];
+			speed.brake_speed = (next_speed < no_limit) ?
+				car.GetBrakeSpeed(next_length, next_speed, FRICTION_FACTOR_LONG) : no_limit;
+			next_speed = Min(speed.speed_limit, speed.brake_speed);
+			next_length = speed.length;
 		}
 	}
 
-	gas_value = RateLimit(inputs[CarInput::THROTTLE], gas_value, THROTTLE_RATE_LIMIT, THROTTLE_RATE_LIMIT);
-	brake_value = RateLimit(inputs[CarInput::BRAKE], brake_value, BRAKE_RATE_LIMIT, BRAKE_RATE_LIMIT);
-
-	inputs[CarInput::THROTTLE] = gas_value;
-	inputs[CarInput::BRAKE] = brake_value;
+	for (size_t i = 0; i < patches.size(); ++i)
+		speed_profile[patches[i]] = speeds[i];
 }
 
 float AiCarStandard::CalcSpeedLimit(
@@ -535,8 +548,9 @@ float AiCarStandard::BrakeFromOthers(float speed_diff)
 	float mineta = 1000;
 	float mindistance = 1000;
 
-	for (const auto & car : othercars)
+	for (unsigned i : nearby)
 	{
+		const OtherCarInfo & car = othercars[i];
 		if (car.active && std::abs(car.horizontal_distance) < horizontal_care)
 		{
 			if (car.fore_distance < mindistance)
@@ -575,7 +589,7 @@ float AiCarStandard::BrakeFromOthers(float speed_diff)
 	return bias;
 }
 
-void AiCarStandard::AnalyzeOthers(float dt, const CarDynamics cars[], const unsigned cars_num)
+void AiCarStandard::AnalyzeOthers(float dt, const CarDynamics cars[], const unsigned cars_num, const AiCarGrid & grid)
 {
 	const float half_carlength = 1.25;
 	const btVector3 throttle_axis = Direction::forward;
@@ -584,11 +598,18 @@ void AiCarStandard::AnalyzeOthers(float dt, const CarDynamics cars[], const unsi
 	if (othercars.size() < cars_num)
 		othercars.resize(cars_num);
 
-	for (unsigned i = 0; i != cars_num; ++i)
+	// only cars within the grid radius are considered,
+	// forget the cars that left it since the last update
+	nearby_prev.swap(nearby);
+	grid.Query(carid, nearby);
+	for (unsigned i : nearby_prev)
 	{
-		if (i == carid)
-			continue;
+		if (!std::binary_search(nearby.begin(), nearby.end(), i))
+			othercars[i].active = false;
+	}
 
+	for (unsigned i : nearby)
+	{
 		const CarDynamics & icar = cars[i];
 		OtherCarInfo & info = othercars[i];
 
@@ -653,8 +674,9 @@ float AiCarStandard::SteerAwayFromOthers(float carspeed)
 	float eta = 1000;
 	float min_horizontal_distance = 1000;
 
-	for (const auto & car : othercars)
+	for (unsigned i : nearby)
 	{
+		const OtherCarInfo & car = othercars[i];
 		if (car.active && std::abs(car.horizontal_distance) < std::abs(min_horizontal_distance))
 		{
 			min_horizontal_distance = car.horizontal_distance;
@@ -26,6 +26,7 @@
 #include "graphics/scenenode.h"
 #include "roadpatch.h"
 
+#include <unordered_map>
 #include <vector>
 
 class CarDynamics;
@@ -42,7 +43,7 @@ public:
 
 	~AiCarStandard();
 
-	void Update(float dt, const CarDynamics cars[], const unsigned cars_num);
+	void Update(float dt, const CarDynamics cars[], const unsigned cars_num, const AiCarGrid & grid);
 
 #ifdef VISUALIZE_AI_DEBUG
 	void Visualize();
@@ -60,7 +61,26 @@ private:
 		float eta;
 		bool active;
 	};
-	std::vector <OtherCarInfo> othercars;
+	std::vector <OtherCarInfo> othercars; ///< indexed by car id
+	std::vector <unsigned> nearby; ///< ids of the cars within the grid radius, ascending
+	std::vector <unsigned> nearby_prev;
+
+	/// Speed profile along the racing line, computed once per road for the car.
+	struct PatchSpeed
+	{
+		Vec3 direction; ///< normalized direction of the revised patch
+		float length; ///< lookahead length of the revised patch
+		float speed_limit; ///< cornering speed limit
+		float brake_speed; ///< highest speed that still allows to brake for the patches ahead
+	};
+	std::unordered_map<const RoadPatch *, PatchSpeed> speed_profile;
+
+	/// get the profile entry of patch, computes the profile of its road on first use
+	const PatchSpeed & GetPatchSpeed(const CarDynamics & car, const RoadPatch * patch);
+
+	/// backward pass over the road ahead of patch, up to the end of the road,
+	/// the start patch of a closed road or a patch with a profile
+	void CalcSpeedProfile(const CarDynamics & car, const RoadPatch * patch);
 
 	void UpdateGasBrake(const CarDynamics & car);
 
@@ -72,7 +92,7 @@ private:
 
 	void UpdateSteer(const CarDynamics & car);
 
-	void AnalyzeOthers(float dt, const CarDynamics cars[], const unsigned cars_num);
+	void AnalyzeOthers(float dt, const CarDynamics cars[], const unsigned cars_num, const AiCarGrid & grid);
 
 	///< returns a float that should be added into the steering wheel command
 	float SteerAwayFromOthers(float carspeed);
@@ -18,9 +18,12 @@
 /************************************************************************/
 
 #include "bezier.h"
+#include "testfixtures.h"
 #include "unittest.h"
+#include "microbench.h"
 
 #include <cmath>
+#include <sstream>
 
 std::ostream & operator << (std::ostream &os, const Bezier & b)
 {
@@ -85,6 +88,8 @@ void Bezier::SetFromCorners(const Vec3 & fl, const Vec3 & fr, const Vec3 & bl, c
 		points[2][i] = points[3][i] - t;
 	}
 
+	UpdateGrid();
+
 	//CheckForProblems();
 }
 
@@ -239,6 +244,8 @@ void Bezier::Reverse()
 	for (int n = 0; n < 4; n++)
 		for (int i = 0; i < 4; i++)
 			points[n][i] = oldpoints[3-n][3-i];
+
+	UpdateGrid();
 }
 
 Vec3 Bezier::Bernstein(float u, const Vec3 p[]) const
@@ -316,6 +323,8 @@ void Bezier::ReadFrom(std::istream &openfile)
 		//FitSpline(points[x]);
 		//FitMidPoint(points[x]);
 	}
+
+	UpdateGrid();
 }
 
 void Bezier::ReadFromYZX(std::istream &openfile)
@@ -330,6 +339,8 @@ void Bezier::ReadFromYZX(std::istream &openfile)
 			openfile >> points[x][y][0];
 		}
 	}
+
+	UpdateGrid();
 }
 
 void Bezier::WriteTo(std::ostream &openfile) const
@@ -432,6 +443,183 @@ bool Bezier::CollideSubDivQuadSimpleNorm(const Vec3 & origin, const Vec3 & direc
 	return true;
 }
 
+bool Bezier::CollideGrid(const Vec3 & origin, const Vec3 & direction, Vec3 &outtri, Vec3 & normal) const
+{
+	const int n = GRID_DIVS + 1;
+
+	// project the grid along the ray onto a plane through the origin,
+	// the ray is at (0, 0) of the plane, a1, a2 need not be normalized
+	int k = 0;
+	for (int i = 1; i < 3; ++i)
+		if (std::abs(direction[i]) < std::abs(direction[k])) k = i;
+	Vec3 axis;
+	axis[k] = 1;
+	const Vec3 a1 = direction.cross(axis);
+	const Vec3 a2 = direction.cross(a1);
+	const float dd = direction.dot(direction);
+	if (!(dd > 0)) return false;
+
+	const float inv_dd = 1 / dd;
+	float px[n][n], py[n][n], pt[n][n];
+	float xmin = 1E38f, xmax = -1E38f, ymin = 1E38f, ymax = -1E38f;
+	for (int j = 0; j < n; ++j)
+	{
+		for (int i = 0; i < n; ++i)
+		{
+			const Vec3 d = grid[j][i] - origin;
+			px[j][i] = d.dot(a1);
+			py[j][i] = d.dot(a2);
+			pt[j][i] = d.dot(direction) * inv_dd;
+			xmin = Min(xmin, px[j][i]);
+			xmax = Max(xmax, px[j][i]);
+			ymin = Min(ymin, py[j][i]);
+			ymax = Max(ymax, py[j][i]);
+		}
+	}
+
+	// the ray passes outside of the projected grid
+	if (xmin > 0 || xmax < 0 || ymin > 0 || ymax < 0)
+	{
+		outtri = origin;
+		return false;
+	}
+
+	// nearest grid triangle containing the ray, shared edges are evaluated
+	// identically for both triangles, so there are no cracks
+	auto edge = [&px, &py](int j0, int i0, int j1, int i1)
+	{
+		return px[j0][i0] * py[j1][i1] - py[j0][i0] * px[j1][i1];
+	};
+
+	bool col = false;
+	float t = 0, su = 0, sv = 0;
+	for (int j = 0; j < GRID_DIVS; ++j)
+	{
+		for (int i = 0; i < GRID_DIVS; ++i)
+		{
+			// triangles (00, 10, 11) and (00, 11, 01) of the cell, index [v][u]
+			const int tri[2][3][2] = {
+				{{j, i}, {j, i + 1}, {j + 1, i + 1}},
+				{{j, i}, {j + 1, i + 1}, {j + 1, i}}};
+			for (const auto & c : tri)
+			{
+				const float w0 = edge(c[1][0], c[1][1], c[2][0], c[2][1]);
+				const float w1 = edge(c[2][0], c[2][1], c[0][0], c[0][1]);
+				const float w2 = edge(c[0][0], c[0][1], c[1][0], c[1][1]);
+				if ((w0 < 0 || w1 < 0 || w2 < 0) && (w0 > 0 || w1 > 0 || w2 > 0))
+					continue;
+
+				const float w = w0 + w1 + w2;
+				if (w == 0)
+					continue;
+
+				const float b0 = w0 / w, b1 = w1 / w, b2 = w2 / w;
+				const float tt = b0 * pt[c[0][0]][c[0][1]] + b1 * pt[c[1][0]][c[1][1]] + b2 * pt[c[2][0]][c[2][1]];
+				if (tt < 0 || (col && tt >= t))
+					continue;
+
+				t = tt;
+				su = (b0 * c[0][1] + b1 * c[1][1] + b2 * c[2][1]) * (1.0f / GRID_DIVS);
+				sv = (b0 * c[0][0] + b1 * c[1][0] + b2 * c[2][0]) * (1.0f / GRID_DIVS);
+				col = true;
+			}
+		}
+	}
+
+	if (!col)
+	{
+		outtri = origin;
+		return false;
+	}
+
+	// solve pos(su, sv) = origin + direction * t
+	Vec3 pos, dpx, dpy;
+	float u = su, v = sv;
+	for (int iter = 0; iter < 6; ++iter)
+	{
+		SurfDerivs(u, v, pos, dpx, dpy);
+		const Vec3 f = pos - origin - direction * t;
+
+		// Cramer's rule for [dpx dpy -direction] * delta = -f
+		const Vec3 c = dpy.cross(direction);
+		const float det = -dpx.dot(c);
+		if (std::abs(det) < 1E-12f)
+			break;
+
+		const float inv = 1 / det;
+		const float du = f.dot(c) * inv;
+		const float dv = dpx.dot(f.cross(direction)) * inv;
+		const float dt = -dpx.dot(dpy.cross(f)) * inv;
+		u += du;
+		v += dv;
+		t += dt;
+
+		if (std::abs(du) < 1E-6f && std::abs(dv) < 1E-6f)
+		{
+			su = u;
+			sv = v;
+			break;
+		}
+		if (iter == 5 || std::abs(u - su) > 1.0f / GRID_DIVS || std::abs(v - sv) > 1.0f / GRID_DIVS)
+		{
+			// diverged, stay with the grid hit
+			u = su;
+			v = sv;
+			break;
+		}
+	}
+
+	// the exact hit may be just outside of the grid edges
+	u = Clamp(u, 0.0f, 1.0f);
+	v = Clamp(v, 0.0f, 1.0f);
+	SurfDerivs(u, v, pos, dpx, dpy);
+	if ((pos - origin).dot(direction) < 0)
+	{
+		outtri = origin;
+		return false;
+	}
+
+	outtri = pos;
+	normal = dpy.cross(dpx).Normalize();
+	return true;
+}
+
+void Bezier::UpdateGrid()
+{
+	for (int j = 0; j <= GRID_DIVS; ++j)
+	{
+		for (int i = 0; i <= GRID_DIVS; ++i)
+		{
+			grid[j][i] = SurfCoord(i * (1.0f / GRID_DIVS), j * (1.0f / GRID_DIVS));
+		}
+	}
+}
+
+void Bezier::SurfDerivs(float px, float py, Vec3 & pos, Vec3 & dpx, Vec3 & dpy) const
+{
+	// bernstein weights of Bernstein() and their derivatives
+	const float ux = 1 - px;
+	const float bx[4] = {px*px*px, 3*px*px*ux, 3*px*ux*ux, ux*ux*ux};
+	const float tx[4] = {3*px*px, 6*px*ux - 3*px*px, 3*ux*ux - 6*px*ux, -3*ux*ux};
+	const float uy = 1 - py;
+	const float by[4] = {py*py*py, 3*py*py*uy, 3*py*uy*uy, uy*uy*uy};
+	const float ty[4] = {3*py*py, 6*py*uy - 3*py*py, 3*uy*uy - 6*py*uy, -3*uy*uy};
+
+	pos = dpx = dpy = Vec3(0);
+	for (int j = 0; j < 4; ++j)
+	{
+		Vec3 row, drow;
+		for (int i = 0; i < 4; ++i)
+		{
+			row = row + points[j][i] * bx[i];
+			drow = drow + points[j][i] * tx[i];
+		}
+		pos = pos + row * by[j];
+		dpx = dpx + drow * by[j];
+		dpy = dpy + row * ty[j];
+	}
+}
+
 void Bezier::DeCasteljauHalveCurve(Vec3 * points4, Vec3 * left4, Vec3 * right4) const
 {
 	left4[0] = points4[0];
@@ -629,3 +817,129 @@ QT_TEST(bezier_test)
 	b.SetFromCorners(Vec3(1,0,1),Vec3(-1,0,1),Vec3(1,0,-1),Vec3(-1,0,-1));
 	QT_CHECK(!b.CheckForProblems());
 }
+
+/// a 10 m x 12 m road patch with a crest and banking
+static Bezier CreateTestPatch()
+{
+	std::stringstream s;
+	for (int x = 0; x < 4; ++x)
+	{
+		for (int y = 0; y < 4; ++y)
+		{
+			const float h = 1.5f * (x == 1 || x == 2) + 0.3f * (y - 1.5f) + 0.2f * (x == 2) * (y == 1);
+			s << 10 * x / 3.0f << " " << h << " " << 12 * y / 3.0f - 6 << "\n";
+		}
+	}
+	Bezier b;
+	b.ReadFrom(s);
+	return b;
+}
+
+/// pseudo random rays through the surface point at (u, v) inside [umin, umax]
+static void CreateTestRays(
+	const Bezier & b, int count, float umin, float umax,
+	std::vector<Vec3> & origins, std::vector<Vec3> & directions,
+	std::vector<Vec3> & targets, std::vector<Vec3> & normals)
+{
+	TestRandom random(777);
+
+	origins.resize(count);
+	directions.resize(count);
+	targets.resize(count);
+	normals.resize(count);
+	for (int i = 0; i < count; ++i)
+	{
+		const float u = umin + (umax - umin) * random();
+		const float v = umin + (umax - umin) * random();
+		targets[i] = b.SurfCoord(u, v);
+		normals[i] = b.SurfNorm(u, v);
+		directions[i] = Vec3(0.4f * random() - 0.2f, -1, 0.4f * random() - 0.2f).Normalize();
+		origins[i] = targets[i] - directions[i] * (1 + 2 * random());
+	}
+}
+
+QT_TEST(bezier_collide_test)
+{
+	const Bezier b = CreateTestPatch();
+	QT_CHECK(!b.CheckForProblems());
+
+	// rays through known surface points, the reference is the exact hit
+	const int count = 2000;
+	std::vector<Vec3> origins, directions, targets, normals;
+	CreateTestRays(b, count, 0.02f, 0.98f, origins, directions, targets, normals);
+
+	// largest contact point and normal error of each method
+	int misses[2] = {0, 0};
+	float error[2] = {0, 0};
+	float normal_error[2] = {0, 0};
+	for (int i = 0; i < count; ++i)
+	{
+		for (int k = 0; k < 2; ++k)
+		{
+			Vec3 tri, normal;
+			const bool col = (k == 0) ?
+				b.CollideSubDivQuadSimpleNorm(origins[i], directions[i], tri, normal) :
+				b.CollideGrid(origins[i], directions[i], tri, normal);
+			if (!col)
+			{
+				misses[k]++;
+				continue;
+			}
+			error[k] = std::max(error[k], (tri - targets[i]).Magnitude());
+			normal_error[k] = std::max(normal_error[k], 1 - normal.dot(normals[i]));
+		}
+	}
+	QT_CHECK_EQUAL(misses[0], 0);
+	QT_CHECK_EQUAL(misses[1], 0);
+	QT_CHECK_LESS(error[1], 1E-4f);
+	QT_CHECK_LESS(error[1], error[0]);
+	QT_CHECK_LESS(normal_error[1], 1E-5f);
+	QT_CHECK_LESS(normal_error[1], normal_error[0] + 1E-6f);
+
+	// rays next to the patch miss
+	CreateTestRays(b, 200, 1.05f, 1.5f, origins, directions, targets, normals);
+	int hits = 0;
+	for (int i = 0; i < 200; ++i)
+	{
+		Vec3 tri, normal;
+		hits += b.CollideGrid(origins[i], directions[i], tri, normal);
+		hits += b.CollideSubDivQuadSimpleNorm(origins[i], directions[i], tri, normal);
+	}
+	QT_CHECK_EQUAL(hits, 0);
+
+	// rays pointing away from the patch miss
+	Vec3 tri, normal;
+	QT_CHECK(!b.CollideGrid(Vec3(5, 5, 0), Vec3(0, 1, 0), tri, normal));
+	QT_CHECK(b.CollideGrid(Vec3(5, 5, 0), Vec3(0, -1, 0), tri, normal));
+	QT_CHECK(!b.CollideGrid(Vec3(5, -5, 0), Vec3(0, -1, 0), tri, normal));
+}
+
+MICROBENCH(bezier)
+{
+	const Bezier b = CreateTestPatch();
+	const int count = 1024;
+	std::vector<Vec3> origins, directions, targets, normals;
+	CreateTestRays(b, count, -0.2f, 1.2f, origins, directions, targets, normals);
+
+	bench.measure("subdivision, rays", count, [&]()
+	{
+		int hits = 0;
+		for (int i = 0; i < count; ++i)
+		{
+			Vec3 tri, normal;
+			hits += b.CollideSubDivQuadSimpleNorm(origins[i], directions[i], tri, normal);
+		}
+		microbench::consume(hits);
+	});
+
+	bench.measure("grid and newton, rays", count, [&]()
+	{
+		int hits = 0;
+		for (int i = 0; i < count; ++i)
+		{
+			Vec3 tri, normal;
+			hits += b.CollideGrid(origins[i], directions[i], tri, normal);
+		}
+		microbench::consume(hits);
+	});
+}
@@ -47,6 +47,10 @@ public:
 	bool CollideSubDivQuadSimple(const Vec3 & origin, const Vec3 & direction, Vec3 &outtri) const;
 	bool CollideSubDivQuadSimpleNorm(const Vec3 & origin, const Vec3 & direction, Vec3 &outtri, Vec3 & normal) const;
 
+	///same as CollideSubDivQuadSimpleNorm, finds the hit on the cached surface grid
+	///and refines it by Newton iteration on the exact surface, outtri lies on the ray
+	bool CollideGrid(const Vec3 & origin, const Vec3 & direction, Vec3 &outtri, Vec3 & normal) const;
+
 	///read/write IO operations (ascii format)
 	void ReadFrom(std::istream & openfile);
 	void ReadFromYZX(std::istream & openfile);
@@ -93,8 +97,20 @@ public:
 	Vec3 SurfNorm(float px, float py) const;
 
 private:
+	///number of surface grid cells per side
+	static const int GRID_DIVS = 4;
+
 	Vec3 points[4][4];
 
+	///surface points at the grid nodes, used by CollideGrid
+	Vec3 grid[GRID_DIVS + 1][GRID_DIVS + 1];
+
+	///update the surface grid, call after the points changed
+	void UpdateGrid();
+
+	///surface point and partial derivatives at the normalized coordinates px and py
+	void SurfDerivs(float px, float py, Vec3 & pos, Vec3 & dpx, Vec3 & dpy) const;
+
 	///return the bernstein given the normalized coordinate u (zero to one) and an array of four points p
 	Vec3 Bernstein(float u, const Vec3 p[]) const;
 
@@ -127,3 +127,13 @@ const std::shared_ptr<PTree> & Factory<PTree>::getDefault() const
 {
 	return m_default;
 }
+
+size_t Factory<PTree>::getSize(const PTree & content) const
+{
+	size_t size = sizeof(PTree) + content.value().capacity();
+	for (const auto & child : content)
+	{
+		size += child.first.capacity() + getSize(child.second);
+	}
+	return size;
+}
@@ -51,6 +51,9 @@ public:
 
 	const std::shared_ptr<PTree> & getDefault() const;
 
+	/// approximate memory used by content in bytes
+	size_t getSize(const PTree & content) const;
+
 private:
 	std::shared_ptr<PTree> m_default;
 	void (*m_read)(std::istream &, PTree &, Include *);
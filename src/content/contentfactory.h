@@ -38,6 +38,9 @@ public:
 		const P & param);
 
 	const std::shared_ptr<Content> & getDefault() const;
+
+	/// approximate memory used by content in bytes
+	size_t getSize(const Content & content) const;
 };
 
 #endif // _CONTENTFACTORY_H
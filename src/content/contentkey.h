@@ -0,0 +1,148 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef _CONTENTKEY_H
+#define _CONTENTKEY_H
+
+#include <cassert>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+/// Content cache key, a 64 bit hash of path + name.
+/// It is computed from path and name in place, without building the key
+/// string, keys compare as integers. Keys of the same concatenation are equal.
+class ContentKey
+{
+public:
+	ContentKey();
+
+	ContentKey(const std::string & path, const std::string & name);
+
+	bool operator==(const ContentKey other) const;
+
+	/// the key is a hash already
+	struct hash
+	{
+		std::size_t operator()(const ContentKey key) const {return std::size_t(key.id);}
+	};
+
+private:
+	uint64_t id;
+
+	/// FNV-1a over str, continuing from h
+	static uint64_t hashString(uint64_t h, const std::string & str);
+};
+
+/// Maps content keys back to their path + name string, for logs.
+/// With a 64 bit hash the collision probability of ten thousand keys
+/// is about 1e-11, debug builds check interned keys for collisions.
+/// Keys are counted, a key added n times is removed by n erase calls.
+class ContentKeyMap
+{
+public:
+	/// intern path + name, returns its key
+	ContentKey add(const std::string & path, const std::string & name);
+
+	/// release a key added before
+	void erase(ContentKey key);
+
+	/// returns an empty string if the key was not interned
+	const std::string & getString(ContentKey key) const;
+
+	size_t size() const;
+
+private:
+	struct Entry
+	{
+		std::string str;
+		unsigned count;
+	};
+	std::unordered_map<ContentKey, Entry, ContentKey::hash> strings;
+};
+
+
+inline ContentKey::ContentKey() : id(0)
+{
+	// ctor
+}
+
+inline ContentKey::ContentKey(const std::string & path, const std::string & name) :
+	id(hashString(hashString(14695981039346656037ULL, path), name))
+{
+	// ctor
+}
+
+inline bool ContentKey::operator==(const ContentKey other) const
+{
+	return id == other.id;
+}
+
+inline uint64_t ContentKey::hashString(uint64_t h, const std::string & str)
+{
+	for (const char c : str)
+	{
+		h ^= (unsigned char)c;
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+inline ContentKey ContentKeyMap::add(const std::string & path, const std::string & name)
+{
+	const ContentKey key(path, name);
+	auto i = strings.find(key);
+	if (i == strings.end())
+	{
+		Entry entry = {path + name, 1};
+		strings.insert(std::make_pair(key, entry));
+	}
+	else
+	{
+		assert(i->second.str.size() == path.size() + name.size() &&
+			i->second.str.compare(0, path.size(), path) == 0 &&
+			i->second.str.compare(path.size(), name.size(), name) == 0);
+		i->second.count++;
+	}
+	return key;
+}
+
+inline void ContentKeyMap::erase(ContentKey key)
+{
+	auto i = strings.find(key);
+	assert(i != strings.end());
+	if (i != strings.end() && --i->second.count == 0)
+		strings.erase(i);
+}
+
+inline const std::string & ContentKeyMap::getString(ContentKey key) const
+{
+	static const std::string empty;
+	auto i = strings.find(key);
+	if (i != strings.end())
+		return i->second.str;
+	return empty;
+}
+
+inline size_t ContentKeyMap::size() const
+{
+	return strings.size();
+}
+
+#endif // _CONTENTKEY_H
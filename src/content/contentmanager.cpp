@@ -18,11 +18,21 @@
 /************************************************************************/
 
 #include "contentmanager.h"
+#include "graphics/model.h"
+#include "graphics/texture.h"
+#include "unittest.h"
+#include "microbench.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <map>
 #include <ostream>
 
 ContentManager::ContentManager(std::ostream & error) :
-	error(error)
+	error(error),
+	budget(0),
+	use_count(0)
 {
 	// ctor
 }
@@ -45,9 +55,85 @@ void ContentManager::addPath(const std::string & path)
 
 void ContentManager::sweep()
 {
+	release();
+
+	std::lock_guard<std::mutex> lock(mutex);
 	for (auto & cache : factory_cached.m_caches)
 	{
-		cache->sweep();
+		cache->sweep(keys);
+	}
+}
+
+void ContentManager::release()
+{
+	// destroy outside of the lock
+	std::vector<std::shared_ptr<void> > released;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		released.swap(evicted);
+	}
+}
+
+void ContentManager::setBudget(size_t bytes)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	budget = bytes;
+	_evict();
+}
+
+void ContentManager::logStats(std::ostream & out)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	size_t bytes = 0;
+	for (const auto & cache : factory_cached.m_caches)
+	{
+		bytes += cache->bytes;
+	}
+
+	out << "Content cache: " << bytes / 1024 << " KB";
+	if (budget)
+		out << " of " << budget / 1024 << " KB";
+	for (const auto & cache : factory_cached.m_caches)
+	{
+		const unsigned requests = cache->hits + cache->misses;
+		out << "\n" << cache->name << ": " << cache->size() << " entries, "
+			<< cache->bytes / 1024 << " KB, hit rate "
+			<< (requests ? 100 * cache->hits / requests : 0) << "% ("
+			<< cache->hits << " hits, " << cache->misses << " misses), "
+			<< cache->evictions << " evictions";
+	}
+	out << std::endl;
+}
+
+void ContentManager::_evict()
+{
+	if (budget == 0)
+		return;
+
+	size_t bytes = 0;
+	for (const auto & cache : factory_cached.m_caches)
+	{
+		bytes += cache->bytes;
+	}
+	if (bytes <= budget)
+		return;
+
+	std::vector<Unused> unused;
+	for (const auto & cache : factory_cached.m_caches)
+	{
+		cache->getUnused(unused);
+	}
+	std::sort(unused.begin(), unused.end(), [](const Unused & a, const Unused & b)
+	{
+		return a.last_use < b.last_use;
+	});
+
+	for (const auto & entry : unused)
+	{
+		if (bytes <= budget)
+			break;
+		bytes -= entry.size;
+		entry.cache->evict(entry.key, keys, evicted);
 	}
 }
 
@@ -65,7 +151,7 @@ bool ContentManager::_logleaks()
 	for (const auto & cache : factory_cached.m_caches)
 	{
 		error << "\n";
-		cache->log(error);
+		cache->log(error, keys);
 	}
 	error << std::endl;
 	return false;
@@ -75,6 +161,7 @@ bool ContentManager::_logerror(
 	const std::string & path,
 	const std::string & name)
 {
+	std::lock_guard<std::mutex> lock(mutex);
 	error << "Failed to load \"" << name << "\" from:";
 	for (const auto & basepath : basepaths)
 	{
@@ -87,3 +174,258 @@ bool ContentManager::_logerror(
 	error << std::endl;
 	return false;
 }
+
+template <>
+bool ContentManager::_upload(
+	std::shared_ptr<Texture> & sptr,
+	const std::string & path,
+	const std::string & name)
+{
+	if (!sptr->GetDecoded())
+		return true;
+
+	std::ostringstream upload_error;
+	if (sptr->Upload(upload_error))
+		return true;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		error << upload_error.str();
+	}
+	return _getdefault(sptr) || _logerror(path, name);
+}
+
+QT_TEST(contentmanager_test)
+{
+	std::ostringstream error;
+	ContentManager content(error);
+	content.addPath("data");
+
+	VertexArray va;
+	va.SetToUnitCube();
+
+	{
+		// requests of content being loaded share one load
+		ContentManager::Request<Model> a = content.loadAsync<Model>("test/", "cube", va);
+		ContentManager::Request<Model> b = content.loadAsync<Model>("test/", "cube", va);
+		std::shared_ptr<Model> ma, mb;
+		QT_CHECK(a.get(ma));
+		QT_CHECK(b.get(mb));
+		QT_CHECK(a.ready() && b.ready());
+		QT_CHECK(ma && ma == mb);
+
+		// synchronous load returns the cached content
+		std::shared_ptr<Model> mc;
+		QT_CHECK(content.load(mc, "test/", "cube", va));
+		QT_CHECK(mc == ma);
+
+		// other keys get their own content
+		std::shared_ptr<Model> md;
+		QT_CHECK(content.load(md, "test/", "cube2", va));
+		QT_CHECK(md && md != ma);
+
+		ma.reset();
+		mb.reset();
+		mc.reset();
+		md.reset();
+	}
+	content.sweep();
+	QT_CHECK(error.str().empty());
+
+	{
+		// a synchronous load uploads a texture decoded by a load job,
+		// a dds file without header fails the upload before any gl call
+		const std::string filename = "contentmanager_test.dds";
+		std::ofstream(filename.c_str(), std::ios::binary) << "DDS ";
+
+		std::ostringstream texture_error;
+		ContentManager textures(texture_error);
+		textures.addPath(".");
+		std::shared_ptr<Texture> decoded, loaded;
+		QT_CHECK(textures.loadAsync<Texture>("", filename, TextureInfo()).get(decoded));
+		QT_CHECK(decoded && decoded->GetDecoded());
+		QT_CHECK(!textures.load(loaded, "", filename, TextureInfo()));
+		QT_CHECK(!decoded->GetDecoded());
+		QT_CHECK(loaded == textures.getFactory<Texture>().getDefault());
+		QT_CHECK(texture_error.str().find("Error loading texture file") != std::string::npos);
+		decoded.reset();
+		loaded.reset();
+		std::remove(filename.c_str());
+	}
+
+	// over budget the least recently used unreferenced content is evicted
+	std::shared_ptr<Model> m[3];
+	QT_CHECK(content.load(m[0], "test/", "m0", va));
+	QT_CHECK(content.load(m[1], "test/", "m1", va));
+	QT_CHECK(content.load(m[2], "test/", "m2", va));
+	const size_t size = content.getFactory<Model>().getSize(*m[0]);
+	std::weak_ptr<Model> m1 = m[1];
+	m[0].reset();
+	m[1].reset();
+	QT_CHECK(content.get(m[0], "test/", "m0"));
+	m[0].reset();
+	content.setBudget(2 * size);
+	QT_CHECK(content.get(m[0], "test/", "m0"));
+	QT_CHECK(!content.get(m[1], "test/", "m1"));
+	QT_CHECK(content.get(m[2], "test/", "m2"));
+
+	// evicted content is destroyed by release
+	QT_CHECK(!m1.expired());
+	content.release();
+	QT_CHECK(m1.expired());
+
+	// referenced content is kept
+	m[0].reset();
+	content.setBudget(1);
+	QT_CHECK(!content.get(m[1], "test/", "m0"));
+	QT_CHECK(content.get(m[1], "test/", "m2"));
+
+	std::ostringstream stats;
+	content.logStats(stats);
+	QT_CHECK(stats.str().find("Model: 1 entries") != std::string::npos);
+	QT_CHECK(stats.str().find("2 evictions") != std::string::npos);
+
+	// keys of the same concatenation are equal
+	QT_CHECK(ContentKey("test/", "m2") == ContentKey("test", "/m2"));
+	QT_CHECK(!(ContentKey("test/", "m2") == ContentKey("test/", "m0")));
+	QT_CHECK(!(ContentKey("test/", "m2") == ContentKey()));
+
+	// key strings are kept until their last entry is gone
+	ContentKeyMap keys;
+	const ContentKey key = keys.add("test/", "m2");
+	keys.add("test", "/m2");
+	QT_CHECK_EQUAL(keys.size(), 1u);
+	QT_CHECK_EQUAL(keys.getString(key), "test/m2");
+	keys.erase(key);
+	QT_CHECK_EQUAL(keys.getString(key), "test/m2");
+	keys.erase(key);
+	QT_CHECK_EQUAL(keys.size(), 0u);
+	QT_CHECK(keys.getString(key).empty());
+
+	// generic content is found for any path
+	std::shared_ptr<Model> g;
+	QT_CHECK(content.load(g, "", "generic", va));
+	QT_CHECK(content.get(m[0], "test/", "generic"));
+	QT_CHECK(m[0] == g);
+	m[0].reset();
+	g.reset();
+
+	m[0].reset();
+	m[1].reset();
+	m[2].reset();
+	content.sweep();
+}
+
+MICROBENCH(contentmanager)
+{
+	std::ostringstream error;
+	ContentManager content(error);
+	content.addPath("data");
+
+	VertexArray va;
+	va.SetToUnitCube();
+
+	// a car with its own models and shared generic ones, a track with
+	// several hundred objects
+	const std::string car_path = "cars/XS/";
+	const std::string track_path = "tracks/ruudskogen/objects/";
+	std::vector<std::string> car_names, generic_names, track_names;
+	for (int i = 0; i < 32; ++i)
+	{
+		std::ostringstream name;
+		name << "body-part-" << i << ".joe";
+		car_names.push_back(name.str());
+	}
+	for (int i = 0; i < 16; ++i)
+	{
+		std::ostringstream name;
+		name << "wheel-generic-" << i << ".joe";
+		generic_names.push_back(name.str());
+	}
+	for (int i = 0; i < 800; ++i)
+	{
+		std::ostringstream name;
+		name << "object-tree-" << i << ".joe";
+		track_names.push_back(name.str());
+	}
+
+	// previous lookup, locked string map search of path + name, then name
+	struct StringEntry
+	{
+		std::shared_ptr<Model> sptr;
+		uint64_t last_use;
+	};
+	std::map<std::string, StringEntry> string_cache;
+	std::mutex string_mutex;
+	uint64_t string_use_count = 0;
+	unsigned string_hits = 0;
+	auto string_find = [&](std::shared_ptr<Model> & sptr, const std::string & key)
+	{
+		std::lock_guard<std::mutex> lock(string_mutex);
+		auto i = string_cache.find(key);
+		if (i == string_cache.end())
+			return false;
+		i->second.last_use = ++string_use_count;
+		sptr = i->second.sptr;
+		string_hits++;
+		return true;
+	};
+	auto string_get = [&](std::shared_ptr<Model> & sptr, const std::string & path, const std::string & name)
+	{
+		return string_find(sptr, path + name) || string_find(sptr, name);
+	};
+
+	std::vector<std::shared_ptr<Model> > models;
+	auto load = [&](const std::string & path, const std::string & name)
+	{
+		models.push_back(std::shared_ptr<Model>());
+		content.load(models.back(), path, name, va);
+		StringEntry entry = {models.back(), 0};
+		string_cache[path + name] = entry;
+	};
+	for (const auto & name : car_names)
+		load(car_path, name);
+	for (const auto & name : generic_names)
+		load("", name);
+	for (const auto & name : track_names)
+		load(track_path, name);
+
+	std::shared_ptr<Model> sptr;
+	bench.measure("track objects", track_names.size(), [&]()
+	{
+		for (const auto & name : track_names)
+			content.get(sptr, track_path, name);
+		microbench::consume(sptr.get());
+	});
+
+	bench.measure("car, generic fallback", car_names.size() + generic_names.size(), [&]()
+	{
+		for (const auto & name : car_names)
+			content.get(sptr, car_path, name);
+		for (const auto & name : generic_names)
+			content.get(sptr, car_path, name);
+		microbench::consume(sptr.get());
+	});
+
+	bench.measure("track objects, string keys", track_names.size(), [&]()
+	{
+		for (const auto & name : track_names)
+			string_get(sptr, track_path, name);
+		microbench::consume(sptr.get());
+	});
+
+	bench.measure("car, generic fallback, string keys", car_names.size() + generic_names.size(), [&]()
+	{
+		for (const auto & name : car_names)
+			string_get(sptr, car_path, name);
+		for (const auto & name : generic_names)
+			string_get(sptr, car_path, name);
+		microbench::consume(sptr.get());
+	});
+	microbench::consume(string_hits);
+
+	sptr.reset();
+	string_cache.clear();
+	models.clear();
+	content.sweep();
+}
@@ -24,12 +24,45 @@
 #include "texturefactory.h"
 #include "modelfactory.h"
 #include "configfactory.h"
+#include "contentkey.h"
+#include "jobsystem.h"
 #include <vector>
-#include <map>
-
+#include <unordered_map>
+#include <cassert>
+#include <cstdint>
+#include <mutex>
+#include <sstream>
+
+class JoePack;
+
+/// Shared content cache. get and load may be called from several threads,
+/// content is created outside of the lock, if two threads create the same
+/// object the first one cached is used.
+/// Cached content is kept after its last user is gone, up to a memory
+/// budget. Over budget, least recently used unreferenced content is evicted.
+/// Content is cached by path + name key hash, cache lookups build no strings.
 class ContentManager
 {
+	template <class T> struct Loading;
+
 public:
+	/// handle of an asynchronous load
+	template <class T>
+	class Request
+	{
+	public:
+		/// true if the load is finished
+		bool ready() const;
+
+		/// wait for the load, executing other jobs meanwhile
+		/// on failure sptr is set to the default object and false is returned
+		bool get(std::shared_ptr<T> & sptr) const;
+
+	private:
+		friend class ContentManager;
+		std::shared_ptr<Loading<T> > state;
+	};
+
 	ContentManager(std::ostream & error);
 
 	~ContentManager();
@@ -41,7 +74,9 @@ public:
 		const std::string & path,
 		const std::string & name);
 
-	/// retrieve shared object, load if not in cache
+	/// retrieve shared object, load on the calling thread if not in cache,
+	/// wait for it if it is being loaded
+	/// textures decoded by load jobs are uploaded on the calling thread
 	template <class T>
 	bool load(
 		std::shared_ptr<T> & sptr,
@@ -56,33 +91,113 @@ public:
 		const std::string & name,
 		const P & param);
 
+	/// queue a load job, requests of content being loaded share its load
+	/// textures are only decoded, Texture::Upload has to be called on the gl thread
+	template <class T>
+	Request<T> loadAsync(
+		const std::string & path,
+		const std::string & name);
+
+	/// param is copied into the job, a JoePack has to outlive the request
+	template <class T, class P>
+	Request<T> loadAsync(
+		const std::string & path,
+		const std::string & name,
+		const P & param);
+
 	/// add shared content directory path
 	void addSharedPath(const std::string & path);
 
 	/// add content directory path
 	void addPath(const std::string & path);
 
-	/// garbage collect unused content
+	/// garbage collect unused content, call on the gl thread
 	void sweep();
 
+	/// destroy evicted content, call on the gl thread once per frame
+	/// content is evicted by loads on any thread, textures have to be
+	/// released on the gl thread
+	void release();
+
+	/// cache memory budget in bytes, 0 disables eviction
+	void setBudget(size_t bytes);
+
+	/// write entries, memory, hit rate and evictions per content type
+	void logStats(std::ostream & out);
+
 	/// factories access
 	template <class T>
 	Factory<T> & getFactory();
 
 private:
+	struct Cache;
+
+	/// unreferenced cache entry
+	struct Unused
+	{
+		uint64_t last_use;
+		size_t size;
+		Cache * cache;
+		ContentKey key;
+	};
+
 	struct Cache
 	{
-		virtual void log(std::ostream & log) const = 0;
+		Cache() : name(""), bytes(0), hits(0), misses(0), evictions(0) {}
+		virtual ~Cache() {}
+		virtual void log(std::ostream & log, const ContentKeyMap & keys) const = 0;
 		virtual size_t size() const = 0;
-		virtual void sweep() = 0;
+		virtual void sweep(ContentKeyMap & keys) = 0;
+		virtual void getUnused(std::vector<Unused> & unused) = 0;
+		virtual void evict(ContentKey key, ContentKeyMap & keys, std::vector<std::shared_ptr<void> > & released) = 0;
+
+		const char * name;
+		size_t bytes; ///< approximate memory used by the cached content
+		unsigned hits; ///< requests served by the cache or a load in flight
+		unsigned misses; ///< requests starting a load
+		unsigned evictions;
+	};
+
+	template <class T>
+	struct Entry
+	{
+		Entry() : size(0), last_use(0) {}
+		std::shared_ptr<T> sptr;
+		size_t size;
+		uint64_t last_use;
 	};
 
 	template <class T>
-	class CacheShared : public Cache, public std::map<std::string, std::shared_ptr<T> >
+	struct Loading
 	{
-		void log(std::ostream & log) const;
+		Loading() : loaded(false) {}
+		std::shared_ptr<T> sptr;
+		bool loaded;
+		JobSystem::JobHandle job; ///< null if the content was cached
+	};
+
+	/// load job parameter copy
+	template <class P>
+	struct Param
+	{
+		Param(const P & param) : value(param) {}
+		const P & get() const { return value; }
+		P value;
+	};
+
+	template <class T>
+	class CacheShared : public Cache, public std::unordered_map<ContentKey, Entry<T>, ContentKey::hash>
+	{
+	public:
+		/// loads in flight
+		std::unordered_map<ContentKey, std::shared_ptr<Loading<T> >, ContentKey::hash> loading;
+
+	private:
+		void log(std::ostream & log, const ContentKeyMap & keys) const;
 		size_t size() const;
-		void sweep();
+		void sweep(ContentKeyMap & keys);
+		void getUnused(std::vector<Unused> & unused);
+		void evict(ContentKey key, ContentKeyMap & keys, std::vector<std::shared_ptr<void> > & released);
 	};
 
 	/// register content factories
@@ -104,7 +219,7 @@ private:
 
 		FactoryCached()
 		{
-			#define INIT(T) m_caches.push_back(&T ## _cache);
+			#define INIT(T) m_caches.push_back(&T ## _cache); T ## _cache.name = #T;
 			INIT(SoundBuffer)
 			INIT(Texture)
 			INIT(Model)
@@ -118,9 +233,34 @@ private:
 	std::vector<std::string> sharedpaths;
 	std::vector<std::string> basepaths;
 
+	/// cached content key strings
+	ContentKeyMap keys;
+
 	/// error log
 	std::ostream & error;
 
+	/// guards caches, keys and error log
+	std::mutex mutex;
+
+	/// cache memory budget in bytes
+	size_t budget;
+
+	/// cache access counter, orders entries by last use
+	uint64_t use_count;
+
+	/// evicted content waiting for release
+	std::vector<std::shared_ptr<void> > evicted;
+
+	/// drop least recently used unreferenced content until the caches
+	/// fit the budget, call with mutex locked
+	void _evict();
+
+	/// cache lookup marking the entry as used, call with mutex locked
+	template <class T>
+	bool _find(
+		std::shared_ptr<T> & sptr,
+		ContentKey key);
+
 	/// content leak logger
 	bool _logleaks();
 
@@ -129,12 +269,6 @@ private:
 		const std::string & path,
 		const std::string & name);
 
-	/// get implementation
-	template <class T>
-	bool _get(
-		std::shared_ptr<T> & sptr,
-		const std::string & name);
-
 	/// load implementation
 	template <class T, class P>
 	bool _load(
@@ -147,6 +281,14 @@ private:
 	/// get default object instance
 	template <class T>
 	bool _getdefault(std::shared_ptr<T> & sptr);
+
+	/// finish content loaded by a job on the calling thread
+	/// on failure sptr is set to the default object
+	template <class T>
+	bool _upload(
+		std::shared_ptr<T> & sptr,
+		const std::string & path,
+		const std::string & name);
 };
 
 template <class T>
@@ -157,8 +299,16 @@ inline bool ContentManager::get(
 {
 	// check for the specialised version
 	// fall back to the generic one
-	return 	_get(sptr, path + name) ||
-			_get(sptr, name);
+	const ContentKey key(path, name);
+	const ContentKey generic_key(std::string(), name);
+	std::lock_guard<std::mutex> lock(mutex);
+	if (_find(sptr, key) || _find(sptr, generic_key))
+	{
+		CacheShared<T> & cache = factory_cached;
+		cache.hits++;
+		return true;
+	}
+	return false;
 }
 
 template <class T>
@@ -177,25 +327,135 @@ inline bool ContentManager::load(
 	const std::string & name,
 	const P & param)
 {
-	// check for the specialised version in basepaths
-	// fall back to the generic one in shared paths
-	return 	_load(sptr, basepaths, path, name, param) ||
+	Request<T> request;
+	bool found = false;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		CacheShared<T> & cache = factory_cached;
+		const ContentKey key(path, name);
+		found = _find(sptr, key);
+		if (found)
+		{
+			cache.hits++;
+		}
+		else
+		{
+			auto l = cache.loading.find(key);
+			if (l != cache.loading.end())
+			{
+				cache.hits++;
+				request.state = l->second;
+			}
+			else
+			{
+				cache.misses++;
+			}
+		}
+	}
+
+	// cached content and shared loads may come from a load job
+	if (found)
+		return _upload(sptr, path, name);
+	if (request.state)
+		return request.get(sptr) && _upload(sptr, path, name);
+
+	// load on the calling thread, content like textures has to be
+	// created on the gl thread
+	return	_load(sptr, basepaths, path, name, param) ||
 			_load(sptr, sharedpaths, "", name, param) ||
 			_getdefault(sptr) ||
 			_logerror(path, name);
 }
 
 template <class T>
-inline bool ContentManager::_get(
-	std::shared_ptr<T> & sptr,
+inline ContentManager::Request<T> ContentManager::loadAsync(
+	const std::string & path,
 	const std::string & name)
 {
-	// retrieve from cache
+	return loadAsync<T>(path, name, typename Factory<T>::empty());
+}
+
+template <class T, class P>
+inline ContentManager::Request<T> ContentManager::loadAsync(
+	const std::string & path,
+	const std::string & name,
+	const P & param)
+{
+	Request<T> request;
+	const ContentKey key(path, name);
+	std::lock_guard<std::mutex> lock(mutex);
+
 	CacheShared<T> & cache = factory_cached;
-	auto i = cache.find(name);
+	std::shared_ptr<T> sptr;
+	if (_find(sptr, key))
+	{
+		cache.hits++;
+		request.state = std::make_shared<Loading<T> >();
+		request.state->sptr = sptr;
+		request.state->loaded = true;
+		return request;
+	}
+
+	auto l = cache.loading.find(key);
+	if (l != cache.loading.end())
+	{
+		cache.hits++;
+		request.state = l->second;
+		return request;
+	}
+	cache.misses++;
+
+	// the job holds no reference to the state, the state owns the job
+	request.state = std::make_shared<Loading<T> >();
+	cache.loading[key] = request.state;
+	Loading<T> * state = request.state.get();
+	Param<P> job_param(param);
+	request.state->job = JobSystem::get().add([this, state, path, name, key, job_param]()
+	{
+		// check for the specialised version in basepaths
+		// fall back to the generic one in shared paths
+		std::shared_ptr<T> sptr;
+		bool loaded =
+			_load(sptr, basepaths, path, name, job_param.get()) ||
+			_load(sptr, sharedpaths, "", name, job_param.get()) ||
+			_getdefault(sptr) ||
+			_logerror(path, name);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		state->sptr = sptr;
+		state->loaded = loaded;
+		CacheShared<T> & cache = factory_cached;
+		cache.loading.erase(key);
+	});
+	return request;
+}
+
+template <class T>
+inline bool ContentManager::Request<T>::ready() const
+{
+	return !state->job || state->job->isDone();
+}
+
+template <class T>
+inline bool ContentManager::Request<T>::get(std::shared_ptr<T> & sptr) const
+{
+	if (state->job)
+		JobSystem::get().wait(state->job);
+	sptr = state->sptr;
+	return state->loaded;
+}
+
+template <class T>
+inline bool ContentManager::_find(
+	std::shared_ptr<T> & sptr,
+	ContentKey key)
+{
+	CacheShared<T> & cache = factory_cached;
+	auto i = cache.find(key);
 	if (i != cache.end())
 	{
-		sptr = i->second;
+		i->second.last_use = ++use_count;
+		sptr = i->second.sptr;
 		return true;
 	}
 	return false;
@@ -210,25 +470,50 @@ inline bool ContentManager::_load(
 	const P & param)
 {
 	// check cache
-	if (_get(sptr, relpath + name))
+	const ContentKey key(relpath, name);
 	{
-		return true;
+		std::lock_guard<std::mutex> lock(mutex);
+		if (_find(sptr, key))
+		{
+			return true;
+		}
 	}
 
 	// load from basepaths
 	Factory<T>& factory = getFactory<T>();
+	std::ostringstream create_error;
+	bool created = false;
 	for (const auto & basepath : basepaths)
 	{
-		if (factory.create(sptr, error, basepath, relpath, name, param))
+		if (factory.create(sptr, create_error, basepath, relpath, name, param))
 		{
-			// cache loaded content
-			CacheShared<T> & cache = factory_cached;
-			cache[relpath + name] = sptr;
-			return true;
+			created = true;
+			break;
 		}
 	}
 
-	return false;
+	const size_t size = created ? factory.getSize(*sptr) : 0;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	error << create_error.str();
+	if (created)
+	{
+		// cache loaded content, keep the object of a concurrent load
+		CacheShared<T> & cache = factory_cached;
+		auto i = cache.insert(std::make_pair(key, Entry<T>()));
+		Entry<T> & entry = i.first->second;
+		if (i.second)
+		{
+			keys.add(relpath, name);
+			entry.sptr = sptr;
+			entry.size = size;
+			cache.bytes += size;
+			_evict();
+		}
+		entry.last_use = ++use_count;
+		sptr = entry.sptr;
+	}
+	return created;
 }
 
 template <class T>
@@ -239,34 +524,98 @@ inline bool ContentManager::_getdefault(std::shared_ptr<T> & sptr)
 }
 
 template <class T>
-inline void ContentManager::CacheShared<T>::log(std::ostream & log) const
+inline void ContentManager::CacheShared<T>::log(std::ostream & log, const ContentKeyMap & keys) const
 {
-	auto it = CacheShared<T>::begin();
-	while (it != CacheShared<T>::end())
+	for (auto it = CacheShared<T>::begin(); it != CacheShared<T>::end(); ++it)
 	{
-		log << it->second.use_count() << " : " << it->first;
+		log << it->second.sptr.use_count() << " : " << keys.getString(it->first) << "\n";
 	}
 }
 
 template <class T>
 inline size_t ContentManager::CacheShared<T>::size() const
 {
-	return std::map<std::string, std::shared_ptr<T> >::size();
+	return std::unordered_map<ContentKey, Entry<T>, ContentKey::hash>::size();
 }
 
 template <class T>
-inline void ContentManager::CacheShared<T>::sweep()
+inline void ContentManager::CacheShared<T>::sweep(ContentKeyMap & keys)
 {
 	auto it = CacheShared<T>::begin();
 	while (it != CacheShared<T>::end())
 	{
-		if (it->second.unique())
+		if (it->second.sptr.unique())
+		{
+			bytes -= it->second.size;
+			keys.erase(it->first);
 			CacheShared<T>::erase(it++);
+		}
 		else
+		{
 			++it;
+		}
 	}
 }
 
+template <class T>
+inline void ContentManager::CacheShared<T>::getUnused(std::vector<Unused> & unused)
+{
+	for (auto it = CacheShared<T>::begin(); it != CacheShared<T>::end(); ++it)
+	{
+		if (it->second.sptr.unique())
+		{
+			Unused u = {it->second.last_use, it->second.size, this, it->first};
+			unused.push_back(u);
+		}
+	}
+}
+
+template <class T>
+inline void ContentManager::CacheShared<T>::evict(ContentKey key, ContentKeyMap & keys, std::vector<std::shared_ptr<void> > & released)
+{
+	auto it = CacheShared<T>::find(key);
+	assert(it != CacheShared<T>::end());
+	keys.erase(key);
+	bytes -= it->second.size;
+	evictions++;
+	released.push_back(it->second.sptr);
+	CacheShared<T>::erase(it);
+}
+
+template <class T>
+inline bool ContentManager::_upload(
+	std::shared_ptr<T> & /*sptr*/,
+	const std::string & /*path*/,
+	const std::string & /*name*/)
+{
+	return true;
+}
+
+/// decoded textures are uploaded, requires the gl context
+template <>
+bool ContentManager::_upload(
+	std::shared_ptr<Texture> & sptr,
+	const std::string & path,
+	const std::string & name);
+
+/// textures loaded by jobs are only decoded, there is no gl context
+template <>
+struct ContentManager::Param<TextureInfo>
+{
+	Param(const TextureInfo & param) : value(param) { value.deferupload = true; }
+	const TextureInfo & get() const { return value; }
+	TextureInfo value;
+};
+
+/// packs are not copyable, the job references them
+template <>
+struct ContentManager::Param<JoePack>
+{
+	Param(const JoePack & param) : value(&param) {}
+	const JoePack & get() const { return *value; }
+	const JoePack * value;
+};
+
 template <class T>
 inline Factory<T> & ContentManager::getFactory()
 {
@@ -94,3 +94,20 @@ const std::shared_ptr<Model> & Factory<Model>::getDefault() const
 {
 	return m_default;
 }
+
+size_t Factory<Model>::getSize(const Model & content) const
+{
+	const VertexArray & va = content.GetVertexArray();
+	const float * floats;
+	const unsigned * faces;
+	const unsigned char * colors;
+	unsigned vertex_floats, normal_floats, texcoord_floats, face_count, color_count;
+	va.GetVertices(floats, vertex_floats);
+	va.GetNormals(floats, normal_floats);
+	va.GetTexCoords(floats, texcoord_floats);
+	va.GetFaces(faces, face_count);
+	va.GetColors(colors, color_count);
+	return sizeof(Model) +
+		(vertex_floats + normal_floats + texcoord_floats) * sizeof(float) +
+		face_count * sizeof(unsigned) + color_count;
+}
@@ -43,6 +43,9 @@ public:
 
 	const std::shared_ptr<Model> & getDefault() const;
 
+	/// approximate memory used by content in bytes
+	size_t getSize(const Model & content) const;
+
 private:
 	std::shared_ptr<Model> m_default;
 };
@@ -64,3 +64,9 @@ const std::shared_ptr<SoundBuffer> & Factory<SoundBuffer>::getDefault() const
 {
 	return m_default;
 }
+
+size_t Factory<SoundBuffer>::getSize(const SoundBuffer & content) const
+{
+	const SoundInfo & info = content.GetInfo();
+	return sizeof(SoundBuffer) + size_t(info.samples) * info.channels * info.bytespersample;
+}
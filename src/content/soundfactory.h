@@ -47,6 +47,9 @@ public:
 
 	const std::shared_ptr<SoundBuffer> & getDefault() const;
 
+	/// approximate memory used by content in bytes
+	size_t getSize(const SoundBuffer & content) const;
+
 private:
 	std::shared_ptr<SoundBuffer> m_default;
 	SoundInfo m_info;
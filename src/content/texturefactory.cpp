@@ -27,16 +27,22 @@ Factory<Texture>::Factory() :
 	m_zero(new Texture()),
 	m_size(TextureInfo::LARGE),
 	m_compress(true),
-	m_srgb(false)
+	m_srgb(false),
+	m_gpu(true)
 {
 	// ctor
 }
 
-void Factory<Texture>::init(int max_size, bool use_srgb, bool compress)
+void Factory<Texture>::init(int max_size, bool use_srgb, bool compress, bool gpu)
 {
 	m_size = max_size;
 	m_srgb = use_srgb;
 	m_compress = compress;
+	m_gpu = gpu;
+
+	// headless, nothing to upload to
+	if (!m_gpu)
+		return;
 
 	// init default texture
 	std::ostringstream error;
@@ -67,6 +73,12 @@ bool Factory<Texture>::create(
 	const std::string & name,
 	const TextureInfo& info)
 {
+	if (!m_gpu)
+	{
+		sptr = m_default;
+		return true;
+	}
+
 	const std::string abspath = basepath + "/" + path + "/" + name;
 	if (info.data || std::ifstream(abspath.c_str()))
 	{
@@ -75,7 +87,10 @@ bool Factory<Texture>::create(
 		info_temp.compress = info.compress && m_compress;	// allow to disable compression
 		info_temp.maxsize = TextureInfo::Size(m_size);
 		std::shared_ptr<Texture> temp(new Texture());
-		if (temp->Load(abspath, info_temp, error))
+		bool loaded = info.deferupload ?
+			temp->Decode(abspath, info_temp, error) :
+			temp->Load(abspath, info_temp, error);
+		if (loaded)
 		{
 			sptr = temp;
 			return true;
@@ -93,3 +108,9 @@ const std::shared_ptr<Texture> & Factory<Texture>::getZero() const
 {
 	return m_zero;
 }
+
+size_t Factory<Texture>::getSize(const Texture & content) const
+{
+	// video memory, assuming 4 bytes per texel and a third more for mip maps
+	return sizeof(Texture) + size_t(content.GetW()) * content.GetH() * 4 * 4 / 3;
+}
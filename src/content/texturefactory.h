@@ -36,7 +36,8 @@ public:
 	/// in general all textures on disk will be in the SRGB colorspace, so if the renderer wants to do
 	/// gamma correct lighting, it will want all textures to be gamma corrected using the SRGB flag
 	/// limit texture size to max size
-	void init(int max_size, bool use_srgb, bool compress);
+	/// without gpu, textures are not uploaded and every request resolves to the default texture
+	void init(int max_size, bool use_srgb, bool compress, bool gpu = true);
 
 	template <class P>
 	bool create(
@@ -53,12 +54,16 @@ public:
 	/// zero texture is black: rgba (0, 0, 0, 0)
 	const std::shared_ptr<Texture> & getZero() const;
 
+	/// approximate memory used by content in bytes
+	size_t getSize(const Texture & content) const;
+
 private:
 	std::shared_ptr<Texture> m_default;
 	std::shared_ptr<Texture> m_zero;
 	int m_size;
 	bool m_compress;
 	bool m_srgb;
+	bool m_gpu;
 };
 
 #endif // _TEXTUREFACTORY_H
@@ -19,13 +19,14 @@
 
 #include "game.h"
 #include "unittest.h"
+#include "microbench.h"
 #include "definitions.h"
 #include "matrix4.h"
 #include "physics/carwheelposition.h"
 #include "physics/tracksurface.h"
-#include "numprocessors.h"
+#include "jobsystem.h"
 #include "performance_testing.h"
-#include "quickprof.h"
+#include "profiler.h"
 #include "utils.h"
 #include "graphics/graphics_gl2.h"
 #include "graphics/graphics_gl3v.h"
@@ -47,6 +48,7 @@
 #include <sstream>
 #include <algorithm>
 #include <cstdio>
+#include <chrono>
 
 #ifdef _WIN32
 	#define OS_NAME "Windows"
@@ -105,6 +107,12 @@ Game::Game(std::ostream & info_out, std::ostream & error_out) :
 	multithreaded(false),
 	profilingmode(false),
 	benchmode(false),
+	headless(false),
+	physics_lod(true),
+	headless_ticks(0),
+	headless_time(0),
+	stress_cars(0),
+	stress_ticks(1000),
 	dumpfps(false),
 	pause(true),
 	controlgrab_id(0),
@@ -149,6 +157,8 @@ void Game::Start(std::list <std::string> & args)
 		return;
 	}
 
+	InitThreading();
+
 	info_output << "Starting VDrift: " << VERSION << ", Revision: " << REVISION << ", O/S: " << OS_NAME << std::endl;
 
 	if (!InitCoreSubsystems())
@@ -202,21 +212,24 @@ void Game::Start(std::list <std::string> & args)
 		PopulateTrackList(trackupdater.GetValueList());
 	}
 
-	// If sound initialization fails, that's okay, it'll disable itself...
-	InitSound();
-
-	// Load font data.
-	if (!LoadFonts())
+	if (!headless)
 	{
-		error_output << "Error loading fonts" << std::endl;
-		return;
-	}
+		// If sound initialization fails, that's okay, it'll disable itself...
+		InitSound();
 
-	// Load GUI.
-	if (!InitGUI())
-	{
-		error_output << "Error initializing graphical user interface" << std::endl;
-		return;
+		// Load font data.
+		if (!LoadFonts())
+		{
+			error_output << "Error loading fonts" << std::endl;
+			return;
+		}
+
+		// Load GUI.
+		if (!InitGUI())
+		{
+			error_output << "Error initializing graphical user interface" << std::endl;
+			return;
+		}
 	}
 
 	// Load particle system.
@@ -225,10 +238,29 @@ void Game::Start(std::list <std::string> & args)
 	tire_smoke.SetParameters(settings.GetParticles(), 0.4,0.9, 1,4, 0.3,0.6, 0.02,0.06, smokedir);
 
 	// Initialize force feedback.
-	forcefeedback.reset(new ForceFeedback(settings.GetFFDevice(), error_output, info_output));
+	if (!headless)
+		forcefeedback.reset(new ForceFeedback(settings.GetFFDevice(), error_output, info_output));
 	ff_update_time = 0;
 
-	if (benchmode)
+	if (stress_cars > 0)
+	{
+		assert(!car_info.empty());
+		car_info.resize(1);
+		car_info[0].driver = Ai::default_type;
+		for (unsigned i = 1; i < stress_cars; ++i)
+		{
+			car_info.push_back(car_info.back());
+			float hue = car_info.back().hsv[0] + 0.07f;
+			car_info.back().hsv[0] = (hue > 1) ? hue - 1 : hue;
+		}
+
+		if (!NewGame(false, true, 0))
+		{
+			error_output << "Error loading stress benchmark" << std::endl;
+			return;
+		}
+	}
+	else if (benchmode || headless)
 	{
 		assert(!car_info.empty());
 		car_info[player_car_id].driver = Ai::default_type;
@@ -246,7 +278,12 @@ void Game::Start(std::list <std::string> & args)
 
 	DoneStartingUp();
 
-	Run();
+	if (stress_cars > 0)
+		RunStress();
+	else if (headless)
+		RunHeadless();
+	else
+		Run();
 
 	End();
 }
@@ -262,18 +299,62 @@ void Game::End()
 		info_output << "Min / Max frame-rate: " << fps_min << " / " << fps_max << " frames per second" << std::endl;
 	}
 
+	if (stress_cars > 0)
+	{
+		ReportStress();
+	}
+	else if (headless)
+	{
+		PerformanceTesting::ReportSimulationPerformance(frame, timestep, headless_time, info_output);
+		info_output << "Average tick time per subsystem:\n" << PROFILER.getAvgSummary(Profiler::MICROSECONDS) << std::endl;
+	}
+
 	if (profilingmode)
-		info_output << "Profiling summary:\n" << PROFILER.getSummary(quickprof::PERCENT) << std::endl;
+	{
+		info_output << "Profiling summary:\n" << PROFILER.getSummary(Profiler::PERCENT) << std::endl;
+		content.logStats(info_output);
+	}
+
+	if (!trace_output.empty())
+	{
+		std::ofstream trace(trace_output.c_str());
+		if (trace)
+		{
+			PROFILER.writeChromeTrace(trace);
+			info_output << "Profiler trace written to " << trace_output << std::endl;
+		}
+		else
+		{
+			error_output << "Unable to write profiler trace to " << trace_output << std::endl;
+		}
+	}
 
 	info_output << "Shutting down..." << std::endl;
 
 	LeaveGame();
 
+	JobSystem::get().deinit();
+
 	// Save settings first incase later deinits cause crashes.
 	settings.Save(pathmanager.GetSettingsFile(), error_output);
 
-	graphics->Deinit();
-	delete graphics;
+	if (graphics)
+	{
+		graphics->Deinit();
+		delete graphics;
+	}
+}
+
+/* Size the job system shared by all parallel work... */
+void Game::InitThreading()
+{
+	Profiler::setThreadName("main");
+
+	unsigned int threads = 1;
+	if (multithreaded)
+		threads = JobSystem::getProcessorCount();
+	if (threads != JobSystem::get().getThreadCount())
+		JobSystem::get().init(threads);
 }
 
 /* Initialize the most important, basic subsystems... */
@@ -305,6 +386,19 @@ bool Game::InitCoreSubsystems()
 	}
 	BeginStartingUp();
 
+	if (headless)
+	{
+		// No window, renderer or event system, only content for the simulation.
+		content.getFactory<Texture>().init(texture_size, false, false, false);
+		content.getFactory<PTree>().init(read_ini, write_ini, content);
+		content.setBudget(size_t(settings.GetContentCacheSize()) << 20);
+		content.addPath(pathmanager.GetWriteableDataPath());
+		content.addPath(pathmanager.GetDataPath());
+		content.addSharedPath(pathmanager.GetCarPartsPath());
+		content.addSharedPath(pathmanager.GetTrackPartsPath());
+		return true;
+	}
+
 	// choose renderer
 	std::string renderer = settings.GetRenderer();
 	if (!renderconfigfile.empty())
@@ -395,6 +489,7 @@ bool Game::InitCoreSubsystems()
 	// Init content factories
 	content.getFactory<Texture>().init(texture_size, using_gl3, settings.GetTextureCompress());
 	content.getFactory<PTree>().init(read_ini, write_ini, content);
+	content.setBudget(size_t(settings.GetContentCacheSize()) << 20);
 
 	// Init content paths
 	// Always add writeable data paths first so they are checked first
@@ -539,6 +634,13 @@ bool Game::ParseArguments(std::list <std::string> & args)
 	}
 	arghelp["-test"] = "Run unit tests.";
 
+	if (argmap.find("-microbench") != argmap.end())
+	{
+		MICROBENCH_RUN(info_output, argmap["-microbench"]);
+		continue_game = false;
+	}
+	arghelp["-microbench [NAME]"] = "Run microbenchmarks, optionally only those whose name starts with NAME.";
+
 	if (!argmap["-cartest"].empty())
 	{
 		pathmanager.Init(info_output, error_output);
@@ -563,7 +665,32 @@ bool Game::ParseArguments(std::list <std::string> & args)
 	}
 	arghelp["-profile NAME"] = "Store settings, controls, and records under a separate profile.";
 
-	if (argmap.find("-profiling") != argmap.end() || argmap.find("-benchmark") != argmap.end())
+	if (argmap.find("-headless") != argmap.end())
+	{
+		info_output << "Entering headless mode." << std::endl;
+		headless = true;
+		headless_ticks = cast<unsigned int>(argmap["-headless"]);
+		sound.Disable();
+	}
+	arghelp["-headless [TICKS]"] = "Simulate an AI race without window, graphics and sound as fast as possible, for TICKS ticks or until the race is over.";
+
+	if (!argmap["-stress"].empty())
+	{
+		stress_cars = std::max(cast<unsigned int>(argmap["-stress"]), 1u);
+		info_output << "Entering stress benchmark mode with " << stress_cars << " cars." << std::endl;
+		if (!argmap["-stressticks"].empty())
+			stress_ticks = cast<unsigned int>(argmap["-stressticks"]);
+		stress_output = argmap["-stressout"];
+	}
+	arghelp["-stress N"] = "Run N AI cars for a fixed number of ticks and report the time per tick of each subsystem.";
+	arghelp["-stressticks TICKS"] = "Number of ticks to run in stress mode, 1000 by default.";
+	arghelp["-stressout FILE"] = "Write the stress results to FILE, CSV rows appended if FILE ends in .csv, JSON otherwise.";
+
+	trace_output = argmap["-trace"];
+	arghelp["-trace FILE"] = "Record a profiler trace and write it to FILE in Chrome trace event format (chrome://tracing) at exit.";
+
+	if (argmap.find("-profiling") != argmap.end() || argmap.find("-benchmark") != argmap.end() ||
+		headless || stress_cars || !trace_output.empty())
 	{
 		PROFILER.init(20);
 		profilingmode = true;
@@ -597,8 +724,7 @@ bool Game::ParseArguments(std::list <std::string> & args)
 	}
 	arghelp["-resolution WxH"] = "Use the specified display resolution.";
 
-	#ifndef _WIN32
-	int processors = NUMPROCESSORS::GetNumProcessors();
+	int processors = JobSystem::getProcessorCount();
 	if (argmap.find("-multithreaded") != argmap.end())
 	{
 		multithreaded = true;
@@ -619,12 +745,29 @@ bool Game::ParseArguments(std::list <std::string> & args)
 			info_output << "Multi-processor system detected.  Run with -multithreaded argument to enable multithreading (EXPERIMENTAL)." << std::endl;
 	}
 	arghelp["-multithreaded"] = "Use multithreading where possible.";
-	#endif
 
 	if (argmap.find("-nosound") != argmap.end())
 		sound.Disable();
 	arghelp["-nosound"] = "Disable all sound.";
 
+	if (!argmap["-broadphase"].empty())
+	{
+		DynamicsWorld::BroadphaseType type;
+		if (DynamicsWorld::getBroadphaseType(argmap["-broadphase"], type))
+			dynamics.setBroadphaseType(type);
+		else
+			error_output << "Unknown broadphase " << argmap["-broadphase"] << ", expected dbvt or axissweep." << std::endl;
+	}
+	arghelp["-broadphase NAME"] = "Collision broadphase, dbvt (default) or axissweep with bounds fitted to the track. Compare them with -stress.";
+
+	if (!argmap["-airadius"].empty())
+		ai.SetCarGridRadius(std::max(cast<float>(argmap["-airadius"]), 1.0f));
+	arghelp["-airadius METERS"] = "Distance within which ai cars notice other cars, 100 by default. A radius larger than the track makes every ai car analyze every other car, compare with -stress.";
+
+	if (argmap.find("-nophysicslod") != argmap.end())
+		physics_lod = false;
+	arghelp["-nophysicslod"] = "Simulate all cars at full detail, also when they are far from the camera.";
+
 	if (argmap.find("-benchmark") != argmap.end())
 	{
 		info_output << "Entering benchmark mode." << std::endl;
@@ -690,81 +833,84 @@ void Game::Test()
 
 void Game::Draw(float dt)
 {
-	PROFILER.beginBlock("scenegraph");
+	{
+		PROFILER_SCOPE("scenegraph");
 
-	std::vector<SceneNode*> nodes;
-	nodes.reserve(5);
+		std::vector<SceneNode*> nodes;
+		nodes.reserve(5);
 
-	nodes.push_back(&dynamicsdraw.getNode());
-	nodes.push_back(&trackmap.GetNode());
-	nodes.push_back(&tire_smoke.GetNode());
+		nodes.push_back(&dynamicsdraw.getNode());
+		nodes.push_back(&trackmap.GetNode());
+		nodes.push_back(&tire_smoke.GetNode());
 
-	if (gui.GetNodes().first)
-		nodes.push_back(gui.GetNodes().first);
+		if (gui.GetNodes().first)
+			nodes.push_back(gui.GetNodes().first);
 
-	if (gui.GetNodes().second)
-		nodes.push_back(gui.GetNodes().second);
+		if (gui.GetNodes().second)
+			nodes.push_back(gui.GetNodes().second);
 
-	graphics->BindDynamicVertexData(nodes);
+		graphics->BindDynamicVertexData(nodes);
 
-	graphics->ClearDynamicDrawables();
-	graphics->AddDynamicNode(dynamicsdraw.getNode());
-	graphics->AddDynamicNode(track.GetBodyNode());
-	graphics->AddDynamicNode(track.GetRacinglineNode());
-	graphics->AddDynamicNode(trackmap.GetNode());
-	graphics->AddDynamicNode(tire_smoke.GetNode());
+		graphics->ClearDynamicDrawables();
+		graphics->AddDynamicNode(dynamicsdraw.getNode());
+		graphics->AddDynamicNode(track.GetBodyNode());
+		graphics->AddDynamicNode(track.GetRacinglineNode());
+		graphics->AddDynamicNode(trackmap.GetNode());
+		graphics->AddDynamicNode(tire_smoke.GetNode());
 
-	for (auto & car : car_graphics)
-		graphics->AddDynamicNode(car.GetNode());
+		for (auto & car : car_graphics)
+			graphics->AddDynamicNode(car.GetNode());
 
-	if (gui.GetNodes().first)
-		graphics->AddDynamicNode(*gui.GetNodes().first);
+		if (gui.GetNodes().first)
+			graphics->AddDynamicNode(*gui.GetNodes().first);
 
-	if (gui.GetNodes().second)
-		graphics->AddDynamicNode(*gui.GetNodes().second);
-
-	PROFILER.endBlock("scenegraph");
+		if (gui.GetNodes().second)
+			graphics->AddDynamicNode(*gui.GetNodes().second);
+	}
 
 	// Send scene information to the graphics subsystem.
-	PROFILER.beginBlock("render setup");
-	graphics->SetContrast(settings.GetContrast());
-	if (active_camera)
 	{
-		float fov = active_camera->GetFOV() > 0 ? active_camera->GetFOV() : settings.GetFOV();
-
-		Vec3 reflection_location = active_camera->GetPosition();
-		if (camera_car_id < unsigned(car_dynamics.size()))
-			reflection_location = ToMathVector<float>(car_dynamics[camera_car_id].GetCenterOfMass());
-
-		Quat camlook;
-		camlook.Rotate(M_PI_2, 1, 0, 0);
-		Quat cam_orientation = -(active_camera->GetOrientation() * camlook);
-
-		graphics->SetupScene(
-			fov, settings.GetViewDistance(),
-			active_camera->GetPosition(),
-			cam_orientation,
-			reflection_location,
-			error_output);
-	}
-	else
-	{
-		graphics->SetupScene(
-			settings.GetFOV(), settings.GetViewDistance(),
-			Vec3(), Quat(), Vec3(),
-			error_output);
+		PROFILER_SCOPE("render setup");
+		graphics->SetContrast(settings.GetContrast());
+		if (active_camera)
+		{
+			float fov = active_camera->GetFOV() > 0 ? active_camera->GetFOV() : settings.GetFOV();
+
+			Vec3 reflection_location = active_camera->GetPosition();
+			if (camera_car_id < unsigned(car_dynamics.size()))
+				reflection_location = ToMathVector<float>(car_dynamics[camera_car_id].GetCenterOfMass());
+
+			Quat camlook;
+			camlook.Rotate(M_PI_2, 1, 0, 0);
+			Quat cam_orientation = -(active_camera->GetOrientation() * camlook);
+
+			graphics->SetupScene(
+				fov, settings.GetViewDistance(),
+				active_camera->GetPosition(),
+				cam_orientation,
+				reflection_location,
+				error_output);
+		}
+		else
+		{
+			graphics->SetupScene(
+				settings.GetFOV(), settings.GetViewDistance(),
+				Vec3(), Quat(), Vec3(),
+				error_output);
+		}
+		graphics->UpdateScene(dt);
 	}
-	graphics->UpdateScene(dt);
-	PROFILER.endBlock("render setup");
 
 	// Sync CPU and GPU (flip the page).
-	PROFILER.beginBlock("render sync");
-	window.SwapBuffers();
-	PROFILER.endBlock("render sync");
+	{
+		PROFILER_SCOPE("render sync");
+		window.SwapBuffers();
+	}
 
-	PROFILER.beginBlock("render draw");
-	graphics->DrawScene(error_output);
-	PROFILER.endBlock("render draw");
+	{
+		PROFILER_SCOPE("render draw");
+		graphics->DrawScene(error_output);
+	}
 }
 
 void Game::Run()
@@ -775,24 +921,113 @@ void Game::Run()
 
 void Game::Advance()
 {
-	CalculateFPS();
+	{
+		PROFILER_SCOPE("frame");
 
-	clocktime += eventsystem.Get_dt();
+		CalculateFPS();
 
-	eventsystem.BeginFrame();
+		clocktime += eventsystem.Get_dt();
 
-	// Do CPU intensive stuff in parallel with the GPU...
-	Tick(eventsystem.Get_dt());
+		eventsystem.BeginFrame();
 
-	Draw(eventsystem.Get_dt());
+		// Do CPU intensive stuff in parallel with the GPU...
+		Tick(eventsystem.Get_dt());
 
-	eventsystem.EndFrame();
+		Draw(eventsystem.Get_dt());
+
+		// content evicted by loads is destroyed on the gl thread
+		content.release();
+
+		eventsystem.EndFrame();
+	}
 
 	PROFILER.endCycle();
 
 	displayframe++;
 }
 
+void Game::RunHeadless()
+{
+	auto start = std::chrono::steady_clock::now();
+
+	while (!eventsystem.GetQuit() && (headless_ticks == 0 || frame < headless_ticks))
+	{
+		frame++;
+
+		AdvanceGameLogic();
+
+		PROFILER.endCycle();
+	}
+
+	auto stop = std::chrono::steady_clock::now();
+	headless_time = std::chrono::duration<double>(stop - start).count();
+	clocktime = frame * timestep;
+}
+
+void Game::RunStress()
+{
+	// Only measure the stress ticks.
+	PROFILER.init(20);
+
+	auto start = std::chrono::steady_clock::now();
+
+	unsigned int ticks = 0;
+	while (!eventsystem.GetQuit() && ticks < stress_ticks)
+	{
+		frame++;
+		ticks++;
+
+		if (!headless)
+			eventsystem.BeginFrame();
+
+		AdvanceGameLogic();
+
+		if (!headless)
+		{
+			Draw(timestep);
+			eventsystem.EndFrame();
+		}
+
+		PROFILER.endCycle();
+	}
+
+	auto stop = std::chrono::steady_clock::now();
+	headless_time = std::chrono::duration<double>(stop - start).count();
+	stress_ticks = ticks;
+	clocktime = frame * timestep;
+}
+
+void Game::ReportStress()
+{
+	const unsigned int ticks = std::max(stress_ticks, 1u);
+
+	PerformanceTesting::StressResult result;
+	result.revision = REVISION;
+	result.track = settings.GetTrack();
+	result.broadphase = DynamicsWorld::getBroadphaseName(dynamics.getBroadphaseType());
+	result.cars = car_dynamics.size();
+	result.ticks = stress_ticks;
+	result.threads = JobSystem::get().getThreadCount();
+	result.tick_ms = headless_time * 1000 / ticks;
+
+	const char * blocks[] = {"ai", "physics", "broadphase", "narrowphase", "car", "sound", "scenegraph", "render setup"};
+	for (const char * block : blocks)
+	{
+		double ms = PROFILER.getTotalDuration(block, Profiler::MILLISECONDS) / ticks;
+		result.block_ms.push_back(std::make_pair(std::string(block), ms));
+	}
+
+	PerformanceTesting::ReportSimulationPerformance(stress_ticks, timestep, headless_time, info_output);
+	info_output << "Stress benchmark results:\n";
+	PerformanceTesting::WriteStressJson(result, info_output);
+
+	if (!stress_output.empty() &&
+		PerformanceTesting::WriteStressResult(result, stress_output, error_output))
+	{
+		info_output << "Stress results written to " << stress_output << std::endl;
+	}
+}
+
 /* Deltat is in seconds... */
 void Game::Tick(float deltat)
 {
@@ -840,68 +1075,86 @@ void Game::Tick(float deltat)
 /* Increment game logic by one frame... */
 void Game::AdvanceGameLogic()
 {
-	//PROFILER.beginBlock("input-processing");
+	PROFILER_SCOPE("tick");
 
-	eventsystem.ProcessEvents();
+	if (!headless)
+	{
+		PROFILER_SCOPE("input-processing");
 
-	float car_speed = !pause ? car_dynamics[player_car_id].GetSpeed() : 0;
-	car_controls_local.ProcessInput(
-			settings.GetJoyType(),
-			eventsystem,
-			timestep,
-			settings.GetJoy200(),
-			car_speed,
-			settings.GetSpeedSensitivity(),
-			window.GetW(),
-			window.GetH(),
-			settings.GetButtonRamp(),
-			settings.GetHGateShifter());
+		eventsystem.ProcessEvents();
 
-	ProcessGUIInputs();
+		float car_speed = !pause ? car_dynamics[player_car_id].GetSpeed() : 0;
+		car_controls_local.ProcessInput(
+				settings.GetJoyType(),
+				eventsystem,
+				timestep,
+				settings.GetJoy200(),
+				car_speed,
+				settings.GetSpeedSensitivity(),
+				window.GetW(),
+				window.GetH(),
+				settings.GetButtonRamp(),
+				settings.GetHGateShifter());
 
-	ProcessGameInputs();
+		ProcessGUIInputs();
 
-	//PROFILER.endBlock("input-processing");
+		ProcessGameInputs();
+	}
 
 	if (!pause)
 	{
-		PROFILER.beginBlock("ai");
-		ai.Visualize();
-		ai.Update(timestep, &car_dynamics[0], car_dynamics.size());
-		PROFILER.endBlock("ai");
+		{
+			PROFILER_SCOPE("ai");
+			ai.Visualize();
+			ai.Update(timestep, &car_dynamics[0], car_dynamics.size());
+		}
 
-		//PROFILER.beginBlock("input");
-		ProcessCarInputs();
-		//PROFILER.endBlock("input");
+		{
+			PROFILER_SCOPE("input");
+			ProcessCarInputs();
+		}
 
-		PROFILER.beginBlock("physics");
-		dynamics.update(timestep);
-		PROFILER.endBlock("physics");
+		{
+			PROFILER_SCOPE("physics");
+			UpdateCarDetail();
+			dynamics.update(timestep);
+		}
+
+		{
+			PROFILER_SCOPE("car");
+			ProcessCameraInputs();
+			UpdateCars(timestep);
+		}
 
-		PROFILER.beginBlock("car");
-		ProcessCameraInputs();
-		UpdateCars(timestep);
-		PROFILER.endBlock("car");
+		{
+			PROFILER_SCOPE("track");
+			// Update dynamic track objects.
+			track.Update();
+		}
 
-		// Update dynamic track objects.
-		track.Update();
+		{
+			PROFILER_SCOPE("timer");
+			UpdateTimer();
+		}
 
-		//PROFILER.beginBlock("timer");
-		UpdateTimer();
-		//PROFILER.endBlock("timer");
+		if (replay.GetPlaying())
+			signal_replay_time(GetTimeString(replay.GetFrame() * replay.GetFrameTime()));
 
-		//PROFILER.beginBlock("particles");
-		UpdateParticles(timestep);
-		//PROFILER.endBlock("particles");
+		{
+			PROFILER_SCOPE("particles");
+			UpdateParticles(timestep);
+		}
 
-		//PROFILER.beginBlock("trackmap-update");
-		UpdateTrackMap();
-		//PROFILER.endBlock("trackmap-update");
+		if (!headless)
+		{
+			PROFILER_SCOPE("trackmap-update");
+			UpdateTrackMap();
+		}
 	}
 
 	if (sound.Enabled())
 	{
-		PROFILER.beginBlock("sound");
+		PROFILER_SCOPE("sound");
 		Vec3 pos;
 		Quat rot;
 		if (active_camera)
@@ -912,12 +1165,36 @@ void Game::AdvanceGameLogic()
 		sound.SetListenerPosition(pos[0], pos[1], pos[2]);
 		sound.SetListenerRotation(rot[0], rot[1], rot[2], rot[3]);
 		sound.Update(pause);
-		PROFILER.endBlock("sound");
 	}
 
-	//PROFILER.beginBlock("force-feedback");
-	UpdateForceFeedback(timestep);
-	//PROFILER.endBlock("force-feedback");
+	if (forcefeedback)
+	{
+		PROFILER_SCOPE("force-feedback");
+		UpdateForceFeedback(timestep);
+	}
+}
+
+/* Jump to a replay frame, simulating from the nearest state frame... */
+void Game::SeekReplay(unsigned target)
+{
+	if (replay.GetRecording() || replay.GetFrameCount() == 0)
+		return;
+
+	// cars are set to the nearest state frame, play the remaining frames
+	unsigned frames = replay.Seek(target, &car_dynamics[0], car_dynamics.size());
+	for (unsigned i = 0; i < frames && replay.GetPlaying(); ++i)
+	{
+		ProcessCarInputs();
+		dynamics.update(timestep);
+	}
+
+	for (int i = 0; i < car_dynamics.size(); ++i)
+	{
+		car_graphics[i].Update(car_dynamics[i]);
+	}
+	track.Update();
+
+	signal_replay_time(GetTimeString(replay.GetFrame() * replay.GetFrameTime()));
 }
 
 /* Process inputs used only for higher level game functions... */
@@ -1289,6 +1566,52 @@ void Game::UpdateCars(float dt)
 	}
 }
 
+void Game::UpdateCarDetail()
+{
+	// Cars switch to full detail well before they get close enough for the
+	// difference to show, the gap to the reduced distances avoids switching
+	// back and forth.
+	const float full_distance = 60;
+	const float full_distance_ahead = 150;
+	const float reduced_distance = 70;
+	const float reduced_distance_ahead = 170;
+
+	Vec3 view_position, view_direction = Direction::Forward;
+	if (active_camera)
+	{
+		view_position = active_camera->GetPosition();
+		active_camera->GetOrientation().RotateVector(view_direction);
+	}
+	else if (camera_car_id < car_dynamics.size())
+	{
+		const CarDynamics & car = car_dynamics[camera_car_id];
+		view_position = ToMathVector<float>(car.GetPosition());
+		view_direction = ToMathVector<float>(quatRotate(car.GetOrientation(), Direction::forward));
+	}
+
+	// the detail level depends on the camera and is not recorded,
+	// replays are simulated at full detail to play back as recorded
+	const bool lod = physics_lod && !replay.GetRecording() && !replay.GetPlaying();
+
+	for (size_t i = 0; i < car_dynamics.size(); ++i)
+	{
+		CarDynamics & car = car_dynamics[i];
+		if (!lod || i == player_car_id || i == camera_car_id)
+		{
+			car.SetReducedDetail(false);
+			continue;
+		}
+
+		const Vec3 offset = ToMathVector<float>(car.GetPosition()) - view_position;
+		const float distance = offset.Magnitude();
+		const bool ahead = offset.dot(view_direction) > 0;
+		if (car.GetReducedDetail())
+			car.SetReducedDetail(distance > (ahead ? full_distance_ahead : full_distance));
+		else
+			car.SetReducedDetail(distance > (ahead ? reduced_distance_ahead : reduced_distance));
+	}
+}
+
 void Game::ProcessCarInputs()
 {
 	bool player_control = car_info[player_car_id].driver.empty();
@@ -1343,7 +1666,7 @@ void Game::ProcessCarInputs()
 			carinputs[CarInput::CLUTCH] = 1.0;
 			carinputs[CarInput::THROTTLE] = 0.0;
 
-			if (benchmode)
+			if (benchmode || headless)
 				eventsystem.Quit();
 		}
 
@@ -1354,7 +1677,7 @@ void Game::ProcessCarInputs()
 		if (replay.GetRecording())
 			replay.RecordFrame(carid, carinputs, car);
 
-		if (carid == camera_car_id && settings.GetHUD() != "NoHud")
+		if (carid == camera_car_id && settings.GetHUD() != "NoHud" && !headless)
 			UpdateHUD(carid, carinputs);
 	}
 }
@@ -1431,7 +1754,8 @@ void Game::ProcessCameraInputs()
 	car_snd.EnableInteriorSound(incar);
 
 	// Move up the close shadow distance if we're in the cockpit.
-	graphics->SetCloseShadow(incar ? 1.0 : 5.0);
+	if (graphics)
+		graphics->SetCloseShadow(incar ? 1.0 : 5.0);
 }
 
 void Game::UpdateHUD(const size_t carid, const std::vector<float> & carinputs)
@@ -1464,7 +1788,7 @@ void Game::UpdateHUD(const size_t carid, const std::vector<float> & carinputs)
 			std::ostringstream gpu_profile;
 			graphics->printProfilingInfo(gpu_profile);
 
-			signal_debug_info[0](PROFILER.getAvgSummary(quickprof::MICROSECONDS));
+			signal_debug_info[0](PROFILER.getAvgSummary(Profiler::MICROSECONDS));
 			signal_debug_info[1](gpu_profile.str());
 		}
 	}
@@ -1649,7 +1973,8 @@ bool Game::NewGame(bool playreplay, bool addopponents, int num_laps)
 	{
 		nodes.push_back(&car.GetNode());
 	}
-	graphics->BindStaticVertexData(nodes);
+	if (graphics)
+		graphics->BindStaticVertexData(nodes);
 
 	// Record a replay.
 	if (settings.GetRecordReplay() && !playreplay)
@@ -1680,7 +2005,8 @@ bool Game::NewGame(bool playreplay, bool addopponents, int num_laps)
 			}
 		}
 
-		replay.StartRecording(car_info, settings.GetTrack(), error_output);
+		std::string streamname = pathmanager.GetReplayPath() + "/recording.tmp";
+		replay.StartRecording(car_info, settings.GetTrack(), streamname, error_output);
 	}
 
 	// Clean up asset cache.
@@ -1688,7 +2014,8 @@ bool Game::NewGame(bool playreplay, bool addopponents, int num_laps)
 
 	// Set up GUI.
 	gui.SetInGame(true);
-	gui.ActivatePage("Hud", 0.25, error_output);
+	if (!headless)
+		gui.ActivatePage("Hud", 0.25, error_output);
 
 	// not strictly needed, is expected to be called by Hud page onfocus event
 	ContinueGame();
@@ -1774,6 +2101,7 @@ bool Game::LoadCar(
 		ToBulletVector(position),
 		ToBulletQuaternion(orientation),
 		settings.GetVehicleDamage(),
+		settings.GetTireTables(),
 		dynamics, content, error_output))
 	{
 		error_output << "Failed to load physics for car: " << info.name << std::endl;
@@ -1810,7 +2138,8 @@ bool Game::LoadCar(
 
 bool Game::LoadTrack(const std::string & trackname)
 {
-	gui.ActivatePage("Loading", 0.5, error_output);
+	if (!headless)
+		gui.ActivatePage("Loading", 0.5, error_output);
 
 	if (!track.DeferredLoad(
 		content, dynamics,
@@ -1819,26 +2148,32 @@ bool Game::LoadTrack(const std::string & trackname)
 		pathmanager.GetTracksDir()+"/"+trackname,
 		pathmanager.GetEffectsTextureDir(),
 		pathmanager.GetTrackPartsPath(),
+		pathmanager.GetCachePath(),
 		settings.GetAnisotropy(),
 		settings.GetTrackReverse(),
 		settings.GetTrackDynamic(),
-		graphics->GetShadows()))
+		graphics && graphics->GetShadows()))
 	{
 		error_output << "Error loading track: " << trackname << std::endl;
 		return false;
 	}
 
+	// objects are loaded in parallel, show progress of the added objects
 	bool success = true;
-	int count = 0;
+	int count_shown = -1;
 	int count_max = track.ObjectsNum();
-	int displayevery = count_max / 50;
+	int displayevery = std::max(count_max / 50, 1);
 	while (!track.Loaded() && success)
 	{
-		if (displayevery == 0 || count % displayevery == 0)
+		int count = track.ObjectsNumLoaded();
+		if (!headless && (count_shown < 0 || count - count_shown >= displayevery))
+		{
 			ShowLoadingScreen(count, count_max, "");
+			count_shown = count;
+		}
 
 		success = track.ContinueDeferredLoad();
-		count++;
+		content.release();
 	}
 
 	if (!success)
@@ -1850,6 +2185,10 @@ bool Game::LoadTrack(const std::string & trackname)
 	// Set racing line visibility.
 	track.SetRacingLineVisibility(settings.GetRacingline());
 
+	// Nothing to draw in headless mode.
+	if (headless)
+		return true;
+
 	// Generate the track map.
 	if (!trackmap.BuildMap(
 			window.GetW(),
@@ -1901,6 +2240,7 @@ void Game::LoadGarage()
 		pathmanager.GetSkinsDir() + "/" + settings.GetSkin(),
 		pathmanager.GetEffectsTextureDir(),
 		pathmanager.GetTrackPartsPath(),
+		pathmanager.GetCachePath(),
 		settings.GetAnisotropy(),
 		track_reverse, track_dynamic,
 		graphics->GetShadows()))
@@ -1910,16 +2250,20 @@ void Game::LoadGarage()
 	}
 
 	bool success = true;
-	int count = 0;
+	int count_shown = -1;
 	int count_max = track.ObjectsNum();
-	int displayevery = count_max / 50;
+	int displayevery = std::max(count_max / 50, 1);
 	while (!track.Loaded() && success)
 	{
-		if (displayevery == 0 || count % displayevery == 0)
+		int count = track.ObjectsNumLoaded();
+		if (count_shown < 0 || count - count_shown >= displayevery)
+		{
 			ShowLoadingScreen(count, count_max, "");
+			count_shown = count;
+		}
 
 		success = track.ContinueDeferredLoad();
-		count++;
+		content.release();
 	}
 
 	if (!success)
@@ -2628,17 +2972,22 @@ void Game::LeaveGame()
 	{
 		std::string replayname = GetReplayRecordingFilename();
 		info_output << "Saving replay to " << replayname << std::endl;
-		replay.StopRecording(replayname);
+		if (!replay.StopRecording(replayname))
+			error_output << "Error saving replay to " << replayname << std::endl;
 
-		GuiOption::List replaylist;
-		PopulateReplayList(replaylist);
-		gui.SetOptionValues("game.selected_replay", "", replaylist, error_output);
+		if (!headless)
+		{
+			GuiOption::List replaylist;
+			PopulateReplayList(replaylist);
+			gui.SetOptionValues("game.selected_replay", "", replaylist, error_output);
+		}
 	}
 
 	if (replay.GetPlaying())
 		replay.Reset();
 
-	graphics->ClearStaticDrawables();
+	if (graphics)
+		graphics->ClearStaticDrawables();
 
 	tire_smoke.Clear();
 	track.Clear();
@@ -2666,20 +3015,26 @@ void Game::StartRace()
 
 void Game::PauseGame()
 {
-	if (settings.GetMouseGrab())
-		window.ShowMouseCursor(true);
+	if (!headless)
+	{
+		if (settings.GetMouseGrab())
+			window.ShowMouseCursor(true);
 
-	gui.ActivatePage("Main", 0.25, error_output);
+		gui.ActivatePage("Main", 0.25, error_output);
+	}
 
 	pause = true;
 }
 
 void Game::ContinueGame()
 {
-	if (settings.GetMouseGrab())
-		window.ShowMouseCursor(false);
+	if (!headless)
+	{
+		if (settings.GetMouseGrab())
+			window.ShowMouseCursor(false);
 
-	gui.ActivatePage(settings.GetHUD(), 0.25, error_output);
+		gui.ActivatePage(settings.GetHUD(), 0.25, error_output);
+	}
 
 	pause = false;
 }
@@ -2702,6 +3057,19 @@ void Game::StartReplay()
 	}
 }
 
+void Game::ReplaySeekBack()
+{
+	const unsigned step = 10 / timestep;
+	const unsigned frame = replay.GetFrame();
+	SeekReplay(frame > step ? frame - step : 0);
+}
+
+void Game::ReplaySeekForward()
+{
+	const unsigned step = 10 / timestep;
+	SeekReplay(replay.GetFrame() + step);
+}
+
 void Game::StartCheckForUpdates()
 {
 	carupdater.StartCheckForUpdates(GameDownloader(*this, http), gui);
@@ -3148,7 +3516,7 @@ void Game::RegisterActions()
 	set_cars_num.call.bind<Game, &Game::SetCarsNum>(this);
 	set_control.call.bind<Game, &Game::SetControl>(this);
 
-	actions.resize(26);
+	actions.resize(28);
 	actions[0].call.bind<Game, &Game::QuitGame>(this);
 	actions[1].call.bind<Game, &Game::LoadGarage>(this);
 	actions[2].call.bind<Game, &Game::StartRace>(this);
@@ -3175,6 +3543,8 @@ void Game::RegisterActions()
 	actions[23].call.bind<Game, &Game::SyncOptions>(this);
 	actions[24].call.bind<Game, &Game::SyncSettings>(this);
 	actions[25].call.bind<Game, &Game::SelectPlayerCar>(this);
+	actions[26].call.bind<Game, &Game::ReplaySeekBack>(this);
+	actions[27].call.bind<Game, &Game::ReplaySeekForward>(this);
 }
 
 void Game::InitActionMap(std::map<std::string, Slot0*> & actionmap)
@@ -3205,12 +3575,15 @@ void Game::InitActionMap(std::map<std::string, Slot0*> & actionmap)
 	actionmap["gui.options.load"] = &actions[23];
 	actionmap["gui.options.save"] = &actions[24];
 	actionmap["SelectPlayerCar"] = &actions[25];
+	actionmap["ReplaySeekBack"] = &actions[26];
+	actionmap["ReplaySeekForward"] = &actions[27];
 }
 
 void Game::InitSignalMap(std::map<std::string, Signal1<const std::string &>*> & signalmap)
 {
 	signalmap["game.loading"] = &signal_loading;
 	signalmap["game.fps"] = &signal_fps;
+	signalmap["game.replay_time"] = &signal_replay_time;
 
 	signalmap["car.debug0"] = &signal_debug_info[0];
 	signalmap["car.debug1"] = &signal_debug_info[1];
@@ -34,6 +34,7 @@
 #include "gui/text_draw.h"
 #include "gui/font.h"
 #include "physics/dynamicsworld.h"
+#include "physics/fracturedispatcher.h"
 #include "physics/cardynamics.h"
 #include "dynamicsdraw.h"
 #include "carcontrolmap.h"
@@ -83,6 +84,15 @@ private:
 	/// Main loop body
 	void Advance();
 
+	/// Headless loop, steps game logic as fast as possible
+	void RunHeadless();
+
+	/// Stress benchmark loop, steps game logic and draws for stress_ticks ticks
+	void RunStress();
+
+	/// Print the stress benchmark results and write them to stress_output
+	void ReportStress();
+
 	bool ParseArguments(std::list <std::string> & args);
 
 	bool InitCoreSubsystems();
@@ -105,6 +115,9 @@ private:
 
 	void UpdateCars(float dt);
 
+	/// Reduce the physics detail of cars far from the camera or behind it
+	void UpdateCarDetail();
+
 	void ProcessCarInputs();
 
 	/// Updates camera, call after physics update
@@ -114,6 +127,9 @@ private:
 
 	void UpdateTimer();
 
+	/// Jump replay playback to frame and re-simulate from the nearest state frame
+	void SeekReplay(unsigned frame);
+
 	/// Check eventsystem state and update GUI
 	void ProcessGUIInputs();
 
@@ -241,6 +257,8 @@ private:
 	void SyncOptions();
 	void SyncSettings();
 	void SelectPlayerCar();
+	void ReplaySeekBack();
+	void ReplaySeekForward();
 
 	void SetCarToEdit(const std::string & value);
 	void SetCarStartPos(const std::string & value);
@@ -280,6 +298,7 @@ private:
 	// game info signals
 	Signal1<const std::string &> signal_loading;
 	Signal1<const std::string &> signal_fps;
+	Signal1<const std::string &> signal_replay_time;
 
 	// hud info signals
 	Signal1<const std::string &> signal_debug_info[4];
@@ -336,6 +355,14 @@ private:
 	bool multithreaded;
 	bool profilingmode;
 	bool benchmode;
+	bool headless;
+	bool physics_lod; ///< reduce the physics detail of distant cars
+	unsigned int headless_ticks; ///< tick limit in headless mode, 0 runs until the race is over
+	double headless_time; ///< wall clock time spent in the headless loop
+	unsigned int stress_cars; ///< number of ai cars in stress mode, 0 if disabled
+	unsigned int stress_ticks; ///< ticks to run in stress mode
+	std::string stress_output; ///< stress result file, csv or json
+	std::string trace_output; ///< profiler trace file
 	bool dumpfps;
 	bool pause;
 
@@ -362,7 +389,7 @@ private:
 	bool practice;
 
 	btDefaultCollisionConfiguration collisionconfig;
-	btCollisionDispatcher collisiondispatch;
+	FractureDispatcher collisiondispatch;
 	btDbvtBroadphase collisionbroadphase;
 	btSequentialImpulseConstraintSolver collisionsolver;
 	DynamicsDraw dynamicsdraw;
@@ -28,6 +28,7 @@
 #include <SDL2/SDL_image.h>
 #endif
 
+#include <algorithm>
 #include <string>
 #include <iostream>
 #include <fstream>
@@ -122,16 +123,16 @@ static void SampleDownAvg(
 }
 
 static void GetTextureFormat(
-	const SDL_Surface * surface,
+	unsigned bytespp,
 	const TextureInfo & info,
 	int & internalformat,
 	int & format)
 {
-	bool compress = info.compress && (surface->w > 512 || surface->h > 512);
+	bool compress = info.compress;
 	bool srgb = info.srgb;
 
 	internalformat = compress ? (srgb ? GL_COMPRESSED_SRGB : GL_COMPRESSED_RGB) : (srgb ? GL_SRGB8 : GL_RGB);
-	switch (surface->format->BytesPerPixel)
+	switch (bytespp)
 	{
 		case 1:
 			internalformat = compress ? GL_COMPRESSED_RED : GL_RED;
@@ -213,7 +214,9 @@ static void SetSampler(const TextureInfo & info, bool hasmiplevels = false)
 		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, (float)info.anisotropy);
 }
 
-Texture::Texture()
+Texture::Texture() :
+	decoded_bytespp(0),
+	decoded(false)
 {
 	// ctor
 }
@@ -225,8 +228,12 @@ Texture::~Texture()
 
 bool Texture::Load(const std::string & path, const TextureInfo & info, std::ostream & error)
 {
+	return Decode(path, info, error) && Upload(error);
+}
 
-	if (texid)
+bool Texture::Decode(const std::string & path, const TextureInfo & info, std::ostream & error)
+{
+	if (texid || decoded)
 	{
 		error << "Tried to double load texture " << path << std::endl;
 		return false;
@@ -238,14 +245,20 @@ bool Texture::Load(const std::string & path, const TextureInfo & info, std::ostr
 		return false;
 	}
 
-	if (!info.data && LoadDDS(path, info, error))
-	{
-		return true;
-	}
+	decoded_path = path;
+	decoded_info = info;
+	decoded_info.data = 0;
 
-	if (info.cube)
+	// dds and cube maps are loaded by Upload
+	if (!info.data)
 	{
-		return LoadCube(path, info, error);
+		char magic[4];
+		std::ifstream file(path.c_str(), std::ifstream::in | std::ifstream::binary);
+		if (info.cube || (file.read(magic, 4) && IsDDS(magic, 4)))
+		{
+			decoded = true;
+			return true;
+		}
 	}
 
 	SDL_Surface * surface = 0;
@@ -282,12 +295,14 @@ bool Texture::Load(const std::string & path, const TextureInfo & info, std::ostr
 
 	const unsigned char * pixels = (const unsigned char *)surface->pixels;
 	const unsigned bytespp = surface->format->BytesPerPixel;
-	unsigned pitch = surface->pitch;
-	unsigned w = surface->w;
-	unsigned h = surface->h;
+	const unsigned pitch = surface->pitch;
+	const unsigned w = surface->w;
+	const unsigned h = surface->h;
+
+	// only compress large textures
+	decoded_info.compress = info.compress && (w > 512 || h > 512);
 
 	// downsample if requested by application
-	std::vector<unsigned char> pixelsd;
 	unsigned wd = w;
 	unsigned hd = h;
 	if (info.maxsize == TextureInfo::SMALL)
@@ -310,23 +325,56 @@ bool Texture::Load(const std::string & path, const TextureInfo & info, std::ostr
 		if (h > 256)
 			hd = h / 2;
 	}
+
+	// rows are padded to the default gl unpack alignment of 4 bytes
+	const unsigned pitchd = (wd * bytespp + 3) & ~3u;
+	decoded_pixels.resize(pitchd * hd);
 	if (wd < w || hd < h)
 	{
-		pixelsd.resize(wd * hd * bytespp);
-
 		SampleDownAvg(
 			bytespp, w, h, pitch, pixels,
-			wd, hd, wd * bytespp, &pixelsd[0]);
-
-		pixels = &pixelsd[0];
-		pitch = wd * bytespp;
-		w = wd;
-		h = hd;
+			wd, hd, pitchd, &decoded_pixels[0]);
+	}
+	else
+	{
+		for (unsigned y = 0; y < h; ++y)
+			std::copy(pixels + y * pitch, pixels + y * pitch + w * bytespp, &decoded_pixels[y * pitchd]);
 	}
 
+	SDL_FreeSurface(surface);
+
 	// store dimensions
-	width = w;
-	height = h;
+	width = wd;
+	height = hd;
+	decoded_bytespp = bytespp;
+	decoded = true;
+
+	return true;
+}
+
+bool Texture::Upload(std::ostream & error)
+{
+	if (!decoded)
+	{
+		return texid != 0;
+	}
+	decoded = false;
+
+	if (decoded_pixels.empty())
+	{
+		if (LoadDDS(decoded_path, decoded_info, error))
+		{
+			return true;
+		}
+
+		if (decoded_info.cube)
+		{
+			return LoadCube(decoded_path, decoded_info, error);
+		}
+
+		error << "Error loading texture file: " << decoded_path << std::endl;
+		return false;
+	}
 
 	target = GL_TEXTURE_2D;
 
@@ -336,13 +384,13 @@ bool Texture::Load(const std::string & path, const TextureInfo & info, std::ostr
 
 	// setup texture
 	glBindTexture(GL_TEXTURE_2D, texid);
-	SetSampler(info);
+	SetSampler(decoded_info);
 
 	int internalformat, format;
-	GetTextureFormat(surface, info, internalformat, format);
+	GetTextureFormat(decoded_bytespp, decoded_info, internalformat, format);
 
 	// upload texture data
-	glTexImage2D(GL_TEXTURE_2D, 0, internalformat, w, h, 0, format, GL_UNSIGNED_BYTE, pixels);
+	glTexImage2D(GL_TEXTURE_2D, 0, internalformat, width, height, 0, format, GL_UNSIGNED_BYTE, &decoded_pixels[0]);
 	CheckForOpenGLErrors("Texture creation", error);
 
 	// If we support generatemipmap, go ahead and do it regardless of the info.mipmap setting.
@@ -351,7 +399,8 @@ bool Texture::Load(const std::string & path, const TextureInfo & info, std::ostr
 	if (GLC_ARB_framebuffer_object)
 		glGenerateMipmap(GL_TEXTURE_2D);
 
-	SDL_FreeSurface(surface);
+	// free the decoded image
+	std::vector<unsigned char>().swap(decoded_pixels);
 
 	return true;
 }
@@ -25,6 +25,7 @@
 
 #include <iosfwd>
 #include <string>
+#include <vector>
 
 class Texture : public TextureInterface
 {
@@ -33,11 +34,31 @@ public:
 
 	virtual ~Texture();
 
+	/// decode and upload, requires the gl context
 	bool Load(const std::string & path, const TextureInfo & info, std::ostream & error);
 
+	/// decode the image into memory, safe to call from any thread
+	/// dds and cube maps are read from file by Upload
+	bool Decode(const std::string & path, const TextureInfo & info, std::ostream & error);
+
+	/// upload the decoded image, requires the gl context
+	/// does nothing if there is no decoded image
+	bool Upload(std::ostream & error);
+
+	/// true if a decoded image waits for Upload
+	bool GetDecoded() const { return decoded; }
+
 	void Unload();
 
 private:
+	// decoded image waiting for upload
+	std::string decoded_path;
+	TextureInfo decoded_info;
+	std::vector<unsigned char> decoded_pixels;
+	unsigned decoded_bytespp;
+	bool decoded;
+
+
 	bool LoadCubeVerticalCross(const std::string & path, const TextureInfo & info, std::ostream & error);
 
 	bool LoadCube(const std::string & path, const TextureInfo & info, std::ostream & error);
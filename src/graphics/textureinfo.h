@@ -39,6 +39,7 @@ struct TextureInfo
 	bool nearest;			///< use nearest-neighbor interpolation filter
 	bool premultiply_alpha; ///< pre-multiply the color by the alpha value; allows using glstate.BlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA); when drawing the texture to get correct blending
 	bool srgb; 				///< apply srgb colorspace correction
+	bool deferupload;		///< only decode the image, Texture::Upload has to be called on the gl thread
 
 	TextureInfo() :
 		data(0),
@@ -56,7 +57,8 @@ struct TextureInfo
 		npot(true),
 		nearest(false),
 		premultiply_alpha(false),
-		srgb(false)
+		srgb(false),
+		deferupload(false)
 	{
 		// ctor
 	}
@@ -0,0 +1,354 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#include "jobsystem.h"
+#include "profiler.h"
+#include "unittest.h"
+
+#include <chrono>
+#include <iostream>
+#include <sstream>
+
+// after the system headers, it includes them in its namespace
+#include "numprocessors.h"
+
+// scheduler owning the calling thread and the thread's queue index in it
+static thread_local const JobSystem * thread_owner = 0;
+static thread_local int thread_index = 0;
+
+JobSystem & JobSystem::get()
+{
+	static JobSystem jobs;
+	return jobs;
+}
+
+unsigned JobSystem::getProcessorCount()
+{
+	unsigned count = NUMPROCESSORS::GetNumProcessors();
+	return count > 0 ? count : 1;
+}
+
+JobSystem::JobSystem() :
+	queued(0),
+	quit(false)
+{
+	queues.emplace_back(new Queue());
+}
+
+JobSystem::~JobSystem()
+{
+	deinit();
+}
+
+void JobSystem::init(unsigned thread_count)
+{
+	deinit();
+
+	if (thread_count == 0)
+		thread_count = getProcessorCount();
+
+	quit = false;
+	queues.clear();
+	for (unsigned i = 0; i < thread_count; ++i)
+		queues.emplace_back(new Queue());
+	for (unsigned i = 1; i < thread_count; ++i)
+		threads.emplace_back(&JobSystem::workerLoop, this, int(i));
+}
+
+void JobSystem::deinit()
+{
+	// jobs may still be queued if nobody waited for them
+	while (executeOne()) {}
+
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		quit = true;
+	}
+	sleep_cond.notify_all();
+	for (auto & thread : threads)
+		thread.join();
+	threads.clear();
+}
+
+unsigned JobSystem::getThreadCount() const
+{
+	return queues.size();
+}
+
+JobSystem::JobHandle JobSystem::add(const std::function<void()> & func)
+{
+	JobHandle job = std::make_shared<Job>();
+	job->func = func;
+	schedule(job);
+	return job;
+}
+
+JobSystem::JobHandle JobSystem::add(const std::function<void()> & func, const std::vector<JobHandle> & dependencies)
+{
+	JobHandle job = std::make_shared<Job>();
+	job->func = func;
+	job->pending = dependencies.size() + 1;
+	for (const auto & dep : dependencies)
+	{
+		std::lock_guard<std::mutex> lock(dep->mutex);
+		if (dep->done)
+		{
+			--job->pending;
+		}
+		else
+		{
+			dep->dependents.push_back(job);
+			job->dependencies.push_back(dep);
+		}
+	}
+	if (--job->pending == 0)
+		schedule(job);
+	return job;
+}
+
+void JobSystem::wait(const JobHandle & job)
+{
+	// the job is queued once its dependencies are done
+	std::vector<JobHandle> dependencies;
+	{
+		std::lock_guard<std::mutex> lock(job->mutex);
+		dependencies = job->dependencies;
+	}
+	for (const auto & dep : dependencies)
+		wait(dep);
+
+	// the last dependency may still be scheduling it, check the queues again
+	while (!job->done)
+	{
+		if (claim(job))
+		{
+			execute(job);
+			return;
+		}
+
+		std::unique_lock<std::mutex> lock(job->mutex);
+		job->finished.wait_for(lock, std::chrono::milliseconds(1), [&job]() { return job->done.load(); });
+	}
+}
+
+void JobSystem::wait(const std::vector<JobHandle> & jobs)
+{
+	for (const auto & job : jobs)
+		wait(job);
+}
+
+int JobSystem::getThreadIndex() const
+{
+	return thread_owner == this ? thread_index : 0;
+}
+
+void JobSystem::schedule(const JobHandle & job)
+{
+	unsigned index = getThreadIndex();
+	if (index >= queues.size())
+		index = 0;
+
+	Queue & queue = *queues[index];
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.jobs.push_back(job);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		++queued;
+	}
+	sleep_cond.notify_one();
+}
+
+void JobSystem::execute(const JobHandle & job)
+{
+	{
+		PROFILER_SCOPE("job");
+		job->func();
+	}
+
+	std::vector<JobHandle> dependents;
+	{
+		std::lock_guard<std::mutex> lock(job->mutex);
+		job->done = true;
+		job->dependencies.clear();
+		dependents.swap(job->dependents);
+	}
+	job->finished.notify_all();
+
+	for (const auto & dep : dependents)
+	{
+		if (--dep->pending == 0)
+			schedule(dep);
+	}
+}
+
+JobSystem::JobHandle JobSystem::take(int index)
+{
+	const int count = queues.size();
+	if (index >= count)
+		index = 0;
+
+	// own jobs newest first, they are likely still in cache
+	{
+		Queue & queue = *queues[index];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (!queue.jobs.empty())
+		{
+			JobHandle job = queue.jobs.back();
+			queue.jobs.pop_back();
+			--queued;
+			return job;
+		}
+	}
+
+	// steal the oldest job of another thread
+	for (int i = 1; i < count; ++i)
+	{
+		Queue & queue = *queues[(index + i) % count];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (!queue.jobs.empty())
+		{
+			JobHandle job = queue.jobs.front();
+			queue.jobs.pop_front();
+			--queued;
+			return job;
+		}
+	}
+
+	return JobHandle();
+}
+
+bool JobSystem::claim(const JobHandle & job)
+{
+	for (const auto & queue : queues)
+	{
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		auto i = std::find(queue->jobs.begin(), queue->jobs.end(), job);
+		if (i != queue->jobs.end())
+		{
+			queue->jobs.erase(i);
+			--queued;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool JobSystem::executeOne()
+{
+	JobHandle job = take(getThreadIndex());
+	if (!job)
+		return false;
+
+	execute(job);
+	return true;
+}
+
+void JobSystem::workerLoop(int index)
+{
+	thread_owner = this;
+	thread_index = index;
+
+	std::ostringstream name;
+	name << "worker " << index;
+	Profiler::setThreadName(name.str());
+
+	while (true)
+	{
+		JobHandle job = take(index);
+		if (job)
+		{
+			execute(job);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleep_mutex);
+		sleep_cond.wait(lock, [this]() { return queued > 0 || quit; });
+		if (quit)
+			break;
+	}
+}
+
+QT_TEST(jobsystem_test)
+{
+	JobSystem jobs;
+	jobs.init(4);
+	QT_CHECK_EQUAL(jobs.getThreadCount(), 4u);
+
+	// parallel for visits every index once
+	std::vector<int> visits(1000, 0);
+	jobs.parallelFor(0, visits.size(), [&visits](int i) { visits[i]++; }, 7);
+	int sum = 0;
+	for (int v : visits)
+		sum += v;
+	QT_CHECK_EQUAL(sum, 1000);
+	QT_CHECK_EQUAL(visits[0], 1);
+	QT_CHECK_EQUAL(visits[999], 1);
+
+	// nested parallel for
+	std::atomic<int> nested(0);
+	jobs.parallelFor(0, 8, [&jobs, &nested](int)
+	{
+		jobs.parallelFor(0, 100, [&nested](int) { nested++; });
+	});
+	QT_CHECK_EQUAL(nested.load(), 800);
+
+	// dependencies: a -> (b, c) -> d
+	std::mutex order_mutex;
+	std::vector<char> order;
+	auto record = [&order_mutex, &order](char c)
+	{
+		std::lock_guard<std::mutex> lock(order_mutex);
+		order.push_back(c);
+	};
+	JobSystem::JobHandle a = jobs.add([&record]() { std::this_thread::yield(); record('a'); });
+	JobSystem::JobHandle b = jobs.add([&record]() { record('b'); }, {a});
+	JobSystem::JobHandle c = jobs.add([&record]() { record('c'); }, {a});
+	JobSystem::JobHandle d = jobs.add([&record]() { record('d'); }, {b, c});
+	jobs.wait(d);
+	QT_CHECK(a->isDone() && b->isDone() && c->isDone() && d->isDone());
+	QT_CHECK_EQUAL(order.size(), 4u);
+	QT_CHECK_EQUAL(order.front(), 'a');
+	QT_CHECK_EQUAL(order.back(), 'd');
+
+	// dependency that is already done
+	JobSystem::JobHandle e = jobs.add([&record]() { record('e'); }, {d});
+	jobs.wait(e);
+	QT_CHECK_EQUAL(order.back(), 'e');
+
+	// waiting for a job does not run unrelated queued jobs
+	jobs.init(1);
+	bool long_done = false;
+	JobSystem::JobHandle long_job = jobs.add([&long_done]() { long_done = true; });
+	JobSystem::JobHandle short_job = jobs.add([]() {});
+	jobs.wait(short_job);
+	QT_CHECK(short_job->isDone());
+	QT_CHECK(!long_done);
+	jobs.wait(long_job);
+	QT_CHECK(long_done);
+
+	// single threaded runs on the caller
+	jobs.init(1);
+	std::thread::id caller = std::this_thread::get_id();
+	bool on_caller = true;
+	jobs.parallelFor(0, 16, [&caller, &on_caller](int) { on_caller &= (std::this_thread::get_id() == caller); });
+	QT_CHECK(on_caller);
+}
@@ -0,0 +1,173 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef _JOBSYSTEM_H
+#define _JOBSYSTEM_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// Work stealing job scheduler, the one way to run code in parallel.
+///
+/// Each thread owns a job deque. It pushes and pops jobs at the back and
+/// steals from the front of other deques when its own is empty. The main
+/// thread is thread 0. A thread waiting for a job runs it if it is still
+/// queued and sleeps otherwise, it does not pick up unrelated jobs.
+/// Jobs can depend on other jobs, they are queued once all their
+/// dependencies are done. With one thread everything runs on the caller.
+class JobSystem
+{
+public:
+	class Job;
+	typedef std::shared_ptr<Job> JobHandle;
+
+	/// the scheduler shared by all subsystems
+	static JobSystem & get();
+
+	/// number of processors of the system
+	static unsigned getProcessorCount();
+
+	JobSystem();
+
+	~JobSystem();
+
+	/// start threads - 1 worker threads, 0 uses one thread per processor
+	void init(unsigned threads = 0);
+
+	/// finish queued jobs and stop the worker threads
+	void deinit();
+
+	/// number of threads executing jobs, including the main thread
+	unsigned getThreadCount() const;
+
+	/// queue func for execution
+	JobHandle add(const std::function<void()> & func);
+
+	/// queue func for execution after all dependencies are done
+	JobHandle add(const std::function<void()> & func, const std::vector<JobHandle> & dependencies);
+
+	/// run job and its queued dependencies here, sleep while others run them
+	void wait(const JobHandle & job);
+
+	/// wait for each of the jobs
+	void wait(const std::vector<JobHandle> & jobs);
+
+	/// Call func(i) for i in [begin, end) in parallel and wait for completion.
+	/// Iterations are handed out in chunks of grain, func must not depend on
+	/// the order of iterations.
+	template <typename Func>
+	void parallelFor(int begin, int end, Func func, int grain = 1);
+
+	class Job
+	{
+	public:
+		Job() : pending(0), done(false) {}
+
+		bool isDone() const { return done; }
+
+	private:
+		friend class JobSystem;
+		std::function<void()> func;
+		std::vector<JobHandle> dependencies; ///< unfinished when added
+		std::vector<JobHandle> dependents;
+		std::atomic<int> pending; ///< unfinished dependencies
+		std::atomic<bool> done;
+		std::mutex mutex;
+		std::condition_variable finished;
+	};
+
+private:
+	struct Queue
+	{
+		std::deque<JobHandle> jobs;
+		std::mutex mutex;
+	};
+
+	std::vector<std::thread> threads;
+	std::vector<std::unique_ptr<Queue> > queues;
+	std::mutex sleep_mutex;
+	std::condition_variable sleep_cond;
+	std::atomic<int> queued;
+	std::atomic<bool> quit;
+
+	/// index of the calling thread, 0 for threads not owned by this scheduler
+	int getThreadIndex() const;
+
+	void schedule(const JobHandle & job);
+
+	void execute(const JobHandle & job);
+
+	/// pop a job from the thread's own queue or steal one
+	JobHandle take(int index);
+
+	/// remove job from the queues, returns false if it is not queued
+	bool claim(const JobHandle & job);
+
+	/// execute one job if available, returns false if there was none
+	bool executeOne();
+
+	void workerLoop(int index);
+};
+
+// implementation
+
+template <typename Func>
+inline void JobSystem::parallelFor(int begin, int end, Func func, int grain)
+{
+	if (begin >= end)
+		return;
+
+	const int count = end - begin;
+	const int chunk_count = (count + grain - 1) / grain;
+	const int helper_count = std::min<int>(chunk_count, getThreadCount()) - 1;
+	if (helper_count <= 0)
+	{
+		for (int i = begin; i < end; ++i)
+			func(i);
+		return;
+	}
+
+	// helpers and caller pull chunks from a shared counter
+	std::atomic<int> next(0);
+	auto loop = [&next, &func, begin, end, grain, chunk_count]()
+	{
+		for (int c = next++; c < chunk_count; c = next++)
+		{
+			const int chunk_begin = begin + c * grain;
+			const int chunk_end = std::min(chunk_begin + grain, end);
+			for (int i = chunk_begin; i < chunk_end; ++i)
+				func(i);
+		}
+	};
+
+	std::vector<JobHandle> helpers(helper_count);
+	for (int i = 0; i < helper_count; ++i)
+		helpers[i] = add(loop);
+	loop();
+	wait(helpers);
+}
+
+#endif // _JOBSYSTEM_H
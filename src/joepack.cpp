@@ -23,6 +23,8 @@
 
 #include <unordered_map>
 #include <fstream>
+#include <mutex>
+#include <thread>
 #include <cassert>
 
 using std::string;
@@ -38,8 +40,17 @@ struct JoePack::Impl
 	};
 	const std::string versionstr;
 	std::unordered_map<std::string, FatEntry> fat;
-	std::unordered_map<std::string, FatEntry>::iterator curfa;
 	std::ifstream f;
+	std::mutex fmutex; ///< guards f, files are read by several threads
+
+	/// a thread has at most one file of a pack open at a time
+	struct OpenFile
+	{
+		const Impl * pack;
+		FatEntry entry;
+		unsigned pos;
+	};
+	static thread_local OpenFile openfile;
 
 	Impl();
 	bool Load(const string & fn);
@@ -49,9 +60,11 @@ struct JoePack::Impl
 	int fread(void * buffer, const unsigned size, const unsigned count);
 };
 
+thread_local JoePack::Impl::OpenFile JoePack::Impl::openfile = {0, JoePack::Impl::FatEntry(), 0};
+
 JoePack::Impl::Impl() : versionstr("JPK01.00")
 {
-	curfa = fat.end();
+	// ctor
 }
 
 bool JoePack::Impl::Load(const string & fn)
@@ -119,37 +132,37 @@ void JoePack::Impl::Close()
 {
 	if (f.is_open()) f.close();
 	fat.clear();
-	curfa = fat.end();
+	if (openfile.pack == this) openfile.pack = 0;
 }
 
 void JoePack::Impl::fclose()
 {
-	curfa = fat.end();
+	if (openfile.pack == this) openfile.pack = 0;
 }
 
 bool JoePack::Impl::fopen(const string & fn)
 {
-	curfa = fat.find(fn);
-	if (curfa == fat.end())
+	std::unordered_map<std::string, FatEntry>::const_iterator i = fat.find(fn);
+	if (i == fat.end())
 	{
+		openfile.pack = 0;
 		return false;
 	}
 	else
 	{
-		f.seekg(curfa->second.offset);
+		openfile.pack = this;
+		openfile.entry = i->second;
+		openfile.pos = 0;
 		return true;
 	}
 }
 
 int JoePack::Impl::fread(void * buffer, const unsigned size, const unsigned count)
 {
-	if (curfa != fat.end())
+	if (openfile.pack == this)
 	{
-		unsigned int abspos = f.tellg();
-		assert(abspos >= curfa->second.offset);
-		unsigned int relpos = abspos - curfa->second.offset;
-		assert(curfa->second.length >= relpos);
-		unsigned int fileleft = curfa->second.length - relpos;
+		assert(openfile.entry.length >= openfile.pos);
+		unsigned int fileleft = openfile.entry.length - openfile.pos;
 		unsigned int requestedread = size*count;
 
 		assert(size != 0);
@@ -157,12 +170,17 @@ int JoePack::Impl::fread(void * buffer, const unsigned size, const unsigned coun
 		if (requestedread > fileleft)
 		{
 			//overflow
-			requestedread = fileleft/size;
+			requestedread = (fileleft/size)*size;
 		}
 
-		//DPRINT("JOEPACK fread: " << abspos << "," << relpos << "," << fileleft << "," << requestedread);
+		// the stream position is shared, seek to the thread's file position
+		std::lock_guard<std::mutex> lock(fmutex);
+		f.clear();
+		f.seekg(openfile.entry.offset + openfile.pos);
 		f.read((char *)buffer, requestedread);
-		return f.gcount()/size;
+		unsigned int readcount = f.gcount();
+		openfile.pos += readcount;
+		return readcount/size;
 	}
 	else
 	{
@@ -230,4 +248,20 @@ QT_TEST(joepack_test)
 	string comparisonstr = "This is\na test.\n";
 	string filestr = buf;
 	QT_CHECK_EQUAL(buf,comparisonstr);
+
+	// threads keep their own file position
+	QT_CHECK(p.fopen("testlist.txt"));
+	QT_CHECK_EQUAL(p.fread(buf, 1, 8), 8);
+	unsigned int thread_chars = 0;
+	std::thread t([&p, &thread_chars]()
+	{
+		char tbuf[1000];
+		if (p.fopen("testlist.txt"))
+			thread_chars = p.fread(tbuf, 1, 999);
+		p.fclose();
+	});
+	t.join();
+	QT_CHECK_EQUAL(thread_chars, 16);
+	QT_CHECK_EQUAL(p.fread(buf, 1, 999), 8);
+	p.fclose();
 }
@@ -22,6 +22,8 @@
 
 #include <string>
 
+/// Read only archive of files. fopen, fread and fclose may be called from
+/// several threads, each thread reads the file it opened.
 class JoePack
 {
 public:
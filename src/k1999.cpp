@@ -28,13 +28,20 @@
 
 #include "k1999.h"
 #include "roadstrip.h"
+#include "testfixtures.h"
+#include "unittest.h"
 
 #include <cassert>
+#include <cstring>
+#include <iostream>
+#include <ostream>
+#include <sstream>
 
 #define SecurityR   100.0 // Security radius
 #define SideDistExt 2.0 // Security distance wrt outside
 #define SideDistInt 1.0 // Security distance wrt inside
 #define Iterations  100 // Number of smoothing operations
+#define CacheVersion 1 // Increment when the race line calculation changes
 #define Mag(x,y) sqrt((x)*(x)+(y)*(y))
 #define Min(X,Y) ((X)<(Y)?(X):(Y))
 #define Max(X,Y) ((X)>(Y)?(X):(Y))
@@ -346,3 +353,125 @@ void K1999::UpdateRoadStrip(RoadStrip & road)
 	tyRight.clear();
 	tLane.clear();
 }
+
+static const char cache_magic[8] = {'V', 'D', 'K', '1', '9', '9', '9', '\0'};
+
+static void HashBytes(uint64_t & hash, const void * data, size_t size)
+{
+	// FNV-1a
+	const unsigned char * bytes = static_cast<const unsigned char *>(data);
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+}
+
+uint64_t K1999::GetHash() const
+{
+	uint64_t hash = 14695981039346656037ULL;
+	const double params[] = {CacheVersion, Iterations, SecurityR, SideDistExt, SideDistInt, double(Divs)};
+	HashBytes(hash, params, sizeof(params));
+	HashBytes(hash, txLeft.data(), txLeft.size() * sizeof(double));
+	HashBytes(hash, tyLeft.data(), tyLeft.size() * sizeof(double));
+	HashBytes(hash, txRight.data(), txRight.size() * sizeof(double));
+	HashBytes(hash, tyRight.data(), tyRight.size() * sizeof(double));
+	return hash;
+}
+
+void K1999::WriteCache(std::ostream & out) const
+{
+	const uint64_t hash = GetHash();
+	const uint32_t count = tLane.size();
+	out.write(cache_magic, sizeof(cache_magic));
+	out.write(reinterpret_cast<const char *>(&hash), sizeof(hash));
+	out.write(reinterpret_cast<const char *>(&count), sizeof(count));
+	out.write(reinterpret_cast<const char *>(tLane.data()), count * sizeof(double));
+	out.write(reinterpret_cast<const char *>(tRInverse.data()), count * sizeof(double));
+}
+
+bool K1999::ReadCache(std::istream & in)
+{
+	char magic[sizeof(cache_magic)];
+	uint64_t hash = 0;
+	uint32_t count = 0;
+	in.read(magic, sizeof(magic));
+	in.read(reinterpret_cast<char *>(&hash), sizeof(hash));
+	in.read(reinterpret_cast<char *>(&count), sizeof(count));
+	if (!in || std::memcmp(magic, cache_magic, sizeof(magic)) ||
+		hash != GetHash() || count != tLane.size())
+		return false;
+
+	std::vector<double> lane(count), rinverse(count);
+	in.read(reinterpret_cast<char *>(lane.data()), count * sizeof(double));
+	in.read(reinterpret_cast<char *>(rinverse.data()), count * sizeof(double));
+	if (!in)
+		return false;
+
+	tLane.swap(lane);
+	tRInverse.swap(rinverse);
+	return true;
+}
+
+static void CreateTestRoad(RoadStrip & road, int patches, float radius)
+{
+	// closed ellipse with a wavy edge
+	std::stringstream s;
+	s << patches << "\n";
+	for (int i = 0; i < patches; ++i)
+	{
+		const float a0 = 2 * M_PI * i / patches;
+		const float a1 = 2 * M_PI * (i + 1) / patches;
+		const float w0 = 6 + std::sin(5 * a0);
+		const float w1 = 6 + std::sin(5 * a1);
+		const Vec3 d0(std::cos(a0), 0.6f * std::sin(a0), 0);
+		const Vec3 d1(std::cos(a1), 0.6f * std::sin(a1), 0);
+		WriteTestPatch(s, d1 * (radius - w1), d1 * (radius + w1), d0 * (radius - w0), d0 * (radius + w0));
+	}
+	road.ReadFrom(s, false, std::cerr);
+}
+
+QT_TEST(k1999_cache_test)
+{
+	RoadStrip road;
+	CreateTestRoad(road, 256, 300);
+	QT_CHECK(road.GetClosed());
+
+	K1999 k1999;
+	k1999.LoadData(road);
+	const uint64_t hash = k1999.GetHash();
+	k1999.CalcRaceLine();
+	std::stringstream cache;
+	k1999.WriteCache(cache);
+	k1999.UpdateRoadStrip(road);
+
+	// cached race line matches the calculated one
+	RoadStrip cached_road;
+	CreateTestRoad(cached_road, 256, 300);
+	k1999.LoadData(cached_road);
+	QT_CHECK_EQUAL(k1999.GetHash(), hash);
+	QT_CHECK(k1999.ReadCache(cache));
+	k1999.UpdateRoadStrip(cached_road);
+	bool same = true;
+	for (size_t i = 0; i < road.GetPatches().size(); ++i)
+	{
+		const RoadPatch & a = road.GetPatches()[i];
+		const RoadPatch & b = cached_road.GetPatches()[i];
+		same = same && a.GetRacingLine() == b.GetRacingLine();
+	}
+	QT_CHECK(same);
+
+	// changed roads are rejected
+	RoadStrip other_road;
+	CreateTestRoad(other_road, 256, 301);
+	k1999.LoadData(other_road);
+	QT_CHECK(k1999.GetHash() != hash);
+	cache.clear();
+	cache.seekg(0);
+	QT_CHECK(!k1999.ReadCache(cache));
+
+	// truncated cache
+	k1999.LoadData(cached_road);
+	std::stringstream truncated(cache.str().substr(0, cache.str().size() - 1));
+	QT_CHECK(!k1999.ReadCache(truncated));
+}
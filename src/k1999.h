@@ -29,6 +29,7 @@
 #ifndef _K1999_H
 #define _K1999_H
 
+#include <cstdint>
 #include <vector>
 #include <iosfwd>
 
@@ -63,6 +64,14 @@ public:
 	void LoadData(const RoadStrip & road);
 	void CalcRaceLine();
 	void UpdateRoadStrip(RoadStrip & road);
+
+	// hash of the loaded road data and of the algorithm parameters
+	uint64_t GetHash() const;
+	// write the race line, call after CalcRaceLine
+	void WriteCache(std::ostream & out) const;
+	// read a race line written for the loaded road instead of CalcRaceLine,
+	// returns false if it was written for different road data
+	bool ReadCache(std::istream & in);
 };
 
 #endif //_K1999_H
@@ -19,7 +19,6 @@
 
 #include "keyed_container.h"
 #include "unittest.h"
-#include "quickprof.h"
 
 #include <stdint.h>
 
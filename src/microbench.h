@@ -0,0 +1,173 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef _MICROBENCH_H
+#define _MICROBENCH_H
+
+#include <chrono>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Microbenchmarks register themselves like QuickTest tests. They live next
+// to the code they measure and are run with the -microbench command line
+// option, optionally filtered by a benchmark name prefix.
+//
+// MICROBENCH(foo_bench)
+// {
+//     setup...
+//     bench.measure("variant", items_per_call, [&]() { code under test });
+// }
+
+namespace microbench
+{
+	/// Keep the optimizer from discarding a computed value.
+	template <typename T>
+	inline void consume(const T & value)
+	{
+		static volatile char sink;
+		sink = *reinterpret_cast<const volatile char *>(&value);
+		(void)sink;
+	}
+
+	class Benchmark
+	{
+	public:
+		Benchmark(const std::string & benchName);
+
+		virtual ~Benchmark() {}
+
+		virtual void run() = 0;
+
+		const std::string & name() const
+		{
+			return mName;
+		}
+
+		void setOutputStream(std::ostream & stream)
+		{
+			mOutput = &stream;
+		}
+
+		/// Call func repeatedly for at least min_time seconds and report the
+		/// time per call and the throughput in items (processed per call) per second.
+		template <typename Func>
+		double measure(const std::string & label, unsigned items, Func func, double min_time = 0.25)
+		{
+			typedef std::chrono::steady_clock Clock;
+
+			// warm up caches and branch predictors
+			func();
+
+			unsigned long calls = 0;
+			unsigned long batch = 1;
+			double elapsed = 0;
+			Clock::time_point start = Clock::now();
+			while (elapsed < min_time)
+			{
+				for (unsigned long i = 0; i < batch; ++i)
+					func();
+				calls += batch;
+				batch *= 2;
+				elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+			}
+
+			double ns_per_call = elapsed * 1E9 / calls;
+			double items_per_sec = double(items) * calls / elapsed;
+			if (mOutput)
+			{
+				*mOutput << std::left << std::setw(40) << (mName + "/" + label) << std::right
+					<< std::setw(12) << std::fixed << std::setprecision(1) << ns_per_call << " ns/call "
+					<< std::setw(14) << std::setprecision(0) << items_per_sec << " items/s"
+					<< std::endl;
+				mOutput->unsetf(std::ios_base::floatfield);
+				mOutput->precision(6);
+			}
+			return ns_per_call;
+		}
+
+	private:
+		std::string mName;
+		std::ostream * mOutput;
+	};
+
+	class BenchmarkManager
+	{
+	public:
+		static BenchmarkManager & instance()
+		{
+			static BenchmarkManager * self = new BenchmarkManager;
+			return *self;
+		}
+
+		void addBenchmark(Benchmark * bench)
+		{
+			mBenchmarks.push_back(bench);
+		}
+
+		/// Run all benchmarks whose name starts with filter.
+		unsigned run(std::ostream & output, const std::string & filter = std::string())
+		{
+			unsigned count = 0;
+			output << "[-------------- RUNNING MICROBENCHMARKS --------------]" << std::endl;
+			for (std::vector<Benchmark*>::iterator i = mBenchmarks.begin(); i != mBenchmarks.end(); ++i)
+			{
+				if ((*i)->name().compare(0, filter.size(), filter) != 0)
+					continue;
+				(*i)->setOutputStream(output);
+				(*i)->run();
+				++count;
+			}
+			output << "Ran " << count << " microbenchmarks" << std::endl;
+			output << "[-------------- MICROBENCHMARKS FINISHED -------------]" << std::endl;
+			return count;
+		}
+
+	private:
+		BenchmarkManager() {}
+
+		/// All benchmarks are statically allocated.
+		std::vector<Benchmark*> mBenchmarks;
+	};
+
+	inline Benchmark::Benchmark(const std::string & benchName) :
+		mName(benchName),
+		mOutput(0)
+	{
+		BenchmarkManager::instance().addBenchmark(this);
+	}
+}
+
+/// Define a microbenchmark, the body can use bench.measure(...).
+#define MICROBENCH(benchName)\
+	class benchName##Bench : public microbench::Benchmark\
+	{\
+	public:\
+		benchName##Bench() : Benchmark(#benchName) {}\
+		void run() { body(*this); }\
+		static void body(microbench::Benchmark & bench);\
+	} benchName##Instance;\
+	void benchName##Bench::body(microbench::Benchmark & bench)
+
+/// Run all registered microbenchmarks matching the filter prefix.
+#define MICROBENCH_RUN(stream, filter)\
+	microbench::BenchmarkManager::instance().run(stream, filter)
+
+#endif // _MICROBENCH_H
@@ -100,6 +100,7 @@ void PathManager::Init(std::ostream & info_output, std::ostream & error_output)
 	MakeDir(GetTrackRecordsPath());
 	MakeDir(GetReplayPath());
 	MakeDir(GetScreenshotPath());
+	MakeDir(GetCachePath());
 	MakeDir(GetTemporaryFolder());
 
 	// Print diagnostic info.
@@ -322,6 +323,11 @@ std::string PathManager::GetScreenshotPath() const
 	return settings_path+"/screenshots";
 }
 
+std::string PathManager::GetCachePath() const
+{
+	return settings_path+"/cache";
+}
+
 std::string PathManager::GetStaticReflectionMap() const
 {
 	return GetDataPath()+"/textures/weather/cubereflection-nosun.png";
@@ -24,12 +24,14 @@
 #include "content/contentmanager.h"
 #include "cfg/ptree.h"
 #include "joeserialize.h"
+#include "unittest.h"
 
 #include "BulletCollision/CollisionDispatch/btCollisionObject.h"
 #include "BulletCollision/CollisionShapes/btStaticPlaneShape.h"
 
 #include <vector>
 #include <iostream>
+#include <fstream>
 #include <sstream>
 #include <ctime>
 
@@ -103,7 +105,8 @@ void PerformanceTesting::Test(
 	btQuaternion rot = btQuaternion::getIdentity();
 	const std::string tire = "";
 	const bool damage = false;
-	if (!car.Load(*cfg, cardir, tire, pos, rot, damage, world, content, error_output))
+	const bool tire_tables = false;
+	if (!car.Load(*cfg, cardir, tire, pos, rot, damage, tire_tables, world, content, error_output))
 	{
 		return;
 	}
@@ -237,15 +240,122 @@ void PerformanceTesting::TestMaxSpeed(std::ostream & info_output, std::ostream &
 		i++;
 	}
 	clock_t cpu_timer_stop = clock();
-	clock_t clock_ticks = cpu_timer_stop - cpu_timer_start;
-	float sim_perf = (clock_ticks > 0) ? t / clock_ticks * CLOCKS_PER_SEC : 0;
+	double cpu_time = double(cpu_timer_stop - cpu_timer_start) / CLOCKS_PER_SEC;
 
 	info_output << "Top speed: " << ConvertToMPH(maxspeed.second) << " MPH at " << maxspeed.first << " s\n";
 	info_output << "Downforce at top speed: " << -maxlift << " N\n";
 	info_output << "Drag at top speed: " << -maxdrag << " N\n";
 	info_output << "0-60 MPH time: " << timeto60 - timeto60start << " s\n";
 	info_output << "1/4 mile time: " << timetoquarter << " s at " << ConvertToMPH(quarterspeed) << " MPH" << std::endl;
-	info_output << "Simulation performance: " << sim_perf << std::endl;
+	ReportSimulationPerformance(i, dt, cpu_time, info_output);
+}
+
+void PerformanceTesting::ReportSimulationPerformance(
+	unsigned ticks,
+	float timestep,
+	double cpu_time,
+	std::ostream & info_output)
+{
+	double sim_time = ticks * double(timestep);
+	double sim_perf = (cpu_time > 0) ? sim_time / cpu_time : 0;
+	double tick_rate = (cpu_time > 0) ? ticks / cpu_time : 0;
+	info_output << "Simulation performance: " << sim_perf << " x realtime, "
+		<< tick_rate << " ticks/s (" << ticks << " ticks in " << cpu_time << " s)" << std::endl;
+}
+
+static std::string JsonString(const std::string & value)
+{
+	std::string s("\"");
+	for (char c : value)
+	{
+		if (c == '"' || c == '\\')
+			s.push_back('\\');
+		s.push_back(c);
+	}
+	s.push_back('"');
+	return s;
+}
+
+static std::string CsvString(const std::string & value)
+{
+	if (value.find_first_of(",\"\n") == std::string::npos)
+		return value;
+
+	std::string s("\"");
+	for (char c : value)
+	{
+		if (c == '"')
+			s.push_back('"');
+		s.push_back(c);
+	}
+	s.push_back('"');
+	return s;
+}
+
+void PerformanceTesting::WriteStressJson(const StressResult & result, std::ostream & out)
+{
+	out << "{\n";
+	out << "\t\"revision\": " << JsonString(result.revision) << ",\n";
+	out << "\t\"track\": " << JsonString(result.track) << ",\n";
+	out << "\t\"broadphase\": " << JsonString(result.broadphase) << ",\n";
+	out << "\t\"cars\": " << result.cars << ",\n";
+	out << "\t\"ticks\": " << result.ticks << ",\n";
+	out << "\t\"threads\": " << result.threads << ",\n";
+	out << "\t\"tick_ms\": " << result.tick_ms << ",\n";
+	out << "\t\"block_ms\": {";
+	for (size_t i = 0; i < result.block_ms.size(); ++i)
+	{
+		out << (i ? ",\n" : "\n");
+		out << "\t\t" << JsonString(result.block_ms[i].first) << ": " << result.block_ms[i].second;
+	}
+	out << "\n\t}\n";
+	out << "}" << std::endl;
+}
+
+void PerformanceTesting::WriteStressCsv(const StressResult & result, bool header, std::ostream & out)
+{
+	if (header)
+	{
+		out << "revision,track,broadphase,cars,ticks,threads,tick_ms";
+		for (const auto & block : result.block_ms)
+			out << "," << CsvString(block.first + "_ms");
+		out << "\n";
+	}
+
+	out << CsvString(result.revision) << "," << CsvString(result.track) << ","
+		<< CsvString(result.broadphase) << "," << result.cars << "," << result.ticks << "," << result.threads << "," << result.tick_ms;
+	for (const auto & block : result.block_ms)
+		out << "," << block.second;
+	out << std::endl;
+}
+
+bool PerformanceTesting::WriteStressResult(
+	const StressResult & result,
+	const std::string & filename,
+	std::ostream & error_output)
+{
+	const bool csv = filename.size() > 4 && filename.compare(filename.size() - 4, 4, ".csv") == 0;
+	if (csv)
+	{
+		const bool header = !std::ifstream(filename.c_str());
+		std::ofstream out(filename.c_str(), std::ios::app);
+		if (out)
+		{
+			WriteStressCsv(result, header, out);
+			return true;
+		}
+	}
+	else
+	{
+		std::ofstream out(filename.c_str());
+		if (out)
+		{
+			WriteStressJson(result, out);
+			return true;
+		}
+	}
+	error_output << "Unable to write stress results to " << filename << std::endl;
+	return false;
 }
 
 void PerformanceTesting::TestStoppingDistance(bool abs, std::ostream & info_output, std::ostream & error_output)
@@ -343,3 +453,30 @@ void PerformanceTesting::TestStoppingDistance(bool abs, std::ostream & info_outp
 		<< "Wheel lockup speed " << ConvertToMPH(front_lockup_speed)
 		<< ", " << ConvertToMPH(rear_lockup_speed) << std::endl;
 }
+
+QT_TEST(stress_result_test)
+{
+	PerformanceTesting::StressResult stress;
+	stress.revision = "r1";
+	stress.track = "track \"a\", b";
+	stress.broadphase = "dbvt";
+	stress.cars = 16;
+	stress.ticks = 1000;
+	stress.threads = 4;
+	stress.tick_ms = 2.5;
+	stress.block_ms.push_back(std::make_pair("ai", 0.5));
+	stress.block_ms.push_back(std::make_pair("render setup", 0.25));
+
+	std::ostringstream json;
+	PerformanceTesting::WriteStressJson(stress, json);
+	QT_CHECK(json.str().find("\"track\": \"track \\\"a\\\", b\",") != std::string::npos);
+	QT_CHECK(json.str().find("\"broadphase\": \"dbvt\",") != std::string::npos);
+	QT_CHECK(json.str().find("\"cars\": 16,") != std::string::npos);
+	QT_CHECK(json.str().find("\"render setup\": 0.25\n") != std::string::npos);
+
+	std::ostringstream csv;
+	PerformanceTesting::WriteStressCsv(stress, true, csv);
+	PerformanceTesting::WriteStressCsv(stress, false, csv);
+	const std::string row = "r1,\"track \"\"a\"\", b\",dbvt,16,1000,4,2.5,0.5,0.25\n";
+	QT_CHECK_EQUAL(csv.str(), "revision,track,broadphase,cars,ticks,threads,tick_ms,ai_ms,render setup_ms\n" + row + row);
+}
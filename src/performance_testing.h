@@ -22,6 +22,10 @@
 
 #include "physics/cardynamics.h"
 
+#include <string>
+#include <utility>
+#include <vector>
+
 class ContentManager;
 
 class PerformanceTesting
@@ -37,6 +41,40 @@ public:
 		std::ostream & info_output,
 		std::ostream & error_output);
 
+	/// Print simulation speed for ticks of length timestep computed in cpu_time seconds.
+	static void ReportSimulationPerformance(
+		unsigned ticks,
+		float timestep,
+		double cpu_time,
+		std::ostream & info_output);
+
+	/// Subsystem times of a stress benchmark run.
+	struct StressResult
+	{
+		std::string revision;
+		std::string track;
+		std::string broadphase;
+		unsigned cars;
+		unsigned ticks;
+		unsigned threads;
+		double tick_ms; ///< wall clock time per tick
+		std::vector<std::pair<std::string, double> > block_ms; ///< profiler block times per tick
+	};
+
+	/// Write result as one JSON object.
+	static void WriteStressJson(const StressResult & result, std::ostream & out);
+
+	/// Write result as one CSV row, preceded by the column names if header is set.
+	static void WriteStressCsv(const StressResult & result, bool header, std::ostream & out);
+
+	/// Write result to file, as CSV if filename ends in .csv, as JSON otherwise.
+	/// CSV rows are appended to an existing file, runs with different car
+	/// counts collect into one scaling curve.
+	static bool WriteStressResult(
+		const StressResult & result,
+		const std::string & filename,
+		std::ostream & error_output);
+
 private:
 	DynamicsWorld & world;
 	TrackSurface surface;
@@ -0,0 +1,421 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+
+#include "bvhcache.h"
+#include "unittest.h"
+
+#include "BulletCollision/CollisionShapes/btBvhTriangleMeshShape.h"
+#include "BulletCollision/CollisionShapes/btOptimizedBvh.h"
+#include "BulletCollision/CollisionShapes/btTriangleCallback.h"
+#include "BulletCollision/CollisionShapes/btTriangleIndexVertexArray.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <ostream>
+#include <sstream>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// file layout: header, entry table, serialized BVHs at 16 byte aligned offsets
+struct FileHeader
+{
+	char magic[8];
+	uint32_t byte_order;
+	uint32_t bullet_version;
+	uint32_t pointer_size;
+	uint32_t scalar_size;
+	uint64_t count;
+};
+
+struct FileEntry
+{
+	uint64_t hash;
+	uint64_t offset;
+	uint64_t size;
+};
+
+static const char cache_magic[8] = {'V', 'D', 'B', 'V', 'H', '0', '1', '\0'};
+
+// serialized BVHs are only valid for the same bullet build and platform
+static FileHeader GetFileHeader(uint64_t count)
+{
+	FileHeader header;
+	std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+	header.byte_order = 0x01020304;
+	header.bullet_version = BT_BULLET_VERSION;
+	header.pointer_size = sizeof(void*);
+	header.scalar_size = sizeof(btScalar);
+	header.count = count;
+	return header;
+}
+
+static inline uint64_t Align16(uint64_t offset)
+{
+	return (offset + 15) & ~uint64_t(15);
+}
+
+static void HashBytes(uint64_t & hash, const void * data, size_t size)
+{
+	// FNV-1a on 64 bit words, meshes can be large
+	const unsigned char * bytes = static_cast<const unsigned char *>(data);
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		uint64_t word;
+		std::memcpy(&word, bytes + i, 8);
+		hash ^= word;
+		hash *= 1099511628211ULL;
+	}
+	for (; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+}
+
+struct BvhCache::MappedFile
+{
+	char * data;
+	size_t size;
+
+	MappedFile() : data(0), size(0) {}
+
+	~MappedFile()
+	{
+		if (!data)
+			return;
+#ifdef _WIN32
+		UnmapViewOfFile(data);
+#else
+		munmap(data, size);
+#endif
+	}
+
+	// private writable mapping, in place deserialization writes to it
+	bool Map(const std::string & filename)
+	{
+#ifdef _WIN32
+		HANDLE handle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+			NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (handle == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER file_size;
+		HANDLE mapping = NULL;
+		if (GetFileSizeEx(handle, &file_size) && file_size.QuadPart > 0)
+			mapping = CreateFileMappingA(handle, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+		CloseHandle(handle);
+		if (!mapping)
+			return false;
+
+		// the view keeps the mapping alive
+		data = static_cast<char *>(MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0));
+		CloseHandle(mapping);
+		size = data ? size_t(file_size.QuadPart) : 0;
+		return data != 0;
+#else
+		int fd = open(filename.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+
+		struct stat st;
+		void * address = MAP_FAILED;
+		if (fstat(fd, &st) == 0 && st.st_size > 0)
+			address = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (address == MAP_FAILED)
+			return false;
+
+		data = static_cast<char *>(address);
+		size = st.st_size;
+		return true;
+#endif
+	}
+};
+
+BvhCache::BvhCache() :
+	hits(0),
+	misses(0)
+{
+	// ctor
+}
+
+BvhCache::~BvhCache()
+{
+	// dtor
+}
+
+bool BvhCache::Load(const std::string & filename)
+{
+	std::unique_ptr<MappedFile> mapped(new MappedFile());
+	if (!mapped->Map(filename) || !Load(mapped->data, mapped->size))
+		return false;
+
+	file = std::move(mapped);
+	return true;
+}
+
+bool BvhCache::Load(char * data, size_t size)
+{
+	entries.clear();
+	hits = 0;
+	misses = 0;
+
+	const FileHeader expected = GetFileHeader(0);
+	FileHeader header;
+	if (size < sizeof(header))
+		return false;
+
+	std::memcpy(&header, data, sizeof(header));
+	if (std::memcmp(header.magic, expected.magic, sizeof(header.magic)) ||
+		header.byte_order != expected.byte_order ||
+		header.bullet_version != expected.bullet_version ||
+		header.pointer_size != expected.pointer_size ||
+		header.scalar_size != expected.scalar_size ||
+		header.count > (size - sizeof(header)) / sizeof(FileEntry))
+	{
+		return false;
+	}
+
+	for (uint64_t i = 0; i < header.count; ++i)
+	{
+		FileEntry fe;
+		std::memcpy(&fe, data + sizeof(header) + i * sizeof(fe), sizeof(fe));
+		if (fe.offset % 16 || fe.offset > size || fe.size > size - fe.offset)
+		{
+			entries.clear();
+			return false;
+		}
+
+		Entry & entry = entries[fe.hash];
+		entry.data = data + fe.offset;
+		entry.size = fe.size;
+	}
+	return true;
+}
+
+btBvhTriangleMeshShape * BvhCache::CreateShape(btTriangleIndexVertexArray * mesh)
+{
+	const uint64_t hash = GetHash(*mesh);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		Entry & entry = entries[hash];
+		if (entry.data && !entry.bvh)
+		{
+			// deserialization modifies the data, it can only be done once
+			entry.bvh = btOptimizedBvh::deSerializeInPlace(entry.data, entry.size, false);
+			if (!entry.bvh)
+				entry.data = 0;
+		}
+
+		if (entry.data)
+		{
+			btBvhTriangleMeshShape * shape = new btBvhTriangleMeshShape(mesh, true, false);
+			shape->setOptimizedBvh(entry.bvh);
+			++hits;
+			return shape;
+		}
+	}
+
+	// shapes with equal meshes build their own BVH, the first one is saved
+	btBvhTriangleMeshShape * shape = new btBvhTriangleMeshShape(mesh, true);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	Entry & entry = entries[hash];
+	if (!entry.bvh)
+		entry.bvh = shape->getOptimizedBvh();
+	++misses;
+	return shape;
+}
+
+bool BvhCache::Write(std::ostream & out) const
+{
+	// sorted by hash, equal content gives equal files
+	std::vector<std::pair<uint64_t, const btQuantizedBvh *> > bvhs;
+	for (const auto & entry : entries)
+	{
+		if (entry.second.bvh)
+			bvhs.push_back(std::make_pair(entry.first, entry.second.bvh));
+	}
+	std::sort(bvhs.begin(), bvhs.end());
+
+	const FileHeader header = GetFileHeader(bvhs.size());
+	out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+	uint64_t offset = Align16(sizeof(header) + bvhs.size() * sizeof(FileEntry));
+	std::vector<FileEntry> table(bvhs.size());
+	for (size_t i = 0; i < bvhs.size(); ++i)
+	{
+		table[i].hash = bvhs[i].first;
+		table[i].offset = offset;
+		table[i].size = bvhs[i].second->calculateSerializeBufferSize();
+		offset = Align16(offset + table[i].size);
+	}
+	if (!table.empty())
+		out.write(reinterpret_cast<const char *>(&table[0]), table.size() * sizeof(FileEntry));
+
+	uint64_t position = sizeof(header) + table.size() * sizeof(FileEntry);
+	const char padding[16] = {0};
+	for (size_t i = 0; i < bvhs.size(); ++i)
+	{
+		out.write(padding, table[i].offset - position);
+
+		void * buffer = btAlignedAlloc(table[i].size, 16);
+		bvhs[i].second->serialize(buffer, table[i].size, false);
+		out.write(static_cast<const char *>(buffer), table[i].size);
+		btAlignedFree(buffer);
+
+		position = table[i].offset + table[i].size;
+	}
+	return out.good();
+}
+
+bool BvhCache::Save(const std::string & filename, std::ostream & error_output) const
+{
+	if (!Changed())
+		return true;
+
+	// the old file may still be mapped, replace it instead of writing to it
+	const std::string tempname = filename + ".tmp";
+	{
+		std::ofstream out(tempname.c_str(), std::ios::binary);
+		if (!Write(out))
+		{
+			error_output << "Failed to write collision mesh cache: " << tempname << std::endl;
+			return false;
+		}
+	}
+
+	if (std::rename(tempname.c_str(), filename.c_str()) != 0 &&
+		(std::remove(filename.c_str()) != 0 || std::rename(tempname.c_str(), filename.c_str()) != 0))
+	{
+		error_output << "Failed to replace collision mesh cache: " << filename << std::endl;
+		std::remove(tempname.c_str());
+		return false;
+	}
+	return true;
+}
+
+uint64_t BvhCache::GetHash(const btTriangleIndexVertexArray & mesh)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	const IndexedMeshArray & parts = mesh.getIndexedMeshArray();
+	for (int i = 0; i < parts.size(); ++i)
+	{
+		const btIndexedMesh & part = parts[i];
+		const int params[] = {
+			part.m_numTriangles, part.m_triangleIndexStride, part.m_numVertices,
+			part.m_vertexStride, int(part.m_indexType), int(part.m_vertexType)};
+		HashBytes(hash, params, sizeof(params));
+		HashBytes(hash, part.m_triangleIndexBase, size_t(part.m_numTriangles) * part.m_triangleIndexStride);
+		HashBytes(hash, part.m_vertexBase, size_t(part.m_numVertices) * part.m_vertexStride);
+	}
+	return hash;
+}
+
+struct TriangleCounter : public btTriangleCallback
+{
+	int count;
+	TriangleCounter() : count(0) {}
+	void processTriangle(btVector3 *, int, int) { ++count; }
+};
+
+static int CountTriangles(const btBvhTriangleMeshShape & shape, const btVector3 & aabbMin, const btVector3 & aabbMax)
+{
+	TriangleCounter counter;
+	shape.processAllTriangles(&counter, aabbMin, aabbMax);
+	return counter.count;
+}
+
+QT_TEST(bvhcache_test)
+{
+	// 16 x 16 quad grid
+	const int n = 16;
+	std::vector<btScalar> vertices;
+	std::vector<int> faces;
+	for (int y = 0; y <= n; ++y)
+	{
+		for (int x = 0; x <= n; ++x)
+		{
+			vertices.push_back(x);
+			vertices.push_back(y);
+			vertices.push_back((x * y) % 3 * btScalar(0.1));
+		}
+	}
+	for (int y = 0; y < n; ++y)
+	{
+		for (int x = 0; x < n; ++x)
+		{
+			const int i = y * (n + 1) + x;
+			const int quad[6] = {i, i + 1, i + n + 2, i + n + 2, i + n + 1, i};
+			faces.insert(faces.end(), quad, quad + 6);
+		}
+	}
+	btTriangleIndexVertexArray mesh(faces.size() / 3, &faces[0], 3 * sizeof(int), vertices.size() / 3, &vertices[0], 3 * sizeof(btScalar));
+
+	// empty cache builds the BVH
+	BvhCache cache;
+	btBvhTriangleMeshShape * built = cache.CreateShape(&mesh);
+	QT_CHECK_EQUAL(cache.GetMisses(), 1);
+	QT_CHECK(cache.Changed());
+
+	std::ostringstream out;
+	QT_CHECK(cache.Write(out));
+	const std::string bytes = out.str();
+	char * data = static_cast<char *>(btAlignedAlloc(bytes.size(), 16));
+	std::memcpy(data, bytes.data(), bytes.size());
+
+	// equal mesh is loaded from the cache
+	BvhCache loaded;
+	QT_CHECK(loaded.Load(data, bytes.size()));
+	btBvhTriangleMeshShape * cached = loaded.CreateShape(&mesh);
+	QT_CHECK_EQUAL(loaded.GetHits(), 1);
+	QT_CHECK(!loaded.Changed());
+	QT_CHECK(cached->getOptimizedBvh() != built->getOptimizedBvh());
+
+	const btVector3 aabbMin(2.5, 3.5, -1), aabbMax(6.5, 4.5, 1);
+	QT_CHECK_EQUAL(CountTriangles(*cached, aabbMin, aabbMax), CountTriangles(*built, aabbMin, aabbMax));
+	QT_CHECK(CountTriangles(*cached, aabbMin, aabbMax) > 0);
+
+	// changed mesh misses
+	vertices[2] = 1;
+	btBvhTriangleMeshShape * changed = loaded.CreateShape(&mesh);
+	QT_CHECK_EQUAL(loaded.GetMisses(), 1);
+
+	// incompatible data is rejected
+	data[0] = 'X';
+	BvhCache rejected;
+	QT_CHECK(!rejected.Load(data, bytes.size()));
+
+	delete changed;
+	delete cached;
+	delete built;
+	btAlignedFree(data);
+}
@@ -0,0 +1,95 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+
+#ifndef _BVHCACHE_H
+#define _BVHCACHE_H
+
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class btBvhTriangleMeshShape;
+class btOptimizedBvh;
+class btTriangleIndexVertexArray;
+
+/// Persistent cache of triangle mesh shape BVHs, one file per track.
+///
+/// Entries are keyed by a hash of the mesh data. The file is memory mapped
+/// copy on write and cached BVHs are deserialized in place, so loading a
+/// cached mesh skips BVH construction. The cache has to outlive the shapes
+/// it created. When BVHs had to be built, Save rewrites the file with the
+/// BVHs of all shapes created since Load.
+class BvhCache
+{
+public:
+	BvhCache();
+
+	~BvhCache();
+
+	/// map cache file, false if it is missing or incompatible
+	bool Load(const std::string & filename);
+
+	/// use cache data in place, data has to be 16 byte aligned, writable
+	/// and stay valid as long as the cache
+	bool Load(char * data, size_t size);
+
+	/// mesh shape using the cached BVH if there is one, building it otherwise
+	/// may be called from several threads, BVHs are built outside of the lock
+	btBvhTriangleMeshShape * CreateShape(btTriangleIndexVertexArray * mesh);
+
+	/// true if BVHs have been built since Load
+	bool Changed() const { return misses > 0; }
+
+	/// write the BVHs of the created shapes, call before the shapes are deleted
+	bool Write(std::ostream & out) const;
+
+	/// write to filename if changed, through a temporary file
+	bool Save(const std::string & filename, std::ostream & error_output) const;
+
+	/// number of shapes with a cached BVH
+	int GetHits() const { return hits; }
+
+	/// number of shapes with a built BVH
+	int GetMisses() const { return misses; }
+
+	/// hash of the vertex and index data of mesh
+	static uint64_t GetHash(const btTriangleIndexVertexArray & mesh);
+
+private:
+	struct MappedFile;
+	std::unique_ptr<MappedFile> file;
+
+	struct Entry
+	{
+		Entry() : data(0), size(0), bvh(0) {}
+		char * data; ///< serialized BVH in the cache data, null if built
+		unsigned size;
+		btOptimizedBvh * bvh; ///< BVH in use, null if not used since Load
+	};
+	std::unordered_map<uint64_t, Entry> entries;
+	std::mutex mutex; ///< guards entries, hits and misses during CreateShape
+	int hits;
+	int misses;
+};
+
+#endif // _BVHCACHE_H
@@ -28,16 +28,25 @@
 #include "cfg/ptree.h"
 #include "fastmath.h"
 #include "minmax.h"
+#include "fracturedispatcher.h"
+#include "joeserialize.h"
+#include "unittest.h"
 
+#include "BulletCollision/CollisionShapes/btBoxShape.h"
 #include "BulletCollision/CollisionShapes/btCompoundShape.h"
 #include "BulletCollision/CollisionShapes/btCylinderShape.h"
 #include "BulletCollision/CollisionShapes/btTriangleShape.h"
+#include "BulletCollision/CollisionDispatch/btDefaultCollisionConfiguration.h"
+#include "BulletCollision/BroadphaseCollision/btDbvtBroadphase.h"
+#include "BulletDynamics/ConstraintSolver/btSequentialImpulseConstraintSolver.h"
 
 #include <cmath>
+#include <sstream>
 
 static const btScalar gravity = 9.81;
-static const int substeps = 10;
-static const btScalar rsubsteps = 1.0/substeps;
+static const int substeps_full = 10;
+static const int substeps_reduced = 4;
+static const btScalar sleep_velocity = 0.1; // body and wheel surface speed a car may sleep at
 
 static inline std::istream & operator >> (std::istream & lhs, btVector3 & rhs)
 {
@@ -560,6 +569,7 @@ bool CarDynamics::Load(
 	const btVector3 & position,
 	const btQuaternion & rotation,
 	const bool damage,
+	const bool tire_tables,
 	DynamicsWorld & world,
 	ContentManager & content,
 	std::ostream & error)
@@ -641,6 +651,17 @@ bool CarDynamics::Load(
 		i++;
 	}
 
+	#if !defined(VDRIFTP) && !defined(VDRIFTN)
+	if (tire_tables)
+	{
+		for (int i = 0; i < WHEEL_COUNT; ++i)
+			tire[i].initTable();
+	}
+	#else
+	(void)tire_tables;
+	#endif
+	tire_batch.init(tire, WHEEL_COUNT);
+
 	// load children bodies
 	for (const auto & node : cfg)
 	{
@@ -654,20 +675,21 @@ bool CarDynamics::Load(
 	}
 
 	if (drive == AWD)
-		InitDriveline4(world.getTimeStep() * rsubsteps);
+		InitDriveline4(world.getTimeStep() / substeps);
 	else
-		InitDriveline2(world.getTimeStep() * rsubsteps);
+		InitDriveline2(world.getTimeStep() / substeps);
 
 	transform.setRotation(rotation);
 	transform.setOrigin(position);
 
 	body = new FractureBody(bodyinfo);
 	body->setCenterOfMassTransform(transform);
-	body->setActivationState(DISABLE_DEACTIVATION);
+	body->setSleepingThresholds(sleep_velocity, sleep_velocity);
 	body->setContactProcessingThreshold(0.0);
 	body->setCollisionFlags(body->getCollisionFlags() | btCollisionObject::CF_CUSTOM_MATERIAL_CALLBACK);
 	world.addRigidBody(body);
 	world.addAction(this);
+	world.addCar(this);
 	this->world = &world;
 
 	// position is the center of a 2 x 4 x 1 meter box on track surface
@@ -714,6 +736,7 @@ bool CarDynamics::Load(
 void CarDynamics::SetPosition(const btVector3 & position)
 {
 	body->translate(position - body->getCenterOfMassPosition());
+	body->activate();
 	transform.setOrigin(position);
 	for (int i = 0; i < WHEEL_COUNT; ++i)
 		wheel_position[i] = transform.getBasis() * (suspension[i]->GetWheelPosition() + GetCenterOfMassOffset());
@@ -865,6 +888,13 @@ void CarDynamics::Update(const std::vector<float> & inputs)
 	// reset car after a rollover
 	if (inputs[CarInput::ROLLOVER])
 		RolloverRecover();
+
+	// keep the car awake while driven, wake it on input changes
+	if (throttle_input > 1E-3f || inputs[CarInput::NOS] > 0 || inputs != last_inputs)
+	{
+		last_inputs = inputs;
+		body->activate();
+	}
 }
 
 void CarDynamics::debugDraw(btIDebugDraw*)
@@ -1028,6 +1058,28 @@ btScalar CarDynamics::GetMaxSpeed(btScalar radius, btScalar friction) const
 	return v;
 }
 
+void CarDynamics::SetReducedDetail(bool value)
+{
+	if (value == reduced_detail)
+		return;
+
+	reduced_detail = value;
+	substeps = value ? substeps_reduced : substeps_full;
+	if (!body)
+		return;
+
+	// differential clutch limits are impulses per substep
+	if (drive == AWD)
+		InitDriveline4(world->getTimeStep() / substeps);
+	else
+		InitDriveline2(world->getTimeStep() / substeps);
+}
+
+bool CarDynamics::GetReducedDetail() const
+{
+	return reduced_detail;
+}
+
 btScalar CarDynamics::GetBrakeDistance(btScalar initial_speed, btScalar final_speed, btScalar friction) const
 {
 	if (initial_speed <= final_speed)
@@ -1046,6 +1098,18 @@ btScalar CarDynamics::GetBrakeDistance(btScalar initial_speed, btScalar final_sp
 	return distance;
 }
 
+btScalar CarDynamics::GetBrakeSpeed(btScalar distance, btScalar final_speed, btScalar friction) const
+{
+	// solve GetBrakeDistance for the initial speed
+	btScalar mu = friction * lon_friction_coeff;
+	btScalar vf2 = final_speed * final_speed;
+	btScalar d = (-aero_lift_coeff * mu + aero_drag_coeff) * GetInvMass();
+	btScalar e = 1 / d;
+	btScalar f = e * mu * gravity;
+	btScalar vi2 = (f + vf2) * std::exp(2 * distance / e) - f;
+	return std::sqrt(Max(vi2, vf2));
+}
+
 std::vector<float> CarDynamics::GetSpecs() const
 {
 	return std::vector<float>{
@@ -1192,6 +1256,9 @@ void CarDynamics::UpdateSuspension(int i, btScalar dt)
 // executed as last function(after integration) in bullet singlestepsimulation
 void CarDynamics::updateAction(btCollisionWorld * /*collisionWorld*/, btScalar dt)
 {
+	if (!body->isActive())
+		return;
+
 	// reset body transform
 	body->setCenterOfMassTransform(transform);
 
@@ -1228,25 +1295,67 @@ void CarDynamics::updateAction(btCollisionWorld * /*collisionWorld*/, btScalar d
 	body->predictIntegratedTransform(dt, transform);
 	body->setCenterOfMassTransform(transform);
 	UpdateWheelTransform();
+
+	// spinning wheels keep the car awake, bullet checks the body velocity
+	for (int i = 0; i < WHEEL_COUNT; ++i)
+	{
+		if (btFabs(wheel[i].GetAngularVelocity() * wheel[i].GetRadius()) > sleep_velocity)
+		{
+			body->activate();
+			break;
+		}
+	}
 }
 
 void CarDynamics::UpdateWheelContacts()
 {
-	btVector3 raydir = GetDownVector();
+	if (!wheel_rays_prepared)
+		PrepareWheelRays();
+	wheel_rays_prepared = false;
+
+	world->castRaysWorld(wheel_ray, wheel_ray_count);
+}
+
+bool CarDynamics::InterpolateWheelContacts()
+{
+	wheel_contacts_interpolated = reduced_detail && !wheel_contacts_interpolated;
+	return wheel_contacts_interpolated;
+}
+
+void CarDynamics::PrepareWheelRays()
+{
+	// updateAction resets the body to transform before the contacts are used,
+	// so the rays are the same whether they are prepared before or in it
+	const bool interpolate = InterpolateWheelContacts();
+
+	btVector3 raydir = -transform.getBasis().getColumn(2);
 	btScalar raylen = 4;
+	wheel_ray_count = 0;
 	for (int i = 0; i < WHEEL_COUNT; ++i)
 	{
-		btVector3 raystart = body->getCenterOfMassPosition() + wheel_position[i] - raydir * wheel[i].GetRadius();
+		btVector3 raystart = transform.getOrigin() + wheel_position[i] - raydir * wheel[i].GetRadius();
 		if (body->getChildBody(i)->isInWorld())
 		{
 			// wheel separated
 			wheel_contact[i] = CollisionContact(raystart, raydir, raylen, -1, 0, TrackSurface::None(), 0);
 		}
+		else if (interpolate)
+		{
+			wheel_contact[i].CastRay(raystart, raydir, raylen);
+		}
 		else
 		{
-			world->castRay(raystart, raydir, raylen, body, wheel_contact[i]);
+			DynamicsWorld::Ray & ray = wheel_ray[wheel_ray_count++];
+			ray.origin = raystart;
+			ray.direction = raydir;
+			ray.length = raylen;
+			ray.caster = body;
+			ray.contact = &wheel_contact[i];
+			ray.track_cast = false;
 		}
 	}
+	world->castRaysTrack(wheel_ray, wheel_ray_count);
+	wheel_rays_prepared = true;
 }
 
 void CarDynamics::InitDriveline2(btScalar dt)
@@ -1308,6 +1417,8 @@ void CarDynamics::UpdateDrivelineGearRatio()
 
 void CarDynamics::SetupDriveline(const btMatrix3x3 wheel_orientation[WHEEL_COUNT], btScalar dt)
 {
+	const btScalar rsubsteps = btScalar(1) / substeps;
+
 	auto & c = driveline.clutch[0];
 	c.impulse_limit_delta = (clutch.GetTorque() * dt - c.impulse_limit) * rsubsteps;
 
@@ -1436,18 +1547,34 @@ void CarDynamics::ApplyRollingResistance(int i)
 
 void CarDynamics::UpdateWheelConstraints(btScalar rdt, btScalar sdt)
 {
+	// gather wheel states, tire forces are evaluated for all wheels at once
+	btScalar suspension_force[WHEEL_COUNT], friction[WHEEL_COUNT], camber[WHEEL_COUNT];
+	btScalar rot_velocity[WHEEL_COUNT], lon_velocity[WHEEL_COUNT], lat_velocity[WHEEL_COUNT];
 	for (int i = 0; i < WHEEL_COUNT; ++i)
 	{
-		auto & c = wheel_constraint[i];
+		const auto & c = wheel_constraint[i];
 		btScalar v[3];
 		c.getContactVelocity(v);
-		btScalar suspension_force = c.constraint[2].impulse * rdt;
-		btVector3 tire_force = tire[i].getForce(suspension_force, c.friction, c.camber, v[2], v[0], v[1]);
-		c.constraint[0].upper_impulse_limit = Max(tire_force[0] * sdt, btScalar(0));
-		c.constraint[0].lower_impulse_limit = Min(tire_force[0] * sdt, btScalar(0));
+		suspension_force[i] = c.constraint[2].impulse * rdt;
+		friction[i] = c.friction;
+		camber[i] = c.camber;
+		rot_velocity[i] = v[2];
+		lon_velocity[i] = v[0];
+		lat_velocity[i] = v[1];
+	}
+
+	btVector3 tire_force[WHEEL_COUNT];
+	tire_batch.getForces(tire, WHEEL_COUNT, suspension_force, friction, camber,
+		rot_velocity, lon_velocity, lat_velocity, tire_force);
+
+	for (int i = 0; i < WHEEL_COUNT; ++i)
+	{
+		auto & c = wheel_constraint[i];
+		c.constraint[0].upper_impulse_limit = Max(tire_force[i][0] * sdt, btScalar(0));
+		c.constraint[0].lower_impulse_limit = Min(tire_force[i][0] * sdt, btScalar(0));
 		c.constraint[0].impulse = 0;
-		c.constraint[1].upper_impulse_limit = Max(tire_force[1] * sdt, btScalar(0));
-		c.constraint[1].lower_impulse_limit = Min(tire_force[1] * sdt, btScalar(0));
+		c.constraint[1].upper_impulse_limit = Max(tire_force[i][1] * sdt, btScalar(0));
+		c.constraint[1].lower_impulse_limit = Min(tire_force[i][1] * sdt, btScalar(0));
 		c.constraint[1].impulse = 0;
 	}
 }
@@ -1456,9 +1583,10 @@ void CarDynamics::UpdateDriveline(btScalar dt)
 {
 	const int solver_iterations = 4;
 	const btScalar rdt = 1 / dt;
-	const btScalar sdt = dt * rsubsteps;
+	const btScalar sdt = dt / substeps;
 
 	UpdateWheelContacts();
+
 	btMatrix3x3 wheel_orientation[WHEEL_COUNT];
 	for (int i = 0; i < WHEEL_COUNT; ++i)
 	{
@@ -1848,6 +1976,7 @@ void CarDynamics::Clear()
 		}
 		delete child;
 	}
+	world->removeCar(this);
 	world->removeAction(this);
 	world->removeRigidBody(body);
 	world = 0;
@@ -1904,6 +2033,11 @@ void CarDynamics::Init()
 	autoshift = false;
 	abs = false;
 	tcs = false;
+	wheel_ray_count = 0;
+	wheel_rays_prepared = false;
+	wheel_contacts_interpolated = false;
+	reduced_detail = false;
+	substeps = substeps_full;
 	for (int i = 0; i < WHEEL_COUNT; ++i)
 	{
 		wheel_velocity[i][0] = 0;
@@ -1979,3 +2113,49 @@ const btCollisionObject & CarDynamics::getCollisionObject() const
 {
 	return *static_cast<btCollisionObject*>(body);
 }
+
+QT_TEST(cardynamics_sleep_test)
+{
+	btDefaultCollisionConfiguration config;
+	FractureDispatcher dispatcher(&config);
+	btDbvtBroadphase broadphase;
+	btSequentialImpulseConstraintSolver solver;
+	DynamicsWorld world(&dispatcher, &broadphase, &solver, &config);
+
+	btBoxShape groundShape(btVector3(100, 100, 1));
+	btCollisionObject ground;
+	ground.setCollisionShape(&groundShape);
+	ground.getWorldTransform().setOrigin(btVector3(0, 0, -1));
+	world.addCollisionObject(&ground);
+
+	// a car body falling onto the ground
+	btBoxShape boxShape(btVector3(1, 1, 1));
+	btRigidBody box(1, 0, &boxShape, btVector3(1, 1, 1));
+	box.setSleepingThresholds(sleep_velocity, sleep_velocity);
+	box.getWorldTransform().setOrigin(btVector3(0, 0, 3));
+	world.addRigidBody(&box);
+
+	// recording a state does not touch the body
+	std::ostringstream state;
+	joeserialize::BinaryOutputSerializer output(state);
+	QT_CHECK(Serializex(output, box));
+	QT_CHECK(box.isActive());
+
+	// at rest it goes to sleep
+	for (int i = 0; i < 1000 && box.isActive(); ++i)
+		world.update(world.getTimeStep());
+	QT_CHECK(!box.isActive());
+	QT_CHECK(box.getCenterOfMassPosition().z() < 1.1);
+
+	// a replayed state wakes it up, it falls again
+	std::istringstream instate(state.str());
+	joeserialize::BinaryInputSerializer input(instate);
+	QT_CHECK(Serializex(input, box));
+	QT_CHECK(box.isActive());
+	QT_CHECK_CLOSE(box.getCenterOfMassPosition().z(), 3.0, 1E-6);
+	world.update(world.getTimeStep());
+	QT_CHECK(box.getCenterOfMassPosition().z() < 3);
+
+	world.removeRigidBody(&box);
+	world.removeCollisionObject(&ground);
+}
@@ -28,6 +28,7 @@
 #include "carsuspension.h"
 #include "carwheel.h"
 #include "cartire.h"
+#include "tirebatch.h"
 #include "carbrake.h"
 #include "carwheelposition.h"
 #include "aerodevice.h"
@@ -35,6 +36,7 @@
 #include "wheelconstraint.h"
 #include "driveline.h"
 #include "motionstate.h"
+#include "dynamicsworld.h"
 #include "macros.h"
 
 #include "BulletDynamics/Dynamics/btActionInterface.h"
@@ -43,7 +45,6 @@ struct btCollisionObjectWrapper;
 class btCollisionWorld;
 class btManifoldPoint;
 class btIDebugDraw;
-class DynamicsWorld;
 class FractureBody;
 class ContentManager;
 class PTree;
@@ -60,6 +61,7 @@ public:
 	~CarDynamics();
 
 	// tirealt is optional tire config, overrides default tire type
+	// tire_tables bakes tire force lookup tables (default tire model only)
 	bool Load(
 		const PTree & cfg,
 		const std::string & cardir,
@@ -67,6 +69,7 @@ public:
 		const btVector3 & position,
 		const btQuaternion & rotation,
 		const bool damage,
+		const bool tire_tables,
 		DynamicsWorld & world,
 		ContentManager & content,
 		std::ostream & error);
@@ -86,6 +89,7 @@ public:
 	void SetTCS(bool value);
 
 	// update dynamics from car input vector
+	// a car at rest without throttle goes to sleep, input changes and contacts wake it
 	void Update(const std::vector<float> & inputs);
 
 	// bullet interface
@@ -109,6 +113,10 @@ public:
 	const CollisionContact & GetWheelContact(WheelPosition wp) const;
 	CollisionContact & GetWheelContact(WheelPosition wp);
 
+	// build the wheel rays of the next updateAction and test them against the
+	// road patches, only touches this car, the world calls it for all cars in parallel
+	void PrepareWheelRays();
+
 	// body
 	const btVector3 & GetCenterOfMass() const;
 	const btVector3 & GetVelocity() const;
@@ -154,9 +162,19 @@ public:
 	// Maxumum speed for a curve with given radius and friction coefficient
 	btScalar GetMaxSpeed(btScalar radius, btScalar friction) const;
 
+	// Reduced detail for distant cars: fewer driveline substeps and tire
+	// force evaluations, wheel rays cast every other step and moved along
+	// the last contact planes in between. Can be switched at any step.
+	void SetReducedDetail(bool value);
+
+	bool GetReducedDetail() const;
+
 	// Distance required to reduce initial to final speed
 	btScalar GetBrakeDistance(btScalar initial_speed, btScalar final_speed, btScalar friction) const;
 
+	// Highest initial speed that can be reduced to final speed within distance, inverse of GetBrakeDistance
+	btScalar GetBrakeSpeed(btScalar distance, btScalar final_speed, btScalar friction) const;
+
 	// This is needed for ray casts in the AI implementation.
 	DynamicsWorld * getDynamicsWorld() const {return world;}
 
@@ -206,6 +224,7 @@ protected:
 	CarBrake brake[WHEEL_COUNT];
 	CarWheel wheel[WHEEL_COUNT];
 	CarTire tire[WHEEL_COUNT];
+	TireBatch<CarTire> tire_batch;
 	CarSuspension* suspension[WHEEL_COUNT];
 	WheelConstraint wheel_constraint[WHEEL_COUNT];
 	Driveline driveline;
@@ -214,6 +233,17 @@ protected:
 	CollisionContact wheel_contact[WHEEL_COUNT];
 	btVector3 wheel_position[WHEEL_COUNT];
 	btScalar wheel_velocity[WHEEL_COUNT][3];
+	DynamicsWorld::Ray wheel_ray[WHEEL_COUNT];
+	int wheel_ray_count;
+	bool wheel_rays_prepared;
+	bool wheel_contacts_interpolated;
+
+	// detail level
+	bool reduced_detail;
+	int substeps;
+
+	// inputs of the last update, changes wake a sleeping car
+	std::vector<float> last_inputs;
 
 	// traction control state
 	bool abs_active[WHEEL_COUNT];
@@ -266,6 +296,10 @@ protected:
 
 	void UpdateWheelContacts();
 
+	// reduced detail cars cast wheel rays every other step, in between the
+	// contacts are moved along their planes, call once per step
+	bool InterpolateWheelContacts();
+
 	void InitDriveline2(btScalar dt);
 
 	void InitDriveline4(btScalar dt);
@@ -481,6 +515,10 @@ inline bool Serializex(Serializer & s, btRigidBody & b)
 	b.setCenterOfMassTransform(t);
 	b.setLinearVelocity(v);
 	b.setAngularVelocity(w);
+
+	// a restored state has to be simulated, the body may be asleep
+	if (s.GetIODirection() == Serializer::DIRECTION_INPUT)
+		b.activate(true);
 	return true;
 }
 
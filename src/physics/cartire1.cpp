@@ -18,6 +18,7 @@
 /************************************************************************/
 
 #include "cartire1.h"
+#include "cartire1table.h"
 #include "fastmath.h"
 #include "minmax.h"
 #include <cassert>
@@ -55,6 +56,12 @@ void CarTire1::init(const CarTireInfo1 & info)
 {
 	CarTireInfo1::operator=(info);
 	initSigmaHatAlphaHat();
+	table.reset();
+}
+
+void CarTire1::initTable()
+{
+	table = CarTire1Table::get(*this);
 }
 
 btVector3 CarTire1::getForce(
@@ -88,13 +95,23 @@ btVector3 CarTire1::getForce(
 	btScalar sigma = (rot_velocity - lon_velocity) * rcp_lon_velocity;
 	btScalar alpha = -Atan(lat_velocity * rcp_lon_velocity) * rad2deg;
 	btScalar gamma = camber * rad2deg;
-	btScalar max_Fx(0), max_Fy(0), max_Mz(0);
-
-	btScalar Fx0 = PacejkaFx(sigma, Fz, friction_coeff, max_Fx);
-	btScalar Fy0 = PacejkaFy(alpha, Fz, gamma, friction_coeff, max_Fy);
-	btScalar Mz = PacejkaMz(alpha, Fz, gamma, friction_coeff, max_Mz);
-	btScalar Gx = PacejkaGx(sigma, alpha * deg2rad);
-	btScalar Gy = PacejkaGy(sigma, alpha * deg2rad);
+	btScalar Fx0, Fy0, Mz, Gx, Gy;
+	if (table)
+	{
+		table->getForce(Fz, sigma, alpha, gamma, Fx0, Fy0, Mz, Gx, Gy);
+		Fx0 *= friction_coeff;
+		Fy0 *= friction_coeff;
+		Mz *= friction_coeff;
+	}
+	else
+	{
+		btScalar max_Fx(0), max_Fy(0), max_Mz(0);
+		Fx0 = PacejkaFx(sigma, Fz, friction_coeff, max_Fx);
+		Fy0 = PacejkaFy(alpha, Fz, gamma, friction_coeff, max_Fy);
+		Mz = PacejkaMz(alpha, Fz, gamma, friction_coeff, max_Mz);
+		Gx = PacejkaGx(sigma, alpha * deg2rad);
+		Gy = PacejkaGy(sigma, alpha * deg2rad);
+	}
 	btScalar Fx = Gx * Fx0;
 	btScalar Fy = Gy * Fy0;
 
@@ -229,7 +246,7 @@ inline btScalar btCosAtan(btScalar x)
 	return btRecipSqrt(1 + x * x);
 }
 
-btScalar CarTire1::PacejkaGx(btScalar sigma, btScalar alpha)
+btScalar CarTire1::PacejkaGx(btScalar sigma, btScalar alpha) const
 {
 	const std::vector<btScalar> & p = combining;
 	btScalar B = p[2] * btCosAtan(p[3] * sigma);
@@ -237,7 +254,7 @@ btScalar CarTire1::PacejkaGx(btScalar sigma, btScalar alpha)
 	return G;
 }
 
-btScalar CarTire1::PacejkaGy(btScalar sigma, btScalar alpha)
+btScalar CarTire1::PacejkaGy(btScalar sigma, btScalar alpha) const
 {
 	const std::vector<btScalar> & p = combining;
 	btScalar B = p[0] * btCosAtan(p[1] * alpha);
@@ -23,6 +23,7 @@
 #include "LinearMath/btVector3.h"
 #include "macros.h"
 
+#include <memory>
 #include <vector>
 
 struct CarTireInfo1
@@ -39,13 +40,24 @@ struct CarTireInfo1
 	CarTireInfo1();
 };
 
+template <class Tire> class TireBatch;
+class CarTire1Table;
+
 class CarTire1 : private CarTireInfo1
 {
+template <class Tire> friend class TireBatch;
+friend class CarTire1Table;
 public:
 	CarTire1();
 
 	void init(const CarTireInfo1 & info);
 
+	/// bake force lookup tables, getForce interpolates them afterwards
+	void initTable();
+
+	/// true if getForce uses lookup tables
+	bool hasTable() const;
+
 	/// get tire tread fraction
 	btScalar getTread() const;
 
@@ -94,6 +106,7 @@ private:
 	btScalar ideal_slide; ///< ideal slide ratio
 	btScalar ideal_slip; ///< ideal slip angle
 	btScalar fx, fy, fz, mz;
+	std::shared_ptr<const CarTire1Table> table;
 
 	/// pacejka magic formula function, longitudinal
 	btScalar PacejkaFx(btScalar sigma, btScalar Fz, btScalar friction_coeff, btScalar & max_Fx) const;
@@ -105,10 +118,10 @@ private:
 	btScalar PacejkaMz(btScalar alpha, btScalar Fz, btScalar gamma, btScalar friction_coeff, btScalar & max_Mz) const;
 
 	/// pacejka magic formula longitudinal combining factor
-	btScalar PacejkaGx(btScalar sigma, btScalar alpha);
+	btScalar PacejkaGx(btScalar sigma, btScalar alpha) const;
 
 	/// pacejka magic formula lateral combining factor
-	btScalar PacejkaGy(btScalar sigma, btScalar alpha);
+	btScalar PacejkaGy(btScalar sigma, btScalar alpha) const;
 
 	void getSigmaHatAlphaHat(btScalar load, btScalar & sh, btScalar & ah) const;
 
@@ -128,6 +141,11 @@ inline btScalar CarTire1::getTread() const
 	return tread;
 }
 
+inline bool CarTire1::hasTable() const
+{
+	return bool(table);
+}
+
 inline btScalar CarTire1::getSlip() const
 {
 	return slide;
@@ -0,0 +1,316 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#include "cartire1table.h"
+#include "cartire1.h"
+#include "minmax.h"
+#include "testfixtures.h"
+#include "unittest.h"
+#include "microbench.h"
+
+#include <cmath>
+#include <map>
+#include <mutex>
+
+static const btScalar deg2rad = M_PI / 180;
+static const btScalar rad2deg = 180 / M_PI;
+
+// Sample axis v(u) = k * u / (1 - |u|) over n uniform nodes in [-umax, umax],
+// nodes are spaced about k apart near zero and get sparse towards vmax.
+struct Axis
+{
+	btScalar k;
+	btScalar umax;
+	int n;
+
+	Axis(btScalar k, btScalar vmax, int n) : k(k), umax(vmax / (vmax + k)), n(n) {}
+
+	btScalar value(int i) const
+	{
+		btScalar u = umax * (btScalar(2 * i) / (n - 1) - 1);
+		return k * u / (1 - std::abs(u));
+	}
+
+	void index(btScalar v, int & i, btScalar & f) const
+	{
+		btScalar u = v / (std::abs(v) + k);
+		btScalar x = (Clamp(u, -umax, umax) / umax + 1) * btScalar(0.5 * (n - 1));
+		i = Min(int(x), n - 2);
+		f = x - i;
+	}
+};
+
+// load in kN, clamped to 30 by getForce, the curve shapes change fastest at
+// low load, so nodes are spaced quadratically
+static const btScalar load_max = 30;
+static const int load_n = 41;
+
+// camber in deg, sin camber is clamped to 0.3 by getForce
+static const btScalar camber_max = (0.3 + 0.3 * 0.3 * 0.3 / 6) * rad2deg;
+static const int camber_n = 9;
+
+// slip ratio, Fx is flat beyond 100
+static const Axis slip_axis(0.1, 100, 129);
+
+// slip angle in deg, Atan output range
+static const Axis angle_axis(4, 90, 129);
+
+// the formulas are singular at zero load, sample its limit
+static inline btScalar LoadNode(int i)
+{
+	btScalar t = btScalar(i) / (load_n - 1);
+	return Max(load_max * t * t, btScalar(1E-3));
+}
+
+static inline void LoadIndex(btScalar Fz, int & i, btScalar & f)
+{
+	btScalar x = std::sqrt(Min(Fz, load_max) * (1 / load_max)) * (load_n - 1);
+	i = Min(int(x), load_n - 2);
+	f = x - i;
+}
+
+static inline void LinearIndex(btScalar v, btScalar vmin, btScalar vmax, int n, int & i, btScalar & f)
+{
+	btScalar x = (Clamp(v, vmin, vmax) - vmin) * ((n - 1) / (vmax - vmin));
+	i = Min(int(x), n - 2);
+	f = x - i;
+}
+
+static inline btScalar Lerp(btScalar a, btScalar b, btScalar f)
+{
+	return a + (b - a) * f;
+}
+
+void CarTire1Table::init(const CarTire1 & tire)
+{
+	btScalar max;
+
+	fx.resize(load_n * slip_axis.n);
+	for (int l = 0; l < load_n; ++l)
+	{
+		btScalar Fz = LoadNode(l);
+		for (int s = 0; s < slip_axis.n; ++s)
+		{
+			fx[l * slip_axis.n + s] = tire.PacejkaFx(slip_axis.value(s), Fz, 1, max);
+		}
+	}
+
+	fymz.resize(load_n * camber_n * angle_axis.n * 2);
+	for (int l = 0; l < load_n; ++l)
+	{
+		btScalar Fz = LoadNode(l);
+		for (int c = 0; c < camber_n; ++c)
+		{
+			btScalar gamma = camber_max * (btScalar(2 * c) / (camber_n - 1) - 1);
+			for (int a = 0; a < angle_axis.n; ++a)
+			{
+				btScalar alpha = angle_axis.value(a);
+				float * v = &fymz[((l * camber_n + c) * angle_axis.n + a) * 2];
+				v[0] = tire.PacejkaFy(alpha, Fz, gamma, 1, max);
+				v[1] = tire.PacejkaMz(alpha, Fz, gamma, 1, max);
+			}
+		}
+	}
+
+	gxgy.resize(slip_axis.n * angle_axis.n * 2);
+	for (int s = 0; s < slip_axis.n; ++s)
+	{
+		btScalar sigma = slip_axis.value(s);
+		for (int a = 0; a < angle_axis.n; ++a)
+		{
+			btScalar alpha = angle_axis.value(a) * deg2rad;
+			float * v = &gxgy[(s * angle_axis.n + a) * 2];
+			v[0] = tire.PacejkaGx(sigma, alpha);
+			v[1] = tire.PacejkaGy(sigma, alpha);
+		}
+	}
+}
+
+void CarTire1Table::getForce(
+	btScalar Fz,
+	btScalar sigma,
+	btScalar alpha,
+	btScalar gamma,
+	btScalar & Fx0,
+	btScalar & Fy0,
+	btScalar & Mz,
+	btScalar & Gx,
+	btScalar & Gy) const
+{
+	int l, c, s, a;
+	btScalar fl, fc, fs, fa;
+	LoadIndex(Fz, l, fl);
+	LinearIndex(gamma, -camber_max, camber_max, camber_n, c, fc);
+	slip_axis.index(sigma, s, fs);
+	angle_axis.index(alpha, a, fa);
+
+	// Fx0(load, slip ratio)
+	const float * x0 = &fx[l * slip_axis.n + s];
+	const float * x1 = x0 + slip_axis.n;
+	Fx0 = Lerp(Lerp(x0[0], x0[1], fs), Lerp(x1[0], x1[1], fs), fl);
+
+	// Fy0, Mz(load, camber, slip angle)
+	const int cs = angle_axis.n * 2;
+	const int ls = camber_n * cs;
+	const float * y00 = &fymz[l * ls + c * cs + a * 2];
+	const float * y01 = y00 + cs;
+	const float * y10 = y00 + ls;
+	const float * y11 = y10 + cs;
+	btScalar v[2];
+	for (int k = 0; k < 2; ++k)
+	{
+		btScalar v0 = Lerp(Lerp(y00[k], y00[k + 2], fa), Lerp(y01[k], y01[k + 2], fa), fc);
+		btScalar v1 = Lerp(Lerp(y10[k], y10[k + 2], fa), Lerp(y11[k], y11[k + 2], fa), fc);
+		v[k] = Lerp(v0, v1, fl);
+	}
+	Fy0 = v[0];
+	Mz = v[1];
+
+	// Gx, Gy(slip ratio, slip angle)
+	const float * g0 = &gxgy[(s * angle_axis.n + a) * 2];
+	const float * g1 = g0 + cs;
+	Gx = Lerp(Lerp(g0[0], g0[2], fa), Lerp(g1[0], g1[2], fa), fs);
+	Gy = Lerp(Lerp(g0[1], g0[3], fa), Lerp(g1[1], g1[3], fa), fs);
+}
+
+size_t CarTire1Table::getSize() const
+{
+	return (fx.size() + fymz.size() + gxgy.size()) * sizeof(float);
+}
+
+std::shared_ptr<const CarTire1Table> CarTire1Table::get(const CarTire1 & tire)
+{
+	// cars of a kind share their tire parameters, bake those once
+	static std::map<std::vector<btScalar>, std::weak_ptr<const CarTire1Table> > tables;
+	static std::mutex tables_mutex;
+
+	const CarTireInfo1 & info = tire;
+	std::vector<btScalar> key(info.longitudinal);
+	key.insert(key.end(), info.lateral.begin(), info.lateral.end());
+	key.insert(key.end(), info.aligning.begin(), info.aligning.end());
+	key.insert(key.end(), info.combining.begin(), info.combining.end());
+
+	// cars load in parallel, drop tables of unloaded cars on the way
+	std::lock_guard<std::mutex> lock(tables_mutex);
+	for (auto i = tables.begin(); i != tables.end();)
+	{
+		if (i->second.expired())
+			i = tables.erase(i);
+		else
+			++i;
+	}
+
+	std::shared_ptr<const CarTire1Table> table = tables[key].lock();
+	if (!table)
+	{
+		std::shared_ptr<CarTire1Table> new_table = std::make_shared<CarTire1Table>();
+		new_table->init(tire);
+		tables[key] = new_table;
+		table = new_table;
+	}
+	return table;
+}
+
+QT_TEST(cartire1table_test)
+{
+	CarTire1 tire, tire_table;
+	tire.init(TestTireInfo());
+	tire_table.init(TestTireInfo());
+	tire_table.initTable();
+	QT_CHECK(tire_table.hasTable());
+
+	// equal parameters share a table
+	CarTire1 tire_shared;
+	tire_shared.init(TestTireInfo());
+	QT_CHECK(CarTire1Table::get(tire_shared) == CarTire1Table::get(tire_table));
+
+	// error relative to the peak force at the given load, over the
+	// load, slip ratio, slip angle and camber envelope
+	btScalar max_error[3] = {0, 0, 0};
+	btScalar max_error_low_load[3] = {0, 0, 0};
+	const btScalar speed = 30;
+	for (btScalar load = 250; load <= 12000; load *= 1.37f)
+	{
+		btScalar peak[3] = {tire.getMaxFx(load), tire.getMaxFy(load, 0), 0};
+		for (btScalar angle = -0.6f; angle <= 0.6f; angle += 0.01f)
+		for (btScalar camber = -0.25f; camber <= 0.25f; camber += 0.01f)
+		{
+			btScalar mz = tire.getForce(load, 1, camber, speed, speed, speed * std::tan(angle))[2];
+			peak[2] = Max(peak[2], std::abs(mz));
+		}
+
+		btScalar * error = (load < 500) ? max_error_low_load : max_error;
+		for (btScalar ratio = -1; ratio <= 1; ratio += 0.0173f)
+		for (btScalar angle = -0.6f; angle <= 0.6f; angle += 0.0131f)
+		for (btScalar camber = -0.25f; camber <= 0.25f; camber += 0.073f)
+		{
+			btScalar rot_velocity = speed * (1 + ratio);
+			btScalar lat_velocity = speed * std::tan(angle);
+			btVector3 f0 = tire.getForce(load, 1, camber, rot_velocity, speed, lat_velocity);
+			btVector3 f1 = tire_table.getForce(load, 1, camber, rot_velocity, speed, lat_velocity);
+			for (int k = 0; k < 3; ++k)
+				error[k] = Max(error[k], std::abs(f0[k] - f1[k]) / peak[k]);
+		}
+	}
+	for (int k = 0; k < 3; ++k)
+	{
+		QT_CHECK_LESS(max_error[k], 0.01f);
+		QT_CHECK_LESS(max_error_low_load[k], 0.02f);
+	}
+}
+
+MICROBENCH(cartire1table)
+{
+	const int count = 64 * 4;
+	std::vector<CarTire1> tire(count), tire_table(count);
+	for (int i = 0; i < count; ++i)
+	{
+		tire[i].init(TestTireInfo());
+		tire_table[i].init(TestTireInfo());
+		tire_table[i].initTable();
+	}
+
+	std::vector<btScalar> normal_force(count), sin_camber(count);
+	std::vector<btScalar> rot_velocity(count), lon_velocity(count), lat_velocity(count);
+	for (int i = 0; i < count; ++i)
+	{
+		normal_force[i] = 2000 + 37 * (i % 97);
+		sin_camber[i] = 0.01f * (i % 7) - 0.03f;
+		lon_velocity[i] = 5 + (i % 50);
+		rot_velocity[i] = lon_velocity[i] * (1 + 0.01f * ((i % 21) - 10));
+		lat_velocity[i] = lon_velocity[i] * 0.01f * ((i % 13) - 6);
+	}
+
+	// one substep of 64 cars
+	bench.measure("analytic", count, [&]()
+	{
+		btVector3 f(0, 0, 0);
+		for (int i = 0; i < count; ++i)
+			f += tire[i].getForce(normal_force[i], 1, sin_camber[i], rot_velocity[i], lon_velocity[i], lat_velocity[i]);
+		microbench::consume(f);
+	});
+
+	bench.measure("table", count, [&]()
+	{
+		btVector3 f(0, 0, 0);
+		for (int i = 0; i < count; ++i)
+			f += tire_table[i].getForce(normal_force[i], 1, sin_camber[i], rot_velocity[i], lon_velocity[i], lat_velocity[i]);
+		microbench::consume(f);
+	});
+}
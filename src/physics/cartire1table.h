@@ -0,0 +1,68 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef _CARTIRE1TABLE_H
+#define _CARTIRE1TABLE_H
+
+#include "LinearMath/btScalar.h"
+
+#include <memory>
+#include <vector>
+
+class CarTire1;
+
+/// Baked CarTire1 force response. The magic formula terms are sampled at
+/// unit friction over load, slip ratio, slip angle and camber, getForce
+/// replaces their evaluation by multilinear interpolation.
+/// Slip axes are sampled densely around zero slip, where the curves bend.
+/// Interpolation error is below 1% of the peak force above 500 N load and
+/// below 2% under it, see cartire1table_test.
+class CarTire1Table
+{
+public:
+	/// get a table for the tire parameters, tires with equal parameters share a table
+	/// thread safe, cars load in parallel
+	static std::shared_ptr<const CarTire1Table> get(const CarTire1 & tire);
+
+	/// Fz: load in kN, sigma: slip ratio, alpha: slip angle in deg, gamma: camber in deg
+	/// Fx0, Fy0, Mz: pure slip forces at unit friction
+	/// Gx, Gy: combined slip factors
+	void getForce(
+		btScalar Fz,
+		btScalar sigma,
+		btScalar alpha,
+		btScalar gamma,
+		btScalar & Fx0,
+		btScalar & Fy0,
+		btScalar & Mz,
+		btScalar & Gx,
+		btScalar & Gy) const;
+
+	/// table memory in bytes
+	size_t getSize() const;
+
+private:
+	std::vector<float> fx; ///< [load][slip ratio]
+	std::vector<float> fymz; ///< [load][camber][slip angle][Fy, Mz]
+	std::vector<float> gxgy; ///< [slip ratio][slip angle][Gx, Gy]
+
+	void init(const CarTire1 & tire);
+};
+
+#endif // _CARTIRE1TABLE_H
@@ -19,11 +19,24 @@
 
 #include "dynamicsworld.h"
 #include "fracturebody.h"
+#include "fracturedispatcher.h"
+#include "cardynamics.h"
 #include "collision_contact.h"
 #include "tobullet.h"
 #include "track.h"
+#include "jobsystem.h"
+#include "profiler.h"
+#include "unittest.h"
 
 #include "BulletCollision/CollisionShapes/btCollisionShape.h"
+#include "BulletCollision/CollisionShapes/btBoxShape.h"
+#include "BulletCollision/CollisionShapes/btStaticPlaneShape.h"
+#include "BulletCollision/CollisionDispatch/btDefaultCollisionConfiguration.h"
+#include "BulletCollision/BroadphaseCollision/btAxisSweep3.h"
+#include "BulletCollision/BroadphaseCollision/btDbvtBroadphase.h"
+#include "BulletDynamics/ConstraintSolver/btSequentialImpulseConstraintSolver.h"
+
+#include <algorithm>
 
 #define EXTBULLET
 
@@ -88,13 +101,16 @@ struct MyRayResultCallback : public btCollisionWorld::RayResultCallback
 };
 
 DynamicsWorld::DynamicsWorld(
-	btDispatcher* dispatcher,
+	FractureDispatcher* dispatcher,
 	btBroadphaseInterface* broadphase,
 	btConstraintSolver* constraintSolver,
 	btCollisionConfiguration* collisionConfig,
 	btScalar timeStep,
 	int maxSubSteps) :
 	btDiscreteDynamicsWorld(dispatcher, broadphase, constraintSolver, collisionConfig),
+	dispatcher(dispatcher),
+	broadphaseType(DBVT_BROADPHASE),
+	currentBroadphaseType(DBVT_BROADPHASE),
 	track(0),
 	timeStep(timeStep),
 	maxSubSteps(maxSubSteps)
@@ -113,73 +129,232 @@ const RoadPatch * DynamicsWorld::GetSectorPatch(int i)
 	return track->GetSectorPatch(i);
 }
 
-bool DynamicsWorld::castRay(
+struct RayHit
+{
+	btVector3 p;
+	btVector3 n;
+	btScalar d;
+	int patch_id;
+	const RoadPatch * patch;
+	const TrackSurface * s;
+	const btCollisionObject * c;
+	bool hit;
+};
+
+// collision world part of the ray cast, touches broadphase state
+static void rayTestWorld(
+	const btCollisionWorld & world,
+	const Track * track,
 	const btVector3 & origin,
 	const btVector3 & direction,
 	const btScalar length,
 	const btCollisionObject * caster,
-	CollisionContact & contact) const
+	RayHit & hit)
 {
-	btVector3 p = origin + direction * length;
-	btVector3 n = -direction;
-	btScalar d = length;
-	int patch_id = -1;
-	const RoadPatch * patch = 0;
-	const TrackSurface * s = TrackSurface::None();
-	const btCollisionObject * c = 0;
+	hit.p = origin + direction * length;
+	hit.n = -direction;
+	hit.d = length;
+	hit.patch_id = -1;
+	hit.patch = 0;
+	hit.s = TrackSurface::None();
+	hit.c = 0;
 
-	MyRayResultCallback ray(origin, p, caster);
-	rayTest(origin, p, ray);
+	MyRayResultCallback ray(origin, hit.p, caster);
+	world.rayTest(origin, hit.p, ray);
+
+	hit.hit = ray.hasHit();
+	if (!hit.hit)
+		return;
 
 	// track geometry collision
-	if (ray.hasHit())
+	hit.p = ray.m_hitPointWorld;
+	hit.n = ray.m_hitNormalWorld;
+	hit.d = ray.m_closestHitFraction * length;
+	hit.c = ray.m_collisionObject;
+	if (hit.c->isStaticObject())
 	{
-		p = ray.m_hitPointWorld;
-		n = ray.m_hitNormalWorld;
-		d = ray.m_closestHitFraction * length;
-		c = ray.m_collisionObject;
-		if (c->isStaticObject())
+		TrackSurface * ts = static_cast<TrackSurface*>(hit.c->getUserPointer());
+		if (hit.c->getCollisionShape()->isCompound())
+			ts = static_cast<TrackSurface*>(ray.m_shape->getUserPointer());
+
+		// verify surface pointer
+		if (track)
 		{
-			TrackSurface * ts = static_cast<TrackSurface*>(c->getUserPointer());
-			if (c->getCollisionShape()->isCompound())
-				ts = static_cast<TrackSurface*>(ray.m_shape->getUserPointer());
+			const std::vector<TrackSurface> & surfaces = track->GetSurfaces();
+			if (ts < &surfaces[0] || ts > &surfaces[surfaces.size() - 1])
+				ts = NULL;
+			assert(ts);
+		}
 
-			// verify surface pointer
-			if (track)
-			{
-				const std::vector<TrackSurface> & surfaces = track->GetSurfaces();
-				if (ts < &surfaces[0] || ts > &surfaces[surfaces.size() - 1])
-					ts = NULL;
-				assert(ts);
-			}
+		if (ts)
+			hit.s = ts;
+	}
+}
+
+// track bezierpatch part of the ray cast, read only
+static void rayTestTrack(
+	const Track & track,
+	const btVector3 & origin,
+	const btVector3 & direction,
+	const btScalar length,
+	const int patch_hint,
+	RayHit & hit)
+{
+	Vec3 org = ToMathVector<float>(origin);
+	Vec3 dir = ToMathVector<float>(direction);
+	Vec3 colpoint;
+	Vec3 colnormal;
+	hit.patch_id = patch_hint;
+	if (track.CastRay(org, dir, length, hit.patch_id, colpoint, hit.patch, colnormal))
+	{
+		hit.p = ToBulletVector(colpoint);
+		hit.n = ToBulletVector(colnormal);
+		hit.d = (colpoint - org).Magnitude();
+	}
+}
 
-			if (ts)
-				s = ts;
+// track bezierpatch part of a ray packet, read only
+// every ray is tested, the collision world part decides whether its hit is used
+static void rayTestTrack(
+	const Track & track,
+	DynamicsWorld::Ray rays[],
+	const int count)
+{
+	Vec3 org[RoadBvh::max_packet];
+	Vec3 dir[RoadBvh::max_packet];
+	float length[RoadBvh::max_packet];
+	int patch_id[RoadBvh::max_packet];
+	for (int i = 0; i < count; ++i)
+	{
+		org[i] = ToMathVector<float>(rays[i].origin);
+		dir[i] = ToMathVector<float>(rays[i].direction);
+		length[i] = rays[i].length;
+		patch_id[i] = rays[i].contact->GetPatchId();
+	}
+
+	Vec3 colpoint[RoadBvh::max_packet];
+	Vec3 colnormal[RoadBvh::max_packet];
+	const RoadPatch * colpatch[RoadBvh::max_packet];
+	bool col[RoadBvh::max_packet];
+	track.CastRays(count, org, dir, length, patch_id, colpoint, colpatch, colnormal, col);
+
+	for (int i = 0; i < count; ++i)
+	{
+		DynamicsWorld::Ray & ray = rays[i];
+		ray.track_patch_id = patch_id[i];
+		ray.track_hit = col[i];
+		ray.track_cast = true;
+		if (col[i])
+		{
+			ray.track_patch = colpatch[i];
+			ray.track_point = ToBulletVector(colpoint[i]);
+			ray.track_normal = ToBulletVector(colnormal[i]);
+			ray.track_depth = (colpoint[i] - org[i]).Magnitude();
 		}
+	}
+}
 
-		// track bezierpatch collision
-		if (track)
+// collision world part of a ray, combined with its road patch hit
+static bool rayTest(
+	const btCollisionWorld & world,
+	const Track * track,
+	const DynamicsWorld::Ray & ray)
+{
+	RayHit hit;
+	rayTestWorld(world, track, ray.origin, ray.direction, ray.length, ray.caster, hit);
+
+	if (hit.hit && track)
+	{
+		if (!ray.track_cast)
+		{
+			rayTestTrack(*track, ray.origin, ray.direction, ray.length, ray.contact->GetPatchId(), hit);
+		}
+		else
 		{
-			Vec3 org = ToMathVector<float>(origin);
-			Vec3 dir = ToMathVector<float>(direction);
-			Vec3 colpoint;
-			Vec3 colnormal;
-			patch_id = contact.GetPatchId();
-			if (track->CastRay(org, dir, length, patch_id, colpoint, patch, colnormal))
+			hit.patch_id = ray.track_patch_id;
+			if (ray.track_hit)
 			{
-				p = ToBulletVector(colpoint);
-				n = ToBulletVector(colnormal);
-				d = (colpoint - org).Magnitude();
+				hit.patch = ray.track_patch;
+				hit.p = ray.track_point;
+				hit.n = ray.track_normal;
+				hit.d = ray.track_depth;
 			}
 		}
+	}
+
+	// no hit should only happen on vehicle rollover
+	*ray.contact = CollisionContact(hit.p, hit.n, hit.d, hit.patch_id, hit.patch, hit.s, hit.c);
+	return hit.hit;
+}
+
+bool DynamicsWorld::castRay(
+	const btVector3 & origin,
+	const btVector3 & direction,
+	const btScalar length,
+	const btCollisionObject * caster,
+	CollisionContact & contact) const
+{
+	Ray ray;
+	ray.origin = origin;
+	ray.direction = direction;
+	ray.length = length;
+	ray.caster = caster;
+	ray.contact = &contact;
+	return rayTest(*this, track, ray);
+}
+
+void DynamicsWorld::castRays(btAlignedObjectArray<Ray> & rays) const
+{
+	const int count = rays.size();
+	if (count == 0)
+		return;
+
+	// consecutive rays of a caster (wheels of a car) form a packet
+	// each packet only reads the track and writes its own rays
+	if (track)
+	{
+		btAlignedObjectArray<int> packets;
+		for (int i = 0; i < count; ++i)
+		{
+			if (i == 0 || rays[i].caster != rays[i - 1].caster ||
+				i - packets[packets.size() - 1] == RoadBvh::max_packet)
+				packets.push_back(i);
+		}
+		packets.push_back(count);
 
-		contact = CollisionContact(p, n, d, patch_id, patch, s, c);
-		return true;
+		JobSystem::get().parallelFor(0, packets.size() - 1, [this, &rays, &packets](int p)
+		{
+			castRaysTrack(&rays[packets[p]], packets[p + 1] - packets[p]);
+		}, 2);
 	}
 
-	// should only happen on vehicle rollover
-	contact = CollisionContact(p, n, d, patch_id, patch, s, c);
-	return false;
+	castRaysWorld(&rays[0], count);
+}
+
+void DynamicsWorld::castRaysTrack(Ray rays[], int count) const
+{
+	if (!track)
+		return;
+
+	for (int i = 0; i < count; i += RoadBvh::max_packet)
+		rayTestTrack(*track, rays + i, std::min(count - i, RoadBvh::max_packet));
+}
+
+void DynamicsWorld::castRaysWorld(Ray rays[], int count) const
+{
+	// broadphase ray tests are not thread safe
+	for (int i = 0; i < count; ++i)
+		rayTest(*this, track, rays[i]);
+}
+
+void DynamicsWorld::addCar(CarDynamics * car)
+{
+	m_cars.push_back(car);
+}
+
+void DynamicsWorld::removeCar(CarDynamics * car)
+{
+	m_cars.remove(car);
 }
 
 void DynamicsWorld::update(btScalar dt)
@@ -188,6 +363,119 @@ void DynamicsWorld::update(btScalar dt)
 	//CProfileManager::dumpAll();
 }
 
+bool DynamicsWorld::getBroadphaseType(const std::string & name, BroadphaseType & type)
+{
+	if (name == "dbvt")
+		type = DBVT_BROADPHASE;
+	else if (name == "axissweep")
+		type = AXIS_SWEEP_BROADPHASE;
+	else
+		return false;
+	return true;
+}
+
+const char * DynamicsWorld::getBroadphaseName(BroadphaseType type)
+{
+	return (type == AXIS_SWEEP_BROADPHASE) ? "axissweep" : "dbvt";
+}
+
+void DynamicsWorld::setBroadphaseType(BroadphaseType type)
+{
+	broadphaseType = type;
+}
+
+void DynamicsWorld::rebuildBroadphase()
+{
+	// a dbvt adapts to the objects it contains
+	if (broadphaseType == DBVT_BROADPHASE && currentBroadphaseType == DBVT_BROADPHASE)
+		return;
+
+	// remove the proxies from the old broadphase, keep their filters
+	btBroadphaseInterface * oldBroadphase = getBroadphase();
+	btAlignedObjectArray<btCollisionObject*> objects(m_collisionObjects);
+	btAlignedObjectArray<int> groups, masks;
+	groups.resize(objects.size());
+	masks.resize(objects.size());
+	btVector3 worldMin(BT_LARGE_FLOAT, BT_LARGE_FLOAT, BT_LARGE_FLOAT);
+	btVector3 worldMax(-BT_LARGE_FLOAT, -BT_LARGE_FLOAT, -BT_LARGE_FLOAT);
+	for (int i = 0; i < objects.size(); ++i)
+	{
+		btCollisionObject * object = objects[i];
+		btBroadphaseProxy * proxy = object->getBroadphaseHandle();
+		groups[i] = proxy->m_collisionFilterGroup;
+		masks[i] = proxy->m_collisionFilterMask;
+		oldBroadphase->getOverlappingPairCache()->cleanProxyFromPairs(proxy, m_dispatcher1);
+		oldBroadphase->destroyProxy(proxy, m_dispatcher1);
+		object->setBroadphaseHandle(0);
+
+		// unbounded shapes like planes would stretch the sweep bounds
+		btVector3 aabbMin, aabbMax;
+		object->getCollisionShape()->getAabb(object->getWorldTransform(), aabbMin, aabbMax);
+		if ((aabbMax - aabbMin).length2() < btScalar(1E12))
+		{
+			worldMin.setMin(aabbMin);
+			worldMax.setMax(aabbMax);
+		}
+	}
+	m_collisionObjects.resize(0);
+
+	if (broadphaseType == AXIS_SWEEP_BROADPHASE)
+	{
+		// leave room for cars, parts and objects moving off the track
+		if (worldMin.x() > worldMax.x())
+		{
+			worldMin.setValue(-1000, -1000, -1000);
+			worldMax.setValue(1000, 1000, 1000);
+		}
+		btVector3 margin = (worldMax - worldMin) * btScalar(0.05) + btVector3(50, 50, 50);
+		worldMin -= margin;
+		worldMax += margin;
+
+		// 16 bit handles are smaller and faster to sort
+		const int maxHandles = objects.size() + 4096;
+		if (maxHandles < 0xfffe)
+			ownBroadphase.reset(new btAxisSweep3(worldMin, worldMax, maxHandles));
+		else
+			ownBroadphase.reset(new bt32BitAxisSweep3(worldMin, worldMax, maxHandles));
+	}
+	else
+	{
+		ownBroadphase.reset(new btDbvtBroadphase());
+	}
+	setBroadphase(ownBroadphase.get());
+	currentBroadphaseType = broadphaseType;
+
+	for (int i = 0; i < objects.size(); ++i)
+		btCollisionWorld::addCollisionObject(objects[i], groups[i], masks[i]);
+}
+
+void DynamicsWorld::performDiscreteCollisionDetection()
+{
+	{
+		PROFILER_SCOPE("broadphase");
+		updateAabbs();
+		m_broadphasePairCache->calculateOverlappingPairs(m_dispatcher1);
+	}
+	{
+		PROFILER_SCOPE("narrowphase");
+		m_dispatcher1->dispatchAllCollisionPairs(m_broadphasePairCache->getOverlappingPairCache(), getDispatchInfo(), m_dispatcher1);
+	}
+}
+
+void DynamicsWorld::updateActions(btScalar timeStep)
+{
+	// road patch tests of all wheel rays run in parallel, the collision
+	// world tests follow in each car's action, in the order of the serial path
+	// sleeping cars skip their action
+	JobSystem::get().parallelFor(0, m_cars.size(), [this](int i)
+	{
+		if (m_cars[i]->getCollisionObject().isActive())
+			m_cars[i]->PrepareWheelRays();
+	});
+
+	btDiscreteDynamicsWorld::updateActions(timeStep);
+}
+
 void DynamicsWorld::solveConstraints(btContactSolverInfo& solverInfo)
 {
 	// todo: after fracture we should run the solver again for better realism
@@ -237,10 +525,10 @@ void DynamicsWorld::fractureCallback()
 #if (BT_BULLET_VERSION < 281)
 	m_activeConnections.resize(0);
 
-	int numManifolds = getDispatcher()->getNumManifolds();
-	for (int i = 0; i < numManifolds; ++i)
+	const btAlignedObjectArray<btPersistentManifold*> & manifolds = dispatcher->getFractureManifolds();
+	for (int i = 0; i < manifolds.size(); ++i)
 	{
-		btPersistentManifold* manifold = getDispatcher()->getManifoldByIndexInternal(i);
+		btPersistentManifold* manifold = manifolds[i];
 		if (!manifold->getNumContacts()) continue;
 
 		FractureBody* body = static_cast<FractureBody*>(manifold->getBody0());
@@ -284,3 +572,113 @@ void DynamicsWorld::fractureCallback()
 	}
 #endif
 }
+
+QT_TEST(dynamicsworld_castrays_test)
+{
+	btDefaultCollisionConfiguration config;
+	FractureDispatcher dispatcher(&config);
+	btDbvtBroadphase broadphase;
+	btSequentialImpulseConstraintSolver solver;
+	DynamicsWorld world(&dispatcher, &broadphase, &solver, &config);
+
+	TrackSurface surface;
+	btStaticPlaneShape plane(btVector3(0, 0, 1), 0);
+	btCollisionObject ground;
+	ground.setCollisionShape(&plane);
+	ground.setUserPointer(&surface);
+	world.addCollisionObject(&ground);
+
+	btBoxShape box(btVector3(1, 1, 1));
+	btCollisionObject obstacle;
+	obstacle.setCollisionShape(&box);
+	obstacle.getWorldTransform().setOrigin(btVector3(2, 0, 1));
+	obstacle.setUserPointer(&surface);
+	world.addCollisionObject(&obstacle);
+
+	// batched rays have to produce the same contacts as single rays
+	const int count = 32;
+	CollisionContact single[count];
+	CollisionContact batched[count];
+	btAlignedObjectArray<DynamicsWorld::Ray> rays;
+	for (int i = 0; i < count; ++i)
+	{
+		DynamicsWorld::Ray ray;
+		ray.origin = btVector3(i * 0.25f - 2, i * 0.1f, 3);
+		ray.direction = btVector3(0.01f * i, 0, -1).normalized();
+		ray.length = (i % 4 == 0) ? 1 : 4;
+		ray.caster = 0;
+		ray.contact = &batched[i];
+		rays.push_back(ray);
+
+		world.castRay(ray.origin, ray.direction, ray.length, ray.caster, single[i]);
+	}
+	world.castRays(rays);
+
+	for (int i = 0; i < count; ++i)
+	{
+		QT_CHECK(single[i].GetPosition() == batched[i].GetPosition());
+		QT_CHECK(single[i].GetNormal() == batched[i].GetNormal());
+		QT_CHECK_EQUAL(single[i].GetDepth(), batched[i].GetDepth());
+		QT_CHECK_EQUAL(single[i].GetPatchId(), batched[i].GetPatchId());
+		QT_CHECK_EQUAL(single[i].GetObject(), batched[i].GetObject());
+		QT_CHECK_EQUAL(&single[i].GetSurface(), &batched[i].GetSurface());
+	}
+
+	world.removeCollisionObject(&obstacle);
+	world.removeCollisionObject(&ground);
+}
+
+QT_TEST(dynamicsworld_broadphase_test)
+{
+	btDefaultCollisionConfiguration config;
+	FractureDispatcher dispatcher(&config);
+	btDbvtBroadphase broadphase;
+	btSequentialImpulseConstraintSolver solver;
+	DynamicsWorld world(&dispatcher, &broadphase, &solver, &config);
+
+	btBoxShape groundShape(btVector3(100, 100, 1));
+	btCollisionObject ground;
+	ground.setCollisionShape(&groundShape);
+	ground.getWorldTransform().setOrigin(btVector3(0, 0, -1));
+	world.addCollisionObject(&ground);
+
+	// boxes resting on the ground, the first two touch each other
+	btBoxShape boxShape(btVector3(1, 1, 1));
+	btRigidBody box0(1, 0, &boxShape, btVector3(1, 1, 1));
+	btRigidBody box1(1, 0, &boxShape, btVector3(1, 1, 1));
+	btRigidBody box2(1, 0, &boxShape, btVector3(1, 1, 1));
+	box0.getWorldTransform().setOrigin(btVector3(0, 0, 1));
+	box1.getWorldTransform().setOrigin(btVector3(2, 0, 1));
+	box2.getWorldTransform().setOrigin(btVector3(50, 50, 1));
+	world.addRigidBody(&box0);
+	world.addRigidBody(&box1);
+	world.addRigidBody(&box2);
+
+	world.update(world.getTimeStep());
+	const int pairs = world.getBroadphase()->getOverlappingPairCache()->getNumOverlappingPairs();
+	QT_CHECK_EQUAL(pairs, 4);
+
+	// both broadphases find the same pairs, objects keep their filters
+	DynamicsWorld::BroadphaseType type;
+	QT_CHECK(DynamicsWorld::getBroadphaseType("axissweep", type));
+	QT_CHECK(!DynamicsWorld::getBroadphaseType("sap", type));
+	const int groundMask = ground.getBroadphaseHandle()->m_collisionFilterMask;
+	world.setBroadphaseType(DynamicsWorld::AXIS_SWEEP_BROADPHASE);
+	world.rebuildBroadphase();
+	QT_CHECK(world.getBroadphase() != &broadphase);
+	QT_CHECK_EQUAL(world.getNumCollisionObjects(), 4);
+	QT_CHECK_EQUAL(int(ground.getBroadphaseHandle()->m_collisionFilterMask), groundMask);
+
+	world.update(world.getTimeStep());
+	QT_CHECK_EQUAL(world.getBroadphase()->getOverlappingPairCache()->getNumOverlappingPairs(), pairs);
+
+	world.setBroadphaseType(DynamicsWorld::DBVT_BROADPHASE);
+	world.rebuildBroadphase();
+	world.update(world.getTimeStep());
+	QT_CHECK_EQUAL(world.getBroadphase()->getOverlappingPairCache()->getNumOverlappingPairs(), pairs);
+
+	world.removeRigidBody(&box2);
+	world.removeRigidBody(&box1);
+	world.removeRigidBody(&box0);
+	world.removeCollisionObject(&ground);
+}
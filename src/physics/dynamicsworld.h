@@ -22,16 +22,22 @@
 
 #include "BulletDynamics/Dynamics/btDiscreteDynamicsWorld.h"
 
+#include <memory>
+#include <string>
+
 class Track;
+class CarDynamics;
 class CollisionContact;
 class FractureBody;
+class FractureDispatcher;
 class RoadPatch;
 
 class DynamicsWorld  : public btDiscreteDynamicsWorld
 {
 public:
+	// broadphase is the initial dbvt broadphase, owned by the caller
 	DynamicsWorld(
-		btDispatcher* dispatcher,
+		FractureDispatcher* dispatcher,
 		btBroadphaseInterface* broadphase,
 		btConstraintSolver* constraintSolver,
 		btCollisionConfiguration* collisionConfig,
@@ -58,8 +64,67 @@ public:
 		const btCollisionObject * caster,
 		CollisionContact & contact) const;
 
+	// ray query for castRays, contact provides the patch hint and receives the result
+	struct Ray
+	{
+		Ray() : length(0), caster(0), contact(0), track_cast(false) {}
+
+		btVector3 origin;
+		btVector3 direction;
+		btScalar length;
+		const btCollisionObject * caster;
+		CollisionContact * contact;
+
+		// road patch hit, set by castRaysTrack
+		btVector3 track_point;
+		btVector3 track_normal;
+		btScalar track_depth;
+		int track_patch_id;
+		const RoadPatch * track_patch;
+		bool track_hit;
+		bool track_cast;
+	};
+
+	// cast a batch of rays, results are identical to castRay called for each ray
+	// collision world tests run serially, road patch tests are spread over worker threads
+	void castRays(btAlignedObjectArray<Ray> & rays) const;
+
+	// road patch part of castRays, read only, rays of different callers can be
+	// tested in parallel, results are kept in the rays
+	void castRaysTrack(Ray rays[], int count) const;
+
+	// collision world part of castRays, writes the contacts of rays tested by
+	// castRaysTrack, touches broadphase state so it has to be called serially
+	void castRaysWorld(Ray rays[], int count) const;
+
+	// road patch ray tests of registered cars run in parallel before the actions
+	void addCar(CarDynamics * car);
+
+	void removeCar(CarDynamics * car);
+
 	btScalar getTimeStep() const { return timeStep; };
 
+	enum BroadphaseType
+	{
+		DBVT_BROADPHASE,
+		AXIS_SWEEP_BROADPHASE
+	};
+
+	// broadphase type by name, dbvt or axissweep, false if the name is unknown
+	static bool getBroadphaseType(const std::string & name, BroadphaseType & type);
+
+	static const char * getBroadphaseName(BroadphaseType type);
+
+	// broadphase created by the next rebuildBroadphase
+	void setBroadphaseType(BroadphaseType type);
+
+	BroadphaseType getBroadphaseType() const { return broadphaseType; }
+
+	// move all collision objects into a new broadphase of the selected type
+	// axis sweep bounds are fitted to the objects in the world, track loading
+	// calls it once all track objects have been added
+	void rebuildBroadphase();
+
 	void update(btScalar dt);
 
 	void draw();
@@ -73,14 +138,23 @@ protected:
 		int id;
 	};
 	btAlignedObjectArray<ActiveCon> m_activeConnections;
+	btAlignedObjectArray<CarDynamics*> m_cars;
+	FractureDispatcher * dispatcher;
+	std::unique_ptr<btBroadphaseInterface> ownBroadphase; // set once rebuilt, replaces the initial broadphase
+	BroadphaseType broadphaseType; // type set by setBroadphaseType
+	BroadphaseType currentBroadphaseType; // type in use
 	const Track * track;
 	btScalar timeStep;
 	int maxSubSteps;
 
 	void reset();
 
+	void performDiscreteCollisionDetection();
+
 	void solveConstraints(btContactSolverInfo& solverInfo);
 
+	void updateActions(btScalar timeStep);
+
 	void fractureCallback();
 };
 
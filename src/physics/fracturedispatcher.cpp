@@ -0,0 +1,133 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+
+#include "fracturedispatcher.h"
+#include "fracturebody.h"
+#include "dynamicsworld.h"
+#include "unittest.h"
+
+#include "BulletCollision/BroadphaseCollision/btDbvtBroadphase.h"
+#include "BulletCollision/CollisionDispatch/btDefaultCollisionConfiguration.h"
+#include "BulletCollision/CollisionShapes/btBoxShape.h"
+#include "BulletCollision/CollisionShapes/btStaticPlaneShape.h"
+#include "BulletDynamics/ConstraintSolver/btSequentialImpulseConstraintSolver.h"
+
+static inline bool isFracture(const btCollisionObject * object)
+{
+	return object->getInternalType() & CO_FRACTURE_TYPE;
+}
+
+FractureDispatcher::FractureDispatcher(btCollisionConfiguration * config) :
+	btCollisionDispatcher(config)
+{
+	// ctor
+}
+
+#if (BT_BULLET_VERSION < 281)
+btPersistentManifold * FractureDispatcher::getNewManifold(void * b0, void * b1)
+#else
+btPersistentManifold * FractureDispatcher::getNewManifold(const btCollisionObject * b0, const btCollisionObject * b1)
+#endif
+{
+	btPersistentManifold * manifold = btCollisionDispatcher::getNewManifold(b0, b1);
+	if (isFracture(static_cast<const btCollisionObject*>(manifold->getBody0())) ||
+		isFracture(static_cast<const btCollisionObject*>(manifold->getBody1())))
+	{
+		// m_index1a is the base dispatcher slot, keep ours in the companion id
+		manifold->m_companionIdA = m_fractureManifolds.size();
+		m_fractureManifolds.push_back(manifold);
+	}
+	return manifold;
+}
+
+void FractureDispatcher::releaseManifold(btPersistentManifold * manifold)
+{
+	if (isFracture(static_cast<const btCollisionObject*>(manifold->getBody0())) ||
+		isFracture(static_cast<const btCollisionObject*>(manifold->getBody1())))
+	{
+		const int i = manifold->m_companionIdA;
+		const int n = m_fractureManifolds.size() - 1;
+		btAssert(i <= n && m_fractureManifolds[i] == manifold);
+		m_fractureManifolds[n]->m_companionIdA = i;
+		m_fractureManifolds.swap(i, n);
+		m_fractureManifolds.pop_back();
+	}
+	btCollisionDispatcher::releaseManifold(manifold);
+}
+
+// rigid body flagged as fracture body, connections are not needed here
+struct FractureTestBody : public btRigidBody
+{
+	FractureTestBody(btCollisionShape * shape) :
+		btRigidBody(1, 0, shape, btVector3(1, 1, 1))
+	{
+		m_internalType |= CO_FRACTURE_TYPE;
+	}
+};
+
+QT_TEST(fracturedispatcher_test)
+{
+	btDefaultCollisionConfiguration config;
+	FractureDispatcher dispatcher(&config);
+	btDbvtBroadphase broadphase;
+	btSequentialImpulseConstraintSolver solver;
+	DynamicsWorld world(&dispatcher, &broadphase, &solver, &config);
+
+	btStaticPlaneShape plane(btVector3(0, 0, 1), 0);
+	btCollisionObject ground;
+	ground.setCollisionShape(&plane);
+	world.addCollisionObject(&ground);
+
+	// two boxes resting on the ground, one of them a fracture body
+	btBoxShape box(btVector3(1, 1, 1));
+	btRigidBody plain(1, 0, &box, btVector3(1, 1, 1));
+	plain.getWorldTransform().setOrigin(btVector3(-5, 0, 1));
+	world.addRigidBody(&plain);
+
+	FractureTestBody fracture(&box);
+	fracture.getWorldTransform().setOrigin(btVector3(5, 0, 1));
+	world.addRigidBody(&fracture);
+
+	FractureTestBody fracture2(&box);
+	fracture2.getWorldTransform().setOrigin(btVector3(0, 5, 1));
+	world.addRigidBody(&fracture2);
+
+	world.update(world.getTimeStep());
+	QT_CHECK_EQUAL(dispatcher.getNumManifolds(), 3);
+	QT_CHECK_EQUAL(dispatcher.getFractureManifolds().size(), 2);
+
+	// removing a body releases its manifold, the other one moves into its slot
+	world.removeRigidBody(&fracture);
+	QT_CHECK_EQUAL(dispatcher.getNumManifolds(), 2);
+	QT_CHECK_EQUAL(dispatcher.getFractureManifolds().size(), 1);
+	if (dispatcher.getFractureManifolds().size() == 1)
+	{
+		const btPersistentManifold * manifold = dispatcher.getFractureManifolds()[0];
+		QT_CHECK(manifold->getBody0() == &fracture2 || manifold->getBody1() == &fracture2);
+		QT_CHECK_EQUAL(manifold->m_companionIdA, 0);
+	}
+
+	world.removeRigidBody(&fracture2);
+	QT_CHECK_EQUAL(dispatcher.getNumManifolds(), 1);
+	QT_CHECK_EQUAL(dispatcher.getFractureManifolds().size(), 0);
+
+	world.removeRigidBody(&plain);
+	world.removeCollisionObject(&ground);
+}
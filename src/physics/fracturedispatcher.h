@@ -0,0 +1,52 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+
+#ifndef _FRACTUREDISPATCHER_H
+#define _FRACTUREDISPATCHER_H
+
+#include "BulletCollision/CollisionDispatch/btCollisionDispatcher.h"
+#include "LinearMath/btAlignedObjectArray.h"
+
+/// Collision dispatcher indexing the contact manifolds of fracture bodies,
+/// the fracture pass visits them instead of scanning all manifolds.
+class FractureDispatcher : public btCollisionDispatcher
+{
+public:
+	FractureDispatcher(btCollisionConfiguration * config);
+
+	/// manifolds with at least one fracture body, in no particular order
+	const btAlignedObjectArray<btPersistentManifold*> & getFractureManifolds() const
+	{
+		return m_fractureManifolds;
+	}
+
+#if (BT_BULLET_VERSION < 281)
+	btPersistentManifold * getNewManifold(void * b0, void * b1);
+#else
+	btPersistentManifold * getNewManifold(const btCollisionObject * b0, const btCollisionObject * b1);
+#endif
+
+	void releaseManifold(btPersistentManifold * manifold);
+
+private:
+	btAlignedObjectArray<btPersistentManifold*> m_fractureManifolds;
+};
+
+#endif // _FRACTUREDISPATCHER_H
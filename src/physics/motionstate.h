@@ -27,9 +27,11 @@ struct MotionState : public btMotionState {
 	btVector3 position;
 	btQuaternion massCenterRotation;
 	btVector3 massCenterOffset;
+	bool moved; ///< set by physics, cleared by the user after reading the transform
 
 	MotionState() : rotation(0,0,0,1), position(0,0,0),
-		massCenterRotation(0,0,0,1), massCenterOffset(0,0,0)
+		massCenterRotation(0,0,0,1), massCenterOffset(0,0,0),
+		moved(false)
 	{
 		// ctor
 	}
@@ -50,6 +52,7 @@ struct MotionState : public btMotionState {
 		//m_graphicsWorldTrans = centerOfMassWorldTrans * m_centerOfMassOffset;
 		rotation = centerOfMassWorldTrans * massCenterRotation;
 		position = centerOfMassWorldTrans * massCenterOffset;
+		moved = true;
 	}
 };
 
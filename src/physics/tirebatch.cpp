@@ -0,0 +1,440 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#include "tirebatch.h"
+#include "fastmath.h"
+#include "simd.h"
+#include "testfixtures.h"
+#include "unittest.h"
+#include "microbench.h"
+
+#include <algorithm>
+
+#if !defined(BT_USE_DOUBLE_PRECISION)
+
+static const float deg2rad = M_PI / 180;
+static const float rad2deg = 180 / M_PI;
+
+// parameter offsets, series b, a, c and combining as in CarTireInfo1
+enum
+{
+	LON = 0,
+	LAT = LON + 11,
+	ALIGN = LAT + 15,
+	COMB = ALIGN + 18,
+	PARAM_COUNT = COMB + 4
+};
+
+// kernel input and output rows
+enum
+{
+	IN_LOAD, IN_FRICTION, IN_SINCAMBER, IN_ROTVEL, IN_LONVEL, IN_LATVEL, IN_COUNT
+};
+
+enum
+{
+	OUT_FX, OUT_FY, OUT_MZ, OUT_FZ, OUT_SLIDE, OUT_SLIP, OUT_CAMBER, OUT_ACTIVE, OUT_COUNT
+};
+
+#if defined(SIMD_FLOAT8)
+static const int block_width = 8;
+#else
+static const int block_width = 4;
+#endif
+
+// branch free versions of the fastmath functions
+
+template <typename T>
+static inline T AtanLanes(T x)
+{
+	T a = Atan1(x);
+	T b = CopySign(T(M_PI_2), x) - Atan1(1 / x);
+	return Select(x * x < T(1), a, b);
+}
+
+template <typename T>
+static inline T SinPiLanes(T x)
+{
+	T y = Abs(x);
+	T z = T(M_PI) - y;
+	y = Min(z, y);
+	y = CopySign(y, x);
+	return SinPi2(y);
+}
+
+template <typename T>
+static inline T Sin3Pi2Lanes(T x)
+{
+	T y = Abs(x);
+	T z = T(M_PI) - y;
+	y = Min(z, y);
+	y = CopySign(y, y * x);
+	return SinPi2(y);
+}
+
+template <typename T>
+static inline T CosAtanLanes(T x)
+{
+	return RecipSqrt(1 + x * x);
+}
+
+// CarTire1::getForce on structure of arrays data, rows are stride floats apart
+template <typename T>
+static void TireForceKernel(const float * param, const float * in, float * out, int stride)
+{
+	#define P(i) LoadLanes<T>(param + (i) * stride)
+
+	T normal_force = LoadLanes<T>(in + IN_LOAD * stride);
+	T friction_coeff = LoadLanes<T>(in + IN_FRICTION * stride);
+	T sin_camber = LoadLanes<T>(in + IN_SINCAMBER * stride);
+	T rot_velocity = LoadLanes<T>(in + IN_ROTVEL * stride);
+	T lon_velocity = LoadLanes<T>(in + IN_LONVEL * stride);
+	T lat_velocity = LoadLanes<T>(in + IN_LATVEL * stride);
+
+	T active = normal_force * friction_coeff >= T(1E-6f);
+	T Fz = Min(normal_force * T(1E-3f), T(30));
+	T sc = Min(Max(sin_camber, T(-0.3f)), T(0.3f));
+	T camber = (T(1/6.0f) * sc) * (sc * sc) + sc;
+
+	T rcp_lon_velocity = 1 / Max(Abs(lon_velocity), T(1E-3f));
+	T sigma = (rot_velocity - lon_velocity) * rcp_lon_velocity;
+	T alpha = -AtanLanes(lat_velocity * rcp_lon_velocity) * T(rad2deg);
+	T gamma = camber * T(rad2deg);
+	T abs_gamma = Abs(gamma);
+
+	// longitudinal
+	T Fx0;
+	{
+		T C = P(LON + 0);
+		T D = (P(LON + 1) * Fz + P(LON + 2)) * Fz;
+		T BCD = (P(LON + 3) * Fz + P(LON + 4)) * Fz * Exp(-P(LON + 5) * Fz);
+		T B = BCD / (C * D);
+		T E = P(LON + 6) * Fz * Fz + P(LON + 7) * Fz + P(LON + 8);
+		T Sh = P(LON + 9) * Fz + P(LON + 10);
+		T S = T(100) * sigma + Sh;
+		T BS = B * S;
+		Fx0 = D * SinPiLanes(C * AtanLanes(BS - E * (BS - AtanLanes(BS))));
+		Fx0 = Fx0 * friction_coeff;
+	}
+
+	// lateral
+	T Fy0;
+	{
+		T C = P(LAT + 0);
+		T D = (P(LAT + 1) * Fz + P(LAT + 2)) * Fz;
+		T BCD = P(LAT + 3) * SinPiLanes(2 * AtanLanes(Fz / P(LAT + 4))) * (1 - P(LAT + 5) * abs_gamma);
+		T B = BCD / (C * D);
+		T E = P(LAT + 6) * Fz + P(LAT + 7);
+		T Sh = P(LAT + 8) * gamma + P(LAT + 9) * Fz + P(LAT + 10);
+		T Sv = ((P(LAT + 11) * Fz + P(LAT + 12)) * gamma + P(LAT + 13)) * Fz + P(LAT + 14);
+		T S = alpha + Sh;
+		T BS = B * S;
+		Fy0 = D * SinPiLanes(C * AtanLanes(BS - E * (BS - AtanLanes(BS)))) + Sv;
+		Fy0 = Fy0 * friction_coeff;
+	}
+
+	// aligning
+	T Mz;
+	{
+		T C = P(ALIGN + 0);
+		T D = (P(ALIGN + 1) * Fz + P(ALIGN + 2)) * Fz;
+		T BCD = (P(ALIGN + 3) * Fz + P(ALIGN + 4)) * Fz * (1 - P(ALIGN + 6) * abs_gamma) * Exp(-P(ALIGN + 5) * Fz);
+		T B = BCD / (C * D);
+		T E = (P(ALIGN + 7) * Fz * Fz + P(ALIGN + 8) * Fz + P(ALIGN + 9)) * (1 - P(ALIGN + 10) * abs_gamma);
+		T Sh = P(ALIGN + 11) * gamma + P(ALIGN + 12) * Fz + P(ALIGN + 13);
+		T S = alpha + Sh;
+		T Sv = (P(ALIGN + 14) * Fz * Fz + P(ALIGN + 15) * Fz) * gamma + P(ALIGN + 16) * Fz + P(ALIGN + 17);
+		T BS = B * S;
+		Mz = D * Sin3Pi2Lanes(C * AtanLanes(BS - E * (BS - AtanLanes(BS)))) + Sv;
+		Mz = Mz * friction_coeff;
+	}
+
+	// combining
+	T alpha_rad = alpha * T(deg2rad);
+	T Gx = CosAtanLanes(P(COMB + 2) * CosAtanLanes(P(COMB + 3) * sigma) * alpha_rad);
+	T Gy = CosAtanLanes(P(COMB + 0) * CosAtanLanes(P(COMB + 1) * alpha_rad) * sigma);
+
+	#undef P
+
+	T zero(0.0f);
+	StoreLanes(out + OUT_FX * stride, Select(active, Gx * Fx0, zero));
+	StoreLanes(out + OUT_FY * stride, Select(active, Gy * Fy0, zero));
+	StoreLanes(out + OUT_MZ * stride, Select(active, Mz, zero));
+	StoreLanes(out + OUT_FZ * stride, Fz);
+	StoreLanes(out + OUT_SLIDE * stride, sigma);
+	StoreLanes(out + OUT_SLIP * stride, alpha_rad);
+	StoreLanes(out + OUT_CAMBER * stride, camber);
+	StoreLanes(out + OUT_ACTIVE * stride, Select(active, T(1), zero));
+}
+
+TireBatch<CarTire1>::TireBatch() :
+	count(0),
+	use_table(false)
+{
+	// ctor
+}
+
+int TireBatch<CarTire1>::getWidth()
+{
+#if defined(SIMD_FLOAT8)
+	return 8;
+#elif defined(SIMD_FLOAT4)
+	return 4;
+#else
+	return 1;
+#endif
+}
+
+void TireBatch<CarTire1>::init(const CarTire1 tire[], int tire_count)
+{
+	count = tire_count;
+	use_table = false;
+	for (int i = 0; i < count; ++i)
+		use_table |= tire[i].hasTable();
+
+	int blocks = (count + block_width - 1) / block_width;
+	coeff.assign(blocks * PARAM_COUNT * block_width, 0.0f);
+	for (int i = 0; i < count; ++i)
+	{
+		const CarTireInfo1 & info = tire[i];
+		float * p = &coeff[(i / block_width) * PARAM_COUNT * block_width + i % block_width];
+		for (int k = 0; k < 11; ++k)
+			p[(LON + k) * block_width] = info.longitudinal[k];
+		for (int k = 0; k < 15; ++k)
+			p[(LAT + k) * block_width] = info.lateral[k];
+		for (int k = 0; k < 18; ++k)
+			p[(ALIGN + k) * block_width] = info.aligning[k];
+		for (int k = 0; k < 4; ++k)
+			p[(COMB + k) * block_width] = info.combining[k];
+	}
+}
+
+void TireBatch<CarTire1>::getForces(
+	CarTire1 tire[],
+	int tire_count,
+	const btScalar normal_force[],
+	const btScalar friction_coeff[],
+	const btScalar sin_camber[],
+	const btScalar rot_velocity[],
+	const btScalar lon_velocity[],
+	const btScalar lat_velocity[],
+	btVector3 force[])
+{
+	btAssert(tire_count <= count);
+
+	if (use_table)
+	{
+		for (int i = 0; i < tire_count; ++i)
+		{
+			force[i] = tire[i].getForce(
+				normal_force[i], friction_coeff[i], sin_camber[i],
+				rot_velocity[i], lon_velocity[i], lat_velocity[i]);
+		}
+		return;
+	}
+
+	for (int b = 0; b < tire_count; b += block_width)
+	{
+		const int n = std::min(block_width, tire_count - b);
+
+		float in[IN_COUNT * block_width] = {0};
+		float out[OUT_COUNT * block_width];
+		for (int j = 0; j < n; ++j)
+		{
+			in[IN_LOAD * block_width + j] = normal_force[b + j];
+			in[IN_FRICTION * block_width + j] = friction_coeff[b + j];
+			in[IN_SINCAMBER * block_width + j] = sin_camber[b + j];
+			in[IN_ROTVEL * block_width + j] = rot_velocity[b + j];
+			in[IN_LONVEL * block_width + j] = lon_velocity[b + j];
+			in[IN_LATVEL * block_width + j] = lat_velocity[b + j];
+		}
+
+		const float * param = &coeff[(b / block_width) * PARAM_COUNT * block_width];
+#if defined(SIMD_FLOAT8)
+		if (n > 4)
+			TireForceKernel<Float8>(param, in, out, block_width);
+		else
+			TireForceKernel<Float4>(param, in, out, block_width);
+#elif defined(SIMD_FLOAT4)
+		TireForceKernel<Float4>(param, in, out, block_width);
+#else
+		for (int j = 0; j < n; ++j)
+			TireForceKernel<float>(param + j, in + j, out + j, block_width);
+#endif
+
+		for (int j = 0; j < n; ++j)
+		{
+			CarTire1 & t = tire[b + j];
+			if (out[OUT_ACTIVE * block_width + j] == 0)
+			{
+				force[b + j].setZero();
+				continue;
+			}
+
+			btScalar sigma_hat(0), alpha_hat(0);
+			t.getSigmaHatAlphaHat(normal_force[b + j], sigma_hat, alpha_hat);
+
+			t.camber = out[OUT_CAMBER * block_width + j];
+			t.slide = out[OUT_SLIDE * block_width + j];
+			t.slip = out[OUT_SLIP * block_width + j];
+			t.ideal_slide = sigma_hat;
+			t.ideal_slip = alpha_hat * deg2rad;
+			t.fx = out[OUT_FX * block_width + j];
+			t.fy = out[OUT_FY * block_width + j];
+			t.fz = out[OUT_FZ * block_width + j];
+			t.mz = out[OUT_MZ * block_width + j];
+			force[b + j].setValue(t.fx, t.fy, t.mz);
+		}
+	}
+}
+
+QT_TEST(tirebatch_test)
+{
+	// two differently scaled tire pairs, so lanes do not share parameters
+	const int count = 4;
+	CarTire1 tire_ref[count], tire[count];
+	for (int i = 0; i < count; ++i)
+	{
+		CarTireInfo1 info = TestTireInfo();
+		info.longitudinal[2] *= 1 + 0.1f * (i / 2);
+		info.lateral[2] *= 1 + 0.1f * (i / 2);
+		tire_ref[i].init(info);
+		tire[i].init(info);
+	}
+	TireBatch<CarTire1> batch;
+	batch.init(tire, count);
+
+	// sweep load, slip ratio, slip angle, camber and friction, including
+	// the zero load and low speed corner cases
+	const btScalar loads[] = {0, 500, 2500, 5000, 9000, 40000};
+	const btScalar ratios[] = {-1, -0.3, -0.08, 0, 0.02, 0.1, 0.5, 2};
+	const btScalar angles[] = {-1.2, -0.2, -0.05, 0, 0.03, 0.15, 0.8};
+	const btScalar cambers[] = {-0.5, -0.05, 0, 0.1, 0.3};
+	const btScalar speeds[] = {0, 0.5, 20, 60};
+
+	int checked = 0;
+	int failed = 0;
+	for (btScalar load : loads)
+	for (btScalar ratio : ratios)
+	for (btScalar angle : angles)
+	for (btScalar camber : cambers)
+	for (btScalar speed : speeds)
+	{
+		btScalar normal_force[count], friction[count], sin_camber[count];
+		btScalar rot_velocity[count], lon_velocity[count], lat_velocity[count];
+		btVector3 force[count];
+		for (int i = 0; i < count; ++i)
+		{
+			// vary each lane a little to catch lane mixups
+			btScalar s = 1 + 0.05f * i;
+			normal_force[i] = load * s;
+			friction[i] = (i == 3) ? 0.6f : 1.0f;
+			sin_camber[i] = (i & 1) ? -camber : camber;
+			lon_velocity[i] = speed * s;
+			rot_velocity[i] = speed * s * (1 + ratio);
+			lat_velocity[i] = speed * s * std::tan(angle);
+		}
+
+		batch.getForces(tire, count, normal_force, friction, sin_camber,
+			rot_velocity, lon_velocity, lat_velocity, force);
+
+		for (int i = 0; i < count; ++i)
+		{
+			btVector3 f = tire_ref[i].getForce(normal_force[i], friction[i], sin_camber[i],
+				rot_velocity[i], lon_velocity[i], lat_velocity[i]);
+			btScalar tol = 1E-4f * (1 + f.length());
+			bool ok = (f - force[i]).length() <= tol &&
+				btFabs(tire_ref[i].getSlip() - tire[i].getSlip()) <= 1E-5f * (1 + btFabs(tire[i].getSlip())) &&
+				btFabs(tire_ref[i].getSlipAngle() - tire[i].getSlipAngle()) <= 1E-5f &&
+				tire_ref[i].getIdealSlip() == tire[i].getIdealSlip() &&
+				tire_ref[i].getIdealSlipAngle() == tire[i].getIdealSlipAngle();
+			if (!ok)
+			{
+				if (failed++ < 8)
+				{
+					QT_CHECK_CLOSE(f[0], force[i][0], tol);
+					QT_CHECK_CLOSE(f[1], force[i][1], tol);
+					QT_CHECK_CLOSE(f[2], force[i][2], tol);
+					QT_CHECK_CLOSE(tire_ref[i].getSlip(), tire[i].getSlip(), 1E-5f * (1 + btFabs(tire[i].getSlip())));
+				}
+			}
+			++checked;
+		}
+	}
+	QT_CHECK_EQUAL(failed, 0);
+	QT_CHECK(checked > 0);
+}
+
+MICROBENCH(tirebatch)
+{
+	const int car_count = 64;
+	const int count = car_count * 4;
+	std::vector<CarTire1> tire(count);
+	for (auto & t : tire)
+		t.init(TestTireInfo());
+
+	std::vector<btScalar> normal_force(count), friction(count, 1), sin_camber(count);
+	std::vector<btScalar> rot_velocity(count), lon_velocity(count), lat_velocity(count);
+	std::vector<btVector3> force(count);
+	for (int i = 0; i < count; ++i)
+	{
+		normal_force[i] = 2000 + 37 * (i % 97);
+		sin_camber[i] = 0.01f * (i % 7) - 0.03f;
+		lon_velocity[i] = 5 + (i % 50);
+		rot_velocity[i] = lon_velocity[i] * (1 + 0.01f * ((i % 21) - 10));
+		lat_velocity[i] = lon_velocity[i] * 0.01f * ((i % 13) - 6);
+	}
+
+	bench.measure("scalar", count, [&]()
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			force[i] = tire[i].getForce(normal_force[i], friction[i], sin_camber[i],
+				rot_velocity[i], lon_velocity[i], lat_velocity[i]);
+		}
+		microbench::consume(force[count - 1]);
+	});
+
+	// per car, as used by CarDynamics
+	std::vector<TireBatch<CarTire1> > car_batch(car_count);
+	for (int c = 0; c < car_count; ++c)
+		car_batch[c].init(&tire[c * 4], 4);
+	bench.measure("batch4", count, [&]()
+	{
+		for (int c = 0; c < car_count; ++c)
+		{
+			int i = c * 4;
+			car_batch[c].getForces(&tire[i], 4, &normal_force[i], &friction[i], &sin_camber[i],
+				&rot_velocity[i], &lon_velocity[i], &lat_velocity[i], &force[i]);
+		}
+		microbench::consume(force[count - 1]);
+	});
+
+	// all cars in one batch, uses the full vector width
+	TireBatch<CarTire1> batch;
+	batch.init(&tire[0], count);
+	bench.measure("batch_all", count, [&]()
+	{
+		batch.getForces(&tire[0], count, &normal_force[0], &friction[0], &sin_camber[0],
+			&rot_velocity[0], &lon_velocity[0], &lat_velocity[0], &force[0]);
+		microbench::consume(force[count - 1]);
+	});
+}
+
+#endif // BT_USE_DOUBLE_PRECISION
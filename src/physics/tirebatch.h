@@ -0,0 +1,94 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef _TIREBATCH_H
+#define _TIREBATCH_H
+
+#include "cartire1.h"
+#include "LinearMath/btVector3.h"
+
+#include <vector>
+
+/// Evaluates the forces of several tires in one call.
+/// Generic version, calls getForce for each tire.
+template <class Tire>
+class TireBatch
+{
+public:
+	/// copy tire parameters, call after tire init
+	void init(const Tire /*tire*/[], int /*count*/) {}
+
+	/// same as force[i] = tire[i].getForce(normal_force[i], ...) for i < count
+	void getForces(
+		Tire tire[],
+		int count,
+		const btScalar normal_force[],
+		const btScalar friction_coeff[],
+		const btScalar sin_camber[],
+		const btScalar rot_velocity[],
+		const btScalar lon_velocity[],
+		const btScalar lat_velocity[],
+		btVector3 force[])
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			force[i] = tire[i].getForce(
+				normal_force[i], friction_coeff[i], sin_camber[i],
+				rot_velocity[i], lon_velocity[i], lat_velocity[i]);
+		}
+	}
+};
+
+#if !defined(BT_USE_DOUBLE_PRECISION)
+
+/// CarTire1 version, evaluates the pacejka formulas on structure of arrays
+/// tire parameters, four (SSE) or eight (AVX) tires at a time.
+/// Results match CarTire1::getForce to float rounding.
+/// Tires with baked tables are evaluated by getForce.
+template <>
+class TireBatch<CarTire1>
+{
+public:
+	TireBatch();
+
+	void init(const CarTire1 tire[], int count);
+
+	void getForces(
+		CarTire1 tire[],
+		int count,
+		const btScalar normal_force[],
+		const btScalar friction_coeff[],
+		const btScalar sin_camber[],
+		const btScalar rot_velocity[],
+		const btScalar lon_velocity[],
+		const btScalar lat_velocity[],
+		btVector3 force[]);
+
+	/// number of tires evaluated per vector op
+	static int getWidth();
+
+private:
+	std::vector<float> coeff; ///< tire parameters, block of [parameter][lane] per getWidth() tires
+	int count;
+	bool use_table;
+};
+
+#endif // BT_USE_DOUBLE_PRECISION
+
+#endif // _TIREBATCH_H
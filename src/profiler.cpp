@@ -0,0 +1,482 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+
+#include "profiler.h"
+#include "unittest.h"
+#include "microbench.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+static thread_local Profiler * thread_profiler = 0;
+static thread_local void * thread_data = 0;
+static thread_local std::shared_ptr<void> thread_owner; ///< released at thread exit
+static thread_local std::string thread_name;
+
+Profiler & Profiler::get()
+{
+	static Profiler profiler;
+	return profiler;
+}
+
+int Profiler::getBlockId(const char * name)
+{
+	Profiler & p = get();
+	std::lock_guard<std::mutex> lock(p.mutex);
+	for (size_t i = 0; i < p.names.size(); ++i)
+	{
+		if (std::strcmp(p.names[i], name) == 0)
+			return i;
+	}
+	if (p.names.size() == size_t(max_blocks))
+		return -1;
+	p.names.push_back(name);
+	return p.names.size() - 1;
+}
+
+void Profiler::setThreadName(const std::string & name)
+{
+	thread_name = name;
+}
+
+Profiler::Profiler() :
+	recording(false),
+	init_ticks(0),
+	smoothing_scalar(0),
+	first_cycle(true),
+	cycle_start(0),
+	cycle_avg(0),
+	block_last(max_blocks, 0),
+	block_avg(max_blocks, 0)
+{
+	// ctor
+}
+
+Profiler::~Profiler()
+{
+	// dtor
+}
+
+void Profiler::init(double smoothing)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	for (auto & thread : threads)
+	{
+		thread->head.store(0, std::memory_order_relaxed);
+		for (int i = 0; i < max_blocks; ++i)
+		{
+			thread->total[i].store(0, std::memory_order_relaxed);
+			thread->count[i].store(0, std::memory_order_relaxed);
+		}
+	}
+
+	// treat smoothing as time constant of the moving average
+	smoothing_scalar = (smoothing > 0) ? std::exp(-1 / smoothing) : 0;
+	first_cycle = true;
+	cycle_avg = 0;
+	std::fill(block_last.begin(), block_last.end(), 0);
+	std::fill(block_avg.begin(), block_avg.end(), 0);
+
+	init_time = std::chrono::steady_clock::now();
+	init_ticks = now();
+	cycle_start = init_ticks;
+	recording = true;
+}
+
+void Profiler::deinit()
+{
+	recording = false;
+}
+
+Profiler::Thread & Profiler::getThread()
+{
+	if (thread_profiler == this)
+		return *static_cast<Thread *>(thread_data);
+
+	// first event of the thread, take over the record of an exited thread,
+	// the profiler holds the only reference to those
+	std::lock_guard<std::mutex> lock(mutex);
+	size_t index = 0;
+	while (index < threads.size() && threads[index].use_count() > 1)
+		++index;
+
+	if (index == threads.size())
+	{
+		std::shared_ptr<Thread> thread = std::make_shared<Thread>();
+		thread->head = 0;
+		thread->events.reset(new Event[event_count]);
+		for (int i = 0; i < max_blocks; ++i)
+		{
+			thread->total[i] = 0;
+			thread->count[i] = 0;
+		}
+		threads.push_back(thread);
+	}
+
+	Thread & thread = *threads[index];
+	thread.name = thread_name;
+	if (thread.name.empty())
+	{
+		std::ostringstream s;
+		s << "thread " << index;
+		thread.name = s.str();
+	}
+	thread_profiler = this;
+	thread_data = &thread;
+	thread_owner = threads[index];
+	return thread;
+}
+
+double Profiler::getTickLength() const
+{
+	const uint64_t ticks = now() - init_ticks;
+	const double ns = std::chrono::duration<double, std::nano>(
+		std::chrono::steady_clock::now() - init_time).count();
+	return (ticks > 0 && ns > 0) ? ns / ticks : 1;
+}
+
+void Profiler::record(int block, uint64_t begin, uint64_t end)
+{
+	Thread & thread = getThread();
+
+	// only this thread writes, relaxed load and store are enough
+	const uint64_t head = thread.head.load(std::memory_order_relaxed);
+	Event & event = thread.events[head & (event_count - 1)];
+	event.begin.store(begin, std::memory_order_relaxed);
+	event.end.store(end, std::memory_order_relaxed);
+	event.block.store(block, std::memory_order_relaxed);
+	thread.head.store(head + 1, std::memory_order_release);
+
+	std::atomic<uint64_t> & total = thread.total[block];
+	total.store(total.load(std::memory_order_relaxed) + (end - begin), std::memory_order_relaxed);
+	std::atomic<uint64_t> & count = thread.count[block];
+	count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+void Profiler::endCycle()
+{
+	if (!enabled())
+		return;
+
+	const uint64_t time = now();
+	const double cycle = double(time - cycle_start);
+	cycle_start = time;
+
+	// the first cycle sets the averages, no ramp up from zero
+	const double s = first_cycle ? 0 : smoothing_scalar;
+	first_cycle = false;
+
+	cycle_avg = s * cycle_avg + (1 - s) * cycle;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	for (size_t i = 0; i < names.size(); ++i)
+	{
+		const uint64_t total = getBlockTotal(i);
+		block_avg[i] = s * block_avg[i] + (1 - s) * double(total - block_last[i]);
+		block_last[i] = total;
+	}
+}
+
+double Profiler::getAvgDuration(const std::string & name, TimeFormat format) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	const int block = findBlock(name);
+	if (block < 0)
+		return 0;
+
+	return convert(block_avg[block] * getTickLength(), format, cycle_avg * getTickLength());
+}
+
+double Profiler::getTotalDuration(const std::string & name, TimeFormat format) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	const int block = findBlock(name);
+	if (block < 0)
+		return 0;
+
+	const double tick = getTickLength();
+	return convert(getBlockTotal(block) * tick, format, (now() - init_ticks) * tick);
+}
+
+static const char * GetSuffix(Profiler::TimeFormat format)
+{
+	switch (format)
+	{
+		case Profiler::SECONDS: return "s";
+		case Profiler::MILLISECONDS: return "ms";
+		case Profiler::MICROSECONDS: return "us";
+		case Profiler::PERCENT: return "%";
+	}
+	return "";
+}
+
+std::string Profiler::getSummary(TimeFormat format) const
+{
+	std::vector<std::string> blocks;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (size_t i = 0; i < names.size(); ++i)
+		{
+			if (isRecorded(i))
+				blocks.push_back(names[i]);
+		}
+	}
+	std::sort(blocks.begin(), blocks.end());
+
+	std::ostringstream s;
+	for (size_t i = 0; i < blocks.size(); ++i)
+	{
+		if (i > 0)
+			s << "\n";
+		s << blocks[i] << ": " << getTotalDuration(blocks[i], format) << " " << GetSuffix(format);
+	}
+	return s.str();
+}
+
+std::string Profiler::getAvgSummary(TimeFormat format) const
+{
+	std::vector<std::string> blocks;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (size_t i = 0; i < names.size(); ++i)
+		{
+			if (isRecorded(i))
+				blocks.push_back(names[i]);
+		}
+	}
+	std::sort(blocks.begin(), blocks.end());
+
+	std::ostringstream s;
+	for (size_t i = 0; i < blocks.size(); ++i)
+	{
+		if (i > 0)
+			s << "\n";
+		s << blocks[i] << ": " << getAvgDuration(blocks[i], format) << " " << GetSuffix(format);
+	}
+	return s.str();
+}
+
+static void WriteJsonString(const char * value, std::ostream & out)
+{
+	out << '"';
+	for (const char * c = value; *c; ++c)
+	{
+		if (*c == '"' || *c == '\\')
+			out << '\\';
+		out << *c;
+	}
+	out << '"';
+}
+
+void Profiler::writeChromeTrace(std::ostream & out) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	const double tick_us = getTickLength() * 1E-3;
+
+	out << "{\"traceEvents\":[\n";
+	bool first = true;
+	for (size_t tid = 0; tid < threads.size(); ++tid)
+	{
+		const Thread & thread = *threads[tid];
+
+		out << (first ? "" : ",\n");
+		out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid << ",\"args\":{\"name\":";
+		WriteJsonString(thread.name.c_str(), out);
+		out << "}}";
+		first = false;
+
+		// events older than a buffer length have been overwritten
+		const uint64_t head = thread.head.load(std::memory_order_acquire);
+		const uint64_t begin = (head > uint64_t(event_count)) ? head - event_count : 0;
+		for (uint64_t i = begin; i < head; ++i)
+		{
+			const Event & event = thread.events[i & (event_count - 1)];
+			const uint64_t event_begin = event.begin.load(std::memory_order_relaxed);
+			const uint64_t event_end = event.end.load(std::memory_order_relaxed);
+			const int block = event.block.load(std::memory_order_relaxed);
+
+			// the thread may have overwritten the event while we read it
+			const uint64_t new_head = thread.head.load(std::memory_order_acquire);
+			if (new_head > uint64_t(event_count) && i < new_head - event_count)
+				continue;
+			if (event_begin < init_ticks || block < 0 || block >= int(names.size()))
+				continue;
+
+			out << ",\n{\"name\":";
+			WriteJsonString(names[block], out);
+			out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid
+				<< ",\"ts\":" << (event_begin - init_ticks) * tick_us
+				<< ",\"dur\":" << (event_end - event_begin) * tick_us << "}";
+		}
+	}
+	out << "\n]}" << std::endl;
+}
+
+int Profiler::findBlock(const std::string & name) const
+{
+	for (size_t i = 0; i < names.size(); ++i)
+	{
+		if (name == names[i])
+			return i;
+	}
+	return -1;
+}
+
+uint64_t Profiler::getBlockTotal(int block) const
+{
+	uint64_t total = 0;
+	for (const auto & thread : threads)
+		total += thread->total[block].load(std::memory_order_relaxed);
+	return total;
+}
+
+bool Profiler::isRecorded(int block) const
+{
+	for (const auto & thread : threads)
+	{
+		if (thread->count[block].load(std::memory_order_relaxed) > 0)
+			return true;
+	}
+	return false;
+}
+
+double Profiler::convert(double ns, TimeFormat format, double percent_base) const
+{
+	switch (format)
+	{
+		case SECONDS: return ns * 1E-9;
+		case MILLISECONDS: return ns * 1E-6;
+		case MICROSECONDS: return ns * 1E-3;
+		case PERCENT: return (percent_base > 0) ? 100 * ns / percent_base : 0;
+	}
+	return 0;
+}
+
+QT_TEST(profiler_test)
+{
+	Profiler & p = Profiler::get();
+	const int outer = Profiler::getBlockId("profiler_test outer");
+	const int inner = Profiler::getBlockId("profiler_test inner");
+	const int worker = Profiler::getBlockId("profiler_test worker");
+	QT_CHECK(outer >= 0 && inner >= 0 && worker >= 0);
+	QT_CHECK_EQUAL(Profiler::getBlockId("profiler_test outer"), outer);
+	QT_CHECK(inner != outer);
+
+	p.init();
+
+	// nested scopes on two threads
+	const uint64_t t0 = Profiler::now();
+	p.record(inner, t0 + 1000, t0 + 3000);
+	p.record(outer, t0, t0 + 5000);
+	std::thread thread([&p, worker, t0]()
+	{
+		Profiler::setThreadName("profiler_test thread");
+		p.record(worker, t0 + 2000, t0 + 4000);
+	});
+	thread.join();
+
+	// the next thread takes over the record of the exited one
+	std::ostringstream first_trace;
+	p.writeChromeTrace(first_trace);
+	QT_CHECK(first_trace.str().find("\"args\":{\"name\":\"profiler_test thread\"}") != std::string::npos);
+	std::thread next_thread([&p, worker, t0]()
+	{
+		Profiler::setThreadName("profiler_test next thread");
+		p.record(worker, t0 + 4000, t0 + 5000);
+	});
+	next_thread.join();
+	std::ostringstream next_trace;
+	p.writeChromeTrace(next_trace);
+	auto thread_count = [](const std::string & trace)
+	{
+		size_t count = 0;
+		for (size_t i = trace.find("\"thread_name\""); i != std::string::npos; i = trace.find("\"thread_name\"", i + 1))
+			count++;
+		return count;
+	};
+	QT_CHECK_EQUAL(thread_count(next_trace.str()), thread_count(first_trace.str()));
+	QT_CHECK(next_trace.str().find("\"args\":{\"name\":\"profiler_test next thread\"}") != std::string::npos);
+
+	// ticks are calibrated over the time since init, let it outweigh clock noise
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	p.endCycle();
+
+	// times are in clock ticks, compare ratios
+	const double outer_time = p.getTotalDuration("profiler_test outer", Profiler::MICROSECONDS);
+	const double inner_time = p.getTotalDuration("profiler_test inner", Profiler::MICROSECONDS);
+	const double worker_time = p.getTotalDuration("profiler_test worker", Profiler::MICROSECONDS);
+	const double worker_avg = p.getAvgDuration("profiler_test worker", Profiler::MICROSECONDS);
+	QT_CHECK(outer_time > 0);
+	QT_CHECK_CLOSE(inner_time / outer_time, 0.4, 1E-3);
+	QT_CHECK_CLOSE(worker_time / outer_time, 0.6, 1E-3);
+	QT_CHECK_CLOSE(worker_avg / outer_time, 0.6, 1E-2);
+	QT_CHECK_EQUAL(p.getTotalDuration("profiler_test unknown", Profiler::MICROSECONDS), 0.0);
+
+	const std::string summary = p.getSummary(Profiler::MICROSECONDS);
+	const size_t inner_pos = summary.find("profiler_test inner: ");
+	const size_t outer_pos = summary.find("profiler_test outer: ");
+	QT_CHECK(inner_pos != std::string::npos && outer_pos != std::string::npos && inner_pos < outer_pos);
+
+	std::ostringstream trace;
+	p.writeChromeTrace(trace);
+	const std::string s = trace.str();
+	QT_CHECK(s.find("{\"traceEvents\":[") == 0);
+	QT_CHECK(s.find("{\"name\":\"profiler_test outer\",\"ph\":\"X\",\"pid\":1,\"tid\":") != std::string::npos);
+	QT_CHECK(s.find("{\"name\":\"profiler_test worker\",\"ph\":\"X\",\"pid\":1,\"tid\":") != std::string::npos);
+
+	// scopes record nothing when the profiler is off
+	p.init();
+	p.deinit();
+	{
+		PROFILER_SCOPE("profiler_test outer");
+	}
+	QT_CHECK_EQUAL(p.getTotalDuration("profiler_test outer", Profiler::MICROSECONDS), 0.0);
+}
+
+MICROBENCH(profiler)
+{
+	const int count = 1000000;
+	Profiler & p = Profiler::get();
+
+	p.deinit();
+	bench.measure("disabled scope", count, [&]()
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			PROFILER_SCOPE("microbench scope");
+			microbench::consume(i);
+		}
+	});
+
+	p.init();
+	bench.measure("enabled scope", count, [&]()
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			PROFILER_SCOPE("microbench scope");
+			microbench::consume(i);
+		}
+	});
+	p.deinit();
+}
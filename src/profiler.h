@@ -0,0 +1,225 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+
+#ifndef _PROFILER_H
+#define _PROFILER_H
+
+#include "definitions.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROFILER_TSC
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#define PROFILER_TSC
+#endif
+
+/// Thread aware scope profiler.
+///
+/// Blocks are named by string literals, each PROFILER_SCOPE site looks up
+/// the id of its name once. A scope adds its duration to the block totals
+/// of the calling thread and records a begin/end event into a ring buffer
+/// owned by that thread. Nothing is locked while recording. Scopes nest,
+/// block totals include the time of nested scopes.
+/// Scopes are timed by the time stamp counter on x86, by steady_clock
+/// elsewhere. Ticks are converted to time by comparing the tick count with
+/// steady_clock since init.
+/// The most recent events of all threads can be exported in the Chrome trace
+/// event format, to view them in chrome://tracing or Perfetto.
+/// A new thread takes over the buffers of an exited thread, their number is
+/// bounded by the number of threads alive at once.
+/// Defining PROFILER_DISABLED (scons profiler=0) compiles the scopes out.
+class Profiler
+{
+public:
+	enum TimeFormat
+	{
+		SECONDS,
+		MILLISECONDS,
+		MICROSECONDS,
+		PERCENT
+	};
+
+	/// the profiler shared by all threads
+	static Profiler & get();
+
+	/// Id of the block name, blocks with equal names share the id.
+	/// name must stay valid, use string literals.
+	static int getBlockId(const char * name);
+
+	/// name the calling thread in the trace
+	static void setThreadName(const std::string & name);
+
+	/// monotonic time in clock ticks
+	static uint64_t now();
+
+	Profiler();
+
+	~Profiler();
+
+	/// Start recording, erases all recorded data. Averages are smoothed over
+	/// about smoothing cycles, 0 disables smoothing.
+	void init(double smoothing = 0);
+
+	/// stop recording
+	void deinit();
+
+	bool enabled() const;
+
+	/// add scope of block from begin to end to the calling thread
+	void record(int block, uint64_t begin, uint64_t end);
+
+	/// end of a profiling cycle (tick, frame), updates the per cycle averages
+	void endCycle();
+
+	/// block time per cycle, smoothed, summed over threads
+	double getAvgDuration(const std::string & name, TimeFormat format) const;
+
+	/// block time since init, summed over threads
+	double getTotalDuration(const std::string & name, TimeFormat format) const;
+
+	/// total time of each recorded block
+	std::string getSummary(TimeFormat format = PERCENT) const;
+
+	/// average time per cycle of each recorded block
+	std::string getAvgSummary(TimeFormat format = PERCENT) const;
+
+	/// write the events in the ring buffers as Chrome trace event json
+	void writeChromeTrace(std::ostream & out) const;
+
+	/// times a block until the end of the scope
+	class Scope
+	{
+	public:
+		Scope(int id);
+		~Scope();
+
+	private:
+		int block;
+		uint64_t begin;
+	};
+
+private:
+	static const int max_blocks = 256;
+	static const int event_count = 1 << 16;
+
+	struct Event
+	{
+		std::atomic<uint64_t> begin;
+		std::atomic<uint64_t> end;
+		std::atomic<int> block;
+	};
+
+	/// written by its thread only
+	struct Thread
+	{
+		std::string name;
+		std::atomic<uint64_t> head; ///< number of recorded events
+		std::unique_ptr<Event[]> events;
+		std::atomic<uint64_t> total[max_blocks]; ///< ticks
+		std::atomic<uint64_t> count[max_blocks];
+	};
+
+	std::atomic<bool> recording;
+	uint64_t init_ticks;
+	std::chrono::steady_clock::time_point init_time;
+
+	mutable std::mutex mutex;
+	std::vector<const char *> names;
+	std::vector<std::shared_ptr<Thread> > threads; ///< also owned by their thread while it runs
+
+	// cycle averages, updated by endCycle
+	double smoothing_scalar;
+	bool first_cycle;
+	uint64_t cycle_start;
+	double cycle_avg;
+	std::vector<uint64_t> block_last;
+	std::vector<double> block_avg;
+
+	Thread & getThread();
+
+	/// nanoseconds per clock tick
+	double getTickLength() const;
+
+	/// id of name or -1
+	int findBlock(const std::string & name) const;
+
+	/// block time summed over threads in ticks
+	uint64_t getBlockTotal(int block) const;
+
+	bool isRecorded(int block) const;
+
+	double convert(double ns, TimeFormat format, double percent_base) const;
+};
+
+#define PROFILER Profiler::get()
+
+#define PROFILER_CONCAT_(a, b) a##b
+#define PROFILER_CONCAT(a, b) PROFILER_CONCAT_(a, b)
+
+#if defined(PROFILER_DISABLED)
+#define PROFILER_SCOPE(name) ((void)0)
+#else
+/// time the rest of the enclosing scope as block name
+#define PROFILER_SCOPE(name) \
+	static const int PROFILER_CONCAT(profiler_block_, __LINE__) = Profiler::getBlockId(name); \
+	Profiler::Scope PROFILER_CONCAT(profiler_scope_, __LINE__)(PROFILER_CONCAT(profiler_block_, __LINE__))
+#endif
+
+// implementation
+
+inline uint64_t Profiler::now()
+{
+#if defined(PROFILER_TSC)
+	return __rdtsc();
+#else
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+inline bool Profiler::enabled() const
+{
+	return recording.load(std::memory_order_relaxed);
+}
+
+inline Profiler::Scope::Scope(int id) :
+	block(PROFILER.enabled() ? id : -1),
+	begin(block >= 0 ? now() : 0)
+{
+	// ctor
+}
+
+inline Profiler::Scope::~Scope()
+{
+	if (block >= 0)
+		PROFILER.record(block, begin, now());
+}
+
+#endif // _PROFILER_H
@@ -24,11 +24,24 @@
 #include "physics/cardynamics.h"
 #include "joeserialize.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
 #include <sstream>
 #include <fstream>
 
+// replays are written as streams since V17, V16 files are loaded as a whole
+static const char * const replay_version = "VDRIFTREPLAYV17";
+static const char * const replay_version_v16 = "VDRIFTREPLAYV16";
+
+// frames recorded per stream chunk
+static const unsigned chunk_frames = 300;
+
+// chunk size limit for streams of unknown length, chunks are a few KB per car
+static const unsigned max_chunk_size = 64 << 20;
+
 Replay::Replay(float framerate) :
-	version_info("VDRIFTREPLAYV16", CarInput::INVALID, framerate),
+	version_info(replay_version, CarInput::INVALID, framerate),
 	replaymode(IDLE)
 {
 	// ctor
@@ -60,19 +73,42 @@ bool Replay::StartPlaying(const std::string & replayfilename, std::ostream & err
 
 void Replay::Reset()
 {
+	// an unfinished recording is discarded
+	if (stream)
+	{
+		// no chunk is written yet within the first chunk interval
+		if (stream_job)
+			JobSystem::get().wait(stream_job);
+		stream.reset();
+		stream_coder.reset();
+		stream_job.reset();
+		std::remove(stream_filename.c_str());
+	}
+
 	replaymode = IDLE;
 	track.clear();
 	carinfo.clear();
 	carstate.clear();
 }
 
-void Replay::StartRecording(
+bool Replay::StartRecording(
 	const std::vector<CarInfo> & ncarinfo,
 	const std::string & trackname,
-	std::ostream & /*error_log*/)
+	const std::string & streamfilename,
+	std::ostream & error_log)
 {
 	Reset();
 
+	stream = std::make_shared<std::ofstream>(streamfilename.c_str(), std::ios::binary);
+	if (!*stream)
+	{
+		error_log << "Error opening replay stream: " << streamfilename << std::endl;
+		stream.reset();
+		return false;
+	}
+	stream_filename = streamfilename;
+	stream_coder = std::make_shared<StreamCoder>(ncarinfo.size());
+
 	replaymode = RECORDING;
 	carinfo = ncarinfo;
 	track = trackname;
@@ -82,19 +118,83 @@ void Replay::StartRecording(
 	{
 		state.Reset();
 	}
+
+	// write the header, the chunks follow as they are recorded
+	version_info.Save(*stream);
+	joeserialize::BinaryOutputSerializer serialize_output(*stream);
+	serialize_output.Serialize("track", track);
+	serialize_output.Serialize("carinfo", carinfo);
+
+	return true;
 }
 
-void Replay::StopRecording(const std::string & replayfilename)
+bool Replay::StopRecording(const std::string & replayfilename)
 {
-	replaymode = IDLE;
-	if (!replayfilename.empty())
+	if (!stream)
+		return false;
+
+	WriteChunk();
+	JobSystem::get().wait(stream_job);
+	stream_job.reset();
+	stream_coder.reset();
+
+	bool success = bool(*stream);
+	stream.reset();
+
+	if (!replayfilename.empty() && success)
+	{
+		std::remove(replayfilename.c_str());
+		success = std::rename(stream_filename.c_str(), replayfilename.c_str()) == 0;
+	}
+	else
+	{
+		std::remove(stream_filename.c_str());
+	}
+
+	Reset();
+
+	return success;
+}
+
+void Replay::WriteChunk()
+{
+	auto chunk = std::make_shared<Chunk>();
+	chunk->inputframes.resize(carstate.size());
+	chunk->stateframes.resize(carstate.size());
+	for (unsigned i = 0; i < carstate.size(); i++)
 	{
-		std::ofstream f(replayfilename.c_str(), std::ios::binary);
-		if (f)
+		chunk->inputframes[i].swap(carstate[i].inputframes);
+		chunk->stateframes[i].swap(carstate[i].stateframes);
+		carstate[i].keyframes.clear();
+	}
+
+	// chunks are written in order, each job waits for the previous one
+	std::shared_ptr<std::ofstream> out = stream;
+	std::shared_ptr<StreamCoder> coder = stream_coder;
+	auto write = [chunk, out, coder]()
+	{
+		std::string data;
+		for (unsigned i = 0; i < chunk->inputframes.size(); i++)
 		{
-			Save(f);
+			coder->Write(i, chunk->inputframes[i], chunk->stateframes[i], data);
 		}
-	}
+
+		unsigned size = data.size();
+		joeserialize::BinaryOutputSerializer serialize_output(*out);
+		serialize_output.Serialize("size", size);
+		out->write(data.data(), data.size());
+		out->flush();
+	};
+
+	JobSystem & jobs = JobSystem::get();
+	if (stream_job)
+		stream_job = jobs.add(write, {stream_job});
+	else
+		stream_job = jobs.add(write);
+
+	// without worker threads the chunk is written right away
+	if (jobs.getThreadCount() == 1)
+		jobs.wait(stream_job);
 }
 
 const std::vector<float> & Replay::PlayFrame(unsigned carid, CarDynamics & car)
@@ -121,7 +221,43 @@ void Replay::RecordFrame(unsigned carid, const std::vector <float> & inputs, Car
 			replaymode = IDLE;
 
 		carstate[carid].RecordFrame(inputs, car);
+
+		if (carid + 1 == carstate.size() && carstate[carid].frame % chunk_frames == 0)
+			WriteChunk();
+	}
+}
+
+unsigned Replay::Seek(unsigned frame, CarDynamics cars[], unsigned count)
+{
+	assert(count <= carstate.size());
+
+	const unsigned frame_count = GetFrameCount();
+	if (GetRecording() || frame_count == 0)
+		return 0;
+
+	if (frame >= frame_count)
+		frame = frame_count - 1;
+
+	unsigned frames = 0;
+	for (unsigned i = 0; i < count; i++)
+	{
+		frames = std::max(frames, carstate[i].Seek(frame, cars[i]));
+	}
+
+	// seeking back from the end of the replay resumes playing
+	replaymode = PLAYING;
+
+	return frames;
+}
+
+unsigned Replay::GetFrameCount() const
+{
+	unsigned count = 0;
+	for (const auto & state : carstate)
+	{
+		count = std::max(count, state.GetFrameCount());
 	}
+	return count;
 }
 
 void Replay::CarState::RecordFrame(const std::vector <float> & inputs, CarDynamics & car)
@@ -150,6 +286,7 @@ void Replay::CarState::RecordFrame(const std::vector <float> & inputs, CarDynami
 		stateframes.push_back(StateFrame(frame));
 		stateframes.back().SetBinaryStateData(statestream.str());
 		stateframes.back().SetInputSnapshot(inputs);
+		keyframes.push_back(inputframes.size());
 	}
 
 	frame++;
@@ -157,6 +294,15 @@ void Replay::CarState::RecordFrame(const std::vector <float> & inputs, CarDynami
 
 bool Replay::CarState::PlayFrame(CarDynamics & car)
 {
+	// keep the initial car state for seeks before the first state frame
+	if (frame == 0 && initial_state.empty())
+	{
+		std::ostringstream statestream;
+		joeserialize::BinaryOutputSerializer serialize_output(statestream);
+		car.Serialize(serialize_output);
+		initial_state = statestream.str();
+	}
+
 	frame++;
 
 	assert(inputbuffer.size() == CarInput::INVALID);
@@ -181,6 +327,77 @@ bool Replay::CarState::PlayFrame(CarDynamics & car)
 	return (cur_stateframe != stateframes.size() || cur_inputframe != inputframes.size());
 }
 
+unsigned Replay::CarState::Seek(unsigned target, CarDynamics & car)
+{
+	assert(keyframes.size() == stateframes.size());
+
+	// last state frame at or before target
+	auto next = std::upper_bound(stateframes.begin(), stateframes.end(), target,
+		[](unsigned f, const StateFrame & s) { return f < s.GetFrame(); });
+	if (next == stateframes.begin())
+	{
+		if (!initial_state.empty())
+		{
+			std::istringstream statestream(initial_state);
+			joeserialize::BinaryInputSerializer serialize_input(statestream);
+			car.Serialize(serialize_input);
+		}
+		inputbuffer.assign(CarInput::INVALID, 0);
+		cur_inputframe = 0;
+		cur_stateframe = 0;
+		frame = 0;
+		return target;
+	}
+	const unsigned key = next - stateframes.begin() - 1;
+	const unsigned key_frame = stateframes[key].GetFrame();
+
+	ProcessPlayStateFrame(stateframes[key], car);
+
+	if (key_frame == 0)
+	{
+		frame = 0;
+		cur_stateframe = key + 1;
+		cur_inputframe = 0;
+		return target;
+	}
+
+	// PlayFrame applies the state frame again when it arrives at it, resume
+	// one frame early so that the simulation step of the state frame is kept
+	unsigned input = keyframes[key];
+	if (input > 0 && inputframes[input - 1].GetFrame() == key_frame)
+		input--;
+
+	frame = key_frame - 1;
+	cur_stateframe = key;
+	cur_inputframe = input;
+	return target - frame;
+}
+
+void Replay::CarState::BuildKeyframes()
+{
+	keyframes.resize(stateframes.size());
+	unsigned input = 0;
+	for (unsigned i = 0; i < stateframes.size(); i++)
+	{
+		while (input < inputframes.size() &&
+			inputframes[input].GetFrame() <= stateframes[i].GetFrame())
+		{
+			input++;
+		}
+		keyframes[i] = input;
+	}
+}
+
+unsigned Replay::CarState::GetFrameCount() const
+{
+	unsigned count = 0;
+	if (!inputframes.empty())
+		count = inputframes.back().GetFrame() + 1;
+	if (!stateframes.empty())
+		count = std::max(count, stateframes.back().GetFrame() + 1);
+	return count;
+}
+
 void Replay::CarState::ProcessPlayInputFrame(const InputFrame & frame)
 {
 	for (unsigned i = 0; i < frame.GetNumInputs(); i++)
@@ -204,26 +421,13 @@ void Replay::CarState::ProcessPlayStateFrame(const StateFrame & frame, CarDynami
 	car.Serialize(serialize_input);
 }
 
-void Replay::Save(std::ostream & outstream)
-{
-	// write the file format version data manually
-	// if the serialization functions were used,
-	// a variable length string would be written instead,
-	// which isn't exactly what we want
-	version_info.Save(outstream);
-
-	joeserialize::BinaryOutputSerializer serialize_output(outstream);
-	Serialize(serialize_output);
-
-	Reset();
-}
-
 bool Replay::Load(std::istream & instream, std::ostream & error_output)
 {
 	Version stream_version;
 	stream_version.Load(instream);
 
-	if (!(stream_version == version_info))
+	const bool legacy = (stream_version.format_version == replay_version_v16);
+	if (!legacy && !(stream_version == version_info))
 	{
 		error_output << "Stream version " <<
 			stream_version.format_version << "/" <<
@@ -236,13 +440,80 @@ bool Replay::Load(std::istream & instream, std::ostream & error_output)
 		return false;
 	}
 
+	if (legacy)
+	{
+		joeserialize::BinaryInputSerializer serialize_input(instream);
+		if (stream_version.inputs_supported != version_info.inputs_supported ||
+			stream_version.framerate != version_info.framerate ||
+			!Serialize(serialize_input))
+		{
+			error_output << "Error loading replay." << std::endl;
+			return false;
+		}
+	}
+	else if (!LoadStream(instream, error_output))
+	{
+		return false;
+	}
+
+	for (auto & state : carstate)
+	{
+		state.BuildKeyframes();
+	}
+
+	return true;
+}
+
+bool Replay::LoadStream(std::istream & instream, std::ostream & error_output)
+{
 	joeserialize::BinaryInputSerializer serialize_input(instream);
-	if (!Serialize(serialize_input))
+	if (!serialize_input.Serialize("track", track) ||
+		!serialize_input.Serialize("carinfo", carinfo))
 	{
 		error_output << "Error loading replay." << std::endl;
 		return false;
 	}
 
+	// chunk sizes are checked against the stream length before allocating
+	std::streamoff end = -1;
+	const std::streamoff begin = instream.tellg();
+	if (begin >= 0 && instream.seekg(0, std::ios::end))
+	{
+		end = instream.tellg();
+		instream.seekg(begin);
+	}
+	instream.clear();
+
+	carstate.resize(carinfo.size());
+	StreamCoder coder(carinfo.size());
+	std::string data;
+	while (true)
+	{
+		// a recording that was cut off ends with an incomplete chunk
+		unsigned size = 0;
+		if (!serialize_input.Serialize("size", size) || !instream)
+			break;
+
+		const std::streamoff chunk_pos = instream.tellg();
+		if ((end >= 0 && chunk_pos >= 0) ? std::streamoff(size) > end - chunk_pos : size > max_chunk_size)
+			break;
+
+		data.resize(size);
+		instream.read(&data[0], size);
+		if (unsigned(instream.gcount()) != size)
+			break;
+
+		size_t pos = 0;
+		for (unsigned i = 0; i < carstate.size(); i++)
+		{
+			if (!coder.Read(i, data, pos, carstate[i].inputframes, carstate[i].stateframes))
+			{
+				error_output << "Error loading replay chunk." << std::endl;
+				return false;
+			}
+		}
+	}
+
 	return true;
 }
 
@@ -379,17 +650,364 @@ void Replay::CarState::Reset()
 	cur_inputframe = 0;
 	cur_stateframe = 0;
 	frame = 0;
+	initial_state.clear();
+}
+
+// Stream format
+//
+// header: version, track, carinfo
+// chunk: size, frames of each car
+// car frames: input frame count, input frames, state frame count, state frames
+// input frame: frame delta, input count, (input index, value) for each input
+// state frame: frame delta, input snapshot size, values, state delta
+//
+// Counts, indices and frame deltas are varints. Values are varints of
+// quantized inputs if the quantization is exact, raw floats otherwise,
+// so the recorded inputs are played back bit exact. State snapshots are
+// xored with the previous snapshot of the car, the zero runs of the
+// result are run length coded.
+
+// input quantization step 1/1024
+static const float value_scale = 1024.0f;
+
+static void WriteVarint(unsigned value, std::string & out)
+{
+	while (value >= 0x80)
+	{
+		out.push_back(char(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back(char(value));
+}
+
+static bool ReadVarint(const std::string & in, size_t & pos, unsigned & value)
+{
+	value = 0;
+	for (unsigned shift = 0; shift < 32 && pos < in.size(); shift += 7)
+	{
+		unsigned char byte = in[pos++];
+		value |= unsigned(byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+			return true;
+	}
+	return false;
+}
+
+static void WriteValue(float value, std::string & out)
+{
+	// lowest bit tags quantized (0) or raw (1) values
+	const float scaled = value * value_scale;
+	if (scaled > -(1 << 28) && scaled < (1 << 28))
+	{
+		const int quantized = int(scaled);
+		const float restored = quantized / value_scale;
+		if (std::memcmp(&restored, &value, sizeof(value)) == 0)
+		{
+			const unsigned zigzag = (unsigned(quantized) << 1) ^ unsigned(quantized >> 31);
+			WriteVarint(zigzag << 1, out);
+			return;
+		}
+	}
+
+	unsigned bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	out.push_back(char(1));
+	for (int i = 0; i < 4; i++)
+		out.push_back(char(bits >> (i * 8)));
+}
+
+static bool ReadValue(const std::string & in, size_t & pos, float & value)
+{
+	unsigned code;
+	if (!ReadVarint(in, pos, code))
+		return false;
+
+	if (!(code & 1))
+	{
+		const unsigned zigzag = code >> 1;
+		const int quantized = int(zigzag >> 1) ^ -int(zigzag & 1);
+		value = quantized / value_scale;
+		return true;
+	}
+
+	if (pos + 4 > in.size())
+		return false;
+	unsigned bits = 0;
+	for (int i = 0; i < 4; i++)
+		bits |= unsigned((unsigned char)in[pos++]) << (i * 8);
+	std::memcpy(&value, &bits, sizeof(value));
+	return true;
+}
+
+// zero runs shorter than this are stored as literals
+static const unsigned min_zero_run = 3;
+
+static void WriteStateDelta(const std::string & prev, const std::string & state, std::string & out)
+{
+	const size_t size = state.size();
+	WriteVarint(size, out);
+
+	std::string delta(state);
+	for (size_t i = 0; i < size && i < prev.size(); i++)
+		delta[i] ^= prev[i];
+
+	// (zero count, literal count, literals) until the state is covered
+	size_t i = 0;
+	while (i < size)
+	{
+		size_t zeros = 0;
+		while (i + zeros < size && delta[i + zeros] == 0)
+			zeros++;
+		if (i + zeros < size && zeros < min_zero_run)
+			zeros = 0;
+
+		size_t literal_end = i + zeros;
+		while (literal_end < size)
+		{
+			size_t run = 0;
+			while (literal_end + run < size && delta[literal_end + run] == 0 && run < min_zero_run)
+				run++;
+			if (run == min_zero_run || literal_end + run == size)
+				break;
+			literal_end += run + 1;
+		}
+
+		WriteVarint(zeros, out);
+		WriteVarint(literal_end - i - zeros, out);
+		out.append(delta, i + zeros, literal_end - i - zeros);
+		i = literal_end;
+	}
+}
+
+static bool ReadStateDelta(const std::string & in, size_t & pos, const std::string & prev, std::string & state)
+{
+	unsigned size;
+	if (!ReadVarint(in, pos, size) || size > in.size() * 64)
+		return false;
+
+	state.assign(size, 0);
+	size_t i = 0;
+	while (i < size)
+	{
+		unsigned zeros, literals;
+		if (!ReadVarint(in, pos, zeros) || !ReadVarint(in, pos, literals) ||
+			zeros + literals == 0 || i + zeros + literals > size || pos + literals > in.size())
+		{
+			return false;
+		}
+		i += zeros;
+		state.replace(i, literals, in, pos, literals);
+		pos += literals;
+		i += literals;
+	}
+
+	for (size_t n = 0; n < size && n < prev.size(); n++)
+		state[n] ^= prev[n];
+
+	return true;
+}
+
+Replay::StreamCoder::StreamCoder(unsigned carcount) :
+	cars(carcount)
+{
+	// ctor
 }
 
-/* FIXME
-QT_TEST(replay_test)
+void Replay::StreamCoder::Write(
+	unsigned car,
+	const std::vector<InputFrame> & inputframes,
+	const std::vector<StateFrame> & stateframes,
+	std::string & chunk)
 {
-	// basic version validity check
+	assert(car < cars.size());
+	Car & c = cars[car];
+
+	WriteVarint(inputframes.size(), chunk);
+	for (const auto & frame : inputframes)
+	{
+		WriteVarint(frame.GetFrame() - c.input_frame, chunk);
+		c.input_frame = frame.GetFrame();
+
+		WriteVarint(frame.GetNumInputs(), chunk);
+		for (unsigned i = 0; i < frame.GetNumInputs(); i++)
+		{
+			WriteVarint(frame.GetInput(i).first, chunk);
+			WriteValue(frame.GetInput(i).second, chunk);
+		}
+	}
+
+	WriteVarint(stateframes.size(), chunk);
+	for (const auto & frame : stateframes)
+	{
+		WriteVarint(frame.GetFrame() - c.state_frame, chunk);
+		c.state_frame = frame.GetFrame();
+
+		const std::vector<float> & inputs = frame.GetInputSnapshot();
+		WriteVarint(inputs.size(), chunk);
+		for (float value : inputs)
+			WriteValue(value, chunk);
+
+		WriteStateDelta(c.state, frame.GetBinaryStateData(), chunk);
+		c.state = frame.GetBinaryStateData();
+	}
+}
+
+bool Replay::StreamCoder::Read(
+	unsigned car,
+	const std::string & chunk,
+	size_t & pos,
+	std::vector<InputFrame> & inputframes,
+	std::vector<StateFrame> & stateframes)
+{
+	assert(car < cars.size());
+	Car & c = cars[car];
+
+	unsigned count;
+	if (!ReadVarint(chunk, pos, count))
+		return false;
+	for (unsigned n = 0; n < count; n++)
+	{
+		unsigned delta, inputs;
+		if (!ReadVarint(chunk, pos, delta) || !ReadVarint(chunk, pos, inputs))
+			return false;
+
+		c.input_frame += delta;
+		InputFrame frame(c.input_frame);
+		for (unsigned i = 0; i < inputs; i++)
+		{
+			unsigned index;
+			float value;
+			if (!ReadVarint(chunk, pos, index) || index >= CarInput::INVALID ||
+				!ReadValue(chunk, pos, value))
+			{
+				return false;
+			}
+			frame.AddInput(index, value);
+		}
+		inputframes.push_back(frame);
+	}
+
+	if (!ReadVarint(chunk, pos, count))
+		return false;
+	for (unsigned n = 0; n < count; n++)
+	{
+		unsigned delta, size;
+		if (!ReadVarint(chunk, pos, delta) || !ReadVarint(chunk, pos, size) || size > chunk.size())
+			return false;
+
+		c.state_frame += delta;
+		std::vector<float> inputs(size);
+		for (auto & value : inputs)
+		{
+			if (!ReadValue(chunk, pos, value))
+				return false;
+		}
+
+		std::string state;
+		if (!ReadStateDelta(chunk, pos, c.state, state))
+			return false;
+		c.state = state;
+
+		stateframes.push_back(StateFrame(c.state_frame));
+		stateframes.back().SetInputSnapshot(inputs);
+		stateframes.back().SetBinaryStateData(state);
+	}
+
+	return true;
+}
+
+QT_TEST(replay_stream_test)
+{
+	// values round trip bit exact
+	{
+		const float values[] = {0.0f, 1.0f, -1.0f, 0.5f, 0.123456f, -0.75f, 1E-20f, 3E+9f, -0.0f};
+		std::string data;
+		for (float v : values)
+			WriteValue(v, data);
+
+		size_t pos = 0;
+		bool exact = true;
+		for (float v : values)
+		{
+			float r = 1;
+			exact = exact && ReadValue(data, pos, r) && std::memcmp(&r, &v, sizeof(v)) == 0;
+		}
+		QT_CHECK(exact);
+		QT_CHECK_EQUAL(pos, data.size());
+
+		// common inputs take one or two bytes
+		std::string one;
+		WriteValue(1.0f, one);
+		QT_CHECK_EQUAL(one.size(), 2u);
+		one.clear();
+		WriteValue(0.0f, one);
+		QT_CHECK_EQUAL(one.size(), 1u);
+	}
+
+	// state deltas round trip, unchanged bytes are not stored
+	{
+		std::string prev, state;
+		for (int i = 0; i < 1000; i++)
+		{
+			prev.push_back(char(i * 7));
+			state.push_back(char(i % 50 == 0 ? i : i * 7));
+		}
+		state.append("tail");
+
+		std::string data;
+		WriteStateDelta(prev, state, data);
+		QT_CHECK_LESS(data.size(), 100u);
+
+		size_t pos = 0;
+		std::string decoded;
+		QT_CHECK(ReadStateDelta(data, pos, prev, decoded));
+		QT_CHECK(decoded == state);
+		QT_CHECK_EQUAL(pos, data.size());
+
+		// truncated data
+		pos = 0;
+		QT_CHECK(!ReadStateDelta(data.substr(0, data.size() - 1), pos, prev, decoded));
+
+		// shorter state, no previous state
+		data.clear();
+		pos = 0;
+		WriteStateDelta(state, prev.substr(0, 10), data);
+		WriteStateDelta(std::string(), state, data);
+		QT_CHECK(ReadStateDelta(data, pos, state, decoded) && decoded == prev.substr(0, 10));
+		QT_CHECK(ReadStateDelta(data, pos, std::string(), decoded) && decoded == state);
+	}
+
+	// a corrupt chunk size ends the replay without allocating it
+	{
+		const std::string filename = "replay_stream_test.vdr";
+		std::ostringstream error;
+		Replay recorder(90);
+		QT_CHECK(recorder.StartRecording(std::vector<CarInfo>(1), "track", filename + ".tmp", error));
+		QT_CHECK(recorder.StopRecording(filename));
+		{
+			std::ofstream file(filename.c_str(), std::ios::binary | std::ios::app);
+			joeserialize::BinaryOutputSerializer output(file);
+			unsigned size = 0xFFFFFFF0;
+			output.Serialize("size", size);
+			file << "junk";
+		}
+
+		Replay player(90);
+		QT_CHECK(player.StartPlaying(filename, error));
+		QT_CHECK_EQUAL(player.GetCarInfo().size(), 1u);
+		QT_CHECK_EQUAL(player.GetFrameCount(), 0u);
+		std::remove(filename.c_str());
+	}
+
+	// a recording reset before its first chunk is discarded
 	{
-		REPLAY replay(0.004);
-		std::ostringstream teststream;
-		replay.Save(teststream);
-		QT_CHECK(replay.Load(teststream, std::cerr));
+		const std::string filename = "replay_reset_test.vdr.tmp";
+		std::ostringstream error;
+		Replay recorder(90);
+		QT_CHECK(recorder.StartRecording(std::vector<CarInfo>(1), "track", filename, error));
+		QT_CHECK(recorder.GetRecording());
+		recorder.Reset();
+		QT_CHECK(!recorder.GetRecording());
+		QT_CHECK(!std::ifstream(filename.c_str()));
 	}
 }
-*/
@@ -21,9 +21,11 @@
 #define _REPLAY_H
 
 #include "carinfo.h"
+#include "jobsystem.h"
 #include "macros.h"
 
 #include <iosfwd>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -45,13 +47,18 @@ public:
 	/// true if the replay system is currently playing
 	bool GetPlaying() const;
 
-	void StartRecording(
+	/// Recorded frames are streamed to streamfilename in chunks by a
+	/// background job, false if the stream can not be opened.
+	bool StartRecording(
 		const std::vector<CarInfo> & carinfo,
 		const std::string & trackname,
+		const std::string & streamfilename,
 		std::ostream & error_log);
 
-	/// if replayfilename is empty, do not save the data
-	void StopRecording(const std::string & replayfilename);
+	/// Write the remaining frames and move the stream file to replayfilename.
+	/// If replayfilename is empty, the stream file is removed.
+	/// Returns false if the stream could not be written.
+	bool StopRecording(const std::string & replayfilename);
 
 	/// true if the replay system is currently recording
 	bool GetRecording() const;
@@ -62,6 +69,20 @@ public:
 	/// record car inputs and state
 	void RecordFrame(unsigned carid, const std::vector <float> & inputs, CarDynamics & car);
 
+	/// Jump to frame. Cars are set to the nearest state frame at or before
+	/// frame, playback continues from there. Returns the number of frames
+	/// to play (PlayFrame and simulate) to arrive at frame.
+	unsigned Seek(unsigned frame, CarDynamics cars[], unsigned count);
+
+	/// last played frame
+	unsigned GetFrame() const;
+
+	/// number of recorded frames
+	unsigned GetFrameCount() const;
+
+	/// duration of a frame in seconds
+	float GetFrameTime() const;
+
 	template <class Serializer>
 	bool Serialize(Serializer & s);
 
@@ -142,6 +163,46 @@ private:
 		std::vector<float> input_snapshot;
 	};
 
+	/// Encodes frames into the compact stream format and back, see replay.cpp.
+	/// Frames are delta coded against the previous frames of the same car.
+	class StreamCoder
+	{
+	public:
+		StreamCoder(unsigned carcount);
+
+		/// append frames of car to chunk
+		void Write(
+			unsigned car,
+			const std::vector<InputFrame> & inputframes,
+			const std::vector<StateFrame> & stateframes,
+			std::string & chunk);
+
+		/// append frames of car read from chunk at pos, false on corrupt data
+		bool Read(
+			unsigned car,
+			const std::string & chunk,
+			size_t & pos,
+			std::vector<InputFrame> & inputframes,
+			std::vector<StateFrame> & stateframes);
+
+	private:
+		struct Car
+		{
+			unsigned input_frame;
+			unsigned state_frame;
+			std::string state;
+			Car() : input_frame(0), state_frame(0) {}
+		};
+		std::vector<Car> cars;
+	};
+
+	/// frames of all cars to be written by the stream job
+	struct Chunk
+	{
+		std::vector< std::vector<InputFrame> > inputframes;
+		std::vector< std::vector<StateFrame> > stateframes;
+	};
+
 	struct CarState
 	{
 		/// serialized
@@ -149,10 +210,12 @@ private:
 		std::vector<StateFrame> stateframes;
 
 		/// not serialized
+		std::vector<unsigned> keyframes; // first input frame after each state frame
 		std::vector<float> inputbuffer; // buffer for input delta frame decoding
 		unsigned cur_inputframe;
 		unsigned cur_stateframe;
 		unsigned frame;
+		std::string initial_state; // car state before the first played frame
 
 		/// true if we have zero recorded frames
 		bool Empty() const;
@@ -170,6 +233,16 @@ private:
 		/// get car state, save input delta frame
 		void RecordFrame(const std::vector<float> & inputs, CarDynamics & car);
 
+		/// set car to the last state frame at or before target, or to the
+		/// initial state if there is none, return frames to play
+		unsigned Seek(unsigned target, CarDynamics & car);
+
+		/// rebuild keyframe index from loaded frames
+		void BuildKeyframes();
+
+		/// number of recorded frames
+		unsigned GetFrameCount() const;
+
 		void ProcessPlayInputFrame(const InputFrame & frame);
 
 		void ProcessPlayStateFrame(const StateFrame & frame, CarDynamics & car);
@@ -184,11 +257,20 @@ private:
 	/// not serialized
 	enum {IDLE, RECORDING, PLAYING} replaymode;
 
-	/// load all input and state frames to the stream
+	/// recording stream, only accessed by stream jobs while recording
+	std::shared_ptr<std::ofstream> stream;
+	std::shared_ptr<StreamCoder> stream_coder;
+	std::string stream_filename;
+	JobSystem::JobHandle stream_job;
+
+	/// load all input and state frames from the stream
 	bool Load(std::istream & instream, std::ostream & error_output);
 
-	/// save all input and state frames to the stream and then clear them
-	void Save(std::ostream & outstream);
+	/// load chunks of a streamed replay, stops at the end of the last complete chunk
+	bool LoadStream(std::istream & instream, std::ostream & error_output);
+
+	/// queue recorded frames for writing and clear them
+	void WriteChunk();
 };
 
 // implementation
@@ -203,6 +285,16 @@ inline bool Replay::GetRecording() const
 	return (replaymode == RECORDING);
 }
 
+inline unsigned Replay::GetFrame() const
+{
+	return carstate.empty() ? 0 : carstate[0].frame;
+}
+
+inline float Replay::GetFrameTime() const
+{
+	return version_info.framerate;
+}
+
 inline const std::vector<CarInfo> & Replay::GetCarInfo() const
 {
 	return carinfo;
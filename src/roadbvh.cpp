@@ -0,0 +1,698 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#include "roadbvh.h"
+#include "roadstrip.h"
+#include "simd.h"
+#include "testfixtures.h"
+#include "unittest.h"
+#include "microbench.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <sstream>
+
+template <typename T> struct LaneCount { static const int value = T::size; };
+template <> struct LaneCount<float> { static const int value = 1; };
+
+#if defined(SIMD_FLOAT8)
+typedef Float8 PacketLanes;
+#elif defined(SIMD_FLOAT4)
+typedef Float4 PacketLanes;
+#else
+typedef float PacketLanes;
+#endif
+
+static const int bin_count = 16;
+static const int max_leaf_size = 8;
+static const int max_depth = 60;
+
+/// node traversal cost relative to a patch test, which subdivides the patch six times
+static const float traversal_cost = 0.125f;
+
+/// patch boxes are padded, hit points are evaluated on the surface, not on the ray
+static const float box_margin = 0.01f;
+
+struct RoadBvh::BuildRef
+{
+	float min[3];
+	float max[3];
+	float center[3];
+	unsigned id;
+};
+
+struct BuildBounds
+{
+	float min[3];
+	float max[3];
+
+	BuildBounds()
+	{
+		for (int k = 0; k < 3; ++k)
+		{
+			min[k] = +1E38f;
+			max[k] = -1E38f;
+		}
+	}
+
+	void Merge(const float bmin[3], const float bmax[3])
+	{
+		for (int k = 0; k < 3; ++k)
+		{
+			min[k] = std::min(min[k], bmin[k]);
+			max[k] = std::max(max[k], bmax[k]);
+		}
+	}
+
+	/// half surface area
+	float Area() const
+	{
+		const float dx = max[0] - min[0];
+		const float dy = max[1] - min[1];
+		const float dz = max[2] - min[2];
+		return dx * dy + dy * dz + dz * dx;
+	}
+};
+
+RoadBvh::RoadBvh()
+{
+	// ctor
+}
+
+void RoadBvh::Build(const std::vector<RoadStrip> & roads)
+{
+	Clear();
+
+	for (const auto & road : roads)
+	{
+		for (const auto & patch : road.GetPatches())
+		{
+			patches.push_back(&patch);
+		}
+	}
+	if (patches.empty())
+		return;
+
+	std::vector<BuildRef> build_refs(patches.size());
+	for (unsigned i = 0; i < patches.size(); ++i)
+	{
+		const Aabb<float> box = patches[i]->GetAABB();
+		const Vec3 & center = box.GetCenter();
+		const Vec3 & extent = box.GetExtent();
+		BuildRef & ref = build_refs[i];
+		for (int k = 0; k < 3; ++k)
+		{
+			ref.min[k] = center[k] - extent[k] - box_margin;
+			ref.max[k] = center[k] + extent[k] + box_margin;
+			ref.center[k] = center[k];
+		}
+		ref.id = i;
+	}
+
+	nodes.reserve(2 * patches.size());
+	refs.reserve(patches.size());
+	BuildNode(build_refs, 0, build_refs.size(), 0);
+}
+
+void RoadBvh::Clear()
+{
+	nodes.clear();
+	refs.clear();
+	patches.clear();
+}
+
+unsigned RoadBvh::BuildNode(std::vector<BuildRef> & build_refs, unsigned begin, unsigned end, int depth)
+{
+	const unsigned index = nodes.size();
+	nodes.push_back(Node());
+
+	BuildBounds bounds, centers;
+	for (unsigned i = begin; i < end; ++i)
+	{
+		bounds.Merge(build_refs[i].min, build_refs[i].max);
+		centers.Merge(build_refs[i].center, build_refs[i].center);
+	}
+	for (int k = 0; k < 3; ++k)
+	{
+		nodes[index].min[k] = bounds.min[k];
+		nodes[index].max[k] = bounds.max[k];
+	}
+
+	// find the cheapest binned split
+	const unsigned count = end - begin;
+	const float area = bounds.Area();
+	float best_cost = count;
+	int best_axis = -1;
+	int best_bin = 0;
+	for (int axis = 0; axis < 3 && count > 1 && area > 0; ++axis)
+	{
+		const float cmin = centers.min[axis];
+		const float extent = centers.max[axis] - cmin;
+		if (extent <= 0)
+			continue;
+
+		BuildBounds bins[bin_count];
+		unsigned bin_refs[bin_count] = {0};
+		const float scale = bin_count / extent;
+		for (unsigned i = begin; i < end; ++i)
+		{
+			const BuildRef & ref = build_refs[i];
+			const int b = std::min(int((ref.center[axis] - cmin) * scale), bin_count - 1);
+			bins[b].Merge(ref.min, ref.max);
+			bin_refs[b]++;
+		}
+
+		// right side cost of splitting before bin b
+		float right_cost[bin_count];
+		BuildBounds right;
+		unsigned right_refs = 0;
+		for (int b = bin_count - 1; b > 0; --b)
+		{
+			right.Merge(bins[b].min, bins[b].max);
+			right_refs += bin_refs[b];
+			right_cost[b] = right_refs ? right.Area() * right_refs : 0;
+		}
+
+		BuildBounds left;
+		unsigned left_refs = 0;
+		for (int b = 1; b < bin_count; ++b)
+		{
+			left.Merge(bins[b - 1].min, bins[b - 1].max);
+			left_refs += bin_refs[b - 1];
+			if (left_refs == 0 || left_refs == count)
+				continue;
+
+			const float cost = traversal_cost + (left.Area() * left_refs + right_cost[b]) / area;
+			if (cost < best_cost)
+			{
+				best_cost = cost;
+				best_axis = axis;
+				best_bin = b;
+			}
+		}
+	}
+
+	unsigned mid = begin;
+	if (best_axis >= 0 && depth < max_depth)
+	{
+		const float cmin = centers.min[best_axis];
+		const float scale = bin_count / (centers.max[best_axis] - cmin);
+		mid = std::partition(
+			build_refs.begin() + begin, build_refs.begin() + end,
+			[best_axis, best_bin, cmin, scale](const BuildRef & ref)
+			{
+				return std::min(int((ref.center[best_axis] - cmin) * scale), bin_count - 1) < best_bin;
+			}) - build_refs.begin();
+	}
+	else if (count > max_leaf_size && depth < max_depth)
+	{
+		// no split beats a leaf, but the leaf is too large, split at the median
+		int axis = 0;
+		for (int k = 1; k < 3; ++k)
+		{
+			if (centers.max[k] - centers.min[k] > centers.max[axis] - centers.min[axis])
+				axis = k;
+		}
+		best_axis = axis;
+		mid = begin + count / 2;
+		std::nth_element(
+			build_refs.begin() + begin, build_refs.begin() + mid, build_refs.begin() + end,
+			[axis](const BuildRef & a, const BuildRef & b) { return a.center[axis] < b.center[axis]; });
+	}
+
+	if (mid == begin || mid == end)
+	{
+		assert(count <= 0xFFFF);
+		nodes[index].offset = refs.size();
+		nodes[index].count = count;
+		nodes[index].axis = 0;
+		for (unsigned i = begin; i < end; ++i)
+		{
+			refs.push_back(build_refs[i].id);
+		}
+		return index;
+	}
+
+	BuildNode(build_refs, begin, mid, depth + 1);
+	const unsigned right = BuildNode(build_refs, mid, end, depth + 1);
+	nodes[index].offset = right;
+	nodes[index].count = 0;
+	nodes[index].axis = best_axis;
+	return index;
+}
+
+bool RoadBvh::CastRay(
+	const Vec3 & origin,
+	const Vec3 & direction,
+	const float seglen,
+	int & patch_id,
+	Vec3 & outtri,
+	const RoadPatch * & colpatch,
+	Vec3 & normal) const
+{
+	bool col;
+	CastPacket<float>(1, &origin, &direction, &seglen, &patch_id, &outtri, &colpatch, &normal, &col);
+	return col;
+}
+
+void RoadBvh::CastRays(
+	const int count,
+	const Vec3 origin[],
+	const Vec3 direction[],
+	const float seglen[],
+	int patch_id[],
+	Vec3 outtri[],
+	const RoadPatch * colpatch[],
+	Vec3 normal[],
+	bool col[]) const
+{
+	assert(count <= max_packet);
+	const int width = LaneCount<PacketLanes>::value;
+	for (int i = 0; i < count; i += width)
+	{
+		const int n = std::min(count - i, width);
+		if (n == 1)
+		{
+			CastPacket<float>(n, origin + i, direction + i, seglen + i,
+				patch_id + i, outtri + i, colpatch + i, normal + i, col + i);
+		}
+		else
+		{
+			CastPacket<PacketLanes>(n, origin + i, direction + i, seglen + i,
+				patch_id + i, outtri + i, colpatch + i, normal + i, col + i);
+		}
+	}
+}
+
+template <typename T>
+void RoadBvh::CastPacket(
+	const int count,
+	const Vec3 origin[],
+	const Vec3 direction[],
+	const float seglen[],
+	int patch_id[],
+	Vec3 outtri[],
+	const RoadPatch * colpatch[],
+	Vec3 normal[],
+	bool col[]) const
+{
+	const int width = LaneCount<T>::value;
+	assert(count <= width);
+
+	// ray lanes, unused lanes get a negative limit and never hit
+	float ray_origin[3][width];
+	float ray_inv_dir[3][width];
+	float ray_limit[width]; ///< parametric length of the segment, shrinks to the nearest hit
+	float ray_scale[width]; ///< distance to parameter scale
+	float best[width]; ///< distance of the nearest hit
+	int hint[width];
+	for (int i = 0; i < width; ++i)
+	{
+		if (i < count)
+		{
+			for (int k = 0; k < 3; ++k)
+			{
+				float d = direction[i][k];
+				if (std::abs(d) < 1E-20f)
+					d = (d < 0) ? -1E-20f : 1E-20f;
+				ray_origin[k][i] = origin[i][k];
+				ray_inv_dir[k][i] = 1 / d;
+			}
+			ray_scale[i] = 1 / direction[i].Magnitude();
+			ray_limit[i] = seglen[i] * ray_scale[i];
+			best[i] = seglen[i];
+			hint[i] = patch_id[i];
+			col[i] = false;
+		}
+		else
+		{
+			for (int k = 0; k < 3; ++k)
+			{
+				ray_origin[k][i] = 0;
+				ray_inv_dir[k][i] = 1;
+			}
+			ray_scale[i] = 1;
+			ray_limit[i] = -1;
+			hint[i] = -1;
+		}
+	}
+
+	// nearest hit wins, equal distances go to the lower patch id
+	auto test = [&](int i, unsigned id)
+	{
+		Vec3 coltri, colnorm;
+		if (!patches[id]->Collide(origin[i], direction[i], seglen[i], coltri, colnorm))
+			return;
+
+		const float dist = (coltri - origin[i]).Magnitude();
+		if (col[i] && (dist > best[i] || (dist == best[i] && int(id) > patch_id[i])))
+			return;
+
+		outtri[i] = coltri;
+		normal[i] = colnorm;
+		colpatch[i] = patches[id];
+		patch_id[i] = id;
+		best[i] = dist;
+		ray_limit[i] = dist * ray_scale[i];
+		col[i] = true;
+	};
+
+	// the hint patch is usually hit, its distance culls most of the tree
+	for (int i = 0; i < count; ++i)
+	{
+		if (hint[i] >= 0 && hint[i] < (int)patches.size())
+			test(i, hint[i]);
+	}
+
+	if (nodes.empty())
+		return;
+
+	const T ox = LoadLanes<T>(ray_origin[0]);
+	const T oy = LoadLanes<T>(ray_origin[1]);
+	const T oz = LoadLanes<T>(ray_origin[2]);
+	const T ix = LoadLanes<T>(ray_inv_dir[0]);
+	const T iy = LoadLanes<T>(ray_inv_dir[1]);
+	const T iz = LoadLanes<T>(ray_inv_dir[2]);
+
+	// the packet is coherent, children are visited in the order of the first ray
+	bool backward[3];
+	for (int k = 0; k < 3; ++k)
+	{
+		backward[k] = direction[0][k] < 0;
+	}
+
+	unsigned stack[max_depth + 4];
+	int stack_size = 0;
+	unsigned index = 0;
+	while (true)
+	{
+		const Node & node = nodes[index];
+
+		const T tx0 = (T(node.min[0]) - ox) * ix;
+		const T tx1 = (T(node.max[0]) - ox) * ix;
+		const T ty0 = (T(node.min[1]) - oy) * iy;
+		const T ty1 = (T(node.max[1]) - oy) * iy;
+		const T tz0 = (T(node.min[2]) - oz) * iz;
+		const T tz1 = (T(node.max[2]) - oz) * iz;
+		const T tmin = Max(Max(Min(tx0, tx1), Min(ty0, ty1)), Max(Min(tz0, tz1), T(0.0f)));
+		const T tmax = Min(Min(Max(tx0, tx1), Max(ty0, ty1)), Min(Max(tz0, tz1), LoadLanes<T>(ray_limit)));
+		const int mask = MoveMask(tmax >= tmin);
+
+		if (mask && node.count == 0)
+		{
+			unsigned near = index + 1;
+			unsigned far = node.offset;
+			if (backward[node.axis])
+				std::swap(near, far);
+			assert(stack_size < max_depth + 4);
+			stack[stack_size++] = far;
+			index = near;
+			continue;
+		}
+
+		if (mask)
+		{
+			for (unsigned r = node.offset; r < node.offset + node.count; ++r)
+			{
+				const unsigned id = refs[r];
+				for (int i = 0; i < count; ++i)
+				{
+					if ((mask >> i) & 1 && int(id) != hint[i])
+						test(i, id);
+				}
+			}
+		}
+
+		if (stack_size == 0)
+			break;
+		index = stack[--stack_size];
+	}
+}
+
+/// Track like test roads: a closed loop of patches with hills and a bridge
+/// strip crossing the loop above the ground.
+static void CreateTestRoads(std::vector<RoadStrip> & roads, int loop_patches)
+{
+	std::stringstream s;
+	const float radius = 200;
+	const float width = 6;
+	s << loop_patches << "\n";
+	for (int i = 0; i < loop_patches; ++i)
+	{
+		const float a0 = 2 * M_PI * i / loop_patches;
+		const float a1 = 2 * M_PI * (i + 1) / loop_patches;
+		const float h0 = 4 * std::sin(3 * a0);
+		const float h1 = 4 * std::sin(3 * a1);
+		const Vec3 d0(std::cos(a0), 0, std::sin(a0));
+		const Vec3 d1(std::cos(a1), 0, std::sin(a1));
+		WriteTestPatch(s,
+			d1 * (radius - width) + Vec3(0, h1, 0), d1 * (radius + width) + Vec3(0, h1, 0),
+			d0 * (radius - width) + Vec3(0, h0, 0), d0 * (radius + width) + Vec3(0, h0, 0));
+	}
+
+	const int bridge_patches = 40;
+	const float bridge_height = 12;
+	s << bridge_patches << "\n";
+	for (int i = 0; i < bridge_patches; ++i)
+	{
+		const float x0 = -radius - 20 + i * (2 * radius + 40) / bridge_patches;
+		const float x1 = -radius - 20 + (i + 1) * (2 * radius + 40) / bridge_patches;
+		WriteTestPatch(s,
+			Vec3(x1, bridge_height, -width), Vec3(x1, bridge_height, width),
+			Vec3(x0, bridge_height, -width), Vec3(x0, bridge_height, width));
+	}
+
+	std::stringstream error;
+	roads.resize(2);
+	roads[0].ReadFrom(s, false, error);
+	roads[1].ReadFrom(s, false, error);
+}
+
+/// pseudo random rays pointing down onto the test roads
+static void CreateTestRays(int count, std::vector<Vec3> & origins, std::vector<Vec3> & directions)
+{
+	TestRandom random(12345);
+
+	origins.resize(count);
+	directions.resize(count);
+	for (int i = 0; i < count; ++i)
+	{
+		const float a = 2 * M_PI * random();
+		const float r = (random() < 0.25f) ? 220 * (2 * random() - 1) : 200 + 10 * (2 * random() - 1);
+		origins[i] = (random() < 0.25f) ? Vec3(r, 20, 12 * random() - 6) : Vec3(r * std::cos(a), 20, r * std::sin(a));
+		directions[i] = Vec3(0.1f * random() - 0.05f, -1, 0.1f * random() - 0.05f).Normalize();
+	}
+}
+
+/// reference, tests every patch
+static bool CastRayBruteForce(
+	const std::vector<RoadStrip> & roads,
+	const Vec3 & origin,
+	const Vec3 & direction,
+	const float seglen,
+	int & patch_id,
+	Vec3 & outtri)
+{
+	bool col = false;
+	float best = 0;
+	int id = 0;
+	for (const auto & road : roads)
+	{
+		for (const auto & patch : road.GetPatches())
+		{
+			Vec3 tri, norm;
+			if (patch.Collide(origin, direction, seglen, tri, norm))
+			{
+				const float dist = (tri - origin).Magnitude();
+				if (!col || dist < best)
+				{
+					best = dist;
+					outtri = tri;
+					patch_id = id;
+				}
+				col = true;
+			}
+			++id;
+		}
+	}
+	return col;
+}
+
+QT_TEST(roadbvh_test)
+{
+	std::vector<RoadStrip> roads;
+	CreateTestRoads(roads, 256);
+	QT_CHECK_EQUAL(roads[0].GetPatches().size(), 256u);
+	QT_CHECK_EQUAL(roads[1].GetPatches().size(), 40u);
+
+	RoadBvh bvh;
+	bvh.Build(roads);
+	QT_CHECK_EQUAL(bvh.GetPatchCount(), 296);
+	QT_CHECK_EQUAL(bvh.GetPatch(256), &roads[1].GetPatches()[0]);
+
+	const int count = 1024;
+	std::vector<Vec3> origins, directions;
+	CreateTestRays(count, origins, directions);
+
+	// nearest hit without and with hints equals testing all patches
+	int hits = 0;
+	int bridge_hits = 0;
+	int mismatches = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		int ref_id = -1;
+		Vec3 ref_tri;
+		const bool ref_col = CastRayBruteForce(roads, origins[i], directions[i], 40, ref_id, ref_tri);
+
+		for (int hint = -1; hint < 296; hint += 150)
+		{
+			int id = hint;
+			Vec3 tri, norm;
+			const RoadPatch * patch = 0;
+			const bool col = bvh.CastRay(origins[i], directions[i], 40, id, tri, patch, norm);
+			if (col != ref_col || (col && (id != ref_id || tri != ref_tri || patch != bvh.GetPatch(id))))
+				mismatches++;
+			if (!col && id != hint)
+				mismatches++;
+		}
+
+		hits += ref_col;
+		bridge_hits += ref_col && ref_id >= 256;
+	}
+	QT_CHECK_EQUAL(mismatches, 0);
+	QT_CHECK(hits > count / 2);
+	QT_CHECK(bridge_hits > 0);
+
+	// packets equal single rays, including partial packets
+	for (int n = 1; n <= RoadBvh::max_packet; ++n)
+	{
+		int packet_mismatches = 0;
+		for (int i = 0; i + n <= count; i += n)
+		{
+			int ids[RoadBvh::max_packet];
+			float seglen[RoadBvh::max_packet];
+			Vec3 tris[RoadBvh::max_packet], norms[RoadBvh::max_packet];
+			const RoadPatch * patches[RoadBvh::max_packet];
+			bool cols[RoadBvh::max_packet];
+			for (int j = 0; j < n; ++j)
+			{
+				ids[j] = (j % 2) ? -1 : 3 * j;
+				seglen[j] = 40;
+			}
+			bvh.CastRays(n, &origins[i], &directions[i], seglen, ids, tris, patches, norms, cols);
+
+			for (int j = 0; j < n; ++j)
+			{
+				int id = (j % 2) ? -1 : 3 * j;
+				Vec3 tri, norm;
+				const RoadPatch * patch = 0;
+				const bool col = bvh.CastRay(origins[i + j], directions[i + j], 40, id, tri, patch, norm);
+				if (col != cols[j] || id != ids[j] || (col && (tri != tris[j] || norm != norms[j] || patch != patches[j])))
+					packet_mismatches++;
+			}
+		}
+		QT_CHECK_EQUAL(packet_mismatches, 0);
+	}
+
+	// segment too short to reach the road
+	{
+		int id = 7;
+		Vec3 tri, norm;
+		const RoadPatch * patch = 0;
+		QT_CHECK(!bvh.CastRay(Vec3(200, 50, 0), Vec3(0, -1, 0), 10, id, tri, patch, norm));
+		QT_CHECK_EQUAL(id, 7);
+	}
+
+	// empty hierarchy
+	{
+		RoadBvh empty;
+		empty.Build(std::vector<RoadStrip>());
+		int id = -1;
+		Vec3 tri, norm;
+		const RoadPatch * patch = 0;
+		QT_CHECK(!empty.CastRay(Vec3(200, 50, 0), Vec3(0, -1, 0), 100, id, tri, patch, norm));
+	}
+}
+
+MICROBENCH(roadbvh)
+{
+	std::vector<RoadStrip> roads;
+	CreateTestRoads(roads, 1024);
+	RoadBvh bvh;
+	bvh.Build(roads);
+
+	const int count = 4096;
+	std::vector<Vec3> origins, directions;
+	CreateTestRays(count, origins, directions);
+	std::vector<float> seglen(count, 40);
+
+	// previous track ray cast, a tree query per road strip
+	std::vector<int> ids(count, -1);
+	bench.measure("strip trees, rays", count, [&]()
+	{
+		int hits = 0;
+		for (int i = 0; i < count; ++i)
+		{
+			bool col = false;
+			Vec3 outtri;
+			for (const auto & road : roads)
+			{
+				Vec3 tri, norm;
+				const RoadPatch * patch = 0;
+				if (road.Collide(origins[i], directions[i], 40, ids[i], tri, patch, norm))
+				{
+					if (!col || (tri - origins[i]).MagnitudeSquared() < (outtri - origins[i]).MagnitudeSquared())
+						outtri = tri;
+					col = true;
+				}
+			}
+			hits += col;
+		}
+		microbench::consume(hits);
+	});
+
+	ids.assign(count, -1);
+	bench.measure("bvh, rays", count, [&]()
+	{
+		int hits = 0;
+		for (int i = 0; i < count; ++i)
+		{
+			Vec3 tri, norm;
+			const RoadPatch * patch = 0;
+			hits += bvh.CastRay(origins[i], directions[i], 40, ids[i], tri, patch, norm);
+		}
+		microbench::consume(hits);
+	});
+
+	ids.assign(count, -1);
+	bench.measure("bvh packets of 4, rays", count, [&]()
+	{
+		int hits = 0;
+		Vec3 tris[4], norms[4];
+		const RoadPatch * patches[4];
+		bool cols[4];
+		for (int i = 0; i < count; i += 4)
+		{
+			bvh.CastRays(4, &origins[i], &directions[i], &seglen[i], &ids[i], tris, patches, norms, cols);
+			hits += cols[0] + cols[1] + cols[2] + cols[3];
+		}
+		microbench::consume(hits);
+	});
+}
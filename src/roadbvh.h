@@ -0,0 +1,117 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef _ROADBVH_H
+#define _ROADBVH_H
+
+#include "mathvector.h"
+
+#include <vector>
+
+class RoadPatch;
+class RoadStrip;
+
+/// Bounding volume hierarchy over the patches of all road strips of a track.
+/// Nodes are stored depth first in one array, the left child follows its
+/// parent, the right child is referenced by index. Built with binned SAH.
+/// Patch ids index the patches of all strips in strip order.
+class RoadBvh
+{
+public:
+	/// maximum number of rays per CastRays call
+	static const int max_packet = 8;
+
+	RoadBvh();
+
+	/// build from road strips, the strips must outlive the hierarchy
+	void Build(const std::vector<RoadStrip> & roads);
+
+	void Clear();
+
+	/// return the nearest patch hit by the ray segment, patch_id is a hint
+	/// for the patch to test first and receives the id of the hit patch
+	bool CastRay(
+		const Vec3 & origin,
+		const Vec3 & direction,
+		const float seglen,
+		int & patch_id,
+		Vec3 & outtri,
+		const RoadPatch * & colpatch,
+		Vec3 & normal) const;
+
+	/// cast count <= max_packet coherent rays (wheels of a car) in one
+	/// traversal, results are identical to CastRay for each ray
+	void CastRays(
+		const int count,
+		const Vec3 origin[],
+		const Vec3 direction[],
+		const float seglen[],
+		int patch_id[],
+		Vec3 outtri[],
+		const RoadPatch * colpatch[],
+		Vec3 normal[],
+		bool col[]) const;
+
+	const RoadPatch * GetPatch(int patch_id) const
+	{
+		return patches[patch_id];
+	}
+
+	int GetPatchCount() const
+	{
+		return patches.size();
+	}
+
+	int GetNodeCount() const
+	{
+		return nodes.size();
+	}
+
+private:
+	struct Node
+	{
+		float min[3];
+		unsigned offset; ///< first ref of a leaf, right child of an inner node
+		float max[3];
+		unsigned short count; ///< number of refs, zero for inner nodes
+		unsigned short axis; ///< split axis of inner nodes
+	};
+
+	struct BuildRef;
+
+	std::vector<Node> nodes;
+	std::vector<unsigned> refs; ///< patch ids referenced by leaves
+	std::vector<const RoadPatch *> patches;
+
+	unsigned BuildNode(std::vector<BuildRef> & build_refs, unsigned begin, unsigned end, int depth);
+
+	template <typename T>
+	void CastPacket(
+		const int count,
+		const Vec3 origin[],
+		const Vec3 direction[],
+		const float seglen[],
+		int patch_id[],
+		Vec3 outtri[],
+		const RoadPatch * colpatch[],
+		Vec3 normal[],
+		bool col[]) const;
+};
+
+#endif // _ROADBVH_H
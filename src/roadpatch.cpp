@@ -95,7 +95,7 @@ bool RoadPatch::Collide(
 	Vec3 & outtri,
 	Vec3 & normal) const
 {
-	bool col = CollideSubDivQuadSimpleNorm(origin, direction, outtri, normal);
+	bool col = CollideGrid(origin, direction, outtri, normal);
 	float len = (outtri - origin).Magnitude();
 	return col && len <= seglen;
 }
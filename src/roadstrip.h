@@ -62,7 +62,7 @@ public:
 
 private:
 	std::vector<RoadPatch> patches;
-	AabbTreeNode <unsigned> aabb_part;
+	AabbRecursiveTree <unsigned> aabb_part;
 	bool closed;
 
 	void GenerateSpacePartitioning();
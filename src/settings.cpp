@@ -74,6 +74,7 @@ Settings::Settings() :
 	selected_replay("none"),
 	texture_size("large"),
 	texture_compress(true),
+	content_cache_size(512),
 	button_ramp(5),
 	ff_device("/dev/input/event0"),
 	ff_gain(1.0),
@@ -105,6 +106,7 @@ Settings::Settings() :
 	hgateshifter(false),
 	ai_level(1.0),
 	vehicle_damage(false),
+	tire_tables(false),
 	particles(512),
 	sky_dynamic(false),
 	sky_time(17),
@@ -132,6 +134,7 @@ void Settings::Serialize(bool write, Config & config)
 
 	config.get("game", section);
 	Param(config, write, section, "vehicle_damage", vehicle_damage);
+	Param(config, write, section, "tire_tables", tire_tables);
 	Param(config, write, section, "ai_level", ai_level);
 	Param(config, write, section, "track", track);
 	Param(config, write, section, "antilock", abs);
@@ -171,6 +174,7 @@ void Settings::Serialize(bool write, Config & config)
 	Param(config, write, section, "racingline", racingline);
 	Param(config, write, section, "texture_size", texture_size);
 	Param(config, write, section, "texture_compress", texture_compress);
+	Param(config, write, section, "content_cache_size", content_cache_size);
 	Param(config, write, section, "shadows", shadows);
 	Param(config, write, section, "shadow_distance", shadow_distance);
 	Param(config, write, section, "shadow_quality", shadow_quality);
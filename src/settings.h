@@ -227,6 +227,12 @@ public:
 		return texture_compress;
 	}
 
+	/// content cache memory budget in MB, 0 is unlimited
+	int GetContentCacheSize() const
+	{
+		return content_cache_size > 0 ? content_cache_size : 0;
+	}
+
 	float GetButtonRamp() const
 	{
 		return button_ramp;
@@ -382,6 +388,11 @@ public:
 		return vehicle_damage;
 	}
 
+	bool GetTireTables() const
+	{
+		return tire_tables;
+	}
+
 	void SetResolution(unsigned w, unsigned h)
 	{
 		resolution[0] = w;
@@ -440,6 +451,7 @@ private:
 	std::string selected_replay;
 	std::string texture_size;
 	bool texture_compress;
+	int content_cache_size;
 	float button_ramp;
 	std::string ff_device;
 	float ff_gain;
@@ -471,6 +483,7 @@ private:
 	bool hgateshifter;
 	float ai_level;
 	bool vehicle_damage;
+	bool tire_tables;
 	int particles;
 	bool sky_dynamic;
 	int sky_time;
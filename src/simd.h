@@ -0,0 +1,157 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef _SIMD_H
+#define _SIMD_H
+
+// Small float vector types for structure of arrays kernels.
+// Kernels are written as templates over the lane type T, which is one of
+// float (scalar fallback), Float4 (SSE) or Float8 (AVX). Comparisons
+// return masks that are consumed by Select, so kernels are branch free.
+
+#include <cmath>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define SIMD_FLOAT4
+#define SIMD_FLOAT8
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIMD_FLOAT4
+#endif
+
+// scalar lane
+
+inline float Abs(float x) { return std::abs(x); }
+inline float Min(float a, float b) { return a < b ? a : b; }
+inline float Max(float a, float b) { return a > b ? a : b; }
+inline float CopySign(float x, float s) { return std::copysign(x, s); }
+inline float Select(bool m, float a, float b) { return m ? a : b; }
+inline float RecipSqrt(float x) { return 1 / std::sqrt(x); }
+inline float Exp(float x) { return std::exp(x); }
+template <typename T> T LoadLanes(const float * p);
+template <> inline float LoadLanes<float>(const float * p) { return *p; }
+inline void StoreLanes(float * p, float x) { *p = x; }
+inline int MoveMask(bool m) { return m; }
+
+#if defined(SIMD_FLOAT4)
+
+struct Float4
+{
+	static const int size = 4;
+
+	__m128 v;
+
+	Float4() {}
+	Float4(__m128 x) : v(x) {}
+	Float4(float x) : v(_mm_set1_ps(x)) {}
+};
+
+inline Float4 operator+(Float4 a, Float4 b) { return _mm_add_ps(a.v, b.v); }
+inline Float4 operator-(Float4 a, Float4 b) { return _mm_sub_ps(a.v, b.v); }
+inline Float4 operator*(Float4 a, Float4 b) { return _mm_mul_ps(a.v, b.v); }
+inline Float4 operator/(Float4 a, Float4 b) { return _mm_div_ps(a.v, b.v); }
+inline Float4 operator-(Float4 a) { return _mm_xor_ps(a.v, _mm_set1_ps(-0.0f)); }
+inline Float4 operator<(Float4 a, Float4 b) { return _mm_cmplt_ps(a.v, b.v); }
+inline Float4 operator>(Float4 a, Float4 b) { return _mm_cmpgt_ps(a.v, b.v); }
+inline Float4 operator>=(Float4 a, Float4 b) { return _mm_cmpge_ps(a.v, b.v); }
+inline Float4 Abs(Float4 x) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), x.v); }
+inline Float4 Min(Float4 a, Float4 b) { return _mm_min_ps(a.v, b.v); }
+inline Float4 Max(Float4 a, Float4 b) { return _mm_max_ps(a.v, b.v); }
+inline Float4 RecipSqrt(Float4 x) { return _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(x.v)); }
+template <> inline Float4 LoadLanes<Float4>(const float * p) { return _mm_loadu_ps(p); }
+inline void StoreLanes(float * p, Float4 x) { _mm_storeu_ps(p, x.v); }
+inline int MoveMask(Float4 m) { return _mm_movemask_ps(m.v); } ///< lane i sets bit i
+
+inline Float4 CopySign(Float4 x, Float4 s)
+{
+	const __m128 sign = _mm_set1_ps(-0.0f);
+	return _mm_or_ps(_mm_andnot_ps(sign, x.v), _mm_and_ps(sign, s.v));
+}
+
+/// per lane m ? a : b
+inline Float4 Select(Float4 m, Float4 a, Float4 b)
+{
+	return _mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v));
+}
+
+/// evaluated per lane with std::exp, bit exact to the scalar path
+inline Float4 Exp(Float4 x)
+{
+	float f[4];
+	_mm_storeu_ps(f, x.v);
+	return _mm_setr_ps(std::exp(f[0]), std::exp(f[1]), std::exp(f[2]), std::exp(f[3]));
+}
+
+#endif // SIMD_FLOAT4
+
+#if defined(SIMD_FLOAT8)
+
+struct Float8
+{
+	static const int size = 8;
+
+	__m256 v;
+
+	Float8() {}
+	Float8(__m256 x) : v(x) {}
+	Float8(float x) : v(_mm256_set1_ps(x)) {}
+};
+
+inline Float8 operator+(Float8 a, Float8 b) { return _mm256_add_ps(a.v, b.v); }
+inline Float8 operator-(Float8 a, Float8 b) { return _mm256_sub_ps(a.v, b.v); }
+inline Float8 operator*(Float8 a, Float8 b) { return _mm256_mul_ps(a.v, b.v); }
+inline Float8 operator/(Float8 a, Float8 b) { return _mm256_div_ps(a.v, b.v); }
+inline Float8 operator-(Float8 a) { return _mm256_xor_ps(a.v, _mm256_set1_ps(-0.0f)); }
+inline Float8 operator<(Float8 a, Float8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+inline Float8 operator>(Float8 a, Float8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+inline Float8 operator>=(Float8 a, Float8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+inline Float8 Abs(Float8 x) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), x.v); }
+inline Float8 Min(Float8 a, Float8 b) { return _mm256_min_ps(a.v, b.v); }
+inline Float8 Max(Float8 a, Float8 b) { return _mm256_max_ps(a.v, b.v); }
+inline Float8 RecipSqrt(Float8 x) { return _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_sqrt_ps(x.v)); }
+template <> inline Float8 LoadLanes<Float8>(const float * p) { return _mm256_loadu_ps(p); }
+inline void StoreLanes(float * p, Float8 x) { _mm256_storeu_ps(p, x.v); }
+inline int MoveMask(Float8 m) { return _mm256_movemask_ps(m.v); } ///< lane i sets bit i
+
+inline Float8 CopySign(Float8 x, Float8 s)
+{
+	const __m256 sign = _mm256_set1_ps(-0.0f);
+	return _mm256_or_ps(_mm256_andnot_ps(sign, x.v), _mm256_and_ps(sign, s.v));
+}
+
+/// per lane m ? a : b
+inline Float8 Select(Float8 m, Float8 a, Float8 b)
+{
+	return _mm256_blendv_ps(b.v, a.v, m.v);
+}
+
+/// evaluated per lane with std::exp, bit exact to the scalar path
+inline Float8 Exp(Float8 x)
+{
+	float f[8];
+	_mm256_storeu_ps(f, x.v);
+	return _mm256_setr_ps(
+		std::exp(f[0]), std::exp(f[1]), std::exp(f[2]), std::exp(f[3]),
+		std::exp(f[4]), std::exp(f[5]), std::exp(f[6]), std::exp(f[7]));
+}
+
+#endif // SIMD_FLOAT8
+
+#endif // _SIMD_H
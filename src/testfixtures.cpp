@@ -0,0 +1,52 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#include "testfixtures.h"
+#include "bezier.h"
+#include "physics/cartire1.h"
+
+#include <ostream>
+
+void WriteTestPatch(std::ostream & s, const Vec3 & fl, const Vec3 & fr, const Vec3 & bl, const Vec3 & br)
+{
+	Bezier b;
+	b.SetFromCorners(fl, fr, bl, br);
+	for (int x = 0; x < 4; ++x)
+	{
+		for (int y = 0; y < 4; ++y)
+		{
+			const Vec3 & p = b.GetPoint(x, y);
+			s << p[1] << " " << p[2] << " " << p[0] << "\n";
+		}
+	}
+}
+
+CarTireInfo1 TestTireInfo()
+{
+	const btScalar a[15] = {1.6, -55, 1890, 2500, 8.7, 0.014, -0.24, 1.0, -0.03, -0.0013, -0.15, -8.5, -0.29, 17.8, -2.4};
+	const btScalar b[11] = {1.55, -80, 1950, 23.3, 390, 0.05, 0, 0.055, -0.024, 0.014, 0.26};
+	const btScalar c[18] = {2.2, -3.9, -3.9, -1.26, -8.2, 0.025, 0, 0.044, -0.58, 0.18, 0.043, 0.048, -0.0035, -0.18, 0.14, -1.029, 0.27, -1.1};
+	const btScalar g[4] = {40, 30, 15, 20};
+	CarTireInfo1 info;
+	info.lateral.assign(a, a + 15);
+	info.longitudinal.assign(b, b + 11);
+	info.aligning.assign(c, c + 18);
+	info.combining.assign(g, g + 4);
+	return info;
+}
@@ -17,10 +17,37 @@
 /*                                                                      */
 /************************************************************************/
 
-#include "parallel_task.h"
+#ifndef _TESTFIXTURES_H
+#define _TESTFIXTURES_H
 
-int Parallel::Dispatch(void * data)
+// Fixtures shared by the unit tests and micro benchmarks.
+
+#include "mathvector.h"
+
+#include <iosfwd>
+
+struct CarTireInfo1;
+
+/// pseudo random numbers in [0, 1), the same sequence on every platform
+class TestRandom
 {
-	((Task *) data)->Run();
-	return 0;
-}
+public:
+	TestRandom(unsigned seed) : seed(seed) {}
+
+	float operator()()
+	{
+		seed = seed * 1664525u + 1013904223u;
+		return (seed >> 8) / float(1 << 24);
+	}
+
+private:
+	unsigned seed;
+};
+
+/// append the patch spanned by the corners to s, as read by RoadStrip::ReadFrom
+void WriteTestPatch(std::ostream & s, const Vec3 & fl, const Vec3 & fr, const Vec3 & bl, const Vec3 & br);
+
+/// tire parameters of a typical road tire
+CarTireInfo1 TestTireInfo();
+
+#endif // _TESTFIXTURES_H
@@ -19,6 +19,7 @@
 
 #include "track.h"
 #include "trackloader.h"
+#include "physics/bvhcache.h"
 #include "physics/dynamicsworld.h"
 #include "coordinatesystem.h"
 #include "tobullet.h"
@@ -45,6 +46,7 @@ bool Track::DeferredLoad(
 	const std::string & trackdir,
 	const std::string & texturedir,
 	const std::string & sharedobjectpath,
+	const std::string & cachepath,
 	const int anisotropy,
 	const bool reverse,
 	const bool dynamicobjects,
@@ -61,7 +63,7 @@ bool Track::DeferredLoad(
 			info_output, error_output,
 			trackpath, trackdir,
 			texturedir,	sharedobjectpath,
-			anisotropy, reverse,
+			cachepath, anisotropy, reverse,
 			dynamicobjects,
 			dynamicshadows));
 
@@ -93,6 +95,9 @@ bool Track::Loaded() const
 
 void Track::Clear()
 {
+	// stop a load in progress, its jobs use the track data
+	loader.reset();
+
 	for (auto & object : data.objects)
 	{
 		data.world->removeCollisionObject(object);
@@ -111,6 +116,7 @@ void Track::Clear()
 		delete mesh;
 	}
 	data.meshes.clear();
+	data.bvh_cache.reset();
 
 	data.static_node.Clear();
 	data.surfaces.clear();
@@ -119,6 +125,7 @@ void Track::Clear()
 	data.body_nodes.clear();
 	data.body_transforms.clear();
 	data.lap.clear();
+	data.road_bvh.Clear();
 	data.roads.clear();
 	data.start_positions.clear();
 	data.racingline_node.Clear();
@@ -134,32 +141,36 @@ bool Track::CastRay(
 	const RoadPatch * & colpatch,
 	Vec3 & normal) const
 {
-	bool col = false;
-	for (const auto & road : data.roads)
-	{
-		Vec3 tri, norm;
-		const RoadPatch * patch = NULL;
-		if (road.Collide(origin, direction, seglen, patch_id, tri, patch, norm))
-		{
-			if (!col || (tri - origin).MagnitudeSquared() < (outtri - origin).MagnitudeSquared())
-			{
-				outtri = tri;
-				normal = norm;
-				colpatch = patch;
-			}
-			col = true;
-		}
-	}
-	return col;
+	return data.road_bvh.CastRay(origin, direction, seglen, patch_id, outtri, colpatch, normal);
+}
+
+void Track::CastRays(
+	const int count,
+	const Vec3 origin[],
+	const Vec3 direction[],
+	const float seglen[],
+	int patch_id[],
+	Vec3 outtri[],
+	const RoadPatch * colpatch[],
+	Vec3 normal[],
+	bool col[]) const
+{
+	data.road_bvh.CastRays(count, origin, direction, seglen, patch_id, outtri, colpatch, normal, col);
 }
 
 void Track::Update()
 {
 	if (!data.loaded) return;
 
+	// bullet only writes the motion states of active bodies,
+	// objects at rest keep their node transforms
 	auto t = data.body_transforms.begin();
 	for (int i = 0, e = data.body_nodes.size(); i < e; ++i, ++t)
 	{
+		if (!t->moved)
+			continue;
+
+		t->moved = false;
 		Transform & vt = data.dynamic_node.GetNode(data.body_nodes[i]).GetTransform();
 		vt.SetRotation(ToQuaternion<float>(t->rotation));
 		vt.SetTranslation(ToMathVector<float>(t->position));
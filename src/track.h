@@ -21,6 +21,7 @@
 #define _TRACK_H
 
 #include "roadstrip.h"
+#include "roadbvh.h"
 #include "mathvector.h"
 #include "quaternion.h"
 #include "graphics/scenenode.h"
@@ -34,6 +35,7 @@
 #include <set>
 #include <vector>
 
+class BvhCache;
 class Model;
 class Texture;
 class RoadStrip;
@@ -62,6 +64,7 @@ public:
 		const std::string & trackdir,
 		const std::string & effects_texturepath,
 		const std::string & sharedobjectpath,
+		const std::string & cachepath,
 		const int anisotropy,
 		const bool reverse,
 		const bool dynamicobjects,
@@ -83,6 +86,8 @@ public:
 
 	void Clear();
 
+	/// Nearest road patch hit by the ray segment.
+	/// patch_id is a hint for the patch to test first and receives the hit patch.
 	bool CastRay(
 		const Vec3 & origin,
 		const Vec3 & direction,
@@ -92,6 +97,19 @@ public:
 		const RoadPatch * & colpatch,
 		Vec3 & normal) const;
 
+	/// Cast up to RoadBvh::max_packet coherent rays, the wheel rays of a car.
+	/// Results are identical to CastRay for each ray.
+	void CastRays(
+		const int count,
+		const Vec3 origin[],
+		const Vec3 direction[],
+		const float seglen[],
+		int patch_id[],
+		Vec3 outtri[],
+		const RoadPatch * colpatch[],
+		Vec3 normal[],
+		bool col[]) const;
+
 	/// Synchronize graphics and physics.
 	void Update();
 
@@ -171,6 +189,7 @@ private:
 		std::vector<btStridingMeshInterface*> meshes;
 		std::vector<btCollisionShape*> shapes;
 		std::vector<btCollisionObject*> objects;
+		std::unique_ptr<BvhCache> bvh_cache; // outlives the shapes using its BVHs
 
 		// dynamic track objects
 		SceneNode dynamic_node;
@@ -180,6 +199,7 @@ private:
 		// road information
 		std::vector<const RoadPatch*> lap;
 		std::vector<RoadStrip> roads;
+		RoadBvh road_bvh;
 		std::vector<std::pair<Vec3, Quat > > start_positions;
 
 		SceneNode racingline_node;
@@ -19,6 +19,7 @@
 
 #include "trackloader.h"
 #include "loadcollisionshape.h"
+#include "physics/bvhcache.h"
 #include "physics/dynamicsworld.h"
 #include "coordinatesystem.h"
 #include "tobullet.h"
@@ -27,6 +28,7 @@
 #include "content/contentmanager.h"
 #include "graphics/texture.h"
 #include "graphics/model.h"
+#include "jobsystem.h"
 
 #include "BulletCollision/CollisionShapes/btBoxShape.h"
 #include "BulletCollision/CollisionShapes/btBvhTriangleMeshShape.h"
@@ -34,6 +36,7 @@
 #include "BulletCollision/CollisionShapes/btTriangleIndexVertexArray.h"
 #include "BulletDynamics/Dynamics/btRigidBody.h"
 
+
 #define EXTBULLET
 
 static const float deg2rad = M_PI / 180;
@@ -86,7 +89,33 @@ static btIndexedMesh GetIndexedMesh(const Model & model)
 
 struct Track::Loader::Object
 {
+	Object() :
+		mesh(0),
+		shape(0),
+		transparent_blend(0),
+		clamptexture(0),
+		surface(0),
+		mipmap(true),
+		nolighting(false),
+		skybox(false),
+		collideable(false)
+	{
+		// ctor
+	}
+
+	~Object()
+	{
+		// collision shape not added to the track
+		delete shape;
+		delete mesh;
+	}
+
 	std::shared_ptr<Model> model;
+	std::shared_ptr<Texture> textures[3];
+	btTriangleIndexVertexArray * mesh;
+	btBvhTriangleMeshShape * shape;
+	std::ostringstream error; ///< errors of the load job
+	std::string model_name;
 	std::string texture;
 	int transparent_blend;
 	int clamptexture;
@@ -95,7 +124,47 @@ struct Track::Loader::Object
 	bool nolighting;
 	bool skybox;
 	bool collideable;
-	bool cached;
+};
+
+struct Track::Loader::BodyLoad
+{
+	BodyLoad() :
+		cfg(0),
+		texture_names(3),
+		clampuv(0),
+		mipmap(true),
+		alphablend(false),
+		doublesided(false),
+		loaded(false),
+		added(false)
+	{
+		// ctor
+	}
+
+	~BodyLoad()
+	{
+		// collision shape not added to the track
+		if (!added)
+		{
+			delete body.shape;
+			delete body.mesh;
+		}
+	}
+
+	Body body;
+	const PTree * cfg;
+	std::shared_ptr<Model> model;
+	std::shared_ptr<Texture> textures[3];
+	std::vector<std::string> texture_names;
+	std::string model_name;
+	std::ostringstream info; ///< messages of the load job
+	int clampuv;
+	bool mipmap;
+	bool alphablend;
+	bool doublesided;
+	bool loaded; ///< set by the load job
+	bool added; ///< set once added to the track data
+	JobSystem::JobHandle job;
 };
 
 Track::Loader::Loader(
@@ -108,6 +177,7 @@ Track::Loader::Loader(
 	const std::string & trackdir,
 	const std::string & texturedir,
 	const std::string & sharedobjectpath,
+	const std::string & cachepath,
 	const int anisotropy,
 	const bool reverse,
 	const bool dynamic_objects,
@@ -121,6 +191,7 @@ Track::Loader::Loader(
 	trackdir(trackdir),
 	texturedir(texturedir),
 	sharedobjectpath(sharedobjectpath),
+	cachepath(cachepath),
 	anisotropy(anisotropy),
 	dynamic_objects(dynamic_objects),
 	dynamic_shadows(dynamic_shadows),
@@ -131,7 +202,6 @@ Track::Loader::Loader(
 	expected_params(17),
 	min_params(14),
 	error(false),
-	list(false),
 	track_shape(0),
 	nodes(0)
 {
@@ -147,6 +217,13 @@ Track::Loader::~Loader()
 
 void Track::Loader::Clear()
 {
+	// wait for loads in flight, they use the loader
+	for (const auto & object : pending)
+	{
+		if (object.job)
+			JobSystem::get().wait(object.job);
+	}
+	pending.clear();
 	bodies.clear();
 	objectfile.close();
 	pack.Close();
@@ -174,6 +251,8 @@ bool Track::Loader::BeginLoad()
 		return false;
 	}
 
+	data.road_bvh.Build(data.roads);
+
 	// load info
 	std::string info_path = trackpath + "/track.txt";
 	std::ifstream file(info_path.c_str());
@@ -231,6 +310,14 @@ bool Track::Loader::ContinueLoad()
 		data.shapes.push_back(track_shape);
 		track_shape = 0;
 #endif
+		// size the broadphase to the loaded track
+		world.rebuildBroadphase();
+
+		// store newly built collision mesh BVHs
+		const std::string bvhfile = GetBvhCacheFile();
+		if (!bvhfile.empty())
+			data.bvh_cache->Save(bvhfile, error_output);
+
 		data.loaded = true;
 		Clear();
 	}
@@ -240,12 +327,16 @@ bool Track::Loader::ContinueLoad()
 
 bool Track::Loader::BeginObjectLoad()
 {
+	data.bvh_cache.reset(new BvhCache());
+	const std::string bvhfile = GetBvhCacheFile();
+	if (!bvhfile.empty())
+		data.bvh_cache->Load(bvhfile);
+
 #ifndef EXTBULLET
 	assert(track_shape == 0);
 	track_shape = new btCompoundShape(true);
 #endif
 
-	list = true;
 	packload = pack.Load(objectpath + "/objects.jpk");
 
 	std::string objectlist = objectpath + "/list.txt";
@@ -255,13 +346,7 @@ bool Track::Loader::BeginObjectLoad()
 		return BeginOld();
 	}
 
-	if (Begin())
-	{
-		list = false;
-		return true;
-	}
-
-	return false;
+	return Begin();
 }
 
 std::pair<bool, bool> Track::Loader::ContinueObjectLoad()
@@ -271,12 +356,33 @@ std::pair<bool, bool> Track::Loader::ContinueObjectLoad()
 		return std::make_pair(true, false);
 	}
 
-	if (list)
+	if (pending.empty())
+	{
+		return std::make_pair(false, false);
+	}
+
+	// keep a few loads per thread in flight, this bounds the memory
+	// of decoded textures waiting for upload
+	JobSystem & jobs = JobSystem::get();
+	const size_t max_launched = 4 * jobs.getThreadCount();
+	for (size_t i = 0; i < pending.size() && i < max_launched; ++i)
 	{
-		return ContinueOld();
+		if (!pending[i].job)
+			pending[i].job = pending[i].launch();
 	}
 
-	return Continue();
+	// help with the loads until the oldest object is ready
+	jobs.wait(pending.front().job);
+
+	// add ready objects in load order, uploading their textures
+	while (!pending.empty() && pending.front().job && pending.front().job->isDone())
+	{
+		pending.front().add();
+		pending.pop_front();
+		numloaded++;
+	}
+
+	return std::make_pair(false, true);
 }
 
 bool Track::Loader::Begin()
@@ -287,8 +393,14 @@ bool Track::Loader::Begin()
 		nodes = 0;
 		if (track_config->get("object", nodes))
 		{
-			node_it = nodes->begin();
-			numobjects = nodes->size();
+			for (const auto & node : *nodes)
+			{
+				if (!ScheduleNode(node.second))
+				{
+					return false;
+				}
+			}
+			numobjects = pending.size();
 			data.meshes.reserve(numobjects);
 			return true;
 		}
@@ -296,30 +408,12 @@ bool Track::Loader::Begin()
 	return false;
 }
 
-std::pair<bool, bool> Track::Loader::Continue()
-{
-	if (node_it == nodes->end())
-	{
-		return std::make_pair(false, false);
-	}
-
-	if (!LoadNode(node_it->second))
-	{
-		return std::make_pair(true, false);
-	}
-
-	node_it++;
-
-	return std::make_pair(false, true);
-}
-
 bool Track::Loader::LoadShape(const PTree & cfg, const Model & model, Body & body)
 {
 	if (body.mass < 1E-3f)
 	{
 		btTriangleIndexVertexArray * mesh = new btTriangleIndexVertexArray();
 		mesh->addIndexedMesh(GetIndexedMesh(model));
-		data.meshes.push_back(mesh);
 		body.mesh = mesh;
 
 		int surface = 0;
@@ -329,9 +423,8 @@ bool Track::Loader::LoadShape(const PTree & cfg, const Model & model, Body & bod
 			surface = 0;
 		}
 
-		btBvhTriangleMeshShape * shape = new btBvhTriangleMeshShape(mesh, true);
+		btBvhTriangleMeshShape * shape = data.bvh_cache->CreateShape(mesh);
 		shape->setUserPointer((void*)&data.surfaces[surface]);
-		data.shapes.push_back(shape);
 		body.shape = shape;
 	}
 	else
@@ -355,7 +448,6 @@ bool Track::Loader::LoadShape(const PTree & cfg, const Model & model, Body & bod
 		{
 			shape = compound;
 		}
-		data.shapes.push_back(shape);
 
 		shape->calculateLocalInertia(body.mass, body.inertia);
 		body.shape = shape;
@@ -365,28 +457,25 @@ bool Track::Loader::LoadShape(const PTree & cfg, const Model & model, Body & bod
 	return true;
 }
 
-Track::Loader::body_iterator Track::Loader::LoadBody(const PTree & cfg)
+std::shared_ptr<Track::Loader::BodyLoad> Track::Loader::ScheduleBody(const PTree & cfg)
 {
-	Body body;
+	std::shared_ptr<BodyLoad> load(new BodyLoad());
+	Body & body = load->body;
 	std::string texture_str;
-	std::string model_name;
-	int clampuv = 0;
-	bool mipmap = true;
-	bool alphablend = false;
-	bool doublesided = false;
+	std::string & model_name = load->model_name;
+	std::vector<std::string> & texture_names = load->texture_names;
 	bool isashadow = false;
 
 	cfg.get("texture", texture_str, error_output);
 	cfg.get("model", model_name, error_output);
-	cfg.get("clampuv", clampuv);
-	cfg.get("mipmap", mipmap);
-	cfg.get("alphablend", alphablend);
-	cfg.get("doublesided", doublesided);
+	cfg.get("clampuv", load->clampuv);
+	cfg.get("mipmap", load->mipmap);
+	cfg.get("alphablend", load->alphablend);
+	cfg.get("doublesided", load->doublesided);
 	cfg.get("isashadow", isashadow);
 	cfg.get("skybox", body.skybox);
 	cfg.get("nolighting", body.nolighting);
 
-	std::vector<std::string> texture_names(3);
 	std::istringstream s(texture_str);
 	s >> texture_names;
 
@@ -415,63 +504,108 @@ Track::Loader::body_iterator Track::Loader::LoadBody(const PTree & cfg)
 
 	if (dynamic_shadows && isashadow)
 	{
-		return bodies.end();
+		return std::shared_ptr<BodyLoad>();
 	}
 
-	std::shared_ptr<Model> model;
-	if ((packload && content.load(model, objectdir, model_name, pack)) ||
-		content.load(model, objectdir, model_name))
+	// referenced bodies are loaded once
+	auto ib = bodies.find(name);
+	if (ib != bodies.end())
 	{
-		data.models.insert(model);
+		return ib->second;
+	}
+
+	load->cfg = &cfg;
+	bodies.insert(std::make_pair(name, load));
+	return load;
+}
+
+void Track::Loader::LoadBody(BodyLoad & load)
+{
+	// queue texture decoding, textures are uploaded by the main thread
+	// the diffuse texture is required, missing misc textures are zero
+	const std::vector<std::string> & texture_names = load.texture_names;
+	ContentManager::Request<Texture> requests[3];
+	TextureInfo texinfo;
+	texinfo.mipmap = load.mipmap || anisotropy; //always mipmap if anisotropy is on
+	texinfo.anisotropy = anisotropy;
+	texinfo.repeatu = load.clampuv != 1 && load.clampuv != 2;
+	texinfo.repeatv = load.clampuv != 1 && load.clampuv != 3;
+	texinfo.deferupload = true;
+	for (int i = 0; i < 3; ++i)
+	{
+		texinfo.compress = (i != 2);
+		if (i == 0 || !texture_names[i].empty())
+			requests[i] = content.loadAsync<Texture>(objectdir, texture_names[i], texinfo);
+	}
+
+	bool loaded = (packload && content.load(load.model, objectdir, load.model_name, pack)) ||
+		content.load(load.model, objectdir, load.model_name);
+	if (loaded)
+	{
+		Body & body = load.body;
+		body.collidable = load.cfg->get("mass", body.mass);
+		if (body.collidable)
+		{
+			LoadShape(*load.cfg, *load.model, body);
+		}
 	}
 	else
 	{
-		info_output << "Failed to load body " << cfg.value() << " model " << model_name << std::endl;
-		return bodies.end();
+		load.info << "Failed to load body " << load.cfg->value() << " model " << load.model_name << std::endl;
 	}
 
-	body.collidable = cfg.get("mass", body.mass);
-	if (body.collidable)
+	// wait for the textures, the objects using them need them decoded
+	for (int i = 0; i < 3; ++i)
 	{
-		LoadShape(cfg, *model, body);
+		if (i == 0 || !texture_names[i].empty())
+			requests[i].get(load.textures[i]);
+		else
+			load.textures[i] = content.getFactory<Texture>().getZero();
 	}
 
-	// load textures
-	std::shared_ptr<Texture> tex[3];
-	TextureInfo texinfo;
-	texinfo.mipmap = mipmap || anisotropy; //always mipmap if anisotropy is on
-	texinfo.anisotropy = anisotropy;
-	texinfo.repeatu = clampuv != 1 && clampuv != 2;
-	texinfo.repeatv = clampuv != 1 && clampuv != 3;
-	content.load(tex[0], objectdir, texture_names[0], texinfo);
-	if (!texture_names[1].empty())
+	load.loaded = loaded;
+}
+
+bool Track::Loader::AddBody(BodyLoad & load)
+{
+	if (load.added)
 	{
-		content.load(tex[1], objectdir, texture_names[1], texinfo);
-		data.textures.insert(tex[1]);
+		return load.loaded;
 	}
-	else
+	load.added = true;
+
+	info_output << load.info.str();
+	if (!load.loaded)
 	{
-		tex[1] = content.getFactory<Texture>().getZero();
+		return false;
 	}
-	if (!texture_names[2].empty())
+
+	Body & body = load.body;
+	data.models.insert(load.model);
+	if (body.mesh)
 	{
-		texinfo.compress = false;
-		content.load(tex[2], objectdir, texture_names[2], texinfo);
-		data.textures.insert(tex[2]);
+		data.meshes.push_back(body.mesh);
 	}
-	else
+	if (body.shape)
 	{
-		tex[2] = content.getFactory<Texture>().getZero();
+		data.shapes.push_back(body.shape);
+	}
+
+	std::shared_ptr<Texture> * tex = load.textures;
+	for (int i = 0; i < 3; ++i)
+	{
+		tex[i]->Upload(error_output);
+		data.textures.insert(tex[i]);
 	}
 
 	// setup drawable
 	Drawable & drawable = body.drawable;
-	drawable.SetModel(*model);
+	drawable.SetModel(*load.model);
 	drawable.SetTextures(tex[0]->GetId(), tex[1]->GetId(), tex[2]->GetId());
-	drawable.SetDecal(alphablend);
-	drawable.SetCull(data.cull && !doublesided);
+	drawable.SetDecal(load.alphablend);
+	drawable.SetCull(data.cull && !load.doublesided);
 
-	return bodies.insert(std::make_pair(name, body)).first;
+	return true;
 }
 
 void Track::Loader::AddBody(SceneNode & scene, const Body & body)
@@ -504,7 +638,7 @@ void Track::Loader::AddBody(SceneNode & scene, const Body & body)
 	dlist->insert(body.drawable);
 }
 
-bool Track::Loader::LoadNode(const PTree & sec)
+bool Track::Loader::ScheduleNode(const PTree & sec)
 {
 	const PTree * sec_body;
 	if (!sec.get("body", sec_body, error_output))
@@ -512,18 +646,39 @@ bool Track::Loader::LoadNode(const PTree & sec)
 		return false;
 	}
 
-	body_iterator ib = LoadBody(*sec_body);
-	if (ib == bodies.end())
+	std::shared_ptr<BodyLoad> load = ScheduleBody(*sec_body);
+	if (!load)
 	{
-		//info_output << "Object " << sec.value() << " failed to load body" << std::endl;
 		return true;
 	}
 
+	// first object referencing the body loads it, the others wait for it
+	PendingObject object;
+	object.launch = [this, load]()
+	{
+		BodyLoad * body = load.get();
+		if (!body->job)
+			body->job = JobSystem::get().add([this, body]() { LoadBody(*body); });
+		return body->job;
+	};
+	object.add = [this, &sec, load]() { AddNode(sec, *load); };
+	pending.push_back(object);
+	return true;
+}
+
+void Track::Loader::AddNode(const PTree & sec, BodyLoad & load)
+{
+	if (!AddBody(load))
+	{
+		//info_output << "Object " << sec.value() << " failed to load body" << std::endl;
+		return;
+	}
+
 	Vec3 position, angle;
 	bool has_transform = sec.get("position",  position) | sec.get("rotation", angle);
 	Quat rotation(angle[0] * deg2rad, angle[1] * deg2rad, angle[2] * deg2rad);
 
-	const Body & body = ib->second;
+	const Body & body = load.body;
 	if (body.mass < 1E-3f)
 	{
 		// static geometry
@@ -615,7 +770,6 @@ bool Track::Loader::LoadNode(const PTree & sec)
 		}
 	}
 
-	return true;
 }
 
 /// read from the file stream and put it in "output".
@@ -642,30 +796,8 @@ static bool get(std::ifstream & f, T & output)
 	return true;
 }
 
-void Track::Loader::CalculateNumOld()
-{
-	numobjects = 0;
-	std::string objectlist = objectpath + "/list.txt";
-	std::ifstream f(objectlist.c_str());
-	int params_per_object;
-	if (get(f, params_per_object))
-	{
-		std::string junk;
-		while (get(f, junk))
-		{
-			for (int i = 0; i < params_per_object-1; ++i)
-			{
-				get(f, junk);
-			}
-			numobjects++;
-		}
-	}
-}
-
 bool Track::Loader::BeginOld()
 {
-	CalculateNumOld();
-
 	if (!get(objectfile, params_per_object))
 	{
 		return false;
@@ -677,35 +809,94 @@ bool Track::Loader::BeginOld()
 		return false;
 	}
 
+	std::string model_name;
+	while (get(objectfile, model_name))
+	{
+		std::shared_ptr<Object> object(new Object());
+		bool isashadow = false;
+		std::string junk;
+
+		object->model_name = model_name;
+		get(objectfile, object->texture);
+		get(objectfile, object->mipmap);
+		get(objectfile, object->nolighting);
+		get(objectfile, object->skybox);
+		get(objectfile, object->transparent_blend);
+		get(objectfile, junk);//bump_wavelength);
+		get(objectfile, junk);//bump_amplitude);
+		get(objectfile, junk);//driveable);
+		get(objectfile, object->collideable);
+		get(objectfile, junk);//friction_notread);
+		get(objectfile, junk);//friction_tread);
+		get(objectfile, junk);//rolling_resistance);
+		get(objectfile, junk);//rolling_drag);
+		get(objectfile, isashadow);
+		get(objectfile, object->clamptexture);
+		get(objectfile, object->surface);
+		for (int i = 0; i < params_per_object - expected_params; i++)
+		{
+			get(objectfile, junk);
+		}
+
+		if (dynamic_shadows && isashadow)
+		{
+			continue;
+		}
+
+		PendingObject pending_object;
+		pending_object.launch = [this, object]()
+		{
+			Object * o = object.get();
+			return JobSystem::get().add([this, o]() { LoadObject(*o); });
+		};
+		pending_object.add = [this, object]() { AddObject(*object); };
+		pending.push_back(pending_object);
+	}
+
+	numobjects = pending.size();
 	return true;
 }
 
-bool Track::Loader::AddObject(const Object & object)
+void Track::Loader::LoadObject(Object & object)
 {
-	data.models.insert(object.model);
+	if (packload)
+	{
+		content.load(object.model, objectdir, object.model_name, pack);
+	}
+	else
+	{
+		content.load(object.model, objectdir, object.model_name);
+	}
 
+	// fixme: ugly hack to make vertical tracking work
+	// should be fixed in the model data instead
+	// the cached model may be shared by other loads, translate a copy
+	if (object.skybox && data.vertical_tracking_skyboxes)
+	{
+		VertexArray va = object.model->GetVertexArray();
+		va.Translate(0, 0, -object.model->GetAabb().GetCenter()[2]);
+		object.model.reset(new Model());
+		object.model->Load(va, object.error);
+	}
+
+	// decode textures, they are uploaded by the main thread
 	TextureInfo texinfo;
 	texinfo.mipmap = object.mipmap || anisotropy; //always mipmap if anisotropy is on
 	texinfo.anisotropy = anisotropy;
 	texinfo.repeatu = object.clamptexture != 1 && object.clamptexture != 2;
 	texinfo.repeatv = object.clamptexture != 1 && object.clamptexture != 3;
-
-	std::shared_ptr<Texture> texture0, texture1, texture2;
-	{
-		content.load(texture0, objectdir, object.texture, texinfo);
-		data.textures.insert(texture0);
-	}
+	texinfo.deferupload = true;
+	content.load(object.textures[0], objectdir, object.texture, texinfo);
 	{
 		std::string texname = object.texture.substr(0, std::max<int>(0, object.texture.length()-4)) + "-misc1.png";
 		std::string filepath = objectpath + "/" + texname;
 		if (std::ifstream(filepath.c_str()))
 		{
-			content.load(texture1, objectdir, texname, texinfo);
-			data.textures.insert(texture1);
+			content.load(object.textures[1], objectdir, texname, texinfo);
 		}
 		else
 		{
-			texture1 = content.getFactory<Texture>().getZero();
+			object.textures[1] = content.getFactory<Texture>().getZero();
 		}
 	}
 	{
@@ -714,15 +905,37 @@ bool Track::Loader::AddObject(const Object & object)
 		std::string filepath = objectpath + "/" + texname;
 		if (std::ifstream(filepath.c_str()))
 		{
-			content.load(texture2, objectdir, texname, texinfo);
-			data.textures.insert(texture2);
+			content.load(object.textures[2], objectdir, texname, texinfo);
 		}
 		else
 		{
-			texture2 = content.getFactory<Texture>().getZero();
+			object.textures[2] = content.getFactory<Texture>().getZero();
 		}
 	}
 
+	if (object.collideable)
+	{
+		object.mesh = new btTriangleIndexVertexArray();
+		object.mesh->addIndexedMesh(GetIndexedMesh(*object.model));
+
+		assert(object.surface >= 0 && object.surface < (int)data.surfaces.size());
+		object.shape = data.bvh_cache->CreateShape(object.mesh);
+		object.shape->setUserPointer((void*)&data.surfaces[object.surface]);
+	}
+}
+
+void Track::Loader::AddObject(Object & object)
+{
+	error_output << object.error.str();
+	data.models.insert(object.model);
+
+	std::shared_ptr<Texture> * tex = object.textures;
+	for (int i = 0; i < 3; ++i)
+	{
+		tex[i]->Upload(error_output);
+		data.textures.insert(tex[i]);
+	}
+
 	//use a different drawlist layer where necessary
 	bool transparent = (object.transparent_blend==1);
 	keyed_container <Drawable> * dlist = &data.static_node.GetDrawList().normal_noblend;
@@ -748,20 +961,17 @@ bool Track::Loader::AddObject(const Object & object)
 	SceneNode::DrawableHandle dref = dlist->insert(Drawable());
 	Drawable & drawable = dlist->get(dref);
 	drawable.SetModel(*object.model);
-	drawable.SetTextures(texture0->GetId(), texture1->GetId(), texture2->GetId());
+	drawable.SetTextures(tex[0]->GetId(), tex[1]->GetId(), tex[2]->GetId());
 	drawable.SetDecal(transparent);
 	drawable.SetCull(data.cull && (object.transparent_blend != 2));
 
-	if (object.collideable)
+	if (object.shape)
 	{
-		btTriangleIndexVertexArray * mesh = new btTriangleIndexVertexArray();
-		mesh->addIndexedMesh(GetIndexedMesh(*object.model));
-		data.meshes.push_back(mesh);
-
-		assert(object.surface >= 0 && object.surface < (int)data.surfaces.size());
-		btBvhTriangleMeshShape * shape = new btBvhTriangleMeshShape(mesh, true);
-		shape->setUserPointer((void*)&data.surfaces[object.surface]);
+		btBvhTriangleMeshShape * shape = object.shape;
+		data.meshes.push_back(object.mesh);
 		data.shapes.push_back(shape);
+		object.mesh = 0;
+		object.shape = 0;
 
 #ifndef EXTBULLET
 		btTransform transform = btTransform::getIdentity();
@@ -775,71 +985,6 @@ bool Track::Loader::AddObject(const Object & object)
 		world.addCollisionObject(co);
 #endif
 	}
-	return true;
-}
-
-std::pair<bool, bool> Track::Loader::ContinueOld()
-{
-	std::string model_name;
-	if (!get(objectfile, model_name))
-	{
-		return std::make_pair(false, false);
-	}
-
-	Object object;
-	bool isashadow;
-	std::string junk;
-
-	get(objectfile, object.texture);
-	get(objectfile, object.mipmap);
-	get(objectfile, object.nolighting);
-	get(objectfile, object.skybox);
-	get(objectfile, object.transparent_blend);
-	get(objectfile, junk);//bump_wavelength);
-	get(objectfile, junk);//bump_amplitude);
-	get(objectfile, junk);//driveable);
-	get(objectfile, object.collideable);
-	get(objectfile, junk);//friction_notread);
-	get(objectfile, junk);//friction_tread);
-	get(objectfile, junk);//rolling_resistance);
-	get(objectfile, junk);//rolling_drag);
-	get(objectfile, isashadow);
-	get(objectfile, object.clamptexture);
-	get(objectfile, object.surface);
-	for (int i = 0; i < params_per_object - expected_params; i++)
-	{
-		get(objectfile, junk);
-	}
-
-	if (dynamic_shadows && isashadow)
-	{
-		return std::make_pair(false, true);
-	}
-
-	if (packload)
-	{
-		content.load(object.model, objectdir, model_name, pack);
-	}
-	else
-	{
-		content.load(object.model, objectdir, model_name);
-	}
-
-	// fixme: ugly hack to make vertical tracking work
-	// should be fixed in the model data instead
-	if (object.skybox && data.vertical_tracking_skyboxes)
-	{
-		VertexArray va = object.model->GetVertexArray();
-		va.Translate(0, 0, -object.model->GetAabb().GetCenter()[2]);
-		object.model->Load(va, error_output);
-	}
-
-	if (!AddObject(object))
-	{
-		return std::make_pair(true, false);
-	}
-
-	return std::make_pair(false, true);
 }
 
 bool Track::Loader::LoadSurfaces()
@@ -925,13 +1070,18 @@ bool Track::Loader::LoadRoads()
 bool Track::Loader::CreateRacingLines()
 {
 	K1999 k1999;
-	for (auto & road : data.roads)
+	for (unsigned i = 0; i < data.roads.size(); ++i)
 	{
 		// K1999 requires a closed circuit
+		RoadStrip & road = data.roads[i];
 		if (road.GetClosed())
 		{
 			k1999.LoadData(road);
-			k1999.CalcRaceLine();
+			if (!LoadRacingLine(i, k1999))
+			{
+				k1999.CalcRaceLine();
+				SaveRacingLine(i, k1999);
+			}
 			k1999.UpdateRoadStrip(road);
 			CreateRacingLine(road);
 		}
@@ -939,6 +1089,50 @@ bool Track::Loader::CreateRacingLines()
 	return true;
 }
 
+std::string Track::Loader::GetRacingLineCacheFile(unsigned road) const
+{
+	if (cachepath.empty())
+		return std::string();
+
+	// one file per road, it stores the road hash, changed roads overwrite it
+	const std::string trackname = trackdir.substr(trackdir.find_last_of('/') + 1);
+	std::ostringstream s;
+	s << cachepath << "/racingline-" << trackname << (data.reverse ? "-reverse-" : "-") << road << ".bin";
+	return s.str();
+}
+
+std::string Track::Loader::GetBvhCacheFile() const
+{
+	if (cachepath.empty())
+		return std::string();
+
+	// one file per track, entries are keyed by the mesh data
+	const std::string trackname = trackdir.substr(trackdir.find_last_of('/') + 1);
+	return cachepath + "/bvh-" + trackname + ".bin";
+}
+
+bool Track::Loader::LoadRacingLine(unsigned road, K1999 & k1999) const
+{
+	const std::string filename = GetRacingLineCacheFile(road);
+	if (filename.empty())
+		return false;
+
+	std::ifstream file(filename.c_str(), std::ios::binary);
+	return file && k1999.ReadCache(file);
+}
+
+void Track::Loader::SaveRacingLine(unsigned road, const K1999 & k1999) const
+{
+	const std::string filename = GetRacingLineCacheFile(road);
+	if (filename.empty())
+		return;
+
+	std::ofstream file(filename.c_str(), std::ios::binary);
+	k1999.WriteCache(file);
+	if (!file)
+		info_output << "Failed to write racing line cache: " << filename << std::endl;
+}
+
 template <bool set_faces>
 static void AddRacingLineSegment(
 	const RoadPatch & patch,
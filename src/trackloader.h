@@ -23,6 +23,10 @@
 #include "track.h"
 #include "cfg/ptree.h"
 #include "joepack.h"
+#include "jobsystem.h"
+
+#include <deque>
+#include <functional>
 
 /*
 [object.foo]
@@ -47,7 +51,10 @@ model = body.joe
 
 class DynamicsWorld;
 class ContentManager;
+class K1999;
 class btStridingMeshInterface;
+class btTriangleIndexVertexArray;
+class btBvhTriangleMeshShape;
 class btCompoundShape;
 class btCollisionShape;
 class PTree;
@@ -65,6 +72,7 @@ public:
 		const std::string & trackdir,
 		const std::string & texturedir,
 		const std::string & sharedobjectpath,
+		const std::string & cachepath,
 		const int anisotropy,
 		const bool reverse,
 		const bool dynamic_shadows,
@@ -91,6 +99,7 @@ private:
 	const std::string & trackdir;
 	const std::string & texturedir;
 	const std::string & sharedobjectpath;
+	const std::string cachepath;
 	const int anisotropy;
 	const bool dynamic_objects;
 	const bool dynamic_shadows;
@@ -106,7 +115,6 @@ private:
 	const int expected_params;
 	const int min_params;
 	bool error;
-	bool list;
 
 	// pod for references
 	struct Body
@@ -127,8 +135,21 @@ private:
 		int surface;
 		bool collidable;
 	};
-	typedef std::map<std::string, Body>::const_iterator body_iterator;
-	std::map<std::string, Body> bodies;
+
+	// body loaded by a job, shared by the objects referencing it
+	struct BodyLoad;
+	std::map<std::string, std::shared_ptr<BodyLoad> > bodies;
+
+	// Object loads in flight. Models, textures and collision shapes are
+	// loaded by jobs, the main thread adds finished objects to the track
+	// in load order and uploads their textures.
+	struct PendingObject
+	{
+		std::function<JobSystem::JobHandle()> launch; ///< start the load job
+		std::function<void()> add; ///< add the loaded object, main thread
+		JobSystem::JobHandle job;
+	};
+	std::deque<PendingObject> pending;
 
 	// compound track shape
 	btCompoundShape * track_shape;
@@ -136,7 +157,6 @@ private:
 	// track config
 	std::shared_ptr<PTree> track_config;
 	const PTree * nodes;
-	PTree::const_iterator node_it;
 
 	bool LoadSurfaces();
 
@@ -144,8 +164,19 @@ private:
 
 	bool CreateRacingLines();
 
+	/// racing line cache file of the road, empty if there is no cache path
+	std::string GetRacingLineCacheFile(unsigned road) const;
+
+	/// read the racing line of the road loaded into k1999 from the cache
+	bool LoadRacingLine(unsigned road, K1999 & k1999) const;
+
+	void SaveRacingLine(unsigned road, const K1999 & k1999) const;
+
 	void CreateRacingLine(const RoadStrip & strip);
 
+	/// collision mesh BVH cache file of the track, empty if there is no cache path
+	std::string GetBvhCacheFile() const;
+
 	bool LoadStartPositions(const PTree & info);
 
 	bool LoadLapSections(const PTree & info);
@@ -158,22 +189,29 @@ private:
 
 	bool BeginOld();
 
-	std::pair<bool, bool> Continue();
+	bool ScheduleNode(const PTree & sec);
 
-	std::pair<bool, bool> ContinueOld();
+	void AddNode(const PTree & sec, BodyLoad & body);
 
-	void CalculateNumOld();
+	bool LoadShape(const PTree & body_cfg, const Model & body_model, Body & body);
 
-	bool LoadNode(const PTree & sec);
+	/// null if the body is skipped
+	std::shared_ptr<BodyLoad> ScheduleBody(const PTree & cfg);
 
-	bool LoadShape(const PTree & body_cfg, const Model & body_model, Body & body);
+	/// load job
+	void LoadBody(BodyLoad & body);
 
-	body_iterator LoadBody(const PTree & cfg);
+	/// add body data to the track, false if the body failed to load
+	bool AddBody(BodyLoad & body);
 
 	void AddBody(SceneNode & scene, const Body & body);
 
 	struct Object;
-	bool AddObject(const Object & object);
+
+	/// load job
+	void LoadObject(Object & object);
+
+	void AddObject(Object & object);
 
 	void Clear();
 };